@@ -15,11 +15,15 @@
 #include "novasm/executable.hpp"
 #include "novasm/serialization.hpp"
 #include "opt/opt.hpp"
+#include <algorithm>
 #include <chrono>
+#include <map>
 #include <optional>
+#include <set>
 
-using Clock    = std::chrono::high_resolution_clock;
-using Duration = std::chrono::duration<double>;
+using Clock      = std::chrono::high_resolution_clock;
+using Duration   = std::chrono::duration<double>;
+using OpSequence = std::vector<novasm::OpCode>;
 
 auto operator<<(std::ostream& out, const Duration& rhs) -> std::ostream&;
 
@@ -97,6 +101,153 @@ auto printExecutable(const novasm::Executable& executable, const backend::Instru
   printInstructions(executable, labels);
 }
 
+auto printDiagnostics(const frontend::Output& frontendOutput) -> void {
+  for (auto diagItr = frontendOutput.beginDiags(); diagItr != frontendOutput.endDiags();
+       ++diagItr) {
+    std::cerr << rang::style::bold << rang::bg::red;
+    diagItr->print(std::cerr, frontendOutput.getSourceTable());
+    std::cerr << rang::bg::reset << '\n' << rang::style::reset;
+  }
+}
+
+// Collect the offsets of all instructions that execution can enter from somewhere else than the
+// previous instruction (branch targets, call targets and instruction pointer literals).
+auto getBranchTargets(const std::vector<novasm::dasm::Instruction>& instructions)
+    -> std::set<uint32_t> {
+  auto result = std::set<uint32_t>{};
+  for (const auto& instr : instructions) {
+    switch (instr.getOp()) {
+    case novasm::OpCode::LoadLitIp:
+    case novasm::OpCode::Jump:
+    case novasm::OpCode::JumpIf:
+      result.insert(std::get<uint32_t>(instr.getArgs()[0].getValue()));
+      break;
+    case novasm::OpCode::Call:
+    case novasm::OpCode::CallTail:
+    case novasm::OpCode::CallForked:
+      result.insert(std::get<uint32_t>(instr.getArgs()[1].getValue()));
+      break;
+    default:
+      break;
+    }
+  }
+  return result;
+}
+
+// Count all instruction sequences of length 2 up to (and including) 'maxLength'.
+// 'counts' contains a map per sequence length, starting at length 2.
+auto countOpSequences(
+    const novasm::Executable& executable,
+    const unsigned int maxLength,
+    std::vector<std::map<OpSequence, uint64_t>>* counts) -> void {
+
+  const auto instructions = novasm::disassembleInstructions(executable);
+  const auto targets      = getBranchTargets(instructions);
+
+  for (auto i = 0U; i != instructions.size(); ++i) {
+    auto sequence = OpSequence{instructions[i].getOp()};
+    for (auto j = i + 1U; j != instructions.size() && sequence.size() != maxLength; ++j) {
+      // Sequences cannot span a branch target, as execution can enter in the middle of it.
+      if (targets.find(instructions[j].getIpOffset()) != targets.end()) {
+        break;
+      }
+      sequence.push_back(instructions[j].getOp());
+      ++(*counts)[sequence.size() - 2U][sequence];
+    }
+  }
+}
+
+auto printOpSequenceStats(
+    const std::vector<std::map<OpSequence, uint64_t>>& counts, const unsigned int maxRows)
+    -> void {
+  const auto countColWidth   = 10;
+  const auto percentColWidth = 7;
+
+  for (auto i = 0U; i != counts.size(); ++i) {
+    auto sorted = std::vector<std::pair<const OpSequence*, uint64_t>>{};
+    auto total  = uint64_t{0};
+    for (const auto& entry : counts[i]) {
+      sorted.emplace_back(&entry.first, entry.second);
+      total += entry.second;
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+      return a.second > b.second;
+    });
+
+    std::cout << rang::style::bold << "Sequences of length " << i + 2U << " (total: " << total
+              << "):\n"
+              << rang::style::reset;
+    for (auto row = 0U; row != std::min<size_t>(maxRows, sorted.size()); ++row) {
+      const auto percent = static_cast<double>(sorted[row].second) * 100.0 / total;
+      std::cout << "  " << std::setw(countColWidth) << std::left << sorted[row].second
+                << rang::style::dim << std::setw(percentColWidth) << std::left << std::fixed
+                << std::setprecision(2) << percent << rang::style::reset << rang::style::bold;
+      for (auto opIdx = 0U; opIdx != sorted[row].first->size(); ++opIdx) {
+        if (opIdx != 0U) {
+          std::cout << " ; ";
+        }
+        std::cout << (*sorted[row].first)[opIdx];
+      }
+      std::cout << '\n' << rang::style::reset;
+    }
+    std::cout << '\n';
+  }
+}
+
+auto loadExecutable(
+    const filesystem::path& filePath,
+    const std::vector<filesystem::path>& searchPaths,
+    const bool optimize) -> std::optional<novasm::Executable> {
+
+  auto absFilePath = filesystem::absolute(filePath);
+  std::ifstream fs{filePath.string(), std::ios::binary};
+  if (absFilePath.extension() == ".nx") {
+    auto executable = novasm::deserialize(
+        std::istreambuf_iterator<char>{fs}, std::istreambuf_iterator<char>{});
+    if (!executable) {
+      std::cerr << rang::style::bold << rang::bg::red << "Failed to deserialize executable: "
+                << filePath << rang::bg::reset << '\n'
+                << rang::style::reset;
+    }
+    return executable;
+  }
+
+  const auto src = frontend::buildSource(
+      filePath.filename().string(),
+      absFilePath,
+      std::istreambuf_iterator<char>{fs},
+      std::istreambuf_iterator<char>{});
+  const auto frontendOutput = frontend::analyze(src, searchPaths);
+  if (!frontendOutput.isSuccess()) {
+    printDiagnostics(frontendOutput);
+    return std::nullopt;
+  }
+  auto asmOutput = optimize ? backend::generate(opt::optimize(frontendOutput.getProg()))
+                            : backend::generate(opt::treeshake(frontendOutput.getProg()));
+  return std::move(asmOutput.first);
+}
+
+// Count the most frequent instruction sequences over all the given files.
+// Used to decide which instruction sequences the runtime should fuse into superinstructions.
+auto runOpStats(
+    const std::vector<std::string>& filePaths,
+    const std::vector<filesystem::path>& searchPaths,
+    const unsigned int maxLength,
+    const unsigned int maxRows,
+    const bool optimize) -> int {
+
+  auto counts = std::vector<std::map<OpSequence, uint64_t>>(maxLength - 1U);
+  for (const auto& filePath : filePaths) {
+    auto executable = loadExecutable(filePath, searchPaths, optimize);
+    if (!executable) {
+      return 1;
+    }
+    countOpSequences(*executable, maxLength, &counts);
+  }
+  printOpSequenceStats(counts, maxRows);
+  return 0;
+}
+
 template <typename InputItr>
 auto runFromSource(
     const std::string& inputId,
@@ -114,13 +265,7 @@ auto runFromSource(
   const auto frontendOutput = frontend::analyze(src, searchPaths);
 
   if (!frontendOutput.isSuccess()) {
-    // Print diagnostics.
-    for (auto diagItr = frontendOutput.beginDiags(); diagItr != frontendOutput.endDiags();
-         ++diagItr) {
-      std::cerr << rang::style::bold << rang::bg::red;
-      diagItr->print(std::cerr, frontendOutput.getSourceTable());
-      std::cerr << rang::bg::reset << '\n' << rang::style::reset;
-    }
+    printDiagnostics(frontendOutput);
     return 1;
   }
 
@@ -245,6 +390,24 @@ auto main(int argc, const char** argv) -> int {
   analyzeFileCmd->add_flag("!--no-output", printOutput, "Skip printing the program");
   analyzeFileCmd->add_flag("-o,--optimize", optimize, "Optimize program");
 
+  // Count instruction sequence frequencies over the input files.
+  std::vector<std::string> statsFilePaths;
+  auto maxSeqLength = 3U;
+  auto maxSeqRows   = 25U;
+  auto opStatsCmd =
+      app.add_subcommand("opstats", "Count the most frequent instruction sequences in the files")
+          ->callback([&]() {
+            rang::setControlMode(colorMode);
+            exitcode = runOpStats(statsFilePaths, searchPaths, maxSeqLength, maxSeqRows, optimize);
+          });
+  opStatsCmd->add_option("files", statsFilePaths, "Paths to source (.ns) or executable (.nx) files")
+      ->check(CLI::ExistingFile)
+      ->required();
+  opStatsCmd->add_option("-l,--length", maxSeqLength, "Maximum sequence length")
+      ->check(CLI::Range(2U, 8U));
+  opStatsCmd->add_option("-n,--count", maxSeqRows, "Amount of sequences to show per length");
+  opStatsCmd->add_flag("-o,--optimize", optimize, "Optimize program");
+
   // Parse arguments and run subcommands.
   std::atexit([]() {
     std::cout << rang::style::reset;
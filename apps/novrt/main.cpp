@@ -2,11 +2,13 @@
 #include "filesystem.hpp"
 #include "metacmd.hpp"
 #include "novasm/serialization.hpp"
+#include "options.hpp"
 #include "vm/exec_state.hpp"
 #include "vm/platform_interface.hpp"
 #include "vm/vm.hpp"
 #include <cstdio>
 #include <fstream>
+#include <string>
 
 auto main(int argc, const char** argv) noexcept -> int {
   // Drop the first arg (path to this executable).
@@ -15,6 +17,31 @@ auto main(int argc, const char** argv) noexcept -> int {
     argv += 1;
   }
 
+  // Apply the runtime options from the environment (like NOVUS_HEAP_LIMIT) and the arguments (like
+  // --jit).
+  auto options = vm::Options{};
+  if (const char* invalidEnv = novrt::applyRuntimeEnvOptions(&options)) {
+    std::cerr << "Novus runtime [" PROJECT_VER "] - Invalid value for environment variable: "
+              << invalidEnv << '\n';
+    return 1;
+  }
+  while (argc) {
+    const novrt::RuntimeOpt* invalidOpt = nullptr;
+    const auto res = novrt::applyRuntimeOption(argv[0], &options, &invalidOpt);
+    if (res == novrt::RuntimeOptResult::NotAnOption) {
+      break;
+    }
+    if (res == novrt::RuntimeOptResult::InvalidValue) {
+      // Report the option without the trailing '='.
+      const auto name = std::string{invalidOpt->input, strcspn(invalidOpt->input, "=")};
+      std::cerr << "Novus runtime [" PROJECT_VER "] - Invalid value for " << name << ": "
+                << argv[0] << '\n';
+      return 1;
+    }
+    argc -= 1;
+    argv += 1;
+  }
+
   // If a meta command was invoked (like --install) then execute it.
   if (argc && strncmp(argv[0], "--", 2) == 0) {
     return novrt::execMetaCommand(argc, argv);
@@ -59,7 +86,7 @@ auto main(int argc, const char** argv) noexcept -> int {
       vm::fileStdOut(),
       vm::fileStdErr()};
 
-  auto res = vm::run(&asmOutput.value(), &iface);
+  auto res = vm::run(&asmOutput.value(), &iface, options);
   if (res > vm::ExecState::Failed) {
     std::cerr << "runtime error: " << res << '\n';
   }
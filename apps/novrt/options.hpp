@@ -0,0 +1,166 @@
+#pragma once
+#include "vm/options.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace novrt {
+
+// Runtime option that can be passed before the path to the executable, for example:
+// 'novrt --jit prog.nx'. Options whose input ends with '=' take a value, for example:
+// 'novrt --gc-mark-threads=4 prog.nx'.
+// Options with an environment variable can also be set through the environment, for example:
+// 'NOVUS_HEAP_LIMIT=512M novrt prog.nx', options passed on the command line take precedence.
+struct RuntimeOpt {
+  // Returns false if the value is invalid.
+  using Func = bool (*)(vm::Options* options, const char* value) noexcept;
+
+  const char* input;
+  Func func;
+  const char* env;
+};
+
+// Result of applying a runtime option, see 'applyRuntimeOption'.
+enum class RuntimeOptResult {
+  Applied,
+  NotAnOption,
+  InvalidValue,
+};
+
+// Parse a unsigned integer value, returns false if the value is not a valid unsigned integer or
+// does not fit in 32 bits.
+inline auto parseUIntOpt(const char* value, uint32_t* out) noexcept -> bool {
+  char* end;
+  errno          = 0;
+  const auto res = std::strtoull(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || *value == '-' || errno == ERANGE || res > UINT32_MAX) {
+    return false;
+  }
+  *out = static_cast<uint32_t>(res);
+  return true;
+}
+
+// Parse a size in bytes with an optional 'K', 'M' or 'G' suffix (powers of 1024), returns false if
+// the value is not a valid size.
+inline auto parseSizeOpt(const char* value, uint64_t* out) noexcept -> bool {
+  char* end;
+  errno          = 0;
+  const auto res = std::strtoull(value, &end, 10);
+  if (*value == '\0' || end == value || *value == '-' || errno == ERANGE) {
+    return false;
+  }
+  auto shift = 0U;
+  switch (*end) {
+  case '\0':
+    break;
+  case 'k':
+  case 'K':
+    shift = 10U;
+    break;
+  case 'm':
+  case 'M':
+    shift = 20U;
+    break;
+  case 'g':
+  case 'G':
+    shift = 30U;
+    break;
+  default:
+    return false;
+  }
+  if (shift != 0U && *(end + 1) != '\0') {
+    return false;
+  }
+  if (res > (UINT64_MAX >> shift)) {
+    return false; // Size does not fit in 64 bits.
+  }
+  *out = static_cast<uint64_t>(res) << shift;
+  return true;
+}
+
+inline constexpr RuntimeOpt g_runtimeOptions[] = {
+    {"--jit",
+     [](vm::Options* options, const char* /*unused*/) noexcept {
+       options->jitEnabled = true;
+       return true;
+     },
+     nullptr},
+    {"--gc-mark-threads=",
+     [](vm::Options* options, const char* value) noexcept {
+       return parseUIntOpt(value, &options->gcMarkThreads);
+     },
+     nullptr},
+    {"--worker-threads=",
+     [](vm::Options* options, const char* value) noexcept {
+       return parseUIntOpt(value, &options->workerThreads);
+     },
+     nullptr},
+    {"--gc-growth=",
+     [](vm::Options* options, const char* value) noexcept {
+       return parseUIntOpt(value, &options->gcGrowthPercent);
+     },
+     "NOVUS_GC_GROWTH"},
+    {"--gc-interval=",
+     [](vm::Options* options, const char* value) noexcept {
+       return parseUIntOpt(value, &options->gcMinIntervalMilliseconds);
+     },
+     "NOVUS_GC_INTERVAL"},
+    {"--gc-soft-target=",
+     [](vm::Options* options, const char* value) noexcept {
+       return parseSizeOpt(value, &options->gcSoftHeapTarget);
+     },
+     "NOVUS_GC_SOFT_TARGET"},
+    {"--heap-limit=",
+     [](vm::Options* options, const char* value) noexcept {
+       return parseSizeOpt(value, &options->heapLimit);
+     },
+     "NOVUS_HEAP_LIMIT"},
+    {},
+};
+
+// Apply the runtime option with the given argument. When the argument is an option with an invalid
+// value then 'invalidOpt' (if provided) is set to the option.
+inline auto applyRuntimeOption(
+    const char* arg, vm::Options* options, const RuntimeOpt** invalidOpt = nullptr) noexcept
+    -> RuntimeOptResult {
+  for (const RuntimeOpt* opt = g_runtimeOptions; opt->input; ++opt) {
+    const auto inputLen = strlen(opt->input);
+    auto valid          = true;
+    if (opt->input[inputLen - 1] == '=') {
+      if (strncmp(arg, opt->input, inputLen) != 0) {
+        continue;
+      }
+      valid = opt->func(options, arg + inputLen);
+    } else if (strcmp(arg, opt->input) == 0) {
+      valid = opt->func(options, nullptr);
+    } else {
+      continue;
+    }
+    if (!valid) {
+      if (invalidOpt) {
+        *invalidOpt = opt;
+      }
+      return RuntimeOptResult::InvalidValue;
+    }
+    return RuntimeOptResult::Applied;
+  }
+  return RuntimeOptResult::NotAnOption;
+}
+
+// Apply the runtime options that are set through environment variables. Returns the name of the
+// first environment variable with an invalid value, or nullptr if all were valid.
+inline auto applyRuntimeEnvOptions(vm::Options* options) noexcept -> const char* {
+  for (const RuntimeOpt* opt = g_runtimeOptions; opt->input; ++opt) {
+    if (!opt->env) {
+      continue;
+    }
+    const char* value = std::getenv(opt->env);
+    if (value && !opt->func(options, value)) {
+      return opt->env;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace novrt
@@ -84,6 +84,7 @@ public:
   auto addLengthString() -> void;
   auto addIndexString() -> void;
   auto addSliceString() -> void;
+  auto addHashString() -> void;
 
   auto addCheckEqInt() -> void;
   auto addCheckEqLong() -> void;
@@ -124,6 +125,8 @@ public:
   auto addMakeNullStruct() -> void;
   auto addStructLoadField(uint8_t fieldIndex) -> void;
   auto addStructStoreField(uint8_t fieldIndex) -> void;
+  auto addUnionWrap(uint8_t discriminant) -> void;
+  auto addUnionCheck(uint8_t discriminant) -> void;
 
   auto addJump(std::string label) -> void;
   auto addJumpIf(std::string label) -> void;
@@ -19,16 +19,19 @@ class InstructionArg final {
   friend auto operator<<(std::ostream& out, const InstructionArg& rhs) -> std::ostream&;
 
 public:
+  using Value = std::variant<int32_t, int64_t, uint32_t, float, PCallCode>;
+
   explicit InstructionArg(int32_t value, std::vector<std::string> labels = {});
   explicit InstructionArg(int64_t value, std::vector<std::string> labels = {});
   explicit InstructionArg(uint32_t value, std::vector<std::string> labels = {});
   explicit InstructionArg(float value, std::vector<std::string> labels = {});
   explicit InstructionArg(PCallCode value, std::vector<std::string> labels = {});
 
+  [[nodiscard]] auto getValue() const noexcept -> const Value&;
   [[nodiscard]] auto getLabels() const noexcept -> const std::vector<std::string>&;
 
 private:
-  std::variant<int32_t, int64_t, uint32_t, float, PCallCode> m_value;
+  Value m_value;
   std::vector<std::string> m_labels;
 };
 
@@ -72,6 +72,7 @@ enum class OpCode : uint8_t {
   LengthString   = 81, // [] (string)           -> (int)    Calc length of a string.
   IndexString    = 82, // [] (int, string)      -> (int)    Get char at index in string (ascii).
   SliceString    = 83, // [] (int, int, string) -> (string) Substring from start to end (exclusive).
+  HashString     = 84, // [] (string)           -> (int)    Calc hash of a string.
 
   CheckEqInt        = 90, //  [] (int, int)               -> (int) Check ints equal.
   CheckEqLong       = 91, //  [] (long, long)             -> (int) Check long equal.
@@ -103,6 +104,22 @@ enum class OpCode : uint8_t {
   ConvFloatChar   = 122, // [] (float)      -> (int)    Convert float to char (8 bit).
   ConvFloatLong   = 123, // [] (float)      -> (long)   Convert float to long.
 
+  // Superinstructions: fused sequences of common instructions.
+  // NOTE: These are only produced by the runtime when loading an executable, to reduce the amount
+  // of instruction dispatches. They are not valid in executable files.
+  StackLoadField     = 130, // [uint16, uint8]  ()         -> (any)      StackLoad, StructLoadField.
+  StackLoadLoad      = 131, // [uint16, uint16] ()         -> (any, any) StackLoad, StackLoad.
+  StackStoreLoad     = 132, // [uint16, uint16] (any)      -> (any)      StackStore, StackLoad.
+  DupStructLoadField = 133, // [uint8]          (struct)   -> (any, any) Dup, StructLoadField.
+  AddIntLit          = 134, // [int32]          (int)      -> (int)      LoadLitInt, AddInt.
+  SubIntLit          = 135, // [int32]          (int)      -> (int)      LoadLitInt, SubInt.
+  CheckEqIntLit      = 136, // [int32]          (int)      -> (int)      LoadLitInt, CheckEqInt.
+  JumpIfZero         = 137, // [ip]             (int)      -> ()         CheckIntZero, JumpIf.
+  JumpIfEqInt        = 138, // [ip]             (int, int) -> ()         CheckEqInt, JumpIf.
+  JumpIfGtInt        = 139, // [ip]             (int, int) -> ()         CheckGtInt, JumpIf.
+  JumpIfLeInt        = 140, // [ip]             (int, int) -> ()         CheckLeInt, JumpIf.
+  JumpIfEqIntLit     = 141, // [int32, ip]      (int)      -> ()         CheckEqIntLit, JumpIf.
+
   MakeAtomic        = 180, // [int32]        ()       -> (atomic) Create a new atomic value.
   AtomicLoad        = 181, // []             (atomic) -> (int)    Load the value of the atomic.
   AtomicCompareSwap = 182, // [int32, int32] (atomic) -> (int)    Compare and swap, return old val.
@@ -112,6 +129,8 @@ enum class OpCode : uint8_t {
   MakeNullStruct   = 191, // []      ()            -> struct   Create a struct without fields.
   StructLoadField  = 192, // [uint8] (struct)      -> (any)    Get value of field x in structure.
   StructStoreField = 193, // [uint8] (any, struct) -> ()       Store value at field x in structure.
+  UnionWrap        = 194, // [uint8] (any)         -> (union)  Wrap in union with discriminant x.
+  UnionCheck       = 195, // [uint8] (union)       -> (int)    Check if union has discriminant x.
 
   Jump   = 220, // [ip] ()    -> () Jump to an instruction pointer.
   JumpIf = 221, // [ip] (int) -> () Jump to an instruction if int is not 0.
@@ -67,6 +67,7 @@ enum class FuncKind {
   LengthString,  // Return the length of a string.
   IndexString,   // Return the character at a specific index into a string.
   SliceString,   // Return a subsection of a string, indicated by start and end.
+  HashString,    // Return a hash of the characters of a string.
   CheckEqString, // Check if two strings are equal.
 
   ConvIntLong,     // Convert a integer to a long.
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+
+namespace vm {
+
+// Optional features of the virtual machine, configured by the host application.
+struct Options {
+  // Compile frequently called functions to native code, only supported on x86-64 linux (ignored
+  // on other platforms).
+  bool jitEnabled = false;
+
+  // Amount of calls before a function is compiled to native code.
+  uint32_t jitThreshold = 1000U;
+
+  // Amount of threads the garbage collector uses to mark live references, 0 picks an amount based
+  // on the hardware concurrency.
+  uint32_t gcMarkThreads = 0U;
+
+  // Amount of workers that run forked calls in parallel, 0 picks an amount based on the hardware
+  // concurrency. Forked calls that are blocked do not occupy a worker.
+  uint32_t workerThreads = 0U;
+
+  // Percentage of the live heap (after the previous collection) the program can allocate before
+  // the next garbage collection is triggered, for example 100 collects when the heap has doubled.
+  uint32_t gcGrowthPercent = 100U;
+
+  // Milliseconds after which a garbage collection is run while allocations are being made (even
+  // if the growth percentage has not been reached), 0 disables timed collections.
+  uint32_t gcMinIntervalMilliseconds = 5000U;
+
+  // Soft target for the heap size in bytes, 0 means no target. Garbage collections are triggered
+  // earlier to stay under the target, unlike 'heapLimit' allocations never fail because of it.
+  uint64_t gcSoftHeapTarget = 0U;
+
+  // Maximum heap size in bytes, 0 means unlimited. When the heap reaches the limit an emergency
+  // garbage collection is run, if that does not free enough memory allocations fail.
+  uint64_t heapLimit = 0U;
+};
+
+} // namespace vm
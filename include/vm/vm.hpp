@@ -1,11 +1,15 @@
 #pragma once
 #include "novasm/executable.hpp"
 #include "vm/exec_state.hpp"
+#include "vm/options.hpp"
 #include "vm/platform_interface.hpp"
 
 namespace vm {
 
 // Execute the given program. Will block until the execution is complete.
-auto run(const novasm::Executable* executable, PlatformInterface* iface) noexcept -> ExecState;
+auto run(
+    const novasm::Executable* executable,
+    PlatformInterface* iface,
+    const Options& options = Options{}) noexcept -> ExecState;
 
 } // namespace vm
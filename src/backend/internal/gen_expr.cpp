@@ -297,6 +297,9 @@ auto GenExpr::visit(const prog::expr::CallExprNode& n) -> void {
   case prog::sym::FuncKind::SliceString:
     m_asmb->addSliceString();
     break;
+  case prog::sym::FuncKind::HashString:
+    m_asmb->addHashString();
+    break;
   case prog::sym::FuncKind::CheckEqString:
     m_asmb->addCheckEqString();
     break;
@@ -697,6 +700,11 @@ auto GenExpr::visit(const prog::expr::UnionCheckExprNode& n) -> void {
     return;
   }
 
+  if (unionIsUnboxed(m_prog, unionType)) {
+    m_asmb->addUnionCheck(getUnionDiscriminant(m_prog, unionType, n.getTargetType()));
+    return;
+  }
+
   // For normal unions we test if the discriminants match.
   m_asmb->addStructLoadField(0);
   m_asmb->addLoadLitInt(getUnionDiscriminant(m_prog, n[0].getType(), n.getTargetType()));
@@ -724,6 +732,37 @@ auto GenExpr::visit(const prog::expr::UnionGetExprNode& n) -> void {
     return;
   }
 
+  if (unionIsUnboxed(m_prog, unionType)) {
+    /*
+    Unboxed unions store the value in the upper 32 bits of the union value, as operations on ints
+    and floats only look at the upper bits the union itself can be assigned to the constant.
+    */
+    const auto typeEqLabel = m_asmb->generateLabel("union-type-equal");
+    const auto endLabel    = m_asmb->generateLabel("union-get-end");
+
+    m_asmb->addDup();
+    m_asmb->addUnionCheck(getUnionDiscriminant(m_prog, unionType, n.getTargetType()));
+    m_asmb->addJumpIf(typeEqLabel);
+
+    m_asmb->addPop();         // Pop the extra union value from the stack.
+    m_asmb->addLoadLitInt(0); // Load false.
+    m_asmb->addJump(endLabel);
+
+    m_asmb->label(typeEqLabel);
+    const auto& targetType = n.getTargetType();
+    if (m_prog.getTypeDecl(targetType).getKind() == prog::sym::TypeKind::Struct &&
+        structIsTagType(m_prog, targetType)) {
+      // Tag types are represented by null, assign a null-struct instead of the union value.
+      m_asmb->addPop();
+      m_asmb->addMakeNullStruct();
+    }
+    m_asmb->addStackStore(getConstOffset(m_constTable, n.getConst()));
+    m_asmb->addLoadLitInt(1); // Load true.
+
+    m_asmb->label(endLabel);
+    return;
+  }
+
   /*
   Normal unions are represented by structs with 2 fields:
     * Field 0: The discriminant indicating which type the value is.
@@ -884,6 +923,13 @@ auto GenExpr::makeUnion(const prog::expr::CallExprNode& n) -> void {
     return;
   }
 
+  if (unionIsUnboxed(m_prog, unionType)) {
+    // Unboxed unions are represented by the value tagged with the discriminant.
+    genSubExpr(n[0], false);
+    m_asmb->addUnionWrap(getUnionDiscriminant(m_prog, unionType, chosenType));
+    return;
+  }
+
   // Normal unions are represented by a struct containing the discriminant and the value.
   m_asmb->addLoadLitInt(getUnionDiscriminant(m_prog, n.getType(), chosenType));
   genSubExpr(n[0], false);
@@ -98,4 +98,45 @@ auto unionIsNullableStruct(const prog::Program& prog, prog::sym::TypeId unionTyp
   return true;
 }
 
+static auto typeFitsUnboxed(const prog::Program& prog, prog::sym::TypeId type, bool allowStruct)
+    -> bool {
+  switch (prog.getTypeDecl(type).getKind()) {
+  case prog::sym::TypeKind::Int:
+  case prog::sym::TypeKind::Float:
+  case prog::sym::TypeKind::Bool:
+  case prog::sym::TypeKind::Char:
+  case prog::sym::TypeKind::Enum:
+    return true;
+  case prog::sym::TypeKind::Struct: {
+    if (!allowStruct) {
+      return false;
+    }
+    /* Tag types are represented by null (carry no data) and structs with a single field are
+    represented by the field itself. */
+    const auto& fields = std::get<prog::sym::StructDef>(prog.getTypeDef(type)).getFields();
+    return fields.getCount() == 0 ||
+        (fields.getCount() == 1 && typeFitsUnboxed(prog, fields[0].getType(), false));
+  }
+  default:
+    return false;
+  }
+}
+
+auto unionIsUnboxed(const prog::Program& prog, prog::sym::TypeId unionType) -> bool {
+  /*
+  Unions where all types fit in 32 bits can be stored in a single value without allocating, the
+  upper 32 bits hold the value and the lower bits the discriminant. Longs and references (strings,
+  structs with multiple fields, etc) need all the bits so unions containing those stay boxed.
+  */
+
+  const auto& typeDecl = prog.getTypeDecl(unionType);
+  if (typeDecl.getKind() != prog::sym::TypeKind::Union) {
+    throw std::logic_error{"Given type is not a union"};
+  }
+  const auto& types = std::get<prog::sym::UnionDef>(prog.getTypeDef(unionType)).getTypes();
+  return std::all_of(types.begin(), types.end(), [&prog](const auto& id) {
+    return typeFitsUnboxed(prog, id, true);
+  });
+}
+
 } // namespace backend::internal
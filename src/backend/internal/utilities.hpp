@@ -30,6 +30,11 @@ auto structIsTagType(const prog::Program& prog, prog::sym::TypeId structType) ->
 // To be eligible it needs to have 2 entries, a struct with fields and an empty struct.
 auto unionIsNullableStruct(const prog::Program& prog, prog::sym::TypeId unionType) -> bool;
 
+// Is union eligible for the unboxed representation.
+// To be eligible all its types need to fit in 32 bits (or be tag types), see 'unionValue' in the
+// vm.
+auto unionIsUnboxed(const prog::Program& prog, prog::sym::TypeId unionType) -> bool;
+
 template <typename Operation>
 auto forEachFuncDef(const prog::Program& program, bool deterministic, Operation op) -> void {
   if (deterministic) {
@@ -174,6 +174,8 @@ auto Assembler::addIndexString() -> void { writeOpCode(OpCode::IndexString); }
 
 auto Assembler::addSliceString() -> void { writeOpCode(OpCode::SliceString); }
 
+auto Assembler::addHashString() -> void { writeOpCode(OpCode::HashString); }
+
 auto Assembler::addCheckEqInt() -> void { writeOpCode(OpCode::CheckEqInt); }
 
 auto Assembler::addCheckEqLong() -> void { writeOpCode(OpCode::CheckEqLong); }
@@ -265,6 +267,16 @@ auto Assembler::addStructStoreField(uint8_t fieldIndex) -> void {
   writeUInt8(fieldIndex);
 }
 
+auto Assembler::addUnionWrap(uint8_t discriminant) -> void {
+  writeOpCode(OpCode::UnionWrap);
+  writeUInt8(discriminant);
+}
+
+auto Assembler::addUnionCheck(uint8_t discriminant) -> void {
+  writeOpCode(OpCode::UnionCheck);
+  writeUInt8(discriminant);
+}
+
 auto Assembler::addJump(std::string label) -> void {
   writeOpCode(OpCode::Jump);
   writeIpOffset(std::move(label));
@@ -22,6 +22,8 @@ InstructionArg::InstructionArg(float value, std::vector<std::string> labels) :
 InstructionArg::InstructionArg(PCallCode value, std::vector<std::string> labels) :
     m_value{value}, m_labels{std::move(labels)} {}
 
+auto InstructionArg::getValue() const noexcept -> const Value& { return m_value; }
+
 auto InstructionArg::getLabels() const noexcept -> const std::vector<std::string>& {
   return m_labels;
 }
@@ -126,6 +128,8 @@ auto disassembleInstructions(
     case OpCode::MakeStruct:
     case OpCode::StructLoadField:
     case OpCode::StructStoreField:
+    case OpCode::UnionWrap:
+    case OpCode::UnionCheck:
     case OpCode::CallDyn:
     case OpCode::CallDynTail:
     case OpCode::CallDynForked:
@@ -177,6 +181,7 @@ auto disassembleInstructions(
     case OpCode::LengthString:
     case OpCode::IndexString:
     case OpCode::SliceString:
+    case OpCode::HashString:
     case OpCode::CheckEqInt:
     case OpCode::CheckEqLong:
     case OpCode::CheckEqFloat:
@@ -246,6 +251,20 @@ auto disassembleInstructions(
     case OpCode::PCall:
       result.push_back(Instr{opCode, offset, {Arg{readAsm<PCallCode>(&ip)}}, labels});
       continue;
+    case OpCode::StackLoadField:
+    case OpCode::StackLoadLoad:
+    case OpCode::StackStoreLoad:
+    case OpCode::DupStructLoadField:
+    case OpCode::AddIntLit:
+    case OpCode::SubIntLit:
+    case OpCode::CheckEqIntLit:
+    case OpCode::JumpIfZero:
+    case OpCode::JumpIfEqInt:
+    case OpCode::JumpIfGtInt:
+    case OpCode::JumpIfLeInt:
+    case OpCode::JumpIfEqIntLit:
+      // Superinstructions are only produced by the runtime, they are not valid in executables.
+      break;
     }
     throw std::logic_error{"Bad assembly"};
   }
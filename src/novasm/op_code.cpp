@@ -180,6 +180,9 @@ auto operator<<(std::ostream& out, const OpCode& rhs) noexcept -> std::ostream&
   case OpCode::SliceString:
     out << "slice-string";
     break;
+  case OpCode::HashString:
+    out << "hash-string";
+    break;
 
   case OpCode::CheckEqInt:
     out << "check-eq-int";
@@ -267,6 +270,43 @@ auto operator<<(std::ostream& out, const OpCode& rhs) noexcept -> std::ostream&
     out << "conv-float-long";
     break;
 
+  case OpCode::StackLoadField:
+    out << "stack-load-field";
+    break;
+  case OpCode::StackLoadLoad:
+    out << "stack-load-load";
+    break;
+  case OpCode::StackStoreLoad:
+    out << "stack-store-load";
+    break;
+  case OpCode::DupStructLoadField:
+    out << "dup-struct-load-field";
+    break;
+  case OpCode::AddIntLit:
+    out << "add-int-lit";
+    break;
+  case OpCode::SubIntLit:
+    out << "sub-int-lit";
+    break;
+  case OpCode::CheckEqIntLit:
+    out << "check-eq-int-lit";
+    break;
+  case OpCode::JumpIfZero:
+    out << "jump-if-zero";
+    break;
+  case OpCode::JumpIfEqInt:
+    out << "jump-if-eq-int";
+    break;
+  case OpCode::JumpIfGtInt:
+    out << "jump-if-gt-int";
+    break;
+  case OpCode::JumpIfLeInt:
+    out << "jump-if-le-int";
+    break;
+  case OpCode::JumpIfEqIntLit:
+    out << "jump-if-eq-int-lit";
+    break;
+
   case OpCode::MakeAtomic:
     out << "make-atomic";
     break;
@@ -292,6 +332,12 @@ auto operator<<(std::ostream& out, const OpCode& rhs) noexcept -> std::ostream&
   case OpCode::StructStoreField:
     out << "struct-store-field";
     break;
+  case OpCode::UnionWrap:
+    out << "union-wrap";
+    break;
+  case OpCode::UnionCheck:
+    out << "union-check";
+    break;
 
   case OpCode::Jump:
     out << "jump";
@@ -142,6 +142,8 @@ Program::Program() :
       *this, Fk::IndexString, "string_index", sym::TypeSet{m_string, m_int}, m_char);
   m_funcDecls.registerIntrinsic(
       *this, Fk::SliceString, "string_slice", sym::TypeSet{m_string, m_int, m_int}, m_string);
+  m_funcDecls.registerIntrinsic(
+      *this, Fk::HashString, "string_hash", sym::TypeSet{m_string}, m_int);
 
   // Register conversion intrinsics.
   m_funcDecls.registerIntrinsic(*this, Fk::ConvIntLong, "int_to_long", sym::TypeSet{m_int}, m_long);
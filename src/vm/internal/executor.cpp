@@ -1,6 +1,8 @@
 #include "internal/executor.hpp"
 #include "internal/intrinsics.hpp"
+#include "internal/jit.hpp"
 #include "internal/pcall.hpp"
+#include "internal/program.hpp"
 #include "internal/ref_allocator.hpp"
 #include "internal/ref_atomic.hpp"
 #include "internal/ref_future.hpp"
@@ -10,88 +12,171 @@
 #include "internal/ref_ulong.hpp"
 #include "internal/stack.hpp"
 #include "internal/string_utilities.hpp"
-#include "internal/thread.hpp"
-#include "novasm/op_code.hpp"
 #include "novasm/pcall_code.hpp"
 #include "vm/exec_state.hpp"
 #include "vm/platform_interface.hpp"
+#include <array>
 #include <cmath>
 
+/* Instruction dispatch mode.
+ * When 'VM_COMPUTED_GOTO' is defined (and the compiler supports the 'labels as values' extension)
+ * the executor uses direct-threaded dispatch: every instruction handler jumps straight to the
+ * handler of the next instruction through a table of label addresses. This gives every handler its
+ * own indirect branch (and thus its own branch-predictor entry) instead of all instructions sharing
+ * the single indirect branch of a switch statement.
+ * Without the extension we fall back to a portable switch based dispatch loop.
+ */
+#if defined(VM_COMPUTED_GOTO) && (defined(__GNUG__) || defined(__clang__))
+#define VM_DIRECT_THREADED 1
+#else
+#define VM_DIRECT_THREADED 0
+#endif
+
+// List of all the opcodes that the executor implements.
+// NOTE: The small variants of the literal and stack instructions are normalized to their regular
+// variants when the program is decoded, so they are not present here.
+#define FOR_EACH_OPCODE(X)                                                                         \
+  X(LoadLitInt) X(LoadLitLong) X(LoadLitFloat) X(LoadLitString) X(LoadLitIp) X(StackAlloc)         \
+  X(StackStore) X(StackLoad) X(AddInt) X(AddLong) X(AddFloat)                                      \
+  X(AddString) X(AppendChar) X(SubInt) X(SubLong) X(SubFloat) X(MulInt) X(MulLong) X(MulFloat)     \
+  X(DivInt) X(DivLong) X(DivFloat) X(RemInt) X(RemLong) X(ModFloat) X(PowFloat) X(SqrtFloat)       \
+  X(SinFloat) X(CosFloat) X(TanFloat) X(ASinFloat) X(ACosFloat) X(ATanFloat) X(ATan2Float)         \
+  X(NegInt) X(NegLong) X(NegFloat) X(ShiftLeftInt) X(ShiftLeftLong) X(ShiftRightInt)               \
+  X(ShiftRightLong) X(AndInt) X(AndLong) X(OrInt) X(OrLong) X(XorInt) X(XorLong) X(InvInt)         \
+  X(InvLong) X(LengthString) X(IndexString) X(SliceString) X(HashString) X(CheckEqInt)             \
+  X(CheckEqLong) X(CheckEqFloat) X(CheckEqString) X(CheckEqIp) X(CheckEqCallDynTgt) X(CheckGtInt)  \
+  X(CheckGtLong) X(CheckGtFloat) X(CheckLeInt) X(CheckLeLong) X(CheckLeFloat)                      \
+  X(CheckStructNull) X(CheckIntZero) X(CheckStringEmpty) X(ConvIntLong) X(ConvIntFloat)            \
+  X(ConvLongInt) X(ConvLongFloat) X(ConvFloatInt) X(ConvIntString) X(ConvLongString)               \
+  X(ConvFloatString) X(ConvCharString) X(ConvIntChar) X(ConvLongChar) X(ConvFloatChar)             \
+  X(ConvFloatLong) X(MakeAtomic) X(AtomicLoad) X(AtomicCompareSwap) X(AtomicBlock)                 \
+  X(MakeStruct) X(MakeNullStruct) X(StructLoadField) X(StructStoreField) X(Jump) X(JumpIf)         \
+  X(UnionWrap) X(UnionCheck)                                                                       \
+  X(Call) X(CallTail) X(CallForked) X(CallDyn) X(CallDynTail) X(CallDynForked) X(PCall) X(Ret)     \
+  X(FutureWaitNano) X(FutureBlock) X(Dup) X(Pop) X(Swap) X(Fail) X(StackLoadField)               \
+  X(StackLoadLoad) X(StackStoreLoad) X(DupStructLoadField) X(AddIntLit) X(SubIntLit)               \
+  X(CheckEqIntLit) X(JumpIfZero) X(JumpIfEqInt) X(JumpIfGtInt) X(JumpIfLeInt) X(JumpIfEqIntLit)
+
 namespace vm::internal {
 
-// Read a value from the executable file and increment the given instruction pointer.
-template <typename Type>
-NO_SANITIZE(alignment)
-inline auto readAsm(const uint8_t** ip) {
-  /* At the moment this function assumes that the host machine uses little-endian byte order, two's
-  compliment signed integers, IEEE 754 floats and supports unalinged loads. So technically this is
-  not conforming to the c++ spec. But unfortunately not all compiler can see through more portable
-  implementations of this code (and thus performance suffers). So when we want to add support for a
-  platform where one of these assumptions does not hold true we should specialize this function. */
-
-  const Type v = *reinterpret_cast<const Type*>(*ip); // NOLINT: Reinterpret cast
-  *ip += sizeof(Type);
-  return v;
+#if VM_DIRECT_THREADED
+
+using DispatchTable = std::array<InstrHandler, 256>;
+
+// Build a table that maps every possible opcode byte to the address of its handler.
+// 'handlers' has to be in the same order as 'FOR_EACH_OPCODE', opcodes that are not implemented
+// map to the 'invalid' handler.
+template <size_t HandlerCount>
+auto makeDispatchTable(const InstrHandler (&handlers)[HandlerCount], InstrHandler invalid) noexcept
+    -> DispatchTable {
+#define OPCODE_ENTRY(NAME) novasm::OpCode::NAME,
+  constexpr novasm::OpCode opCodes[] = {FOR_EACH_OPCODE(OPCODE_ENTRY)};
+#undef OPCODE_ENTRY
+  static_assert(sizeof(opCodes) / sizeof(novasm::OpCode) == HandlerCount);
+
+  auto result = DispatchTable{};
+  result.fill(invalid);
+  for (auto i = 0U; i != HandlerCount; ++i) {
+    result[static_cast<uint8_t>(opCodes[i])] = handlers[i];
+  }
+  return result;
+}
+
+#endif // VM_DIRECT_THREADED
+
+// Update the stack-homes after the stack has been moved (to grow it).
+// The stack-home of every stack-frame is saved in the stack-frame above it, so the chain of
+// stack-frames is walked from the current stack-frame down to the root.
+static auto rebaseStackFrames(Value** sh, Value** rootSh, uintptr_t oldBottom, Value* newBottom)
+    -> void {
+  const auto rebase = [oldBottom, newBottom](Value* ptr) {
+    const auto offset = reinterpret_cast<uintptr_t>(ptr) - oldBottom; // NOLINT: Reinterpret cast
+    return newBottom + offset / sizeof(Value);
+  };
+  *sh     = rebase(*sh);
+  *rootSh = rebase(*rootSh);
+  for (auto* frameSh = *sh; frameSh != *rootSh;) {
+    auto* retSh    = rebase((frameSh - 1)->getRawPtr<Value>());
+    *(frameSh - 1) = rawPtrValue(retSh);
+    frameSh        = retSh;
+  }
+}
+
+// Grow the stack so there is space for at least 'amount' more values and update the stack-homes,
+// returns false if the stack could not be grown.
+// Note: Kept out of line as its only called when the stack is full.
+NO_INLINE static auto growStack(BasicStack* stack, unsigned int amount, Value** sh, Value** rootSh)
+    -> bool {
+  // NOLINTNEXTLINE: Reinterpret cast
+  const auto oldBottom = reinterpret_cast<uintptr_t>(stack->getBottom());
+  if (unlikely(!stack->grow(amount))) {
+    return false;
+  }
+  rebaseStackFrames(sh, rootSh, oldBottom, stack->getBottom());
+  return true;
+}
+
+// Amount of values that a stack-frame uses for its meta-data (return ip and return stack-home).
+const unsigned int stackFrameMetaSize = 2U;
+
+// Lookup the stack requirements of the target of a dynamic call.
+// Returns nullptr if the target is not the start of a function or too few arguments are passed.
+inline auto getDynCallFrame(const Program* program, uint32_t ipIndex, unsigned int argCount)
+    -> const FrameInfo* {
+  const auto& frame = program->getFrameInfo(ipIndex);
+  return likely(argCount >= frame.minArgs) ? &frame : nullptr;
+}
+
+// Pop the top value of the stack, 'tos' is updated to the new top value.
+// NOTE: Loading the new top value is safe even when the stack becomes empty, as there is always a
+// value below the root stack-home (see 'execute').
+inline auto popTos(Value** sp, Value* tos) noexcept -> Value {
+  const auto result = *tos;
+  *tos              = *(--*sp - 1);
+  return result;
 }
 
 // Make a call to a function at a given instruction pointer location. The current
 // instruction-pointer is saved on the stack for returning to when the called function returns.
-inline auto call(
-    const novasm::Executable* executable,
-    BasicStack* stack,
-    ExecutorHandle* execHandle,
-    const uint8_t** ip,
-    Value** sh,
-    uint8_t argCount,
-    uint32_t tgtIpOffset) -> bool {
+// NOTE: Expects the space for the stack-frame meta-data to be reserved already, this way the caller
+// can grow the stack before making the call.
+inline auto call(Value** sp, const Instr** ip, Value** sh, uint8_t argCount, const Instr* tgtIp)
+    -> void {
 
   /* Arguments are pushed on the stack before the call instruction, we shift over the arguments
   to make space for the return instruction, and the return stack home ptr. */
 
-  const int sfMetaSize = 2; // Return ip and return stack-home.
-
-  auto* argStart = stack->getNext() - argCount;
-  auto* newSh    = argStart + sfMetaSize;
-
-  // Allocate space on the stack for the stackframe meta-data.
-  if (unlikely(!stack->alloc(sfMetaSize))) {
-    execHandle->setState(ExecState::StackOverflow);
-    return false;
-  }
+  *sp += stackFrameMetaSize;
+  auto* newSh    = *sp - argCount;
+  auto* argStart = newSh - stackFrameMetaSize;
 
   // Move the arguments to the beginning of the stack-home for the new stack frame.
   std::memmove(newSh, argStart, sizeof(Value) * argCount);
 
   // Save the return instruction pointer and stack-home.
-  *(newSh - 2) = uintValue(executable->getOffset(*ip));
+  *(newSh - 2) = rawPtrValue(*ip);
   *(newSh - 1) = rawPtrValue(*sh);
 
   // Setup the ip and stack-home for the new stack frame.
-  *ip = executable->getIp(tgtIpOffset);
+  *ip = tgtIp;
   *sh = newSh;
-  return true;
 }
 
 // Make a tail call to a function at a given instruction pointer location. Execution will NOT be
 // returned to the current function when the called function returns.
-inline auto callTail(
-    const novasm::Executable* executable,
-    BasicStack* stack,
-    const uint8_t** ip,
-    Value* sh,
-    uint8_t argCount,
-    uint32_t tgtIpOffset) -> void {
+inline auto callTail(Value** sp, const Instr** ip, Value* sh, uint8_t argCount, const Instr* tgtIp)
+    -> void {
 
   /* In case of a tail-call we discard our current stack-frame, we copy the arguments to the
   beginning of the current-stack frame and update the ip. */
 
-  auto* argStart = stack->getNext() - argCount;
+  auto* argStart = *sp - argCount;
 
   // Move the arguments to the beginning of the current stack home.
   std::memmove(sh, argStart, sizeof(Value) * argCount);
 
-  stack->rewindToNext(sh + argCount); // Discard any extra values on the stack.
-  *ip = executable->getIp(tgtIpOffset);
+  *sp = sh + argCount; // Discard any extra values on the stack.
+  *ip = tgtIp;
 }
 
 // Push all the arguments of a closure on the stack (in preparation for calling the closure
@@ -101,7 +186,7 @@ inline auto pushClosure(
     ExecutorHandle* execHandle,
     const Value& closureVal,
     uint8_t* boundArgCount,
-    uint32_t* ipOffset) -> bool {
+    uint32_t* ipIndex) -> bool {
 
   auto* closureStruct = getStructRef(closureVal);
   *boundArgCount      = closureStruct->getFieldCount() - 1U;
@@ -109,94 +194,109 @@ inline auto pushClosure(
 
   // Push all bound arguments on the stack.
   for (auto i = 0U; i != *boundArgCount; ++i) {
-    const auto& arg = closureStruct->getField(i);
-    if (unlikely(!stack->push(arg))) {
+    if (unlikely(!stack->hasSpace(1)) && unlikely(!stack->grow())) {
       execHandle->setState(ExecState::StackOverflow);
       return false;
     }
+    stack->push(closureStruct->getField(i));
   }
 
-  *ipOffset = closureStruct->getField(*boundArgCount).getUInt();
+  *ipIndex = closureStruct->getField(*boundArgCount).getUInt();
   return true;
 }
 
-// Start executing a call to a function at a given instruction pointer location on a new thread. A
-// promise object for retreiving the results from will be pushed onto the stack.
+// Request to start a forked executor, owned by the task that runs it.
+struct ForkRequest {
+  const Settings* settings;
+  Program* program;
+  PlatformInterface* iface;
+  ExecutorRegistry* execRegistry;
+  Scheduler* scheduler;
+  RefAllocator* refAlloc;
+  GarbageCollector* gc;
+  Jit* jit;
+  const Instr* entryIp;
+  FutureRef* future;
+};
+
+static auto runFork(void* arg) noexcept -> void {
+  const auto req = *static_cast<ForkRequest*>(arg);
+  delete static_cast<ForkRequest*>(arg);
+
+  execute(
+      req.settings,
+      req.program,
+      req.iface,
+      req.execRegistry,
+      req.scheduler,
+      req.refAlloc,
+      req.gc,
+      req.jit,
+      req.entryIp,
+      req.future);
+}
+
+// Start executing a call to a function at a given instruction pointer location as a scheduler task.
+// A promise object for retreiving the results from will be pushed onto the stack.
+// NOTE: The arguments are copied into the promise, so the caller does not wait for the fork to
+// start.
 inline auto fork(
     const Settings* settings,
-    const novasm::Executable* executable,
+    Program* program,
     PlatformInterface* iface,
     ExecutorRegistry* execRegistry,
+    Scheduler* scheduler,
     RefAllocator* refAlloc,
     GarbageCollector* gc,
+    Jit* jit,
     BasicStack* stack,
     ExecutorHandle* execHandle,
     uint8_t argCount,
-    uint32_t entryIpOffset) -> bool {
+    const Instr* entryIp) -> bool {
 
   // Create a future object to interact with the fork.
-  auto* future = refAlloc->allocPlain<FutureRef>();
+  auto* future = refAlloc->allocFuture(argCount);
   if (unlikely(future == nullptr)) {
     execHandle->setState(ExecState::AllocFailed);
     return false;
   }
 
+  // Move the arguments from the stack into the future.
   auto* argSource = stack->getNext() - argCount;
+  std::memcpy(future->getArgsBegin(), argSource, sizeof(Value) * argCount);
+  stack->rewindToNext(argSource);
+
+  // Keep the future alive until the fork has registered itself.
+  execRegistry->addPendingFork(future);
 
-  const auto startRes = threadStart(
-      &execute,
-      settings,
-      executable,
-      iface,
-      execRegistry,
-      refAlloc,
-      gc,
-      entryIpOffset,
-      argCount,
-      argSource,
-      future);
-
-  if (unlikely(startRes != ThreadStartResult::Success)) {
+  auto* req = new ForkRequest{
+      settings, program, iface, execRegistry, scheduler, refAlloc, gc, jit, entryIp, future};
+  if (unlikely(!scheduler->run(&runFork, req))) {
+    delete req;
+    execRegistry->removePendingFork(future);
     execHandle->setState(ExecState::ForkFailed);
     return false;
   }
 
-  // Wait until the fork executor has started.
-  threadYield();
-  while (!future->getStarted().load(std::memory_order_acquire)) {
-    threadPause();
-  }
-
-  /* Note its important to leave the arguments alone until the fork executor has started, as until
-  then the executor might still be reading them. */
-
-  // Remove the arguments from the stack.
-  stack->rewindToNext(stack->getNext() - argCount);
-
-  // Push the future on the stack.
-  if (unlikely(!stack->push(refValue(future)))) {
-    execHandle->setState(ExecState::StackOverflow);
-    return false;
-  }
+  // Push the future on the stack (in place of the arguments so there is always space for it).
+  stack->push(refValue(future));
   return true;
 }
 
 auto execute(
     const Settings* settings,
-    const novasm::Executable* executable,
+    Program* program,
     PlatformInterface* iface,
     ExecutorRegistry* execRegistry,
+    Scheduler* scheduler,
     RefAllocator* refAlloc,
     GarbageCollector* gc,
-    uint32_t entryIpOffset,
-    uint8_t entryArgCount,
-    Value* entryArgSource,
+    Jit* jit,
+    const Instr* entryIp,
     FutureRef* promise) noexcept -> ExecState {
 
-  assert(settings && executable && iface && execRegistry && refAlloc && gc);
-
-  using OpCode    = novasm::OpCode;
-  using PCallCode = novasm::PCallCode;
+  assert(
+      settings && program && iface && execRegistry && scheduler && refAlloc && gc && entryIp);
 
 #define CHECK_ALLOC(PTR)                                                                           \
   {                                                                                                \
@@ -205,43 +305,71 @@ auto execute(
       goto End;                                                                                    \
     }                                                                                              \
   }
-#define READ_BYTE() readAsm<uint8_t>(&ip)
-#define READ_UHALF() readAsm<uint16_t>(&ip)
-#define READ_INT() readAsm<int32_t>(&ip)
-#define READ_UINT() readAsm<uint32_t>(&ip)
-#define READ_LONG() readAsm<int64_t>(&ip)
-#define READ_FLOAT() readAsm<float>(&ip)
-#define SALLOC(COUNT)                                                                              \
-  if (unlikely(!stack.alloc(COUNT))) {                                                             \
-    execHandle.setState(ExecState::StackOverflow);                                                 \
-    goto End;                                                                                      \
+// Top-of-stack caching: inside the dispatch loop the next free stack slot is kept in 'sp' and the
+// topmost value in 'tos' so they can live in registers. Values are still written to the stack
+// memory (so stack-loads, the garbage collector and generated code see all values) but the 'next'
+// pointer of the stack object is only updated by 'SYNC_STACK', which has to happen before anything
+// else can observe the stack (calls into the stack object, pcalls, forks and safe-points).
+#define SYNC_STACK() stack.setNext(sp)
+#define LOAD_STACK()                                                                               \
+  {                                                                                                \
+    sp  = stack.getNext();                                                                         \
+    tos = *(sp - 1);                                                                               \
+  }
+// Wait at a safe-point if a pause was requested, evaluates to true if the executor was aborted.
+#define TRAP() (SYNC_STACK(), execHandle.trap())
+// Make sure there is space for 'AMOUNT' more values on the stack, grows the stack and rebases the
+// stack-frames if needed (which invalidates all other pointers into the stack).
+#define RESERVE(AMOUNT)                                                                            \
+  SYNC_STACK();                                                                                    \
+  if (unlikely(!stack.hasSpace(AMOUNT))) {                                                         \
+    if (unlikely(!growStack(&stack, AMOUNT, &sh, &rootSh))) {                                      \
+      execHandle.setState(ExecState::StackOverflow);                                               \
+      goto End;                                                                                    \
+    }                                                                                              \
+    sp = stack.getNext();                                                                          \
+  }
+// Call an operation that uses the stack object and rebase the stack-frames if it has grown the
+// stack.
+#define REBASE_STACK(EXPR)                                                                         \
+  {                                                                                                \
+    SYNC_STACK();                                                                                  \
+    const auto oldBottom = reinterpret_cast<uintptr_t>(stack.getBottom());                         \
+    EXPR;                                                                                          \
+    if (unlikely(reinterpret_cast<uintptr_t>(stack.getBottom()) != oldBottom)) {                   \
+      rebaseStackFrames(&sh, &rootSh, oldBottom, stack.getBottom());                               \
+    }                                                                                              \
+    LOAD_STACK();                                                                                  \
   }
+// NOTE: Pushing and allocating does not check the stack capacity, the space for the whole
+// stack-frame is reserved when entering a function (see 'FrameInfo' in program.hpp).
 #define SALLOC_CLEAR(COUNT)                                                                        \
   {                                                                                                \
-    SALLOC(COUNT);                                                                                 \
-    std::memset(stack.getNext() - (COUNT), 0, sizeof(Value) * (COUNT));                            \
+    std::memset(sp, 0, sizeof(Value) * (COUNT));                                                   \
+    sp += (COUNT);                                                                                 \
+    tos = *(sp - 1);                                                                               \
   }
 
 #define PUSH(VAL)                                                                                  \
-  if (unlikely(!stack.push(VAL))) {                                                                \
-    execHandle.setState(ExecState::StackOverflow);                                                 \
-    goto End;                                                                                      \
+  {                                                                                                \
+    tos   = VAL;                                                                                   \
+    *sp++ = tos;                                                                                   \
   }
 #define PUSH_UINT(VAL) PUSH(uintValue(VAL))
 #define PUSH_INT(VAL) PUSH(intValue(VAL))
-#define PUSH_ULONG(VAL)                                                                            \
+#define PUSH_LONG(VAL)                                                                             \
   {                                                                                                \
-    const uint64_t ulongVal = VAL;                                                                 \
-    if (ulongVal & (1ULL << 63)) {                                                                 \
-      PUSH_REF(refAlloc->allocPlain<ULongRef>(ulongVal));                                          \
+    const int64_t longVal = VAL;                                                                   \
+    if (likely(isSmallLong(longVal))) {                                                            \
+      PUSH(smallLongValue(longVal));                                                               \
     } else {                                                                                       \
-      PUSH(smallULongValue(ulongVal));                                                             \
+      PUSH_REF(refAlloc->allocPlain<ULongRef>(reinterpret_cast<const uint64_t&>(longVal)));        \
     }                                                                                              \
   }
-#define PUSH_LONG(VAL)                                                                             \
+#define PUSH_ULONG(VAL)                                                                            \
   {                                                                                                \
-    const int64_t longVal = VAL;                                                                   \
-    PUSH_ULONG(reinterpret_cast<const uint64_t&>(longVal));                                        \
+    const uint64_t ulongVal = VAL;                                                                 \
+    PUSH_LONG(reinterpret_cast<const int64_t&>(ulongVal));                                         \
   }
 #define PUSH_BOOL(VAL) PUSH(intValue(VAL))
 #define PUSH_FLOAT(VAL) PUSH(floatValue(VAL))
@@ -252,184 +380,282 @@ auto execute(
     PUSH(refValue(refPtr));                                                                        \
   }
 #define PUSH_CLOSURE(VAL, RES_BOUND_ARG_COUNT, RES_TGT_IP_OFFSET)                                  \
-  if (unlikely(!pushClosure(&stack, &execHandle, VAL, RES_BOUND_ARG_COUNT, RES_TGT_IP_OFFSET))) {  \
-    goto End;                                                                                      \
+  {                                                                                                \
+    bool pushed;                                                                                   \
+    REBASE_STACK(                                                                                  \
+        pushed = pushClosure(&stack, &execHandle, VAL, RES_BOUND_ARG_COUNT, RES_TGT_IP_OFFSET));   \
+    if (unlikely(!pushed)) {                                                                       \
+      goto End;                                                                                    \
+    }                                                                                              \
   }
-#define PEEK() stack.peek()
-#define POP() stack.pop()
+#define PEEK() tos
+#define POP() popTos(&sp, &tos)
 #define POP_UINT() POP().getUInt()
 #define POP_INT() POP().getInt()
 #define POP_FLOAT() POP().getFloat()
-#define CALL(ARG_COUNT, TGT_IP)                                                                    \
-  if (unlikely(!call(executable, &stack, &execHandle, &ip, &sh, ARG_COUNT, TGT_IP))) {             \
+#if VM_DIRECT_THREADED
+#define OP_LABEL_ADDR(NAME) &&Op##NAME,
+  static const InstrHandler opHandlers[] = {FOR_EACH_OPCODE(OP_LABEL_ADDR)};
+#undef OP_LABEL_ADDR
+  static const DispatchTable dispatchTable = makeDispatchTable(opHandlers, &&OpInvalid);
+
+  // Resolve the handler addresses of the program instructions (only done for the first executor).
+  program->linkHandlers(dispatchTable.data());
+
+#define DISPATCH_BEGIN() NEXT();
+#define DISPATCH_END()
+#define OP(NAME) Op##NAME:
+#define OP_INVALID OpInvalid:
+#define NEXT()                                                                                     \
+  {                                                                                                \
+    instr = ip++;                                                                                  \
+    goto* instr->handler;                                                                          \
+  }
+#else // !VM_DIRECT_THREADED
+#define DISPATCH_BEGIN()                                                                           \
+  while (true) {                                                                                   \
+    instr = ip++;                                                                                  \
+    switch (instr->op) {
+#define DISPATCH_END()                                                                             \
+  }                                                                                                \
+  }
+#define OP(NAME) case novasm::OpCode::NAME:
+#define OP_INVALID default:
+#define NEXT() break
+#endif // !VM_DIRECT_THREADED
+// Continue in native code if the jit has code for the current instruction, execution returns to
+// the interpreter at the first instruction that the native code does not support.
+#define JIT_ENTER(CODE)                                                                            \
+  if (unlikely(jit != nullptr)) {                                                                  \
+    const JitCode jitCode = CODE;                                                                  \
+    if (jitCode != nullptr) {                                                                      \
+      auto* jitNext = sp;                                                                          \
+      ip            = jitCode(sh, &jitNext, execHandle.getRequestFlag());                          \
+      sp            = jitNext;                                                                     \
+      tos           = *(sp - 1);                                                                   \
+    }                                                                                              \
+  }
+#define JIT_ENTER_FUNCTION() JIT_ENTER(jit->enterFunction(ip))
+#define JIT_ENTER_RETURN() JIT_ENTER(jit->getCode(ip))
+#define CALL(ARG_COUNT, TGT_IP, TGT_MAX_STACK)                                                     \
+  {                                                                                                \
+    RESERVE(stackFrameMetaSize + (TGT_MAX_STACK));                                                 \
+    call(&sp, &ip, &sh, ARG_COUNT, TGT_IP);                                                        \
+    tos = *(sp - 1);                                                                               \
+    JIT_ENTER_FUNCTION();                                                                          \
+  }
+#define CALL_TAIL(ARG_COUNT, TGT_IP, TGT_MAX_STACK)                                                \
+  {                                                                                                \
+    callTail(&sp, &ip, sh, ARG_COUNT, TGT_IP);                                                     \
+    tos = *(sp - 1);                                                                               \
+    RESERVE(TGT_MAX_STACK);                                                                        \
+    JIT_ENTER_FUNCTION();                                                                          \
+  }
+// Lookup the stack requirements of a dynamic call target, fails the executor if its invalid.
+#define DYN_CALL_FRAME(RES_FRAME, TGT_IP_INDEX, ARG_COUNT)                                         \
+  [[maybe_unused]] const auto* RES_FRAME =                                                         \
+      getDynCallFrame(program, TGT_IP_INDEX, ARG_COUNT);                                           \
+  if (unlikely(RES_FRAME == nullptr)) {                                                            \
+    execHandle.setState(ExecState::InvalidAssembly);                                               \
     goto End;                                                                                      \
   }
-#define CALL_TAIL(ARG_COUNT, TGT_IP) callTail(executable, &stack, &ip, sh, ARG_COUNT, TGT_IP)
 #define CALL_FORKED(ARG_COUNT, TGT_IP)                                                             \
-  if (unlikely(!fork(                                                                              \
-          settings,                                                                                \
-          executable,                                                                              \
-          iface,                                                                                   \
-          execRegistry,                                                                            \
-          refAlloc,                                                                                \
-          gc,                                                                                      \
-          &stack,                                                                                  \
-          &execHandle,                                                                             \
-          ARG_COUNT,                                                                               \
-          TGT_IP))) {                                                                              \
-    goto End;                                                                                      \
+  {                                                                                                \
+    bool forked;                                                                                   \
+    REBASE_STACK(                                                                                  \
+        forked = fork(                                                                             \
+            settings,                                                                              \
+            program,                                                                               \
+            iface,                                                                                 \
+            execRegistry,                                                                          \
+            scheduler,                                                                             \
+            refAlloc,                                                                              \
+            gc,                                                                                    \
+            jit,                                                                                   \
+            &stack,                                                                                \
+            &execHandle,                                                                           \
+            ARG_COUNT,                                                                             \
+            TGT_IP));                                                                              \
+    if (unlikely(!forked)) {                                                                       \
+      goto End;                                                                                    \
+    }                                                                                              \
   }
 
   // Setup state.
   auto stack      = BasicStack{};
   auto execHandle = ExecutorHandle{&stack};
   auto pErr       = PlatformError::None;
-  execRegistry->registerExecutor(&execHandle);
 
   // If we are given a promise to fill then push it on the stack, its important to be on the stack
   // so the garbage collector can 'see' it. We place the promise one position before the root
   // stack-home to make it invisible to the running assembly.
-  if (promise) {
-    stack.push(refValue(promise));
+  // NOTE: Without a promise a placeholder is pushed instead, there always has to be a value below
+  // the root stack-home for the top-of-stack cache to load when the stack is empty.
+  // NOTE: Pushed before registering, from the moment we are registered our stack keeps the promise
+  // alive (instead of the list of pending forks in the registry).
+  stack.push(promise ? refValue(promise) : intValue(0));
+
+  if (unlikely(!execRegistry->registerExecutor(&execHandle, promise))) {
+    return ExecState::Aborted; // Forked while the program was shutting down.
+  }
+
+  // Arguments for forked calls are stored in the promise.
+  const auto entryArgCount = promise ? promise->getArgCount() : uint8_t{0};
+
+  // Reserve the space for the entry args and the stack-frame of the entry function.
+  const auto& entryFrame = program->getFrameInfo(entryIp);
+  if (unlikely(entryArgCount < entryFrame.minArgs)) {
+    execHandle.setState(ExecState::InvalidAssembly);
+  } else if (
+      unlikely(!stack.hasSpace(entryArgCount + entryFrame.maxStack)) &&
+      unlikely(!stack.grow(entryArgCount + entryFrame.maxStack))) {
+    execHandle.setState(ExecState::StackOverflow);
   }
-  const uint8_t* ip = executable->getIp(entryIpOffset); // Current instruction-pointer.
+
+  const Instr* ip    = entryIp; // Next instruction to execute.
+  const Instr* instr = nullptr; // Instruction that is currently being executed.
   Value* sh     = stack.getNext(); // Current 'home' for this stack-frame, used to store variables.
   Value* rootSh = sh;
 
-  // Push the entry args on the stack (if any), these are available at the root stack-home.
-  if (entryArgSource && entryArgCount > 0) {
-    SALLOC(entryArgCount);
-    std::memcpy(sh, entryArgSource, sizeof(Value) * entryArgCount);
+  // Move the entry args from the promise onto the stack (if any), these are available at the root
+  // stack-home.
+  if (entryArgCount > 0 &&
+      likely(execHandle.getState(std::memory_order_relaxed) == ExecState::Running)) {
+    stack.alloc(entryArgCount);
+    std::memcpy(sh, promise->getArgsBegin(), sizeof(Value) * entryArgCount);
   }
-
   if (promise) {
-    // Signal that we've started running the promise, this also tells to outside that we are done
-    // with accessing the entry arguments and have properly placed the future on our stack.
-    promise->getStarted().store(true, std::memory_order_release);
+    promise->clearArgs();
+  }
+
+  Value* sp = stack.getNext(); // Next free stack slot, see 'SYNC_STACK'.
+  Value tos = *(sp - 1);       // Value at the top of the stack.
+
+  if (unlikely(execHandle.getState(std::memory_order_relaxed) != ExecState::Running)) {
+    goto End;
   }
 
   // Trap incase the registry is in the process of being paused.
-  if (unlikely(execHandle.trap())) {
+  if (unlikely(TRAP())) {
     goto End;
   }
 
+  JIT_ENTER_FUNCTION();
+
   // Start executing instructions.
-  while (true) {
-    switch (readAsm<OpCode>(&ip)) {
-    case OpCode::LoadLitInt: {
-      PUSH_INT(READ_INT());
-    } break;
-    case OpCode::LoadLitIntSmall: {
-      PUSH_INT(READ_BYTE());
-    } break;
-    case OpCode::LoadLitInt0: {
-      PUSH_INT(0);
-    } break;
-    case OpCode::LoadLitInt1: {
-      PUSH_INT(1);
-    } break;
-    case OpCode::LoadLitLong: {
-      PUSH_LONG(READ_LONG());
-    } break;
-    case OpCode::LoadLitFloat: {
-      PUSH_FLOAT(READ_FLOAT());
-    } break;
-    case OpCode::LoadLitString: {
-      const auto& litStr = executable->getLitString(READ_UINT());
-      PUSH_REF(refAlloc->allocStrLit(litStr.data(), litStr.length()));
-    } break;
-    case OpCode::LoadLitIp: {
-      PUSH_UINT(READ_UINT());
-    } break;
-
-    case OpCode::StackAlloc: {
-      const auto amount = READ_UHALF();
-      assert(amount > 0);
-      SALLOC_CLEAR(amount);
-    } break;
-    case OpCode::StackAllocSmall: {
-      const auto amount = READ_BYTE();
+  DISPATCH_BEGIN()
+    OP(LoadLitInt) {
+      PUSH_INT(instr->intArg);
+    }
+    NEXT();
+    OP(LoadLitLong) {
+      PUSH_LONG(instr->longArg);
+    }
+    NEXT();
+    OP(LoadLitFloat) {
+      PUSH_FLOAT(instr->floatArg);
+    }
+    NEXT();
+    OP(LoadLitString) {
+      PUSH(refValue(program->getLitString(instr->uintArg)));
+    }
+    NEXT();
+    OP(LoadLitIp) {
+      PUSH_UINT(instr->uintArg);
+    }
+    NEXT();
+
+    OP(StackAlloc) {
+      const auto amount = instr->halfArg;
       assert(amount > 0);
       SALLOC_CLEAR(amount);
-    } break;
-    case OpCode::StackStore: {
-      *(sh + READ_UHALF()) = stack.pop();
-    } break;
-    case OpCode::StackStoreSmall: {
-      *(sh + READ_BYTE()) = stack.pop();
-    } break;
-    case OpCode::StackLoad: {
-      PUSH(*(sh + READ_UHALF()));
-    } break;
-    case OpCode::StackLoadSmall: {
-      PUSH(*(sh + READ_BYTE()));
-    } break;
-
-    case OpCode::AddInt: {
+    }
+    NEXT();
+    OP(StackStore) {
+      *(sh + instr->halfArg) = POP();
+      tos                    = *(sp - 1); // The store could have replaced the top of the stack.
+    }
+    NEXT();
+    OP(StackLoad) {
+      PUSH(*(sh + instr->halfArg));
+    }
+    NEXT();
+
+    OP(AddInt) {
       PUSH_INT(POP_INT() + POP_INT());
-    } break;
-    case OpCode::AddLong: {
+    }
+    NEXT();
+    OP(AddLong) {
       const auto val = getULong(POP()) + getULong(POP());
       PUSH_LONG(val);
-    } break;
-    case OpCode::AddFloat: {
+    }
+    NEXT();
+    OP(AddFloat) {
       PUSH_FLOAT(POP_FLOAT() + POP_FLOAT());
-    } break;
-    case OpCode::AddString: {
-      auto* b = getStringRef(refAlloc, POP());
-      CHECK_ALLOC(b);
-
+    }
+    NEXT();
+    OP(AddString) {
       // To optimize building up a string we don't yet create the concatenated string but instead
-      // create a linked list of strings, then only when the string is 'observed' we perform the
-      // actual concatenation.
-      // At the moment this optimization only supports building up the string forwards (so appending
-      // to the end). Support for building up strings backwards is possible but not implemented atm.
+      // create a rope (a tree of links between strings), only when the string is 'observed' do we
+      // walk the rope. Both sides can be ropes so building up strings backwards is supported as
+      // well.
 
+      auto* b = getStringOrLinkRef(POP());
       auto* a = getStringOrLinkRef(POP());
-      if (b->getSize() == 0) {
+      if (getStringSize(b) == 0) {
         // When adding an empty string, its just a no-op.
         // This way we also maintain our invariant that a StringLink is never empty.
         PUSH_REF(a);
+      } else if (getStringSize(a) == 0) {
+        PUSH_REF(b);
       } else {
         PUSH_REF(refAlloc->allocStrLink(a, refValue(b)));
       }
-    } break;
-    case OpCode::AppendChar: {
+    }
+    NEXT();
+    OP(AppendChar) {
       auto b  = POP_INT();
       auto* a = getStringOrLinkRef(POP());
       PUSH_REF(refAlloc->allocStrLink(a, intValue(b)));
-    } break;
-    case OpCode::SubInt: {
+    }
+    NEXT();
+    OP(SubInt) {
       auto b = POP_INT();
       auto a = POP_INT();
       PUSH_INT(a - b);
-    } break;
-    case OpCode::SubLong: {
+    }
+    NEXT();
+    OP(SubLong) {
       auto b = getLong(POP());
       auto a = getLong(POP());
       PUSH_LONG(a - b);
-    } break;
-    case OpCode::SubFloat: {
+    }
+    NEXT();
+    OP(SubFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_FLOAT(a - b);
-    } break;
-    case OpCode::MulInt: {
+    }
+    NEXT();
+    OP(MulInt) {
       auto b = POP_INT();
       auto a = POP_INT();
       PUSH_INT(a * b);
-    } break;
-    case OpCode::MulLong: {
+    }
+    NEXT();
+    OP(MulLong) {
       auto b = getLong(POP());
       auto a = getLong(POP());
       PUSH_LONG(a * b);
-    } break;
-    case OpCode::MulFloat: {
+    }
+    NEXT();
+    OP(MulFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_FLOAT(a * b);
-    } break;
-    case OpCode::DivInt: {
+    }
+    NEXT();
+    OP(DivInt) {
       auto b = POP_INT();
       auto a = POP_INT();
       if (unlikely(b == 0)) {
@@ -437,8 +663,9 @@ auto execute(
         goto End;
       }
       PUSH_INT(a / b);
-    } break;
-    case OpCode::DivLong: {
+    }
+    NEXT();
+    OP(DivLong) {
       auto b = getLong(POP());
       auto a = getLong(POP());
       if (unlikely(b == 0)) {
@@ -446,13 +673,15 @@ auto execute(
         goto End;
       }
       PUSH_LONG(a / b);
-    } break;
-    case OpCode::DivFloat: {
+    }
+    NEXT();
+    OP(DivFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_FLOAT(a / b);
-    } break;
-    case OpCode::RemInt: {
+    }
+    NEXT();
+    OP(RemInt) {
       auto b = POP_INT();
       auto a = POP_INT();
       if (unlikely(b == 0)) {
@@ -460,8 +689,9 @@ auto execute(
         goto End;
       }
       PUSH_INT(a % b);
-    } break;
-    case OpCode::RemLong: {
+    }
+    NEXT();
+    OP(RemLong) {
       auto b = getLong(POP());
       auto a = getLong(POP());
       if (unlikely(b == 0)) {
@@ -469,157 +699,195 @@ auto execute(
         goto End;
       }
       PUSH_LONG(a % b);
-    } break;
-    case OpCode::ModFloat: {
+    }
+    NEXT();
+    OP(ModFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_FLOAT(fmodf(a, b));
-    } break;
-    case OpCode::PowFloat: {
+    }
+    NEXT();
+    OP(PowFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_FLOAT(powf(a, b));
-    } break;
-    case OpCode::SqrtFloat: {
+    }
+    NEXT();
+    OP(SqrtFloat) {
       PUSH_FLOAT(sqrtf(POP_FLOAT()));
-    } break;
-    case OpCode::SinFloat: {
+    }
+    NEXT();
+    OP(SinFloat) {
       PUSH_FLOAT(sinf(POP_FLOAT()));
-    } break;
-    case OpCode::CosFloat: {
+    }
+    NEXT();
+    OP(CosFloat) {
       PUSH_FLOAT(cosf(POP_FLOAT()));
-    } break;
-    case OpCode::TanFloat: {
+    }
+    NEXT();
+    OP(TanFloat) {
       PUSH_FLOAT(tanf(POP_FLOAT()));
-    } break;
-    case OpCode::ASinFloat: {
+    }
+    NEXT();
+    OP(ASinFloat) {
       PUSH_FLOAT(asinf(POP_FLOAT()));
-    } break;
-    case OpCode::ACosFloat: {
+    }
+    NEXT();
+    OP(ACosFloat) {
       PUSH_FLOAT(acosf(POP_FLOAT()));
-    } break;
-    case OpCode::ATanFloat: {
+    }
+    NEXT();
+    OP(ATanFloat) {
       PUSH_FLOAT(atanf(POP_FLOAT()));
-    } break;
-    case OpCode::ATan2Float: {
+    }
+    NEXT();
+    OP(ATan2Float) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_FLOAT(atan2f(a, b));
-    } break;
-    case OpCode::NegInt: {
+    }
+    NEXT();
+    OP(NegInt) {
       PUSH_INT(-POP_INT());
-    } break;
-    case OpCode::NegLong: {
+    }
+    NEXT();
+    OP(NegLong) {
       PUSH_LONG(-getLong(POP()));
-    } break;
-    case OpCode::NegFloat: {
+    }
+    NEXT();
+    OP(NegFloat) {
       PUSH_FLOAT(-POP_FLOAT());
-    } break;
-    case OpCode::ShiftLeftInt: {
+    }
+    NEXT();
+    OP(ShiftLeftInt) {
       auto b = POP_UINT();
       auto a = POP_UINT();
       PUSH_UINT(a << b);
-    } break;
-    case OpCode::ShiftLeftLong: {
+    }
+    NEXT();
+    OP(ShiftLeftLong) {
       auto b = POP_UINT();
       auto a = getULong(POP());
       PUSH_ULONG(a << b);
-    } break;
-    case OpCode::ShiftRightInt: {
+    }
+    NEXT();
+    OP(ShiftRightInt) {
       auto b = POP_UINT();
       auto a = POP_UINT();
       PUSH_UINT(a >> b);
-    } break;
-    case OpCode::ShiftRightLong: {
+    }
+    NEXT();
+    OP(ShiftRightLong) {
       auto b = POP_UINT();
       auto a = getULong(POP());
       PUSH_ULONG(a >> b);
-    } break;
-    case OpCode::AndInt: {
+    }
+    NEXT();
+    OP(AndInt) {
       auto b = POP_UINT();
       auto a = POP_UINT();
       PUSH_UINT(a & b);
-    } break;
-    case OpCode::AndLong: {
+    }
+    NEXT();
+    OP(AndLong) {
       auto b = getULong(POP());
       auto a = getULong(POP());
       PUSH_ULONG(a & b);
-    } break;
-    case OpCode::OrInt: {
+    }
+    NEXT();
+    OP(OrInt) {
       auto b = POP_UINT();
       auto a = POP_UINT();
       PUSH_UINT(a | b);
-    } break;
-    case OpCode::OrLong: {
+    }
+    NEXT();
+    OP(OrLong) {
       auto b = getULong(POP());
       auto a = getULong(POP());
       PUSH_ULONG(a | b);
-    } break;
-    case OpCode::XorInt: {
+    }
+    NEXT();
+    OP(XorInt) {
       auto b = POP_UINT();
       auto a = POP_UINT();
       PUSH_UINT(a ^ b);
-    } break;
-    case OpCode::XorLong: {
+    }
+    NEXT();
+    OP(XorLong) {
       auto b = getULong(POP());
       auto a = getULong(POP());
       PUSH_ULONG(a ^ b);
-    } break;
-    case OpCode::InvInt: {
+    }
+    NEXT();
+    OP(InvInt) {
       PUSH_UINT(~POP_UINT());
-    } break;
-    case OpCode::InvLong: {
+    }
+    NEXT();
+    OP(InvLong) {
       PUSH_ULONG(~getULong(POP()));
-    } break;
-    case OpCode::LengthString: {
-      auto* strRef = getStringRef(refAlloc, POP());
-      CHECK_ALLOC(strRef);
-      PUSH_INT(strRef->getSize());
-    } break;
-    case OpCode::IndexString: {
+    }
+    NEXT();
+    OP(LengthString) {
+      PUSH_INT(getStringSize(getStringOrLinkRef(POP())));
+    }
+    NEXT();
+    OP(IndexString) {
       auto index   = POP_INT();
-      auto* strRef = getStringRef(refAlloc, POP());
+      auto* strRef = getWalkableStringRef(refAlloc, POP());
       CHECK_ALLOC(strRef);
       PUSH_INT(indexString(strRef, index));
-    } break;
-    case OpCode::SliceString: {
+    }
+    NEXT();
+    OP(SliceString) {
       auto end     = POP_INT();
       auto start   = POP_INT();
-      auto* strRef = getStringRef(refAlloc, POP());
+      auto* strRef = getStringOrSliceRef(refAlloc, POP());
       CHECK_ALLOC(strRef);
       PUSH_REF(sliceString(refAlloc, strRef, start, end));
-    } break;
+    }
+    NEXT();
+    OP(HashString) {
+      auto* strRef = getWalkableStringRef(refAlloc, POP());
+      CHECK_ALLOC(strRef);
+      PUSH_INT(static_cast<int32_t>(getStringHash(strRef)));
+    }
+    NEXT();
 
-    case OpCode::CheckEqInt: {
+    OP(CheckEqInt) {
       auto b = POP_INT();
       auto a = POP_INT();
       PUSH_BOOL(a == b);
-    } break;
-    case OpCode::CheckEqLong: {
+    }
+    NEXT();
+    OP(CheckEqLong) {
       auto b = getLong(POP());
       auto a = getLong(POP());
       PUSH_BOOL(a == b);
-    } break;
-    case OpCode::CheckEqFloat: {
+    }
+    NEXT();
+    OP(CheckEqFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_BOOL(a == b);
-    } break;
-    case OpCode::CheckEqString: {
-      auto* bStrRef = getStringRef(refAlloc, POP());
+    }
+    NEXT();
+    OP(CheckEqString) {
+      auto* bStrRef = getWalkableStringRef(refAlloc, POP());
       CHECK_ALLOC(bStrRef);
 
-      auto* aStrRef = getStringRef(refAlloc, POP());
+      auto* aStrRef = getWalkableStringRef(refAlloc, POP());
       CHECK_ALLOC(aStrRef);
 
       PUSH_BOOL(checkStringEq(aStrRef, bStrRef));
-    } break;
-    case OpCode::CheckEqIp: {
+    }
+    NEXT();
+    OP(CheckEqIp) {
       auto b = POP_UINT();
       auto a = POP_UINT();
       PUSH_BOOL(a == b);
-    } break;
-    case OpCode::CheckEqCallDynTgt: {
+    }
+    NEXT();
+    OP(CheckEqCallDynTgt) {
       // Compare the target instruction pointers (which for closure structs are stored in the last
       // field). Note: This does not compare bound arguments in a closure struct, main reason is
       // that we have no type information for those.
@@ -628,118 +896,160 @@ auto execute(
       auto a   = POP();
       auto aIp = (a.isRef() ? getStructRef(a)->getLastField() : a).getUInt();
       PUSH_BOOL(aIp == bIp);
-    } break;
-    case OpCode::CheckGtInt: {
+    }
+    NEXT();
+    OP(CheckGtInt) {
       auto b = POP_INT();
       auto a = POP_INT();
       PUSH_BOOL(a > b);
-    } break;
-    case OpCode::CheckGtLong: {
+    }
+    NEXT();
+    OP(CheckGtLong) {
       auto b = getLong(POP());
       auto a = getLong(POP());
       PUSH_BOOL(a > b);
-    } break;
-    case OpCode::CheckGtFloat: {
+    }
+    NEXT();
+    OP(CheckGtFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_BOOL(a > b);
-    } break;
-    case OpCode::CheckLeInt: {
+    }
+    NEXT();
+    OP(CheckLeInt) {
       auto b = POP_INT();
       auto a = POP_INT();
       PUSH_BOOL(a < b);
-    } break;
-    case OpCode::CheckLeLong: {
+    }
+    NEXT();
+    OP(CheckLeLong) {
       auto b = getLong(POP());
       auto a = getLong(POP());
       PUSH_BOOL(a < b);
-    } break;
-    case OpCode::CheckLeFloat: {
+    }
+    NEXT();
+    OP(CheckLeFloat) {
       auto b = POP_FLOAT();
       auto a = POP_FLOAT();
       PUSH_BOOL(a < b);
-    } break;
-    case OpCode::CheckStructNull: {
+    }
+    NEXT();
+    OP(CheckStructNull) {
       PUSH_BOOL(POP().isNullRef());
-    } break;
-    case OpCode::CheckIntZero: {
+    }
+    NEXT();
+    OP(CheckIntZero) {
       PUSH_BOOL(POP_INT() == 0);
-    } break;
-    case OpCode::CheckStringEmpty: {
+    }
+    NEXT();
+    OP(CheckStringEmpty) {
       PUSH_BOOL(isStringEmpty(POP()));
-    } break;
+    }
+    NEXT();
 
-    case OpCode::ConvIntLong: {
+    OP(ConvIntLong) {
       PUSH_LONG(static_cast<int64_t>(POP_INT()));
-    } break;
-    case OpCode::ConvIntFloat: {
+    }
+    NEXT();
+    OP(ConvIntFloat) {
       PUSH_FLOAT(static_cast<float>(POP_INT()));
-    } break;
-    case OpCode::ConvLongInt: {
+    }
+    NEXT();
+    OP(ConvLongInt) {
       PUSH_INT(static_cast<int32_t>(getLong(POP())));
-    } break;
-    case OpCode::ConvLongFloat: {
+    }
+    NEXT();
+    OP(ConvLongFloat) {
       PUSH_FLOAT(static_cast<float>(getLong(POP())));
-    } break;
-    case OpCode::ConvFloatInt: {
+    }
+    NEXT();
+    OP(ConvFloatInt) {
       PUSH_INT(static_cast<int32_t>(POP_FLOAT()));
-    } break;
-    case OpCode::ConvIntString: {
+    }
+    NEXT();
+    OP(ConvIntString) {
       PUSH_REF(intToString(refAlloc, POP_INT()));
-    } break;
-    case OpCode::ConvLongString: {
+    }
+    NEXT();
+    OP(ConvLongString) {
       PUSH_REF(intToString(refAlloc, getLong(POP())));
-    } break;
-    case OpCode::ConvFloatString: {
+    }
+    NEXT();
+    OP(ConvFloatString) {
       // Flags are stored in the least significant 8 bits.
       // Precision is stored in the 8 bits before (more significant).
       const auto options   = POP_INT();
       const auto flags     = static_cast<FloatToStringFlags>(options);
       const auto precision = static_cast<uint8_t>(options >> 8U);
       PUSH_REF(floatToString(refAlloc, POP_FLOAT(), precision, flags));
-    } break;
-    case OpCode::ConvCharString: {
+    }
+    NEXT();
+    OP(ConvCharString) {
       PUSH_REF(charToString(refAlloc, static_cast<uint8_t>(POP_INT())));
-    } break;
-    case OpCode::ConvIntChar: {
+    }
+    NEXT();
+    OP(ConvIntChar) {
       PUSH_INT(static_cast<uint8_t>(POP_INT()));
-    } break;
-    case OpCode::ConvLongChar: {
+    }
+    NEXT();
+    OP(ConvLongChar) {
       PUSH_INT(static_cast<uint8_t>(getLong(POP())));
-    } break;
-    case OpCode::ConvFloatChar: {
+    }
+    NEXT();
+    OP(ConvFloatChar) {
       PUSH_INT(static_cast<uint8_t>(POP_FLOAT()));
-    } break;
-    case OpCode::ConvFloatLong: {
+    }
+    NEXT();
+    OP(ConvFloatLong) {
       PUSH_LONG(static_cast<int64_t>(POP_FLOAT()));
-    } break;
+    }
+    NEXT();
 
-    case OpCode::MakeAtomic: {
-      PUSH_REF(refAlloc->allocPlain<AtomicRef>(READ_INT()));
-    } break;
-    case OpCode::AtomicLoad: {
+    OP(MakeAtomic) {
+      PUSH_REF(refAlloc->allocPlain<AtomicRef>(instr->intArg));
+    }
+    NEXT();
+    OP(AtomicLoad) {
       const auto* atomic = getAtomic(POP());
       PUSH_INT(atomic->load());
-    } break;
-    case OpCode::AtomicCompareSwap: {
-      const int32_t expected = READ_INT();
-      const int32_t desired  = READ_INT();
+    }
+    NEXT();
+    OP(AtomicCompareSwap) {
+      const int32_t expected = instr->intArg;
+      const int32_t desired  = instr->intArg2;
       auto* atomic           = getAtomic(POP());
       PUSH_INT(atomic->compareAndSwap(expected, desired));
-    } break;
-    case OpCode::AtomicBlock: {
-      const int32_t expected = READ_INT();
-      const auto* atomic     = getAtomic(POP());
-      while (atomic->load() != expected) {
-        if (unlikely(execHandle.trap())) {
-          goto End;
+    }
+    NEXT();
+    OP(AtomicBlock) {
+      const int32_t expected = instr->intArg;
+      // Get the atomic but leave it on the stack, reason is gc could run while we are blocked.
+      auto* atomic = getAtomic(PEEK());
+      if (atomic->load() != expected) {
+        SYNC_STACK();
+        while (true) {
+          const auto current = atomic->beginWait();
+          if (current == expected) {
+            atomic->endWait();
+            break;
+          }
+          execHandle.setParked();
+          atomic->wait(current);
+          execHandle.setState(ExecState::Running);
+
+          // NOTE: When aborted the atomic is not touched anymore as it might already be freed.
+          if (unlikely(TRAP())) {
+            goto End;
+          }
+          atomic->endWait();
         }
-        threadYield();
       }
-    } break;
+      POP(); // Pop the atomic itself from the stack.
+    }
+    NEXT();
 
-    case OpCode::MakeStruct: {
-      const auto fieldCount = READ_BYTE();
+    OP(MakeStruct) {
+      const auto fieldCount = instr->byteArg;
       assert(fieldCount > 0);
 
       auto structRef = refAlloc->allocStruct(fieldCount);
@@ -753,113 +1063,135 @@ auto execute(
         *structRef->getFieldPtr(fieldIndex) = POP();
       }
       PUSH(refValue(structRef));
-    } break;
-    case OpCode::MakeNullStruct: {
+    }
+    NEXT();
+    OP(MakeNullStruct) {
       PUSH(nullRefValue());
-    } break;
-    case OpCode::StructLoadField: {
-      const auto fieldIndex = READ_BYTE();
+    }
+    NEXT();
+    OP(StructLoadField) {
+      const auto fieldIndex = instr->byteArg;
       auto* structure       = getStructRef(POP());
       PUSH(structure->getField(fieldIndex));
-    } break;
-    case OpCode::StructStoreField: {
-      const auto fieldIndex               = READ_BYTE();
+    }
+    NEXT();
+    OP(StructStoreField) {
+      const auto fieldIndex               = instr->byteArg;
       auto val                            = POP();
       auto* structure                     = getStructRef(POP());
       *structure->getFieldPtr(fieldIndex) = val;
-    } break;
+      refAlloc->writeBarrier(structure, val);
+    }
+    NEXT();
+    OP(UnionWrap) {
+      PUSH(unionValue(POP(), instr->byteArg));
+    }
+    NEXT();
+    OP(UnionCheck) {
+      PUSH_BOOL(POP().getUnionDiscriminant() == instr->byteArg);
+    }
+    NEXT();
 
-    case OpCode::Jump: {
-      ip = executable->getIp(READ_UINT());
-    } break;
-    case OpCode::JumpIf: {
-      auto ipOffset = READ_UINT();
+    OP(Jump) {
+      ip = instr->target;
+    }
+    NEXT();
+    OP(JumpIf) {
       if (POP_INT() != 0) {
-        ip = executable->getIp(ipOffset);
+        ip = instr->target;
       }
-    } break;
-
-    case OpCode::Call: {
-      const auto argCount    = READ_BYTE();
-      const auto tgtIpOffset = READ_UINT();
-      CALL(argCount, tgtIpOffset);
-    } break;
-    case OpCode::CallTail: {
+    }
+    NEXT();
+
+    OP(Call) {
+      // NOTE: The maximum stack size of the target is stored in 'intArg' by the verifier.
+      CALL(instr->byteArg, instr->target, static_cast<uint32_t>(instr->intArg));
+    }
+    NEXT();
+    OP(CallTail) {
       // Place a trap here as with tail-calls is possible to have code that runs for a long time
       // without ever hitting a 'ret' instruction.
-      if (unlikely(execHandle.trap())) {
+      if (unlikely(TRAP())) {
         goto End;
       }
 
-      const auto argCount    = READ_BYTE();
-      const auto tgtIpOffset = READ_UINT();
-      CALL_TAIL(argCount, tgtIpOffset);
-    } break;
-    case OpCode::CallForked: {
-      const auto argCount    = READ_BYTE();
-      const auto tgtIpOffset = READ_UINT();
-      CALL_FORKED(argCount, tgtIpOffset);
-    } break;
-    case OpCode::CallDyn: {
-      const auto argCount = READ_BYTE();
+      CALL_TAIL(instr->byteArg, instr->target, static_cast<uint32_t>(instr->intArg));
+    }
+    NEXT();
+    OP(CallForked) {
+      CALL_FORKED(instr->byteArg, instr->target);
+    }
+    NEXT();
+    OP(CallDyn) {
+      const auto argCount = instr->byteArg;
       auto tgt            = POP();
       if (tgt.isRef()) { // Target is a closure containing bound args and a instruction pointer.
         uint8_t boundArgCount;
-        uint32_t tgtIpOffset;
-        PUSH_CLOSURE(tgt, &boundArgCount, &tgtIpOffset);
-        CALL(argCount + boundArgCount, tgtIpOffset);
+        uint32_t tgtIpIndex;
+        PUSH_CLOSURE(tgt, &boundArgCount, &tgtIpIndex);
+        DYN_CALL_FRAME(frame, tgtIpIndex, argCount + boundArgCount);
+        CALL(argCount + boundArgCount, program->getInstr(tgtIpIndex), frame->maxStack);
       } else { // Target is a instruction pointer only.
-        CALL(argCount, tgt.getUInt());
+        DYN_CALL_FRAME(frame, tgt.getUInt(), argCount);
+        CALL(argCount, program->getInstr(tgt.getUInt()), frame->maxStack);
       }
-    } break;
-    case OpCode::CallDynTail: {
+    }
+    NEXT();
+    OP(CallDynTail) {
       // Place a trap here as with tail-calls is possible to have code that runs for a long time
       // without ever hitting a 'ret' instruction.
-      if (unlikely(execHandle.trap())) {
+      if (unlikely(TRAP())) {
         goto End;
       }
 
-      const auto argCount = READ_BYTE();
+      const auto argCount = instr->byteArg;
       auto tgt            = POP();
       if (tgt.isRef()) { // Target is a closure containing bound args and a instruction pointer.
         uint8_t boundArgCount;
-        uint32_t tgtIpOffset;
-        PUSH_CLOSURE(tgt, &boundArgCount, &tgtIpOffset);
-        CALL_TAIL(argCount + boundArgCount, tgtIpOffset);
+        uint32_t tgtIpIndex;
+        PUSH_CLOSURE(tgt, &boundArgCount, &tgtIpIndex);
+        DYN_CALL_FRAME(frame, tgtIpIndex, argCount + boundArgCount);
+        CALL_TAIL(argCount + boundArgCount, program->getInstr(tgtIpIndex), frame->maxStack);
       } else { // Target is a instruction pointer only.
-        CALL_TAIL(argCount, tgt.getUInt());
+        DYN_CALL_FRAME(frame, tgt.getUInt(), argCount);
+        CALL_TAIL(argCount, program->getInstr(tgt.getUInt()), frame->maxStack);
       }
-    } break;
-    case OpCode::CallDynForked: {
-      const auto argCount = READ_BYTE();
+    }
+    NEXT();
+    OP(CallDynForked) {
+      const auto argCount = instr->byteArg;
       auto tgt            = POP();
       if (tgt.isRef()) { // Target is a closure containing bound args and a instruction pointer.
         uint8_t boundArgCount;
-        uint32_t tgtIpOffset;
-        PUSH_CLOSURE(tgt, &boundArgCount, &tgtIpOffset);
-        CALL_FORKED(argCount + boundArgCount, tgtIpOffset);
+        uint32_t tgtIpIndex;
+        PUSH_CLOSURE(tgt, &boundArgCount, &tgtIpIndex);
+        DYN_CALL_FRAME(frame, tgtIpIndex, argCount + boundArgCount);
+        CALL_FORKED(argCount + boundArgCount, program->getInstr(tgtIpIndex));
       } else { // Target is a instruction pointer only.
-        CALL_FORKED(argCount, tgt.getUInt());
+        DYN_CALL_FRAME(frame, tgt.getUInt(), argCount);
+        CALL_FORKED(argCount, program->getInstr(tgt.getUInt()));
       }
-    } break;
-    case OpCode::PCall: {
-      pcall(
+    }
+    NEXT();
+    OP(PCall) {
+      REBASE_STACK(pcall(
           settings,
-          executable,
+          program->getExecutable(),
           iface,
           refAlloc,
           gc,
           &stack,
           &execHandle,
           &pErr,
-          readAsm<PCallCode>(&ip));
+          instr->pcallArg));
       if (unlikely(execHandle.getState(std::memory_order_relaxed) != ExecState::Running)) {
         assert(execHandle.getState(std::memory_order_relaxed) != ExecState::Success);
         goto End;
       }
-    } break;
-    case OpCode::Ret: {
-      if (unlikely(execHandle.trap())) {
+    }
+    NEXT();
+    OP(Ret) {
+      if (unlikely(TRAP())) {
         goto End;
       }
 
@@ -868,53 +1200,65 @@ auto execute(
         execHandle.setState(ExecState::Success);
         goto End;
       }
-      assert(stack.getSize() >= 3); // Should at least contain a return ip and sh and ret value.
+      // Should at least contain a return ip and sh and ret value.
+      assert(sp - stack.getBottom() >= 3);
 
-      auto retVal = POP();
+      auto retVal = tos;
 
       // Rewind this entire stack-frame (+ 2 for the stack-frame meta-data).
-      stack.rewindToNext(sh - 2);
+      sp = sh - 2;
 
       // Note this assumes that the rewinding does not actually invalidate the memory (which it
       // doesn't).
-      ip = executable->getIp((sh - 2)->getUInt());
+      ip = (sh - 2)->getRawPtr<const Instr>();
       sh = (sh - 1)->getRawPtr<Value>();
 
       // Place the return-value on the stack.
       PUSH(retVal);
-    } break;
+      JIT_ENTER_RETURN();
+    }
+    NEXT();
 
-    case OpCode::FutureWaitNano: {
+    OP(FutureWaitNano) {
       const int64_t timeout = getLong(POP());
       if (timeout <= 0) {
-        auto* future = getFutureRef(POP());
-        PUSH_BOOL(future->poll() != ExecState::Running);
-        break;
+        auto* future     = getFutureRef(POP());
+        const auto ready = future->poll() != ExecState::Running;
+        PUSH_BOOL(ready);
+        if (!ready) {
+          // Let other executors run first, otherwise polling in a loop could starve the executor
+          // that we are waiting for (executors are not preempted).
+          schedulerYield();
+        }
+        NEXT();
       }
 
       // Get the future but leave it on the stack, reason is gc could run while we are blocked.
       auto* future = getFutureRef(PEEK());
 
+      SYNC_STACK();
       execHandle.setState(ExecState::Paused);
       auto success = future->waitNano(timeout);
       execHandle.setState(ExecState::Running);
 
-      if (unlikely(execHandle.trap())) {
+      if (unlikely(TRAP())) {
         goto End;
       }
 
       POP(); // Pop the future itself from the stack.
       PUSH_BOOL(success);
-    } break;
-    case OpCode::FutureBlock: {
+    }
+    NEXT();
+    OP(FutureBlock) {
       // Get the future but leave it on the stack, reason is gc could run while we are blocked.
       auto* future = getFutureRef(PEEK());
 
-      execHandle.setState(ExecState::Paused);
+      SYNC_STACK();
+      execHandle.setParked();
       auto futureState = future->block();
       execHandle.setState(ExecState::Running);
 
-      if (unlikely(execHandle.trap())) {
+      if (unlikely(TRAP())) {
         goto End;
       }
 
@@ -927,29 +1271,106 @@ auto execute(
         execHandle.setState(futureState);
         goto End;
       }
-    } break;
-    case OpCode::Dup:
+    }
+    NEXT();
+    OP(Dup) {
       PUSH(PEEK());
-      break;
-    case OpCode::Pop:
+    }
+    NEXT();
+    OP(Pop) {
       POP();
-      break;
-    case OpCode::Swap: {
-      auto* a  = stack.getTop();
-      auto* b  = a - 1;
-      auto tmp = *a; // Old a.
-      *a       = *b;
-      *b       = tmp;
-    } break;
-
-    case OpCode::Fail:
-    default:
+    }
+    NEXT();
+    OP(Swap) {
+      auto* b   = sp - 2;
+      *(sp - 1) = *b;
+      *b        = tos; // Old a.
+      tos       = *(sp - 1);
+    }
+    NEXT();
+
+    // Superinstructions, see 'fuseInstr' in program.cpp.
+    OP(StackLoadField) {
+      PUSH(getStructRef(*(sh + instr->halfArg))->getField(instr->byteArg));
+    }
+    NEXT();
+    OP(StackLoadLoad) {
+      PUSH(*(sh + instr->halfArg));
+      PUSH(*(sh + instr->intArg));
+    }
+    NEXT();
+    OP(StackStoreLoad) {
+      // Replace the top of the stack instead of popping and pushing.
+      *(sh + instr->halfArg) = tos;
+      tos                    = *(sh + instr->intArg);
+      *(sp - 1)              = tos;
+    }
+    NEXT();
+    OP(DupStructLoadField) {
+      PUSH(getStructRef(PEEK())->getField(instr->byteArg));
+    }
+    NEXT();
+    OP(AddIntLit) {
+      PUSH_INT(POP_INT() + instr->intArg);
+    }
+    NEXT();
+    OP(SubIntLit) {
+      PUSH_INT(POP_INT() - instr->intArg);
+    }
+    NEXT();
+    OP(CheckEqIntLit) {
+      PUSH_BOOL(POP_INT() == instr->intArg);
+    }
+    NEXT();
+    OP(JumpIfZero) {
+      if (POP_INT() == 0) {
+        ip = instr->target;
+      }
+    }
+    NEXT();
+    OP(JumpIfEqInt) {
+      auto b = POP_INT();
+      auto a = POP_INT();
+      if (a == b) {
+        ip = instr->target;
+      }
+    }
+    NEXT();
+    OP(JumpIfGtInt) {
+      auto b = POP_INT();
+      auto a = POP_INT();
+      if (a > b) {
+        ip = instr->target;
+      }
+    }
+    NEXT();
+    OP(JumpIfLeInt) {
+      auto b = POP_INT();
+      auto a = POP_INT();
+      if (a < b) {
+        ip = instr->target;
+      }
+    }
+    NEXT();
+    OP(JumpIfEqIntLit) {
+      if (POP_INT() == instr->intArg) {
+        ip = instr->target;
+      }
+    }
+    NEXT();
+
+    OP(Fail)
+    OP_INVALID {
       execHandle.setState(ExecState::Failed);
       goto End;
     }
-  }
+  DISPATCH_END()
 
 End:
+  // Make the stack observable again, the garbage collector can scan the stack until the executor is
+  // unregistered.
+  SYNC_STACK();
+
   // If we are backing a promise then fill-in the results and notify all waiters.
   const auto endState = execHandle.getState(std::memory_order_relaxed);
 
@@ -961,21 +1382,24 @@ End:
 
   if (promise) {
     if (endState == ExecState::Success) {
-      promise->setResult(POP());
+      const auto result = POP();
+      promise->setResult(result);
+      refAlloc->writeBarrier(promise, result);
     }
     promise->setState(endState);
   }
+  // Release the thread-cache while still registered, this way it cannot race with a sweep (which
+  // only runs while all registered executors are paused).
+  refAlloc->releaseThreadCache();
   execRegistry->unregisterExecutor(&execHandle);
   return endState;
 
 #undef CHECK_ALLOC
-#undef READ_UHALF
-#undef READ_BYTE
-#undef READ_INT
-#undef READ_UINT
-#undef READ_LONG
-#undef READ_FLOAT
-#undef SALLOC
+#undef SYNC_STACK
+#undef LOAD_STACK
+#undef TRAP
+#undef RESERVE
+#undef REBASE_STACK
 #undef SALLOC_CLEAR
 #undef PUSH
 #undef PUSH_UINT
@@ -994,6 +1418,15 @@ End:
 #undef CALL
 #undef CALL_TAIL
 #undef CALL_FORKED
+#undef JIT_ENTER
+#undef JIT_ENTER_FUNCTION
+#undef JIT_ENTER_RETURN
+#undef DYN_CALL_FRAME
+#undef DISPATCH_BEGIN
+#undef DISPATCH_END
+#undef OP
+#undef OP_INVALID
+#undef NEXT
 }
 
 } // namespace vm::internal
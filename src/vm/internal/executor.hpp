@@ -1,8 +1,9 @@
 #pragma once
 #include "internal/executor_registry.hpp"
+#include "internal/program.hpp"
 #include "internal/ref_allocator.hpp"
+#include "internal/scheduler.hpp"
 #include "internal/settings.hpp"
-#include "novasm/executable.hpp"
 #include "vm/exec_state.hpp"
 #include "vm/platform_interface.hpp"
 
@@ -10,21 +11,27 @@ namespace vm::internal {
 
 class FutureRef;
 class GarbageCollector;
+class Jit;
 
-// Execute a specific entrypoint in the executable until completion.
+// Execute a specific entrypoint in the program until completion.
 //
-// 'entryArgCount', 'entryArgSource', 'promise' are used for sub-executers (forked calls) that take
-// arguments from a parent executor and place their result in the 'promise' object.
+// 'promise' is used for sub-executers (forked calls), it holds the arguments passed by the parent
+// executor and receives the result.
+//
+// 'scheduler' runs the forked calls as tasks on its workers.
+//
+// 'jit' is optional (nullptr when the jit is disabled), when provided hot functions are executed
+// as native code.
 auto execute(
     const Settings* settings,
-    const novasm::Executable* executable,
+    Program* program,
     PlatformInterface* iface,
     ExecutorRegistry* execRegistry,
+    Scheduler* scheduler,
     RefAllocator* refAlloc,
     GarbageCollector* gc,
-    uint32_t entryIpOffset,
-    uint8_t entryArgCount,
-    Value* entryArgSource,
+    Jit* jit,
+    const Instr* entryIp,
     FutureRef* promise) noexcept -> ExecState;
 
 } // namespace vm::internal
@@ -0,0 +1,49 @@
+#include "internal/executor_handle.hpp"
+#include "internal/futex.hpp"
+
+namespace vm::internal {
+
+auto ExecutorHandle::trapSlow() noexcept -> bool {
+TrapBegin:
+
+  auto req = m_request.load(std::memory_order_acquire);
+  switch (req) {
+  case RequestType::Abort:
+  Abort:
+    m_state.store(ExecState::Aborted, std::memory_order_release);
+    return true;
+  case RequestType::Pause:
+    m_state.store(ExecState::Paused, std::memory_order_release);
+
+    // Park the thread until the registry is resumed (which changes the resume epoch). The epoch is
+    // loaded before the request, this way a resume in between is either observed through the
+    // request or makes the futex wait return immediately.
+    // NOTE: After waking the request is checked first, when aborted the registry is not touched
+    // anymore as it might already be destroyed.
+    assert(m_resumeEpoch);
+    do {
+      const auto epoch = m_resumeEpoch->load(std::memory_order_acquire);
+      if (req = m_request.load(std::memory_order_acquire), req != RequestType::Pause) {
+        break;
+      }
+      futexWait(m_resumeEpoch, epoch);
+    } while (req = m_request.load(std::memory_order_acquire), req == RequestType::Pause);
+
+    if (unlikely(req == RequestType::Abort)) {
+      goto Abort;
+    }
+
+    // Store running (ordered before the next request load) and restart the trap check. This is
+    // important because we could be re-paused in between us checking.
+    setState(ExecState::Running);
+    goto TrapBegin;
+  case RequestType::None:
+    return false;
+  }
+
+  // Unreachable as long as valid request types are used.
+  assert(false);
+  return false;
+}
+
+} // namespace vm::internal
@@ -1,19 +1,22 @@
 #pragma once
 #include "internal/intrinsics.hpp"
+#include "internal/scheduler.hpp"
 #include "internal/stack.hpp"
 #include "internal/thread.hpp"
 #include "vm/exec_state.hpp"
 #include <atomic>
+#include <cstdint>
 
 namespace vm::internal {
 
 class ExecutorRegistry;
 
 // Handle to an executor, an executor is a single thread that is executing novus assembly.
-// Each executor has its own virtual stack (that is stored on the hardware stack) and a simple
+// Each executor has its own growable virtual stack (see stack.hpp) and a simple
 // api to interact with the executor (to request it to pause for example).
 //
-// Executors have a 'prev' and a 'next' to form a doubly linked list of executors.
+// Executors have a 'prev' and a 'next' to form a doubly linked list of executors (one list per
+// shard of the registry, see executor_registry.hpp).
 //
 class ExecutorHandle final {
   friend ExecutorRegistry;
@@ -23,6 +26,8 @@ public:
       m_stack{stack},
       m_state{ExecState::Running},
       m_request{RequestType::None},
+      m_shard{0U},
+      m_resumeEpoch{nullptr},
       m_prev{nullptr},
       m_next{nullptr} {}
   ExecutorHandle(const ExecutorHandle& rhs) = delete;
@@ -33,61 +38,61 @@ public:
   auto operator=(ExecutorHandle&& rhs) -> ExecutorHandle& = delete;
 
   [[nodiscard]] inline auto getStack() noexcept -> BasicStack* { return m_stack; }
-  [[nodiscard]] inline auto getNext() noexcept -> ExecutorHandle* { return m_next; }
 
   [[nodiscard]] inline auto
   getState(std::memory_order memOrder = std::memory_order_acquire) noexcept -> ExecState {
     return m_state.load(memOrder);
   }
 
+  // NOTE: Executors that leave a blocking call (during which they were 'Paused') have to 'trap'
+  // after setting the state back to 'Running' as a pause could have been requested meanwhile.
+  // NOTE: Forked executors hand off their scheduler worker while 'Paused' (see scheduler.hpp), so
+  // other executors can run during the blocking call, and wait for a worker when resuming.
   inline auto setState(ExecState state) noexcept -> void {
+    if (state == ExecState::Running) {
+      schedulerLeaveBlocking();
+    }
     m_state.store(state, std::memory_order_release);
+    if (state == ExecState::Running) {
+      // Order the store before the request load in 'trap', pairs with the fence in
+      // 'ExecutorRegistry::pauseExecutors'. Either the registry observes that we are running (and
+      // waits for us to trap) or we observe the pause request.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    } else if (state == ExecState::Paused) {
+      schedulerEnterBlocking();
+    }
+  }
+
+  // Pause the executor for a wait that parks it (see 'schedulerPark') instead of blocking its
+  // thread, unlike 'setState(Paused)' the worker is not handed off as it runs other executors while
+  // this one is parked. Resume with 'setState(Running)'.
+  inline auto setParked() noexcept -> void {
+    m_state.store(ExecState::Paused, std::memory_order_release);
   }
 
   // Called by the executor at safe-points in the execution, safe meaning that all data is written
   // back to the stack and the current state is safe to be observed.
   //
   // If no pause request has been placed than trap returns immediately, if pause was requested then
-  // trap blocks until its un-paused again.
+  // trap parks the thread until its un-paused again.
+  //
+  // NOTE: This is executed on every return and tail-call so the common case (no request) is kept
+  // to a single relaxed load and a branch, handling of the requests lives out of line. Relaxed is
+  // sufficient as observing 'None' needs no synchronization, 'trapSlow' reloads with acquire order.
   //
   [[nodiscard]] inline auto trap() noexcept -> bool {
-  TrapBegin:
-
-    auto req = m_request.load(std::memory_order_acquire);
-    switch (req) {
-    case RequestType::Abort:
-    Abort:
-      m_state.store(ExecState::Aborted, std::memory_order_release);
-      return true;
-    case RequestType::Pause:
-      m_state.store(ExecState::Paused, std::memory_order_release);
-
-      // TODO(bastian): Might be worth experimenting with different pausing mechanisms. Basically
-      // the longer we pause the slower we are at reacting to a 'resume' but the shorter we pause
-      // the more cpu cycles we waste.
-      //
-      // Current strategy is we do a single longer pause (thread yield) and after returning from
-      // that we do short cpu pauses until we are resumed. This works well if the pause request is
-      // very short, but if its longer it starts to be wastefull.
-      threadYield();
-      while (req = m_request.load(std::memory_order_acquire), req == RequestType::Pause) {
-        threadPause();
-      }
-      if (unlikely(req == RequestType::Abort)) {
-        goto Abort;
-      }
-
-      // Store running with sequential-consistency order and restart the trap check. This is
-      // important because we could be re-paused in between us checking.
-      m_state.store(ExecState::Running, std::memory_order_seq_cst);
-      goto TrapBegin;
-    case RequestType::None:
+    if (likely(m_request.load(std::memory_order_relaxed) == RequestType::None)) {
       return false;
     }
+    return trapSlow();
+  }
 
-    // Unreachable as long as valid request types are used.
-    assert(false);
-    return false;
+  // Address of the request flag, the flag is zero when there is no pending request. Allows
+  // generated code (see jit.hpp) to check if it has to return to a safe-point without calling
+  // 'trap'.
+  [[nodiscard]] inline auto getRequestFlag() const noexcept -> const void* {
+    static_assert(sizeof(m_request) == sizeof(int) && static_cast<int>(RequestType::None) == 0);
+    return &m_request;
   }
 
   // Request the executor to abort.
@@ -99,14 +104,20 @@ public:
     m_request.store(RequestType::Abort, std::memory_order_release);
   }
 
-  // Request the executor to pause. Returns immediately with a boolean indicating if the executor
-  // has paused yet. Common pattern is to keep calling this function until true is returned.
-  inline auto requestPause() noexcept -> bool {
+  // Request the executor to pause, returns immediately. Use 'isPaused' to check if the executor
+  // has paused yet.
+  inline auto requestPause() noexcept -> void {
     // Set request to 'Pause' in case its currently 'None', reason is we want to leave it alone when
     // its currently set to 'Abort' to avoid resurrecting aborted executors.
     auto expectedReq = RequestType::None;
     m_request.compare_exchange_strong(
         expectedReq, RequestType::Pause, std::memory_order_acq_rel, std::memory_order_relaxed);
+  }
+
+  // Has the executor paused, either because it trapped or because its inside a blocking call.
+  // NOTE: Once a paused executor is observed (after requesting the pause) it stays paused until
+  // resumed, executors that leave a blocking call will trap before touching any shared memory.
+  [[nodiscard]] inline auto isPaused() noexcept -> bool {
     return m_state.load(std::memory_order_acquire) == ExecState::Paused;
   }
 
@@ -119,6 +130,8 @@ public:
 
     // Double check that we did not try to resume a non-paused executor.
     assert(expectedReq != RequestType::None);
+
+    // NOTE: Parked executors are woken by the registry, see 'ExecutorRegistry::resumeExecutors'.
   }
 
 private:
@@ -132,8 +145,15 @@ private:
   std::atomic<ExecState> m_state;
   std::atomic<RequestType> m_request;
 
+  // Set by the registry when registering, paused executors park on the resume epoch.
+  unsigned int m_shard;
+  std::atomic<uint32_t>* m_resumeEpoch;
+
   ExecutorHandle* m_prev;
   ExecutorHandle* m_next;
+
+  // Handle a pending pause or abort request, returns true if the executor was aborted.
+  NO_INLINE auto trapSlow() noexcept -> bool;
 };
 
 } // namespace vm::internal
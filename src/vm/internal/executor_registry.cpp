@@ -1,40 +1,74 @@
 #include "internal/executor_registry.hpp"
+#include "internal/futex.hpp"
+#include "internal/ref_future.hpp"
 #include "internal/thread.hpp"
 
 namespace vm::internal {
 
-ExecutorRegistry::ExecutorRegistry() noexcept : m_head{nullptr}, m_state{RegistryState::Running} {};
+ExecutorRegistry::ExecutorRegistry() noexcept :
+    m_shards{}, m_state{RegistryState::Running}, m_resumeEpoch{0U} {};
 
-auto ExecutorRegistry::registerExecutor(ExecutorHandle* handle) noexcept -> void {
-  assert(m_state.load(std::memory_order_acquire) == RegistryState::Running);
+auto ExecutorRegistry::registerExecutor(ExecutorHandle* handle, FutureRef* promise) noexcept
+    -> bool {
   assert(handle->m_prev == nullptr);
   assert(handle->m_next == nullptr);
 
-  auto lk = std::lock_guard<std::mutex>{m_mutex};
-
-  // Double check that its still running after aquiring the lock.
-  assert(m_state.load(std::memory_order_acquire) == RegistryState::Running);
+  // Forked executors use the shard of their promise, this way the pending fork can be replaced by
+  // the executor under a single lock.
+  handle->m_shard       = getShardIndex(promise ? static_cast<void*>(promise) : handle);
+  handle->m_resumeEpoch = &m_resumeEpoch;
+  auto& shard           = m_shards[handle->m_shard];
 
-  if (m_head) {
-    m_head->m_prev = handle;
-    handle->m_next = m_head;
+  while (true) {
+    // Load the epoch before checking the state, a resume in between makes the wait return.
+    const auto epoch = m_resumeEpoch.load(std::memory_order_acquire);
+    {
+      auto lk = std::lock_guard<std::mutex>{shard.mutex};
+
+      switch (m_state.load(std::memory_order_acquire)) {
+      case RegistryState::Running:
+        if (shard.head) {
+          shard.head->m_prev = handle;
+          handle->m_next     = shard.head;
+        }
+        shard.head = handle;
+
+        // Now that the executor is registered its stack (which contains the promise) keeps the
+        // promise alive.
+        if (promise) {
+          unlinkPendingFork(shard, promise);
+        }
+        return true;
+      case RegistryState::Pausing:
+      case RegistryState::Paused:
+        // Registering now would delay the pause or race with the garbage collector inspecting the
+        // executors, wait until the executors are resumed.
+        break;
+      case RegistryState::Aborted:
+        if (promise) {
+          unlinkPendingFork(shard, promise);
+        }
+        return false;
+      }
+    }
+    futexWait(&m_resumeEpoch, epoch);
   }
-  m_head = handle;
 }
 
 auto ExecutorRegistry::unregisterExecutor(ExecutorHandle* handle) noexcept -> void {
-  assert(m_state.load(std::memory_order_acquire) == RegistryState::Running);
+  auto& shard = m_shards[handle->m_shard];
+  auto lk     = std::lock_guard<std::mutex>{shard.mutex};
 
-  auto lk = std::lock_guard<std::mutex>{m_mutex};
-
-  // Double check that its still running after aquiring the lock.
-  assert(m_state.load(std::memory_order_acquire) == RegistryState::Running);
+  // Running executors can observe a pause being requested but not a paused registry.
+  assert(
+      m_state.load(std::memory_order_acquire) == RegistryState::Running ||
+      m_state.load(std::memory_order_acquire) == RegistryState::Pausing);
 
-  assert(m_head);
-  assert(handle == m_head || handle->m_prev);
+  assert(shard.head);
+  assert(handle == shard.head || handle->m_prev);
 
-  if (handle == m_head) {
-    m_head = handle->m_next;
+  if (handle == shard.head) {
+    shard.head = handle->m_next;
   } else {
     handle->m_prev->m_next = handle->m_next;
   }
@@ -43,6 +77,47 @@ auto ExecutorRegistry::unregisterExecutor(ExecutorHandle* handle) noexcept -> vo
   }
 }
 
+auto ExecutorRegistry::addPendingFork(FutureRef* future) noexcept -> void {
+  assert(future->m_pendingPrev == nullptr);
+  assert(future->m_pendingNext == nullptr);
+
+  auto& shard = m_shards[getShardIndex(future)];
+  auto lk     = std::lock_guard<std::mutex>{shard.mutex};
+
+  // Running executors can observe a pause being requested but not a paused registry.
+  assert(
+      m_state.load(std::memory_order_acquire) == RegistryState::Running ||
+      m_state.load(std::memory_order_acquire) == RegistryState::Pausing);
+
+  if (shard.pendingHead) {
+    shard.pendingHead->m_pendingPrev = future;
+    future->m_pendingNext            = shard.pendingHead;
+  }
+  shard.pendingHead = future;
+}
+
+auto ExecutorRegistry::removePendingFork(FutureRef* future) noexcept -> void {
+  auto& shard = m_shards[getShardIndex(future)];
+  auto lk     = std::lock_guard<std::mutex>{shard.mutex};
+  unlinkPendingFork(shard, future);
+}
+
+auto ExecutorRegistry::unlinkPendingFork(Shard& shard, FutureRef* future) noexcept -> void {
+  assert(shard.pendingHead);
+  assert(future == shard.pendingHead || future->m_pendingPrev);
+
+  if (future == shard.pendingHead) {
+    shard.pendingHead = future->m_pendingNext;
+  } else {
+    future->m_pendingPrev->m_pendingNext = future->m_pendingNext;
+  }
+  if (future->m_pendingNext) {
+    future->m_pendingNext->m_pendingPrev = future->m_pendingPrev;
+  }
+  future->m_pendingPrev = nullptr;
+  future->m_pendingNext = nullptr;
+}
+
 auto ExecutorRegistry::abortExecutors() noexcept -> void {
 
   assert(m_state.load(std::memory_order_acquire) == RegistryState::Running);
@@ -53,40 +128,93 @@ auto ExecutorRegistry::abortExecutors() noexcept -> void {
 
   assert(m_state.load(std::memory_order_acquire) == RegistryState::Paused);
 
-  // Then request all executors to abort.
+  // Then abort all executors.
   // NOTE: After aborting executors its unsafe to access any memory memory belonging to that
   // executor (including the handle).
   // NOTE: Aborted executors will not unregister themselves.
-  {
-    auto lk    = std::lock_guard<std::mutex>{m_mutex};
-    auto* exec = m_head;
+  for (auto& shard : m_shards) {
+    auto lk    = std::lock_guard<std::mutex>{shard.mutex};
+    auto* exec = shard.head;
     while (exec) {
+      auto* next = exec->m_next;
       exec->requestAbort();
-      exec = exec->m_next;
+      exec = next;
     }
-    m_head = nullptr;
+    shard.head = nullptr;
   }
   m_state.store(RegistryState::Aborted, std::memory_order_release);
+
+  // Wake the parked executors (so they can observe the abort) and the executors that are waiting to
+  // register.
+  wakeResumeWaiters();
+
+  // Wait for the pending forks to observe the abort, after that no executor will access the
+  // registry anymore.
+  for (auto& shard : m_shards) {
+    while (true) {
+      {
+        auto lk = std::lock_guard<std::mutex>{shard.mutex};
+        if (!shard.pendingHead) {
+          break;
+        }
+      }
+      threadYield();
+    }
+  }
 }
 
 auto ExecutorRegistry::pauseExecutors() noexcept -> void {
   assert(m_state.load(std::memory_order_acquire) == RegistryState::Running);
 
-  /* Keep looping over all executors and requesting pause until all of them have paused. */
-  while (true) {
-    {
-      bool done  = true;
-      auto lk    = std::lock_guard<std::mutex>{m_mutex};
-      auto* exec = m_head;
-      while (exec) {
-        done &= exec->requestPause();
-        exec = exec->m_next;
+  // Stop new executors from registering until the executors are resumed again.
+  // NOTE: Registering checks the state while holding the lock of its shard, so after the shard has
+  // been locked below all executors that registered in it are visible.
+  m_state.store(RegistryState::Pausing, std::memory_order_seq_cst);
+
+  // Request all executors to pause, this way they all head for a safe-point at the same time.
+  // NOTE: Paused executors cannot unregister, so the last executor (of the leading run of paused
+  // executors) that was observed as paused is used to continue the scan when waiting below. This
+  // way executors that are already paused (for example because they are inside a blocking call)
+  // are visited only once.
+  ExecutorHandle* lastPaused[executorRegistryShardCount] = {};
+  for (auto i = 0U; i != executorRegistryShardCount; ++i) {
+    auto& shard    = m_shards[i];
+    auto lk        = std::lock_guard<std::mutex>{shard.mutex};
+    auto allPaused = true;
+    for (auto* exec = shard.head; exec; exec = exec->m_next) {
+      exec->requestPause();
+
+      // Order the request before the state load, pairs with the fence in
+      // 'ExecutorHandle::setState'. Executors that leave a blocking call after we observe them as
+      // paused are guaranteed to observe the request.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      allPaused &= exec->isPaused();
+      if (allPaused) {
+        lastPaused[i] = exec;
       }
-      if (done) {
-        break;
+    }
+  }
+
+  // Wait for the remaining executors to acknowledge the pause.
+  // NOTE: Waiting is done without holding the lock, as executors that have not paused yet might
+  // need it to unregister.
+  for (auto i = 0U; i != executorRegistryShardCount; ++i) {
+    auto& shard = m_shards[i];
+    while (true) {
+      {
+        auto lk    = std::lock_guard<std::mutex>{shard.mutex};
+        auto* exec = lastPaused[i] ? lastPaused[i]->m_next : shard.head;
+        while (exec && exec->isPaused()) {
+          lastPaused[i] = exec;
+          exec          = exec->m_next;
+        }
+        if (!exec) {
+          break;
+        }
       }
+      threadYield();
     }
-    threadYield();
   }
 
   m_state.store(RegistryState::Paused, std::memory_order_release);
@@ -98,12 +226,28 @@ auto ExecutorRegistry::resumeExecutors() noexcept -> void {
   m_state.store(RegistryState::Running, std::memory_order_release);
 
   /* Unset the pause flag on all executors. */
-  auto lk    = std::lock_guard<std::mutex>{m_mutex};
-  auto* exec = m_head;
-  while (exec) {
-    exec->resume();
-    exec = exec->m_next;
+  for (auto& shard : m_shards) {
+    auto lk = std::lock_guard<std::mutex>{shard.mutex};
+    for (auto* exec = shard.head; exec; exec = exec->m_next) {
+      exec->resume();
+    }
   }
+
+  // Wake the parked executors and the executors that are waiting to register.
+  wakeResumeWaiters();
+}
+
+auto ExecutorRegistry::getShardIndex(const void* ptr) noexcept -> unsigned int {
+  // Handles live on the stacks of the executor threads and futures in the heap, both are aligned
+  // similarly so the address is mixed (fibonacci hashing) before picking a shard.
+  const auto addr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+  return static_cast<unsigned int>((addr * 11400714819323198485ULL) >> 60U) %
+      executorRegistryShardCount;
+}
+
+auto ExecutorRegistry::wakeResumeWaiters() noexcept -> void {
+  m_resumeEpoch.fetch_add(1U, std::memory_order_seq_cst);
+  futexWakeAll(&m_resumeEpoch);
 }
 
 } // namespace vm::internal
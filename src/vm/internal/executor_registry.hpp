@@ -1,12 +1,32 @@
 #pragma once
 #include "internal/executor_handle.hpp"
+#include "internal/ref_future.hpp"
 #include "internal/stack.hpp"
 #include <atomic>
+#include <cstdint>
 #include <mutex>
 
 namespace vm::internal {
 
+// Amount of independently locked executor lists, see 'ExecutorRegistry'.
+const auto executorRegistryShardCount = 16U;
+
 // Registry that keeps track of all executors.
+//
+// Forked executors start asynchronously, until a forked executor has registered itself its future
+// (which holds the arguments of the call) is tracked as a 'pending fork'. The garbage collector
+// treats pending forks as roots, this way the arguments stay alive even if the parent executor has
+// already discarded the future.
+//
+// Executors and pending forks are spread over 'executorRegistryShardCount' shards that each have
+// their own lock, this way executors that start and stop at the same time (for example one per tcp
+// connection) rarely contend. A forked executor registers in the same shard as its future so that
+// it can replace its pending fork atomically.
+//
+// Pausing (stop-the-world) is a two step handshake: first the pause is requested from all executors
+// and then the registry waits for the ones that have not acknowledged it yet. Executors that are
+// inside a blocking call are already paused and do not have to acknowledge, executors that trap
+// park their thread on the 'resume epoch' and are woken all at once when the registry is resumed.
 class ExecutorRegistry final {
 public:
   ExecutorRegistry() noexcept;
@@ -17,7 +37,29 @@ public:
   auto operator=(const ExecutorRegistry& rhs) -> ExecutorRegistry& = delete;
   auto operator=(ExecutorRegistry&& rhs) -> ExecutorRegistry& = delete;
 
-  [[nodiscard]] auto getHeadExecutor() noexcept -> ExecutorHandle* { return m_head; }
+  // Invoke the visitor for every executor.
+  // NOTE: Only allowed while the executors are paused.
+  template <typename Visitor>
+  auto visitExecutors(Visitor visitor) noexcept -> void {
+    assert(isPaused());
+    for (auto& shard : m_shards) {
+      for (auto* exec = shard.head; exec; exec = exec->m_next) {
+        visitor(exec);
+      }
+    }
+  }
+
+  // Invoke the visitor for every pending fork.
+  // NOTE: Only allowed while the executors are paused.
+  template <typename Visitor>
+  auto visitPendingForks(Visitor visitor) noexcept -> void {
+    assert(isPaused());
+    for (auto& shard : m_shards) {
+      for (auto* future = shard.pendingHead; future; future = future->m_pendingNext) {
+        visitor(future);
+      }
+    }
+  }
 
   [[nodiscard]] auto isRunning() noexcept {
     return m_state.load(std::memory_order_acquire) == RegistryState::Running;
@@ -31,9 +73,19 @@ public:
     return m_state.load(std::memory_order_acquire) == RegistryState::Aborted;
   }
 
-  auto registerExecutor(ExecutorHandle* handle) noexcept -> void;
+  // Register an executor, for forked executors 'promise' is the future that was passed to
+  // 'addPendingFork'. Blocks while the executors are (being) paused.
+  // Returns false if the registry has been aborted, the executor should then exit immediately
+  // without touching any shared memory.
+  [[nodiscard]] auto registerExecutor(ExecutorHandle* handle, FutureRef* promise = nullptr) noexcept
+      -> bool;
   auto unregisterExecutor(ExecutorHandle* handle) noexcept -> void;
 
+  // Track the future of a forked executor that has not registered itself yet.
+  // NOTE: Has to be called by a running (registered and not paused) executor.
+  auto addPendingFork(FutureRef* future) noexcept -> void;
+  auto removePendingFork(FutureRef* future) noexcept -> void;
+
   auto abortExecutors() noexcept -> void;
   auto pauseExecutors() noexcept -> void;
   auto resumeExecutors() noexcept -> void;
@@ -41,13 +93,29 @@ public:
 private:
   enum class RegistryState : int {
     Running = 0,
-    Paused  = 1,
-    Aborted = 2,
+    Pausing = 1,
+    Paused  = 2,
+    Aborted = 3,
   };
 
-  std::mutex m_mutex;
-  ExecutorHandle* m_head;
+  // Aligned to a cache line to avoid false sharing between the locks of neighbouring shards.
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    ExecutorHandle* head   = nullptr;
+    FutureRef* pendingHead = nullptr;
+  };
+
+  Shard m_shards[executorRegistryShardCount];
   std::atomic<RegistryState> m_state;
+
+  // Incremented (and waited on) when the registry stops being paused, both paused executors and
+  // executors waiting to register park on this.
+  std::atomic<uint32_t> m_resumeEpoch;
+
+  [[nodiscard]] static auto getShardIndex(const void* ptr) noexcept -> unsigned int;
+
+  auto wakeResumeWaiters() noexcept -> void;
+  auto unlinkPendingFork(Shard& shard, FutureRef* future) noexcept -> void;
 };
 
 } // namespace vm::internal
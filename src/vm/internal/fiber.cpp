@@ -0,0 +1,235 @@
+#include "internal/fiber.hpp"
+#include "internal/os_include.hpp"
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define VM_FIBER_ASAN
+#endif
+#endif
+
+#if defined(VM_FIBER_ASAN)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+#if !defined(_WIN32)
+
+#if !defined(__x86_64__)
+#error "Fibers are only implemented for x86-64"
+#endif
+
+// Switch to another stack, saves the callee-saved registers (and the floating-point control words)
+// of the current fiber on its stack and its stack pointer in 'fromSp', then restores the registers
+// from 'toSp'. Newly created fibers 'return' into 'vm_fiber_start' which calls the routine in r13
+// with the argument in r12.
+extern "C" void vm_fiber_switch(void** fromSp, void* toSp) noexcept;
+extern "C" void vm_fiber_start() noexcept;
+
+// clang-format off
+#if defined(__APPLE__)
+#define FIBER_ASM_FUNC(name) ".private_extern _" #name "\n_" #name ":\n"
+#define FIBER_ASM_END(name) ""
+#else // !__APPLE__
+#define FIBER_ASM_FUNC(name) ".hidden " #name "\n.type " #name ",@function\n" #name ":\n"
+#define FIBER_ASM_END(name) ".size " #name ",.-" #name "\n"
+#endif // !__APPLE__
+
+asm(".text\n"
+    ".p2align 4\n"
+    FIBER_ASM_FUNC(vm_fiber_switch)
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  subq $8, %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  addq $8, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  retq\n"
+    FIBER_ASM_END(vm_fiber_switch)
+    ".p2align 4\n"
+    FIBER_ASM_FUNC(vm_fiber_start)
+    "  movq %r12, %rdi\n"
+    "  callq *%r13\n"
+    "  ud2\n"
+    FIBER_ASM_END(vm_fiber_start));
+// clang-format on
+
+#undef FIBER_ASM_FUNC
+#undef FIBER_ASM_END
+
+#endif // !_WIN32
+
+namespace vm::internal {
+
+#if defined(_WIN32)
+
+struct Fiber {
+  void* handle;
+  FiberRoutine routine;
+  void* arg;
+};
+
+static VOID CALLBACK fiberEntry(LPVOID param) {
+  auto* fiber = static_cast<Fiber*>(param);
+  fiber->routine(fiber->arg);
+  std::abort(); // Fiber routines are not allowed to return.
+}
+
+auto fiberThreadEnter() noexcept -> Fiber* {
+  auto* handle = ConvertThreadToFiberEx(nullptr, FIBER_FLAG_FLOAT_SWITCH);
+  if (!handle) {
+    return nullptr;
+  }
+  return new Fiber{handle, nullptr, nullptr};
+}
+
+auto fiberThreadLeave(Fiber* threadFiber) noexcept -> void {
+  ConvertFiberToThread();
+  delete threadFiber;
+}
+
+auto fiberCreate(FiberRoutine routine, void* arg) noexcept -> Fiber* {
+  auto* fiber   = new Fiber{nullptr, routine, arg};
+  fiber->handle = CreateFiberEx(0, fiberStackSize, FIBER_FLAG_FLOAT_SWITCH, &fiberEntry, fiber);
+  if (!fiber->handle) {
+    delete fiber;
+    return nullptr;
+  }
+  return fiber;
+}
+
+auto fiberDestroy(Fiber* fiber) noexcept -> void {
+  DeleteFiber(fiber->handle);
+  delete fiber;
+}
+
+auto fiberSwitch(Fiber* /*unused*/, Fiber* to) noexcept -> void { SwitchToFiber(to->handle); }
+
+#else // !_WIN32
+
+// Initial register values for new fibers, the default floating-point control words (all exceptions
+// masked, round to nearest) and zeroed callee-saved registers.
+const uint64_t fiberDefaultControlWords = 0x1F80U | (uint64_t{0x037FU} << 32U);
+
+struct Fiber {
+  void* sp;            // Stack pointer of the fiber while it is suspended.
+  void* stackMem;      // Mapped stack memory (including the guard page), nullptr for threads.
+  size_t stackMemSize; // Size of the mapped stack memory.
+  FiberRoutine routine;
+  void* arg;
+#if defined(VM_FIBER_ASAN)
+  // The address-sanitizer needs to be told about stack switches, the stack bounds of thread fibers
+  // are only known after they have switched to another fiber.
+  const void* asanStackBottom;
+  size_t asanStackSize;
+  void* asanFakeStack;
+  Fiber* asanFrom;
+#endif
+};
+
+#if defined(VM_FIBER_ASAN)
+static auto asanFinishSwitch(Fiber* fiber) noexcept -> void {
+  const void* fromBottom;
+  size_t fromSize;
+  __sanitizer_finish_switch_fiber(fiber->asanFakeStack, &fromBottom, &fromSize);
+  fiber->asanFrom->asanStackBottom = fromBottom;
+  fiber->asanFrom->asanStackSize   = fromSize;
+}
+#endif
+
+static auto fiberEntry(Fiber* fiber) noexcept -> void {
+#if defined(VM_FIBER_ASAN)
+  asanFinishSwitch(fiber);
+#endif
+  fiber->routine(fiber->arg);
+  std::abort(); // Fiber routines are not allowed to return.
+}
+
+auto fiberThreadEnter() noexcept -> Fiber* { return new Fiber{}; }
+
+auto fiberThreadLeave(Fiber* threadFiber) noexcept -> void { delete threadFiber; }
+
+auto fiberCreate(FiberRoutine routine, void* arg) noexcept -> Fiber* {
+  const auto pageSize = static_cast<size_t>(getpagesize());
+  const auto memSize  = fiberStackSize + pageSize;
+
+  // Reserve the stack, pages are only committed once they are touched.
+  auto flags = MAP_PRIVATE | MAP_ANON;
+#if defined(MAP_NORESERVE)
+  flags |= MAP_NORESERVE;
+#endif
+#if defined(MAP_STACK)
+  flags |= MAP_STACK;
+#endif
+  auto* mem = mmap(nullptr, memSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+
+  // Guard page at the bottom of the stack, overflowing the stack faults instead of corrupting.
+  if (mprotect(mem, pageSize, PROT_NONE) != 0) {
+    munmap(mem, memSize);
+    return nullptr;
+  }
+
+  auto* fiber         = new Fiber{};
+  fiber->stackMem     = mem;
+  fiber->stackMemSize = memSize;
+  fiber->routine      = routine;
+  fiber->arg          = arg;
+#if defined(VM_FIBER_ASAN)
+  fiber->asanStackBottom = static_cast<uint8_t*>(mem) + pageSize;
+  fiber->asanStackSize   = fiberStackSize;
+#endif
+
+  // Initial frame as saved by 'vm_fiber_switch', 'returns' into 'vm_fiber_start' with a 16 byte
+  // aligned stack.
+  auto* top   = static_cast<uint8_t*>(mem) + memSize;
+  auto* frame = reinterpret_cast<uint64_t*>(top - 80);
+  frame[0]    = fiberDefaultControlWords;
+  frame[1]    = 0U;                                          // r15
+  frame[2]    = 0U;                                          // r14
+  frame[3]    = reinterpret_cast<uint64_t>(&fiberEntry);     // r13
+  frame[4]    = reinterpret_cast<uint64_t>(fiber);           // r12
+  frame[5]    = 0U;                                          // rbx
+  frame[6]    = 0U;                                          // rbp
+  frame[7]    = reinterpret_cast<uint64_t>(&vm_fiber_start); // Return address.
+  frame[8]    = 0U;
+  frame[9]    = 0U;
+  fiber->sp   = frame;
+  return fiber;
+}
+
+auto fiberDestroy(Fiber* fiber) noexcept -> void {
+  munmap(fiber->stackMem, fiber->stackMemSize);
+  delete fiber;
+}
+
+auto fiberSwitch(Fiber* from, Fiber* to) noexcept -> void {
+#if defined(VM_FIBER_ASAN)
+  to->asanFrom = from;
+  __sanitizer_start_switch_fiber(&from->asanFakeStack, to->asanStackBottom, to->asanStackSize);
+#endif
+  vm_fiber_switch(&from->sp, to->sp);
+#if defined(VM_FIBER_ASAN)
+  asanFinishSwitch(from);
+#endif
+}
+
+#endif // !_WIN32
+
+} // namespace vm::internal
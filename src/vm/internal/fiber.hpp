@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+
+namespace vm::internal {
+
+// A fiber is a stack and a saved register context, switching between fibers is a plain function
+// call that saves the registers of the current fiber and restores the ones of the target fiber.
+// Unlike threads fibers are never preempted, a fiber runs until it explicitly switches to another.
+//
+// Used by the scheduler (see scheduler.hpp) to run many executors on a small amount of threads.
+//
+// NOTE: A fiber can be resumed on a different thread than the one it was suspended on, code that
+// runs on fibers should not hold on to thread-local state over a switch.
+
+struct Fiber;
+
+// Routine that a fiber executes, should never return (switch to another fiber instead).
+using FiberRoutine = void (*)(void* arg) noexcept;
+
+// Size of the stack that fibers are created with (the memory is only committed when used).
+const auto fiberStackSize = std::size_t{1024U * 1024U}; // 1 MiB
+
+// Turn the calling thread into a fiber so it can switch to other fibers, returns nullptr on
+// failure. Has to be undone with 'fiberThreadLeave' before the thread exits.
+[[nodiscard]] auto fiberThreadEnter() noexcept -> Fiber*;
+
+auto fiberThreadLeave(Fiber* threadFiber) noexcept -> void;
+
+// Create a new (suspended) fiber that starts executing the routine when first switched to,
+// returns nullptr on failure.
+[[nodiscard]] auto fiberCreate(FiberRoutine routine, void* arg) noexcept -> Fiber*;
+
+// Destroy a suspended fiber.
+auto fiberDestroy(Fiber* fiber) noexcept -> void;
+
+// Suspend the current fiber ('from') and resume 'to', returns when another fiber switches back to
+// 'from'.
+auto fiberSwitch(Fiber* from, Fiber* to) noexcept -> void;
+
+} // namespace vm::internal
@@ -0,0 +1,84 @@
+#include "internal/futex.hpp"
+#include "internal/os_include.hpp"
+#include "internal/scheduler.hpp"
+
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#else // !__linux__
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#endif // !__linux__
+
+namespace vm::internal {
+
+#if defined(__linux__)
+
+auto futexWait(std::atomic<uint32_t>* addr, uint32_t expected, int64_t timeout) noexcept -> bool {
+  if (timeout < 0 && schedulerPark(addr, expected)) {
+    return true;
+  }
+  timespec ts  = {timeout / 1'000'000'000, timeout % 1'000'000'000};
+  auto* tsPtr  = timeout < 0 ? nullptr : &ts;
+  const auto r = syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, tsPtr, nullptr, 0);
+  return r == 0 || errno != ETIMEDOUT;
+}
+
+auto futexWakeAll(std::atomic<uint32_t>* addr) noexcept -> void {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+  schedulerUnparkAll(addr);
+}
+
+#else // !__linux__
+
+// Waiters are spread over a fixed amount of buckets based on the address they wait on, waking an
+// address wakes all the waiters in its bucket (which then re-check their values).
+const auto futexBucketCount = 64U;
+
+struct FutexBucket {
+  std::mutex mutex;
+  std::condition_variable condVar;
+};
+
+static FutexBucket g_futexBuckets[futexBucketCount];
+
+static auto getFutexBucket(std::atomic<uint32_t>* addr) noexcept -> FutexBucket& {
+  const auto hash = std::hash<std::atomic<uint32_t>*>{}(addr);
+  return g_futexBuckets[(hash >> 3U) % futexBucketCount];
+}
+
+auto futexWait(std::atomic<uint32_t>* addr, uint32_t expected, int64_t timeout) noexcept -> bool {
+  if (timeout < 0 && schedulerPark(addr, expected)) {
+    return true;
+  }
+  auto& bucket = getFutexBucket(addr);
+  auto lk      = std::unique_lock<std::mutex>{bucket.mutex};
+
+  // Check the value while holding the lock, wakes also take the lock so they cannot be missed.
+  if (addr->load(std::memory_order_acquire) != expected) {
+    return true;
+  }
+  if (timeout < 0) {
+    bucket.condVar.wait(lk);
+    return true;
+  }
+  return bucket.condVar.wait_for(lk, std::chrono::nanoseconds(timeout)) ==
+      std::cv_status::no_timeout;
+}
+
+auto futexWakeAll(std::atomic<uint32_t>* addr) noexcept -> void {
+  {
+    auto& bucket = getFutexBucket(addr);
+    auto lk      = std::lock_guard<std::mutex>{bucket.mutex};
+    bucket.condVar.notify_all();
+  }
+  schedulerUnparkAll(addr);
+}
+
+#endif // !__linux__
+
+} // namespace vm::internal
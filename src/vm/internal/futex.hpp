@@ -0,0 +1,24 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace vm::internal {
+
+// Block the calling thread while the value at 'addr' is equal to 'expected', or until a timeout
+// occurs ('timeout' in nanoseconds, negative means no timeout).
+// Returns false if the timeout occurred before being woken.
+// NOTE: Can return spuriously, callers have to re-check the value in a loop.
+//
+// On linux this is a futex wait, on other platforms the thread waits on a condition-variable from
+// a table that is shared between all addresses (see 'futexWakeAll').
+//
+// Scheduler tasks (see scheduler.hpp) do not block their thread when waiting without a timeout,
+// instead the task is parked and its worker runs other tasks until the address is woken.
+auto futexWait(std::atomic<uint32_t>* addr, uint32_t expected, int64_t timeout = -1) noexcept
+    -> bool;
+
+// Wake all threads (and parked tasks) that are blocked in 'futexWait' on the given address.
+// NOTE: Has to be called after changing the value at 'addr', otherwise waiters can miss the wake.
+auto futexWakeAll(std::atomic<uint32_t>* addr) noexcept -> void;
+
+} // namespace vm::internal
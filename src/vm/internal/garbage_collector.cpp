@@ -3,12 +3,15 @@
 #include "internal/ref_future.hpp"
 #include "internal/ref_stream_process.hpp"
 #include "internal/ref_string_link.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/ref_struct.hpp"
 #include "internal/thread.hpp"
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
 
 namespace vm::internal {
 
@@ -17,10 +20,25 @@ namespace vm::internal {
 const static auto bytesAllocThreadAccumMax = 1024U * 1024U; // 1 MiB
 thread_local static unsigned int bytesAllocThreadAccum;
 
-GarbageCollector::GarbageCollector(RefAllocator* refAlloc, ExecutorRegistry* execReg) noexcept :
+GarbageCollector::GarbageCollector(
+    RefAllocator* refAlloc, ExecutorRegistry* execReg, const Options& options) noexcept :
     m_refAlloc{refAlloc},
     m_execRegistry{execReg},
-    m_bytesUntilNextCollection{gcByteInterval},
+    m_markIdleCount{0},
+    m_markThreadsRunning{0},
+    m_markEpoch{0},
+    m_markActiveCount{0},
+    m_markTerminate{false},
+    m_bytesUntilNextCollection{gcMinHeapGrowth},
+    m_allocatedSinceCollection{false},
+    m_growthPercent{options.gcGrowthPercent},
+    m_minIntervalMilliseconds{options.gcMinIntervalMilliseconds},
+    m_softHeapTarget{options.gcSoftHeapTarget},
+    m_oldCount{0},
+    m_oldCountAfterFull{0},
+    m_oldBytes{0},
+    m_oldBytesAfterFull{0},
+    m_lastRelease{std::chrono::steady_clock::now()},
     m_collectorStatus{CollectorStatus::NotRunning},
     m_requestType{RequestType::None},
     m_requestCollectFlags{GcCollectNormal},
@@ -32,7 +50,14 @@ GarbageCollector::GarbageCollector(RefAllocator* refAlloc, ExecutorRegistry* exe
   // Subscribe to allocation notifications, we can use these to decide when to run a collection.
   refAlloc->subscribe(this);
 
-  m_markQueue.reserve(initialGcMarkQueueSize);
+  auto markThreads = options.gcMarkThreads;
+  if (markThreads == 0) {
+    markThreads = std::min(std::max(std::thread::hardware_concurrency(), 1U), gcMaxMarkThreads);
+  }
+  for (auto i = 0U; i != markThreads; ++i) {
+    m_markWorkers.push_back(std::make_unique<MarkWorker>());
+    m_markWorkers.back()->local.reserve(initialGcMarkQueueSize);
+  }
 }
 
 GarbageCollector::~GarbageCollector() noexcept { terminateCollector(); }
@@ -43,11 +68,21 @@ auto GarbageCollector::startCollector() noexcept -> CollectorStartResult {
   m_collectorStatus.store(CollectorStatus::Running, std::memory_order_release);
 
   auto collectorThread = +[](GarbageCollector* collector) noexcept { collector->collectorLoop(); };
-  const auto startRes  = threadStart(collectorThread, this);
-
-  if (unlikely(startRes != ThreadStartResult::Success)) {
+  if (unlikely(threadStart(collectorThread, this) != ThreadStartResult::Success)) {
     return CollectorStartResult::Failure;
   }
+
+  // Start the mark threads, the collector thread itself is the first mark worker.
+  auto markThread = +[](GarbageCollector* collector, unsigned int workerIndex) noexcept {
+    collector->markThreadLoop(workerIndex);
+  };
+  for (auto i = 1U; i != m_markWorkers.size(); ++i) {
+    m_markThreadsRunning.fetch_add(1, std::memory_order_acq_rel);
+    if (unlikely(threadStart(markThread, this, i) != ThreadStartResult::Success)) {
+      m_markThreadsRunning.fetch_sub(1, std::memory_order_acq_rel);
+      return CollectorStartResult::Failure;
+    }
+  }
   return CollectorStartResult::Success;
 }
 
@@ -85,21 +120,49 @@ auto GarbageCollector::terminateCollector() noexcept -> void {
       threadYield();
     }
   }
+
+  // Terminate the mark threads.
+  {
+    std::lock_guard<std::mutex> lk(m_markMutex);
+    m_markTerminate = true;
+  }
+  m_markStartCondVar.notify_all();
+  while (m_markThreadsRunning.load(std::memory_order_acquire) != 0) {
+    threadYield();
+  }
 }
 
 auto GarbageCollector::notifyAlloc(unsigned int size) noexcept -> void {
+  // Wake up the collector thread (which sleeps while nothing is allocated) on the first allocation
+  // since the last collection so it can run the timed collections again.
+  if (unlikely(!m_allocatedSinceCollection.load(std::memory_order_relaxed))) {
+    {
+      std::lock_guard<std::mutex> lk(m_requestMutex);
+      m_allocatedSinceCollection.store(true, std::memory_order_relaxed);
+    }
+    m_requestCondVar.notify_one();
+  }
+
   // Increase the thread-static counter.
   bytesAllocThreadAccum += size;
   if (bytesAllocThreadAccum > bytesAllocThreadAccumMax) {
 
     // Decrease the bytesUntilNextCollection atomic.
-    if (m_bytesUntilNextCollection.fetch_sub(
-            static_cast<int>(bytesAllocThreadAccum), std::memory_order_acq_rel) < 0) {
+    if (m_bytesUntilNextCollection.fetch_sub(bytesAllocThreadAccum, std::memory_order_acq_rel) <
+        0) {
 
-      m_bytesUntilNextCollection.store(gcByteInterval, std::memory_order_release);
+      // Avoid requesting again until the requested collection has updated the pacing.
+      m_bytesUntilNextCollection.store(INT64_MAX, std::memory_order_release);
       requestCollection(GarbageCollectFlags::GcCollectNormal);
     }
 
+    // Request an emergency collection when the heap has reached its limit (unless a previous
+    // emergency collection already failed to get the heap under its limit).
+    const auto* memAlloc = m_refAlloc->getMemAlloc();
+    if (unlikely(memAlloc->isHeapLimitReached() && !memAlloc->isHeapLimitEnforced())) {
+      requestCollection(GarbageCollectFlags::GcCollectEmergency);
+    }
+
     bytesAllocThreadAccum = 0;
   }
 }
@@ -107,22 +170,29 @@ auto GarbageCollector::notifyAlloc(unsigned int size) noexcept -> void {
 auto GarbageCollector::collectorLoop() noexcept -> void {
   GarbageCollectFlags collectFlags = GcCollectNormal;
   while (true) {
-    // Wait for a request (or timout for a minimum gc interval).
+    // Wait for a request. While allocations are being made also collect after the minimum
+    // interval, when nothing is allocated wait until the first allocation.
     {
       std::unique_lock<std::mutex> lk(m_requestMutex);
-      m_requestCondVar.wait_for(lk, std::chrono::milliseconds(gcMinIntervalMilliseconds), [this]() {
-        return m_requestType != RequestType::None;
-      });
+      auto timedOut = false;
+      while (m_requestType == RequestType::None && !timedOut) {
+        if (m_minIntervalMilliseconds != 0 &&
+            m_allocatedSinceCollection.load(std::memory_order_relaxed)) {
+          timedOut = m_requestCondVar.wait_for(
+                         lk, std::chrono::milliseconds(m_minIntervalMilliseconds)) ==
+              std::cv_status::timeout;
+        } else {
+          m_requestCondVar.wait(lk);
+        }
+      }
       if (unlikely(m_requestType == RequestType::Terminate)) {
         break;
       }
       collectFlags          = m_requestCollectFlags;
       m_requestType         = RequestType::None;
       m_requestCollectFlags = GcCollectNormal;
+      m_allocatedSinceCollection.store(false, std::memory_order_relaxed);
       m_collectionStarted.fetch_add(1, std::memory_order_acq_rel);
-
-      // Reset the bytes counter.
-      m_bytesUntilNextCollection.store(gcByteInterval, std::memory_order_release);
     }
 
     // Collect garbage.
@@ -132,29 +202,115 @@ auto GarbageCollector::collectorLoop() noexcept -> void {
   m_collectorStatus.store(CollectorStatus::Terminated, std::memory_order_release);
 }
 
+auto GarbageCollector::markThreadLoop(unsigned int workerIndex) noexcept -> void {
+  uint64_t markEpoch = 0;
+  while (true) {
+    // Wait for a mark phase to start.
+    {
+      std::unique_lock<std::mutex> lk(m_markMutex);
+      m_markStartCondVar.wait(
+          lk, [this, markEpoch]() { return m_markTerminate || m_markEpoch != markEpoch; });
+      if (unlikely(m_markTerminate)) {
+        break;
+      }
+      markEpoch = m_markEpoch;
+    }
+
+    markWorker(m_markWorkers[workerIndex].get());
+
+    // Notify the collector thread when all mark threads are done.
+    bool done;
+    {
+      std::lock_guard<std::mutex> lk(m_markMutex);
+      done = --m_markActiveCount == 0;
+    }
+    if (done) {
+      m_markDoneCondVar.notify_one();
+    }
+  }
+
+  m_markThreadsRunning.fetch_sub(1, std::memory_order_acq_rel);
+}
+
 auto GarbageCollector::collect(GarbageCollectFlags flags) noexcept -> void {
 
+  auto* memAlloc       = m_refAlloc->getMemAlloc();
+  const bool emergency = (flags & GcCollectEmergency) != 0;
+  const bool blocking  = (flags & GcCollectBlockingSweep) != 0 || emergency;
+
+  // Do a full collection when the amount of old references has doubled or the size of the old
+  // generation has grown by the growth percentage since the last full collection.
+  const auto oldGrowth      = m_oldCount - m_oldCountAfterFull;
+  const auto oldBytesGrowth = static_cast<uint64_t>(m_oldBytes - m_oldBytesAfterFull);
+  const bool full           = (flags & GcCollectFull) != 0 || emergency ||
+      oldGrowth > std::max(m_oldCountAfterFull, static_cast<size_t>(gcMinOldGrowth)) ||
+      oldBytesGrowth > std::max(
+                           static_cast<uint64_t>(m_oldBytesAfterFull) * m_growthPercent / 100U,
+                           uint64_t{gcMinHeapGrowth});
+
   // Pause all executors. This makes sure that we are free to inspect the stacks of the allocators
   // and no new allocations are being made.
   m_execRegistry->pauseExecutors(); // Will block until all executors have paused.
 
+  // Marks are kept between collections (marked references are old), a full collection starts by
+  // clearing them so the old references are visited again.
+  if (full) {
+    m_refAlloc->clearMarks();
+  }
+
   // Populate mark-queue with the references from the stacks of the executors.
   populateMarkQueue();
 
-  // Mark all references in the mark-queue.
+  // For minor collections the old references that could point to young references are roots also.
+  if (!full) {
+    for (auto* ref : m_refAlloc->getRemembered()) {
+      pushChildren(ref, &m_markWorkers[0]->local);
+    }
+  }
+
+  // Mark all references in the mark-queue, marked young references are promoted to the old
+  // generation. Needs to happen before resuming as it changes the generation (which the executors
+  // read in the write-barrier).
   mark();
 
-  // Get the head ref to start the sweep from.
-  Ref* sweepHead = m_refAlloc->getHeadAlloc();
+  // After promoting there are no young references anymore so nothing needs to be remembered.
+  m_refAlloc->clearRemembered();
+
+  // Remove all non-marked references. Sweeping only walks the allocation bitmaps of the heap (and
+  // the references that need to be finalized) so its done while the executors are still paused,
+  // this way the allocator does not need to synchronize with the sweep.
+  const auto live = m_refAlloc->sweep();
+  m_oldCount      = live.count;
+  m_oldBytes      = live.bytes;
+  if (full) {
+    m_oldCountAfterFull = m_oldCount;
+    m_oldBytesAfterFull = m_oldBytes;
+  }
 
-  if ((flags & GcCollectBlockingSweep) == 0) {
+  if (!blocking) {
     m_execRegistry->resumeExecutors();
   }
 
-  // Remove all non-marked allocations.
-  sweep(sweepHead);
+  // Schedule the next collection based on the size of the live heap.
+  updatePacing();
+
+  // Return free memory to the system. Explicitly requested full collections and collections while
+  // the heap is at its limit return all free memory.
+  const bool releaseAll =
+      (flags & GcCollectFull) != 0 || emergency || memAlloc->isHeapLimitEnforced();
+  const auto now = std::chrono::steady_clock::now();
+  if (releaseAll ||
+      now - m_lastRelease >= std::chrono::milliseconds(gcReleaseIntervalMilliseconds)) {
+    memAlloc->release(releaseAll);
+    m_lastRelease = now;
+  }
+
+  // Enforce the heap limit when an emergency collection could not get the heap under its limit,
+  // stop enforcing it once the heap is under its limit again.
+  memAlloc->setHeapLimitEnforced(
+      memAlloc->isHeapLimitReached() && (emergency || memAlloc->isHeapLimitEnforced()));
 
-  if (flags & GcCollectBlockingSweep) {
+  if (blocking) {
     m_execRegistry->resumeExecutors();
   }
 
@@ -163,120 +319,258 @@ auto GarbageCollector::collect(GarbageCollectFlags flags) noexcept -> void {
 
 auto GarbageCollector::populateMarkQueue() noexcept -> void {
   // Go through all the executors and process their stacks.
-  auto* execHandle = m_execRegistry->getHeadExecutor();
-  while (execHandle) {
-    populateMarkQueue(execHandle->getStack());
-    execHandle = execHandle->getNext();
-  }
+  m_execRegistry->visitExecutors(
+      [this](ExecutorHandle* execHandle) { populateMarkQueue(execHandle->getStack()); });
+
+  // Futures of forked executors that have not registered themselves yet keep their arguments alive.
+  m_execRegistry->visitPendingForks(
+      [this](FutureRef* pendingFork) { m_markWorkers[0]->local.push_back(pendingFork); });
 }
 
 auto GarbageCollector::populateMarkQueue(BasicStack* stack) noexcept -> void {
-  // Add all references on the stack to the mark-queue.
+  // Add all references on the stack to the mark-queue of the collector thread, they are divided
+  // between the mark threads when marking starts.
+  auto& markQueue = m_markWorkers[0]->local;
   for (auto* sp = stack->getBottom(); sp != stack->getNext(); ++sp) {
     assert(sp < stack->getNext());
     if (sp->isRef()) {
       auto* ref = sp->getRef();
       if (ref != nullptr) {
-        m_markQueue.push_back(ref);
+        markQueue.push_back(ref);
       }
     }
   }
 }
 
+auto GarbageCollector::pushChildren(Ref* ref, std::vector<Ref*>* queue) noexcept -> void {
+  switch (ref->getKind()) {
+  case RefKind::Struct: {
+    auto* s = downcastRef<StructRef>(ref);
+    for (auto* fP = s->getFieldsBegin(); fP != s->getFieldsEnd(); ++fP) {
+      if (fP->isRef()) {
+        auto* child = fP->getRef();
+        if (child != nullptr) {
+          queue->push_back(child);
+        }
+      }
+    }
+  } break;
+  case RefKind::Future: {
+    auto* f  = downcastRef<FutureRef>(ref);
+    auto res = f->getResult();
+    if (res.isRef()) {
+      auto* child = res.getRef();
+      if (child != nullptr) {
+        queue->push_back(child);
+      }
+    }
+    auto* argsEnd = f->getArgsBegin() + f->getArgCount();
+    for (auto* argP = f->getArgsBegin(); argP != argsEnd; ++argP) {
+      if (argP->isRef()) {
+        auto* child = argP->getRef();
+        if (child != nullptr) {
+          queue->push_back(child);
+        }
+      }
+    }
+  } break;
+  case RefKind::StringLink: {
+    auto* l = downcastRef<StringLinkRef>(ref);
+    if (l->getBalanced() != nullptr) {
+      queue->push_back(l->getBalanced());
+      // If a balanced representation has been computed we can safely discard the sides of the
+      // rope.
+      l->clearLink();
+    } else {
+      assert(l->getLeft() != nullptr);
+      queue->push_back(l->getLeft());
+      if (l->getRight().isRef()) {
+        auto* rightRef = l->getRight().getRef();
+        assert(rightRef != nullptr);
+        queue->push_back(rightRef);
+      }
+    }
+  } break;
+  case RefKind::StreamProcess:
+    queue->push_back(downcastRef<ProcessStreamRef>(ref)->getProcess());
+    break;
+  case RefKind::StringSlice:
+    queue->push_back(downcastRef<StringSliceRef>(ref)->getParent());
+    break;
+  case RefKind::Atomic:
+  case RefKind::String:
+  case RefKind::ULong:
+  case RefKind::StreamFile:
+  case RefKind::StreamConsole:
+  case RefKind::StreamTcp:
+  case RefKind::Process:
+  case RefKind::IOWatcher:
+    break;
+  }
+}
+
 auto GarbageCollector::mark() noexcept -> void {
-  while (!m_markQueue.empty()) {
-    // Take a reference from the queue.
-    Ref* cur = m_markQueue.back();
-    m_markQueue.pop_back();
+  const auto workerCount = static_cast<unsigned int>(m_markWorkers.size());
+  m_markIdleCount.store(0, std::memory_order_release);
 
-    // If its allready marked then we ignore it.
-    if (cur->hasFlag<RefFlags::GcMarked>()) {
-      continue;
+  if (workerCount == 1) {
+    markWorker(m_markWorkers[0].get());
+    return;
+  }
+
+  // Divide the roots between the mark threads.
+  auto& roots = m_markWorkers[0]->local;
+  for (auto i = roots.size(); i-- > 0;) {
+    const auto workerIndex = i % workerCount;
+    if (workerIndex != 0) {
+      m_markWorkers[workerIndex]->local.push_back(roots[i]);
+      roots[i] = roots.back();
+      roots.pop_back();
     }
+  }
+
+  // Start the mark threads and participate in the marking on the collector thread.
+  {
+    std::lock_guard<std::mutex> lk(m_markMutex);
+    m_markActiveCount = workerCount - 1;
+    ++m_markEpoch;
+  }
+  m_markStartCondVar.notify_all();
+
+  markWorker(m_markWorkers[0].get());
+
+  // Wait for the other mark threads to finish.
+  std::unique_lock<std::mutex> lk(m_markMutex);
+  m_markDoneCondVar.wait(lk, [this]() { return m_markActiveCount == 0; });
+}
 
-    // Mark it.
-    cur->setFlag<RefFlags::GcMarked>();
-
-    // Push any child references it has to the queue.
-    switch (cur->getKind()) {
-    case RefKind::Struct: {
-      auto* s = downcastRef<StructRef>(cur);
-      for (auto* fP = s->getFieldsBegin(); fP != s->getFieldsEnd(); ++fP) {
-        if (fP->isRef()) {
-          auto* ref = fP->getRef();
-          if (ref != nullptr) {
-            m_markQueue.push_back(ref);
-          }
+inline auto GarbageCollector::tryMark(Ref* ref, bool parallel) noexcept -> bool {
+  // Immortal references are never collected.
+  if (ref->hasFlag<RefFlags::Immortal>()) {
+    return false;
+  }
+  // Old references are still marked from the collection that promoted them, so minor collections
+  // do not visit them.
+  if (!m_refAlloc->tryMark(ref, parallel)) {
+    return false;
+  }
+  // Promote it to the old generation, only the thread that marked the reference updates its
+  // generation so no atomic read-modify-write is needed.
+  if (ref->getGen() == RefGen::Young) {
+    ref->setGen(RefGen::Old);
+  }
+  return true;
+}
+
+auto GarbageCollector::markWorker(MarkWorker* worker) noexcept -> void {
+  const auto workerCount = static_cast<unsigned int>(m_markWorkers.size());
+  const bool parallel    = workerCount > 1;
+  auto& queue            = worker->local;
+  while (true) {
+    // Mark all references in the local queue.
+    while (!queue.empty()) {
+      Ref* cur = queue.back();
+      queue.pop_back();
+
+      if (tryMark(cur, parallel)) {
+        // Push any child references it has to the queue.
+        pushChildren(cur, &queue);
+
+        // Share work when other threads are idle and our previously shared work has been taken.
+        if (parallel && queue.size() >= gcMarkShareThreshold &&
+            m_markIdleCount.load(std::memory_order_relaxed) != 0 &&
+            !worker->hasShared.load(std::memory_order_relaxed)) {
+          shareWork(worker);
         }
       }
-    } break;
-    case RefKind::Future: {
-      auto* f  = downcastRef<FutureRef>(cur);
-      auto res = f->getResult();
-      if (res.isRef()) {
-        auto* ref = res.getRef();
-        if (ref != nullptr) {
-          m_markQueue.push_back(ref);
-        }
+    }
+    if (takeWork(worker)) {
+      continue;
+    }
+
+    // Out of work, wait until another thread shares work or until all threads are out of work.
+    // Note: Only the owner adds work to a shared queue and it only goes idle after taking back its
+    // own shared work, so when all threads are idle no work can appear anymore.
+    m_markIdleCount.fetch_add(1, std::memory_order_acq_rel);
+    while (true) {
+      if (m_markIdleCount.load(std::memory_order_acquire) == workerCount) {
+        return;
       }
-    } break;
-    case RefKind::StringLink: {
-      auto* l = downcastRef<StringLinkRef>(cur);
-      if (l->isCollapsed()) {
-        m_markQueue.push_back(l->getCollapsed());
-        // If a collapsed representation has been computed we can safely discard the 'link' to the
-        // rest of the chain.
-        l->clearLink();
-      } else {
-        assert(l->getPrev() != nullptr);
-        m_markQueue.push_back(l->getPrev());
-        if (l->getVal().isRef()) {
-          auto* valRef = l->getVal().getRef();
-          assert(valRef != nullptr);
-          m_markQueue.push_back(valRef);
+      const auto hasSharedWork =
+          std::any_of(m_markWorkers.begin(), m_markWorkers.end(), [](const auto& w) {
+            return w->hasShared.load(std::memory_order_relaxed);
+          });
+      if (hasSharedWork) {
+        m_markIdleCount.fetch_sub(1, std::memory_order_acq_rel);
+        if (takeWork(worker)) {
+          break;
         }
+        m_markIdleCount.fetch_add(1, std::memory_order_acq_rel);
       }
-    } break;
-    case RefKind::StreamProcess:
-      m_markQueue.push_back(downcastRef<ProcessStreamRef>(cur)->getProcess());
-      break;
-    case RefKind::Atomic:
-    case RefKind::String:
-    case RefKind::ULong:
-    case RefKind::StreamFile:
-    case RefKind::StreamConsole:
-    case RefKind::StreamTcp:
-    case RefKind::Process:
-    case RefKind::IOWatcher:
-      break;
+      threadYield();
     }
   }
 }
 
-auto GarbageCollector::sweep(Ref* head) noexcept -> void {
-  if (unlikely(head == nullptr)) {
-    return;
-  }
+auto GarbageCollector::shareWork(MarkWorker* worker) noexcept -> void {
+  // Move the bottom half of the local queue (oldest entries) to the shared queue.
+  auto& queue      = worker->local;
+  const auto count = queue.size() / 2;
 
-  // Walks the list of allocations, if its marked then its unmarked and if its not marked it is
-  // deleted. This won't ever delete the head node, reason is that would require syncronization as
-  // the running program might change the head.
+  std::lock_guard<std::mutex> lk(worker->sharedMutex);
+  worker->shared.insert(worker->shared.end(), queue.begin(), queue.begin() + count);
+  queue.erase(queue.begin(), queue.begin() + count);
+  worker->hasShared.store(true, std::memory_order_relaxed);
+}
 
-  head->unsetFlag<RefFlags::GcMarked>();
+auto GarbageCollector::takeWork(MarkWorker* worker) noexcept -> bool {
+  // Take back our own shared work.
+  if (worker->hasShared.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lk(worker->sharedMutex);
+    worker->local.insert(worker->local.end(), worker->shared.begin(), worker->shared.end());
+    worker->shared.clear();
+    worker->hasShared.store(false, std::memory_order_relaxed);
+    if (!worker->local.empty()) {
+      return true;
+    }
+  }
 
-  Ref* prev = head;
-  Ref* cur  = m_refAlloc->getNextAlloc(head);
-  while (cur) {
-    if (cur->hasFlag<RefFlags::GcMarked>()) {
-      // Still reachable.
-      cur->unsetFlag<RefFlags::GcMarked>();
-      prev = cur;
-      cur  = m_refAlloc->getNextAlloc(cur);
-    } else {
-      // No longer reachable.
-      cur = m_refAlloc->freeNext(prev);
+  // Steal half of the shared work of another thread.
+  for (auto& other : m_markWorkers) {
+    if (other.get() == worker || !other->hasShared.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lk(other->sharedMutex);
+    auto& shared = other->shared;
+    if (shared.empty()) {
+      continue;
+    }
+    const auto count = std::max<size_t>(shared.size() / 2, 1U);
+    worker->local.insert(worker->local.end(), shared.end() - count, shared.end());
+    shared.erase(shared.end() - count, shared.end());
+    if (shared.empty()) {
+      other->hasShared.store(false, std::memory_order_relaxed);
     }
+    return true;
+  }
+  return false;
+}
+
+auto GarbageCollector::updatePacing() noexcept -> void {
+  // After a collection all live references are old, allow the heap to grow by the growth
+  // percentage of the live heap before collecting again.
+  const auto liveBytes = static_cast<uint64_t>(m_oldBytes);
+  auto budget          = std::max(liveBytes * m_growthPercent / 100U, uint64_t{gcMinHeapGrowth});
+
+  // Collect earlier to stay under the soft target, but always allow some growth so we don't
+  // continuously collect when the live heap itself is over the target.
+  if (m_softHeapTarget != 0U) {
+    const auto targetBudget = m_softHeapTarget > liveBytes ? m_softHeapTarget - liveBytes : 0U;
+    budget = std::min(budget, std::max(targetBudget, uint64_t{gcMinSoftTargetGrowth}));
   }
+
+  m_bytesUntilNextCollection.store(
+      static_cast<int64_t>(std::min(budget, uint64_t{INT64_MAX})), std::memory_order_release);
 }
 
 } // namespace vm::internal
@@ -1,33 +1,74 @@
 #pragma once
 #include "internal/executor_registry.hpp"
 #include "internal/ref_alloc_observer.hpp"
+#include "vm/options.hpp"
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace vm::internal {
 
 class RefAllocator;
 
-const auto gcByteInterval            = 100U * 1024U * 1024U; // 100 MiB
-const auto gcMinIntervalMilliseconds = 5000U;
-const auto initialGcMarkQueueSize    = 1024U;
+const auto gcMinHeapGrowth               = 8U * 1024U * 1024U; // 8 MiB
+const auto gcMinSoftTargetGrowth         = 1U * 1024U * 1024U; // 1 MiB
+const auto gcReleaseIntervalMilliseconds = 1000U; // Min interval between releasing unused memory.
+const auto gcMinOldGrowth                = 256U * 1024U; // Amount of references.
+const auto initialGcMarkQueueSize        = 1024U;
+const auto gcMaxMarkThreads              = 8U;
+const auto gcMarkShareThreshold          = 4U; // Min queue size to share work with idle threads.
 
 enum GarbageCollectFlags {
   GcCollectNormal        = 0,
-  GcCollectBlockingSweep = 1 << 0,
+  GcCollectBlockingSweep = 1 << 0, // Keep the executors paused until free memory is released.
+  GcCollectFull          = 1 << 1, // Collect all generations.
+  GcCollectEmergency     = 1 << 2, // Heap limit reached, full blocking collection.
 };
 
 // Garbage collector is responsible for freeing unused references. It uses allocated bytes and
 // elapsed time as heuristics to decide when to run a collection pass.
 //
+// Collections are paced on the size of the live heap after the previous collection: the next
+// collection is triggered once the program has allocated 'gcGrowthPercent' of the live heap (but
+// at least 'gcMinHeapGrowth'). When a soft heap target is configured collections are triggered
+// earlier to stay under the target. While allocations are being made a collection is also run
+// every 'gcMinIntervalMilliseconds', when nothing is allocated the collector thread sleeps until
+// the next allocation.
+//
+// References are divided into two generations, 'young' references that were allocated since the
+// last collection and 'old' references that survived a collection. As most references die young
+// most collections are 'minor' collections that only visit the young references, references that
+// survive a minor collection are promoted to the old generation (they are not moved in memory).
+// The marks are stored in side-table bitmaps of the heap (see 'MemoryAllocator') and are kept
+// between collections, so a marked reference is an old reference.
+//
+// Minor collections use the stacks of all executors plus the 'remembered-set' (old references that
+// had a reference stored into them, see 'RefAllocator::writeBarrier') as the roots and do not
+// visit old references. A 'full' collection clears all marks and visits all references, its done
+// when the old generation has grown too much since the last full collection (in amount of
+// references or in bytes) or when explicitly requested.
+//
 // When collecting garbage it performs these steps:
 // * Wake up the collector thread.
 // * Pause all executors ('Stop the world').
-// * Mark all used objects on the stacks of all executors.
+// * Mark all used objects on the stacks of all executors (and the remembered-set), marked young
+//   references are promoted to the old generation. Marking is done in parallel by the collector
+//   thread and a set of mark threads (see 'markWorker').
+// * Remove all unmarked references ('Sweep'), this walks the allocation bitmaps of the heap.
 // * Resume all executors ('Resume the world').
-// * Remove all unused references ('Sweep').
+// * Return free memory that was not needed since the previous release to the system (see
+//   'MemoryAllocator::release'), at most once per 'gcReleaseIntervalMilliseconds' so memory that is
+//   recycled between collections is not released and faulted back in.
 // * Put the collector thread to sleep.
 //
+// When the heap reaches its limit (see 'MemoryAllocator::setHeapLimit') an 'emergency' collection
+// is requested: a full collection that keeps the executors paused until all free memory is
+// returned to the system. If the heap is still over its limit afterwards the limit is enforced, and
+// allocations that need to grow the heap fail.
+//
 class GarbageCollector final : public RefAllocObserver {
 public:
   using CollectionId = uint64_t;
@@ -37,7 +78,10 @@ public:
     Failure = 1,
   };
 
-  GarbageCollector(RefAllocator* refAlloc, ExecutorRegistry* execRegistry) noexcept;
+  // The amount of mark threads and the pacing settings are taken from the options (see
+  // 'vm::Options').
+  GarbageCollector(
+      RefAllocator* refAlloc, ExecutorRegistry* execRegistry, const Options& options) noexcept;
   GarbageCollector(const GarbageCollector& rhs) = delete;
   GarbageCollector(GarbageCollector&& rhs)      = delete;
   ~GarbageCollector() noexcept;
@@ -70,10 +114,37 @@ private:
     Terminated = 2,
   };
 
+  // Mark queue of a single mark thread. The thread pushes and pops from its 'local' queue without
+  // synchronization, when other mark threads are idle part of it is moved to the 'shared' queue
+  // where the idle threads can steal it from.
+  struct MarkWorker {
+    std::vector<Ref*> local;
+    std::mutex sharedMutex;
+    std::vector<Ref*> shared;
+    std::atomic<bool> hasShared{false};
+  };
+
   RefAllocator* m_refAlloc;
   ExecutorRegistry* m_execRegistry;
-  std::vector<Ref*> m_markQueue;
-  std::atomic<int> m_bytesUntilNextCollection;
+  std::vector<std::unique_ptr<MarkWorker>> m_markWorkers; // Index 0 is the collector thread.
+  std::atomic<unsigned int> m_markIdleCount;
+  std::atomic<unsigned int> m_markThreadsRunning;
+  uint64_t m_markEpoch;
+  unsigned int m_markActiveCount;
+  bool m_markTerminate;
+  std::mutex m_markMutex;
+  std::condition_variable m_markStartCondVar;
+  std::condition_variable m_markDoneCondVar;
+  std::atomic<int64_t> m_bytesUntilNextCollection;
+  std::atomic<bool> m_allocatedSinceCollection;
+  uint32_t m_growthPercent;
+  uint32_t m_minIntervalMilliseconds;
+  uint64_t m_softHeapTarget;
+  size_t m_oldCount;          // Amount of old references.
+  size_t m_oldCountAfterFull; // Amount of old references after the last full collection.
+  size_t m_oldBytes;          // Size of the old references in bytes.
+  size_t m_oldBytesAfterFull; // Size of the old references after the last full collection.
+  std::chrono::steady_clock::time_point m_lastRelease;
 
   std::atomic<CollectorStatus> m_collectorStatus;
   RequestType m_requestType;
@@ -86,12 +157,18 @@ private:
   auto notifyAlloc(unsigned int size) noexcept -> void override;
 
   auto collectorLoop() noexcept -> void;
+  auto markThreadLoop(unsigned int workerIndex) noexcept -> void;
 
   auto collect(GarbageCollectFlags flags) noexcept -> void;
   auto populateMarkQueue() noexcept -> void;
   auto populateMarkQueue(BasicStack* stack) noexcept -> void;
+  auto pushChildren(Ref* ref, std::vector<Ref*>* queue) noexcept -> void;
   auto mark() noexcept -> void;
-  auto sweep(Ref* head) noexcept -> void;
+  auto markWorker(MarkWorker* worker) noexcept -> void;
+  auto tryMark(Ref* ref, bool parallel) noexcept -> bool;
+  auto shareWork(MarkWorker* worker) noexcept -> void;
+  auto takeWork(MarkWorker* worker) noexcept -> bool;
+  auto updatePacing() noexcept -> void;
 };
 
 } // namespace vm::internal
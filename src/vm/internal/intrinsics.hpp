@@ -13,6 +13,21 @@
 
 #endif // !defined(__clang__) && !defined(__GNUG__)
 
+// Hints to the compiler that a function should not be inlined.
+#if defined(__clang__) || defined(__GNUG__)
+
+#define NO_INLINE __attribute__((noinline))
+
+#elif defined(_MSC_VER)
+
+#define NO_INLINE __declspec(noinline)
+
+#else
+
+#define NO_INLINE
+
+#endif
+
 // Attribute to the disable a specific sanitizer check.
 #if defined(__clang__)
 
@@ -23,3 +38,45 @@
 #define NO_SANITIZE(n)
 
 #endif // !defined(__clang__)
+
+// Bit manipulation helpers.
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#include <cstdint>
+
+namespace vm::internal {
+
+// Index of the least significant set bit, 'val' should not be zero.
+inline auto countTrailingZeros(uint64_t val) noexcept -> unsigned int {
+#if defined(__clang__) || defined(__GNUG__)
+  return static_cast<unsigned int>(__builtin_ctzll(val));
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, val);
+  return static_cast<unsigned int>(index);
+#else
+  auto index = 0U;
+  for (; (val & 1U) == 0; val >>= 1U) {
+    ++index;
+  }
+  return index;
+#endif
+}
+
+// Amount of set bits.
+inline auto popCount(uint64_t val) noexcept -> unsigned int {
+#if defined(__clang__) || defined(__GNUG__)
+  return static_cast<unsigned int>(__builtin_popcountll(val));
+#elif defined(_MSC_VER)
+  return static_cast<unsigned int>(__popcnt64(val));
+#else
+  auto count = 0U;
+  for (; val != 0; val &= val - 1U) {
+    ++count;
+  }
+  return count;
+#endif
+}
+
+} // namespace vm::internal
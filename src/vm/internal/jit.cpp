@@ -0,0 +1,659 @@
+#include "internal/jit.hpp"
+#include "internal/os_include.hpp"
+#include "internal/ref_string.hpp"
+#include "internal/ref_struct.hpp"
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+
+namespace vm::internal {
+
+using OpCode = novasm::OpCode;
+
+Jit::Jit(const Program* program, uint32_t threshold) noexcept :
+    m_program{program},
+    m_threshold{threshold},
+    m_code(program->getInstrCount()),
+    m_counters(program->getInstrCount()) {}
+
+#if VM_JIT
+
+Jit::~Jit() noexcept {
+  for (const auto& block : m_blocks) {
+    munmap(block.mem, block.size);
+  }
+}
+
+namespace {
+
+// Maximum amount of values that 'StackAlloc' is allowed to clear in native code.
+const uint16_t maxNativeStackAlloc = 32U;
+
+// Marker for instructions that have no native code.
+const uint32_t noLabel = std::numeric_limits<uint32_t>::max();
+
+/* Registers used by the generated code:
+ * - rdi: Stack-home of the current stack-frame.
+ * - rsi: Location to write the next stack slot to when returning to the interpreter.
+ * - rdx: Request flag of the executor (polled on backwards jumps).
+ * - rcx: Next stack slot.
+ * - rax, r8, xmm0 and xmm1 are used as scratch registers.
+ * All of these are caller-saved in the System V abi, so no registers have to be preserved.
+ *
+ * Values are stored in the same representation as the interpreter uses, ints and floats are stored
+ * in the upper 32 bits of a value (at byte offset 4 on little-endian).
+ */
+class Emitter final {
+public:
+  [[nodiscard]] auto getPos() const noexcept -> size_t { return m_buffer.size(); }
+  [[nodiscard]] auto getBuffer() const noexcept -> const std::vector<uint8_t>& { return m_buffer; }
+
+  auto bytes(std::initializer_list<uint8_t> bytes) -> void {
+    m_buffer.insert(m_buffer.end(), bytes.begin(), bytes.end());
+  }
+
+  auto imm32(uint32_t val) -> void {
+    for (auto i = 0U; i != 4U; ++i) {
+      m_buffer.push_back(static_cast<uint8_t>(val >> (i * 8U)));
+    }
+  }
+
+  auto imm64(uint64_t val) -> void {
+    for (auto i = 0U; i != 8U; ++i) {
+      m_buffer.push_back(static_cast<uint8_t>(val >> (i * 8U)));
+    }
+  }
+
+  // Patch a 32 bit relative offset (at 'pos') to point to 'target'.
+  auto patchRel32(size_t pos, size_t target) -> void {
+    const auto rel = static_cast<uint32_t>(static_cast<int64_t>(target) - (pos + 4));
+    for (auto i = 0U; i != 4U; ++i) {
+      m_buffer[pos + i] = static_cast<uint8_t>(rel >> (i * 8U));
+    }
+  }
+
+  // Return to the interpreter, continuing at the given instruction.
+  auto exit(const Instr* instr) -> void {
+    bytes({0x48, 0x89, 0x0E}); // mov [rsi], rcx
+    bytes({0x48, 0xB8});       // mov rax, imm64
+    imm64(reinterpret_cast<uint64_t>(instr)); // NOLINT: Reinterpret cast
+    bytes({0xC3}); // ret
+  }
+
+  auto pushRax() -> void {
+    bytes({0x48, 0x89, 0x01});       // mov [rcx], rax
+    bytes({0x48, 0x83, 0xC1, 0x08}); // add rcx, 8
+  }
+
+  auto pushRaw(uint64_t raw) -> void {
+    bytes({0x48, 0xB8}); // mov rax, imm64
+    imm64(raw);
+    pushRax();
+  }
+
+  auto popDiscard(uint8_t count) -> void {
+    bytes({0x48, 0x83, 0xE9, static_cast<uint8_t>(count * 8U)}); // sub rcx, count * 8
+  }
+
+  // Load the int / float of the value at 'offset' (relative to the next stack slot).
+  auto loadUpperEax(int8_t offset) -> void {
+    bytes({0x8B, 0x41, static_cast<uint8_t>(offset + 4)}); // mov eax, [rcx + offset + 4]
+  }
+
+  auto loadUpperR8d(int8_t offset) -> void {
+    bytes({0x44, 0x8B, 0x41, static_cast<uint8_t>(offset + 4)}); // mov r8d, [rcx + offset + 4]
+  }
+
+  auto loadUpperXmm0(int8_t offset) -> void {
+    bytes({0xF3, 0x0F, 0x10, 0x41, static_cast<uint8_t>(offset + 4)}); // movss xmm0, [..]
+  }
+
+  auto loadUpperXmm1(int8_t offset) -> void {
+    bytes({0xF3, 0x0F, 0x10, 0x49, static_cast<uint8_t>(offset + 4)}); // movss xmm1, [..]
+  }
+
+  // Store eax as an int value at 'offset' (relative to the next stack slot).
+  auto storeEax(int8_t offset) -> void {
+    bytes({0x48, 0xC1, 0xE0, 0x20});                            // shl rax, 32
+    bytes({0x48, 0x89, 0x41, static_cast<uint8_t>(offset)}); // mov [rcx + offset], rax
+  }
+
+  auto storeXmm0(int8_t offset) -> void {
+    bytes({0x66, 0x0F, 0x7E, 0xC0}); // movd eax, xmm0
+    storeEax(offset);
+  }
+
+  // Store the flag 'CC' as a bool value at 'offset' (relative to the next stack slot).
+  auto storeFlag(uint8_t setCC, int8_t offset) -> void {
+    bytes({0x0F, setCC, 0xC0});  // setcc al
+    bytes({0x0F, 0xB6, 0xC0});   // movzx eax, al
+    storeEax(offset);
+  }
+
+  auto loadStackHome(uint16_t index) -> void {
+    bytes({0x48, 0x8B, 0x87}); // mov rax, [rdi + index * 8]
+    imm32(index * 8U);
+  }
+
+  auto storeStackHome(uint16_t index) -> void {
+    bytes({0x48, 0x89, 0x87}); // mov [rdi + index * 8], rax
+    imm32(index * 8U);
+  }
+
+  // Replace the struct reference in rax by the value of one of its fields.
+  auto loadFieldRax(uint8_t field) -> void {
+    bytes({0x48, 0x83, 0xE0, 0xFE}); // and rax, ~refTag
+    bytes({0x48, 0x8B, 0x80});       // mov rax, [rax + fieldOffset]
+    imm32(static_cast<uint32_t>(sizeof(StructRef) + field * sizeof(Value)));
+  }
+
+  // Emit a jump with a relative target, returns the position of the target to patch.
+  auto jump() -> size_t {
+    bytes({0xE9});
+    imm32(0);
+    return getPos() - 4;
+  }
+
+  auto jumpIf(uint8_t jCC) -> size_t {
+    bytes({0x0F, jCC});
+    imm32(0);
+    return getPos() - 4;
+  }
+
+private:
+  std::vector<uint8_t> m_buffer;
+};
+
+// Condition codes.
+const uint8_t setE  = 0x94;
+const uint8_t setA  = 0x97;
+const uint8_t setL  = 0x9C;
+const uint8_t setG  = 0x9F;
+const uint8_t jE    = 0x84;
+const uint8_t jNE   = 0x85;
+const uint8_t jL    = 0x8C;
+const uint8_t jG    = 0x8F;
+
+// Check if native code can be generated for the given instruction.
+auto isNative(const Instr& instr) noexcept -> bool {
+  switch (instr.op) {
+  case OpCode::LoadLitInt:
+  case OpCode::LoadLitFloat:
+  case OpCode::LoadLitString:
+  case OpCode::LoadLitIp:
+  case OpCode::StackLoad:
+  case OpCode::StackStore:
+  case OpCode::AddInt:
+  case OpCode::SubInt:
+  case OpCode::MulInt:
+  case OpCode::AndInt:
+  case OpCode::OrInt:
+  case OpCode::XorInt:
+  case OpCode::NegInt:
+  case OpCode::InvInt:
+  case OpCode::AddFloat:
+  case OpCode::SubFloat:
+  case OpCode::MulFloat:
+  case OpCode::DivFloat:
+  case OpCode::NegFloat:
+  case OpCode::ConvIntFloat:
+  case OpCode::CheckEqInt:
+  case OpCode::CheckGtInt:
+  case OpCode::CheckLeInt:
+  case OpCode::CheckEqFloat:
+  case OpCode::CheckGtFloat:
+  case OpCode::CheckLeFloat:
+  case OpCode::CheckIntZero:
+  case OpCode::CheckStructNull:
+  case OpCode::MakeNullStruct:
+  case OpCode::StructLoadField:
+  case OpCode::UnionWrap:
+  case OpCode::UnionCheck:
+  case OpCode::Jump:
+  case OpCode::JumpIf:
+  case OpCode::Dup:
+  case OpCode::Pop:
+  case OpCode::Swap:
+  case OpCode::StackLoadField:
+  case OpCode::StackLoadLoad:
+  case OpCode::StackStoreLoad:
+  case OpCode::DupStructLoadField:
+  case OpCode::AddIntLit:
+  case OpCode::SubIntLit:
+  case OpCode::CheckEqIntLit:
+  case OpCode::JumpIfZero:
+  case OpCode::JumpIfEqInt:
+  case OpCode::JumpIfGtInt:
+  case OpCode::JumpIfLeInt:
+  case OpCode::JumpIfEqIntLit:
+    return true;
+  case OpCode::LoadLitLong:
+    return isSmallLong(instr.longArg); // Big longs need an allocation.
+  case OpCode::StackAlloc:
+    return instr.halfArg <= maxNativeStackAlloc;
+  default:
+    return false;
+  }
+}
+
+inline auto hasJumpTarget(OpCode op) noexcept -> bool {
+  switch (op) {
+  case OpCode::Jump:
+  case OpCode::JumpIf:
+  case OpCode::JumpIfZero:
+  case OpCode::JumpIfEqInt:
+  case OpCode::JumpIfGtInt:
+  case OpCode::JumpIfLeInt:
+  case OpCode::JumpIfEqIntLit:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Emit the template for a single instruction.
+// Returns the position of the jump target to patch (for jump instructions).
+auto emitInstr(Emitter* e, const Program* program, const Instr& instr) noexcept -> size_t {
+  switch (instr.op) {
+  case OpCode::LoadLitInt:
+    e->pushRaw(intValue(instr.intArg).getRaw());
+    break;
+  case OpCode::LoadLitLong:
+    e->pushRaw(smallLongValue(instr.longArg).getRaw());
+    break;
+  case OpCode::LoadLitFloat:
+    e->pushRaw(floatValue(instr.floatArg).getRaw());
+    break;
+  case OpCode::LoadLitString:
+    // String literals are immortal so the reference can be embedded in the code.
+    e->pushRaw(refValue(program->getLitString(instr.uintArg)).getRaw());
+    break;
+  case OpCode::LoadLitIp:
+    e->pushRaw(uintValue(instr.uintArg).getRaw());
+    break;
+  case OpCode::MakeNullStruct:
+    e->pushRaw(nullRefValue().getRaw());
+    break;
+  case OpCode::StackAlloc:
+    for (auto i = 0U; i != instr.halfArg; ++i) {
+      e->bytes({0x48, 0xC7, 0x81}); // mov qword [rcx + i * 8], 0
+      e->imm32(i * 8U);
+      e->imm32(0U);
+    }
+    e->bytes({0x48, 0x81, 0xC1}); // add rcx, amount * 8
+    e->imm32(instr.halfArg * 8U);
+    break;
+  case OpCode::StackLoad:
+    e->loadStackHome(instr.halfArg);
+    e->pushRax();
+    break;
+  case OpCode::StackStore:
+    e->popDiscard(1);
+    e->bytes({0x48, 0x8B, 0x01}); // mov rax, [rcx]
+    e->storeStackHome(instr.halfArg);
+    break;
+
+  case OpCode::AddInt:
+  case OpCode::SubInt:
+  case OpCode::MulInt:
+  case OpCode::AndInt:
+  case OpCode::OrInt:
+  case OpCode::XorInt:
+    e->loadUpperEax(-16);
+    e->loadUpperR8d(-8);
+    switch (instr.op) {
+    case OpCode::AddInt:
+      e->bytes({0x44, 0x01, 0xC0}); // add eax, r8d
+      break;
+    case OpCode::SubInt:
+      e->bytes({0x44, 0x29, 0xC0}); // sub eax, r8d
+      break;
+    case OpCode::MulInt:
+      e->bytes({0x41, 0x0F, 0xAF, 0xC0}); // imul eax, r8d
+      break;
+    case OpCode::AndInt:
+      e->bytes({0x44, 0x21, 0xC0}); // and eax, r8d
+      break;
+    case OpCode::OrInt:
+      e->bytes({0x44, 0x09, 0xC0}); // or eax, r8d
+      break;
+    default:
+      e->bytes({0x44, 0x31, 0xC0}); // xor eax, r8d
+      break;
+    }
+    e->storeEax(-16);
+    e->popDiscard(1);
+    break;
+  case OpCode::NegInt:
+    e->loadUpperEax(-8);
+    e->bytes({0xF7, 0xD8}); // neg eax
+    e->storeEax(-8);
+    break;
+  case OpCode::InvInt:
+    e->loadUpperEax(-8);
+    e->bytes({0xF7, 0xD0}); // not eax
+    e->storeEax(-8);
+    break;
+  case OpCode::AddIntLit:
+    e->loadUpperEax(-8);
+    e->bytes({0x05}); // add eax, imm32
+    e->imm32(static_cast<uint32_t>(instr.intArg));
+    e->storeEax(-8);
+    break;
+  case OpCode::SubIntLit:
+    e->loadUpperEax(-8);
+    e->bytes({0x2D}); // sub eax, imm32
+    e->imm32(static_cast<uint32_t>(instr.intArg));
+    e->storeEax(-8);
+    break;
+
+  case OpCode::AddFloat:
+  case OpCode::SubFloat:
+  case OpCode::MulFloat:
+  case OpCode::DivFloat:
+    e->loadUpperXmm0(-16);
+    e->loadUpperXmm1(-8);
+    switch (instr.op) {
+    case OpCode::AddFloat:
+      e->bytes({0xF3, 0x0F, 0x58, 0xC1}); // addss xmm0, xmm1
+      break;
+    case OpCode::SubFloat:
+      e->bytes({0xF3, 0x0F, 0x5C, 0xC1}); // subss xmm0, xmm1
+      break;
+    case OpCode::MulFloat:
+      e->bytes({0xF3, 0x0F, 0x59, 0xC1}); // mulss xmm0, xmm1
+      break;
+    default:
+      e->bytes({0xF3, 0x0F, 0x5E, 0xC1}); // divss xmm0, xmm1
+      break;
+    }
+    e->storeXmm0(-16);
+    e->popDiscard(1);
+    break;
+  case OpCode::NegFloat:
+    e->loadUpperEax(-8);
+    e->bytes({0x35}); // xor eax, signBit
+    e->imm32(0x80000000U);
+    e->storeEax(-8);
+    break;
+  case OpCode::ConvIntFloat:
+    e->loadUpperEax(-8);
+    e->bytes({0xF3, 0x0F, 0x2A, 0xC0}); // cvtsi2ss xmm0, eax
+    e->storeXmm0(-8);
+    break;
+
+  case OpCode::CheckEqInt:
+  case OpCode::CheckGtInt:
+  case OpCode::CheckLeInt:
+    e->loadUpperEax(-16);
+    e->loadUpperR8d(-8);
+    e->bytes({0x44, 0x39, 0xC0}); // cmp eax, r8d
+    e->storeFlag(
+        instr.op == OpCode::CheckEqInt ? setE : instr.op == OpCode::CheckGtInt ? setG : setL, -16);
+    e->popDiscard(1);
+    break;
+  case OpCode::CheckEqIntLit:
+    e->loadUpperEax(-8);
+    e->bytes({0x3D}); // cmp eax, imm32
+    e->imm32(static_cast<uint32_t>(instr.intArg));
+    e->storeFlag(setE, -8);
+    break;
+  case OpCode::CheckEqFloat:
+    // Unordered (nan) operands set the zero flag as well, so also check the parity flag.
+    e->loadUpperXmm0(-16);
+    e->loadUpperXmm1(-8);
+    e->bytes({0x0F, 0x2E, 0xC1});       // ucomiss xmm0, xmm1
+    e->bytes({0x0F, setE, 0xC0});       // sete al
+    e->bytes({0x41, 0x0F, 0x9B, 0xC0}); // setnp r8b
+    e->bytes({0x44, 0x20, 0xC0});       // and al, r8b
+    e->bytes({0x0F, 0xB6, 0xC0});       // movzx eax, al
+    e->storeEax(-16);
+    e->popDiscard(1);
+    break;
+  case OpCode::CheckGtFloat:
+    e->loadUpperXmm0(-16);
+    e->loadUpperXmm1(-8);
+    e->bytes({0x0F, 0x2E, 0xC1}); // ucomiss xmm0, xmm1
+    e->storeFlag(setA, -16);
+    e->popDiscard(1);
+    break;
+  case OpCode::CheckLeFloat:
+    e->loadUpperXmm0(-16);
+    e->loadUpperXmm1(-8);
+    e->bytes({0x0F, 0x2E, 0xC8}); // ucomiss xmm1, xmm0
+    e->storeFlag(setA, -16);
+    e->popDiscard(1);
+    break;
+  case OpCode::CheckIntZero:
+    e->loadUpperEax(-8);
+    e->bytes({0x85, 0xC0}); // test eax, eax
+    e->storeFlag(setE, -8);
+    break;
+  case OpCode::CheckStructNull:
+    e->bytes({0x48, 0x8B, 0x41, 0xF8}); // mov rax, [rcx - 8]
+    e->bytes({0x48, 0x83, 0xF8});       // cmp rax, nullRef
+    e->bytes({static_cast<uint8_t>(nullRefValue().getRaw())});
+    e->storeFlag(setE, -8);
+    break;
+
+  case OpCode::StructLoadField:
+    e->bytes({0x48, 0x8B, 0x41, 0xF8}); // mov rax, [rcx - 8]
+    e->loadFieldRax(instr.byteArg);
+    e->bytes({0x48, 0x89, 0x41, 0xF8}); // mov [rcx - 8], rax
+    break;
+  case OpCode::UnionWrap:
+    // Keep the payload in the upper 32 bits and store the discriminant above the ref tag.
+    e->bytes({0x48, 0x8B, 0x41, 0xF8}); // mov rax, [rcx - 8]
+    e->bytes({0x48, 0xC1, 0xE8, 0x20}); // shr rax, 32
+    e->bytes({0x48, 0xC1, 0xE0, 0x20}); // shl rax, 32
+    e->bytes({0x48, 0x0D});             // or rax, discriminant << 1
+    e->imm32(static_cast<uint32_t>(instr.byteArg) << 1U);
+    e->bytes({0x48, 0x89, 0x41, 0xF8}); // mov [rcx - 8], rax
+    break;
+  case OpCode::UnionCheck:
+    e->bytes({0x8B, 0x41, 0xF8}); // mov eax, [rcx - 8]
+    e->bytes({0xD1, 0xE8});       // shr eax, 1
+    e->bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+    e->bytes({0x3D});             // cmp eax, discriminant
+    e->imm32(instr.byteArg);
+    e->storeFlag(setE, -8);
+    break;
+  case OpCode::StackLoadField:
+    e->loadStackHome(instr.halfArg);
+    e->loadFieldRax(instr.byteArg);
+    e->pushRax();
+    break;
+  case OpCode::DupStructLoadField:
+    e->bytes({0x48, 0x8B, 0x41, 0xF8}); // mov rax, [rcx - 8]
+    e->loadFieldRax(instr.byteArg);
+    e->pushRax();
+    break;
+  case OpCode::StackLoadLoad:
+    e->loadStackHome(instr.halfArg);
+    e->pushRax();
+    e->loadStackHome(static_cast<uint16_t>(instr.intArg));
+    e->pushRax();
+    break;
+  case OpCode::StackStoreLoad:
+    e->bytes({0x48, 0x8B, 0x41, 0xF8}); // mov rax, [rcx - 8]
+    e->storeStackHome(instr.halfArg);
+    e->loadStackHome(static_cast<uint16_t>(instr.intArg));
+    e->bytes({0x48, 0x89, 0x41, 0xF8}); // mov [rcx - 8], rax
+    break;
+
+  case OpCode::Dup:
+    e->bytes({0x48, 0x8B, 0x41, 0xF8}); // mov rax, [rcx - 8]
+    e->pushRax();
+    break;
+  case OpCode::Pop:
+    e->popDiscard(1);
+    break;
+  case OpCode::Swap:
+    e->bytes({0x48, 0x8B, 0x41, 0xF8}); // mov rax, [rcx - 8]
+    e->bytes({0x4C, 0x8B, 0x41, 0xF0}); // mov r8, [rcx - 16]
+    e->bytes({0x48, 0x89, 0x41, 0xF0}); // mov [rcx - 16], rax
+    e->bytes({0x4C, 0x89, 0x41, 0xF8}); // mov [rcx - 8], r8
+    break;
+
+  case OpCode::Jump:
+    return e->jump();
+  case OpCode::JumpIf:
+  case OpCode::JumpIfZero:
+    e->popDiscard(1);
+    e->bytes({0x8B, 0x41, 0x04}); // mov eax, [rcx + 4]
+    e->bytes({0x85, 0xC0});       // test eax, eax
+    return e->jumpIf(instr.op == OpCode::JumpIf ? jNE : jE);
+  case OpCode::JumpIfEqInt:
+  case OpCode::JumpIfGtInt:
+  case OpCode::JumpIfLeInt:
+    e->loadUpperEax(-16);
+    e->loadUpperR8d(-8);
+    e->popDiscard(2);
+    e->bytes({0x44, 0x39, 0xC0}); // cmp eax, r8d
+    return e->jumpIf(
+        instr.op == OpCode::JumpIfEqInt ? jE : instr.op == OpCode::JumpIfGtInt ? jG : jL);
+  case OpCode::JumpIfEqIntLit:
+    e->popDiscard(1);
+    e->bytes({0x8B, 0x41, 0x04}); // mov eax, [rcx + 4]
+    e->bytes({0x3D});             // cmp eax, imm32
+    e->imm32(static_cast<uint32_t>(instr.intArg));
+    return e->jumpIf(jE);
+  default:
+    assert(false); // Not supported, should have been filtered out by 'isNative'.
+    break;
+  }
+  return 0U;
+}
+
+// Allocate executable memory containing the given code.
+auto mapCode(const std::vector<uint8_t>& code, size_t* size) noexcept -> void* {
+  const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  *size               = (code.size() + pageSize - 1U) / pageSize * pageSize;
+
+  auto* mem = mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (unlikely(mem == MAP_FAILED)) {
+    return nullptr;
+  }
+  std::memcpy(mem, code.data(), code.size());
+  if (unlikely(mprotect(mem, *size, PROT_READ | PROT_EXEC) != 0)) {
+    munmap(mem, *size);
+    return nullptr;
+  }
+  return mem;
+}
+
+} // namespace
+
+auto Jit::compile(uint32_t entryIndex) noexcept -> JitCode {
+  auto lk = std::lock_guard<std::mutex>{m_compileMutex};
+
+  // Another executor might have compiled this function while we were waiting for the lock.
+  if (auto code = m_code[entryIndex].load(std::memory_order_acquire)) {
+    return code;
+  }
+
+  const auto* instrs    = m_program->getInstr(0);
+  const auto instrCount = static_cast<uint32_t>(m_program->getInstrCount());
+  if (!isNative(instrs[entryIndex])) {
+    return nullptr; // Nothing to gain by compiling this function.
+  }
+
+  // Find all the instructions that are reachable from the entry without leaving native code.
+  auto reachable   = std::vector<bool>(instrCount, false);
+  auto entryPoints = std::vector<uint32_t>{entryIndex};
+  auto pending     = std::vector<uint32_t>{entryIndex};
+  while (!pending.empty()) {
+    const auto index = pending.back();
+    pending.pop_back();
+    if (reachable[index]) {
+      continue;
+    }
+    reachable[index]  = true;
+    const auto& instr = instrs[index];
+    if (isNative(instr)) {
+      if (hasJumpTarget(instr.op)) {
+        pending.push_back(static_cast<uint32_t>(instr.target - instrs));
+      }
+      if (instr.op != OpCode::Jump) {
+        pending.push_back(index + 1U);
+      }
+    } else if (instr.op == OpCode::Call || instr.op == OpCode::CallDyn) {
+      // Execution continues at the next instruction when the called function returns.
+      if (isNative(instrs[index + 1U])) {
+        entryPoints.push_back(index + 1U);
+      }
+      pending.push_back(index + 1U);
+    }
+  }
+
+  // Emit the instructions in order, so execution can fall through to the next instruction.
+  auto e           = Emitter{};
+  auto labels      = std::vector<uint32_t>(instrCount, noLabel);
+  auto jumpFixups  = std::vector<std::pair<size_t, uint32_t>>{};
+  auto pollFixups  = std::vector<std::pair<size_t, uint32_t>>{};
+  for (auto index = 0U; index != instrCount; ++index) {
+    if (!reachable[index]) {
+      continue;
+    }
+    labels[index]     = static_cast<uint32_t>(e.getPos());
+    const auto& instr = instrs[index];
+    if (!isNative(instr)) {
+      e.exit(&instr);
+      continue;
+    }
+    const auto isBackwardsJump = hasJumpTarget(instr.op) && instr.target <= &instr;
+    if (isBackwardsJump) {
+      // Poll the request flag to avoid looping in native code while a pause is requested.
+      e.bytes({0x83, 0x3A, 0x00}); // cmp dword [rdx], 0
+      pollFixups.emplace_back(e.jumpIf(jNE), index);
+    }
+    const auto jumpPos = emitInstr(&e, m_program, instr);
+    if (hasJumpTarget(instr.op)) {
+      jumpFixups.emplace_back(jumpPos, static_cast<uint32_t>(instr.target - instrs));
+    }
+  }
+
+  // Exit stubs for the backwards jumps, continue at the jump instruction in the interpreter.
+  for (const auto& [pos, index] : pollFixups) {
+    e.patchRel32(pos, e.getPos());
+    e.exit(instrs + index);
+  }
+  for (const auto& [pos, index] : jumpFixups) {
+    e.patchRel32(pos, labels[index]);
+  }
+
+  // Entry stubs, load the next stack slot into rcx and jump to the instruction.
+  auto entryOffsets = std::vector<size_t>{};
+  for (const auto index : entryPoints) {
+    entryOffsets.push_back(e.getPos());
+    e.bytes({0x48, 0x8B, 0x0E}); // mov rcx, [rsi]
+    e.patchRel32(e.jump(), labels[index]);
+  }
+
+  size_t size;
+  auto* mem = mapCode(e.getBuffer(), &size);
+  if (unlikely(mem == nullptr)) {
+    return nullptr;
+  }
+  m_blocks.push_back({mem, size});
+
+  // Publish the entry points, entry points that already have code (from a different function
+  // that shares instructions) are left alone as the code for an instruction is always the same.
+  for (auto i = 0U; i != entryPoints.size(); ++i) {
+    // NOLINTNEXTLINE: Reinterpret cast
+    auto code     = reinterpret_cast<JitCode>(static_cast<uint8_t*>(mem) + entryOffsets[i]);
+    auto expected = JitCode{nullptr};
+    m_code[entryPoints[i]].compare_exchange_strong(expected, code, std::memory_order_acq_rel);
+  }
+  return m_code[entryIndex].load(std::memory_order_acquire);
+}
+
+#else // !VM_JIT
+
+Jit::~Jit() noexcept = default;
+
+auto Jit::compile(uint32_t /*unused*/) noexcept -> JitCode { return nullptr; }
+
+#endif // !VM_JIT
+
+} // namespace vm::internal
@@ -0,0 +1,94 @@
+#pragma once
+#include "internal/intrinsics.hpp"
+#include "internal/program.hpp"
+#include "internal/value.hpp"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// The jit is only available on x86-64 linux.
+#if defined(__x86_64__) && defined(__linux__)
+#define VM_JIT 1
+#else
+#define VM_JIT 0
+#endif
+
+namespace vm::internal {
+
+// Generated native code for a function.
+// Executes instructions starting at an entry point until an instruction is reached that the
+// generated code does not support (calls, returns, allocations, platform-calls etc), that
+// instruction is returned so the interpreter can continue from there.
+//
+// 'sh' is the stack-home of the current stack-frame and 'next' the next free stack slot (updated
+// when returning). 'requestFlag' is polled on backwards jumps, when a pause or abort is requested
+// the generated code returns to the interpreter so it can reach a safe-point.
+using JitCode = const Instr* (*)(Value* sh, Value** next, const void* requestFlag) noexcept;
+
+/* Baseline template compiler.
+ * Counts the calls to every function and once a function has been called 'threshold' times its
+ * instructions are translated to native code by concatenating fixed machine-code templates per
+ * instruction. The generated code operates directly on the executor stack, using the same value
+ * representation as the interpreter, so execution can move between the two at any instruction.
+ *
+ * Entry points are created for the start of the function and for the instructions after calls
+ * (where execution continues when the called function returns).
+ *
+ * NOTE: Shared between all executors, functions are compiled by the first executor that crosses
+ * the threshold.
+ */
+class Jit final {
+public:
+  Jit(const Program* program, uint32_t threshold) noexcept;
+  Jit(const Jit& rhs) = delete;
+  Jit(Jit&& rhs)      = delete;
+  ~Jit() noexcept;
+
+  auto operator=(const Jit& rhs) -> Jit& = delete;
+  auto operator=(Jit&& rhs) -> Jit& = delete;
+
+  // Is the jit available on this platform.
+  [[nodiscard]] static auto isSupported() noexcept -> bool { return VM_JIT != 0; }
+
+  // Called when entering the function that starts at the given instruction. Counts the call and
+  // compiles the function when it becomes hot.
+  // Returns the native code for the function or nullptr if the function is not compiled (yet).
+  [[nodiscard]] inline auto enterFunction(const Instr* entry) noexcept -> JitCode {
+    const auto index = getIndex(entry);
+    auto code        = m_code[index].load(std::memory_order_acquire);
+    if (likely(code != nullptr)) {
+      return code;
+    }
+    if (unlikely(m_counters[index].fetch_add(1U, std::memory_order_relaxed) == m_threshold)) {
+      return compile(index);
+    }
+    return nullptr;
+  }
+
+  // Lookup the native code for continuing at the given instruction, returns nullptr if there is no
+  // native code entry point for the instruction.
+  [[nodiscard]] inline auto getCode(const Instr* instr) const noexcept -> JitCode {
+    return m_code[getIndex(instr)].load(std::memory_order_acquire);
+  }
+
+private:
+  struct CodeBlock {
+    void* mem;
+    size_t size;
+  };
+
+  const Program* m_program;
+  uint32_t m_threshold;
+  std::vector<std::atomic<JitCode>> m_code;       // Native entry point per instruction.
+  std::vector<std::atomic<uint32_t>> m_counters; // Call count per function entry instruction.
+  std::vector<CodeBlock> m_blocks;
+  std::mutex m_compileMutex;
+
+  [[nodiscard]] inline auto getIndex(const Instr* instr) const noexcept -> uint32_t {
+    return static_cast<uint32_t>(instr - m_program->getInstr(0));
+  }
+
+  auto compile(uint32_t entryIndex) noexcept -> JitCode;
+};
+
+} // namespace vm::internal
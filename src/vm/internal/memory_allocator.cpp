@@ -1,43 +1,104 @@
 #include "internal/memory_allocator.hpp"
+#include "internal/intrinsics.hpp"
 #include "internal/os_include.hpp"
-#include "intrinsics.hpp"
+#include <algorithm>
 #include <cassert>
-#include <mutex>
-#include <vector>
+#include <cstdlib>
+#include <new>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 namespace vm::internal {
 
 /*
-Naive allocator, allocations for 'chunkSize' or less are allocated from a 'pool' of
-chunks. Bigger allocations are handled through the systems 'malloc' and 'free'.
+Page-organized heap, allocations of 'maxChunkSize' or less are rounded up to the nearest size-class
+and allocated from an 'area' that holds chunks of that size. Bigger allocations are handled through
+the systems 'malloc' and 'free' (which maps big allocations directly from the system), they are
+tracked in a linked list.
+
+Size-classes are multiples of 8 bytes up to 64 bytes, multiples of 16 bytes up to 128 bytes, above
+that there are four classes per power of two (so at most 25% of a chunk is wasted).
+
+Areas are 'heapAreaSize' bytes and aligned to their size, they start with a header followed by
+bitmaps with a bit per chunk (see 'HeapArea'). There are no per allocation headers or lists, the
+state of a chunk is only stored in the bitmaps of its area. This keeps marking and sweeping away
+from the memory of the allocations themselves: sweeping walks the bitmaps of the areas linearly and
+only touches the memory of an allocation if it needs to be finalized.
+
+Each thread has a thread-cache with a 'cursor' per size-class that points into the area that the
+thread allocates from, allocating takes the next free chunk from the current bitmap word of the
+cursor without any synchronization. When the area runs out of free chunks it is 'retired' and an
+area with free chunks (or a new area) is acquired from the heap of the size-class.
+
+Nothing is freed while allocating, only 'sweep' frees (all unmarked chunks) while no allocations
+are being made. Sweeping afterwards makes the areas with free chunks (that are not owned by a
+thread) available to be acquired again.
+
+Free memory is returned to the system on 'release' (called by the garbage collector after a
+collection): areas without allocations are unmapped and the pages in other areas that only contain
+free chunks are released to the system ('madvise' / 'VirtualAlloc(MEM_RESET)'). Released pages are
+faulted back in when the area is acquired and the pages are written to again. Normal releases only
+return the memory of areas that have not been acquired since the previous release, this way memory
+that is recycled between collections is not released and faulted in again.
+
+The heap size is the amount of memory taken from the system (used areas plus 'malloc' allocations)
+minus the released memory, when the heap limit is enforced allocations that need to grow the heap
+fail.
+*/
 
-When an allocation for a chunk comes in it tries to satisfy it from a thread-cache, if the
-thread-cache is empty it refills the thread-cache from a global cache. If the global cache is empty
-it will allocate new memory from the system.
+const unsigned int maxChunkSize     = 4096U;
+const unsigned int sizeClassCount   = 32U;
+const unsigned int heapAreaMapBatch = 32U; // Amount of areas to map from the system at once.
 
-When free-ing a chunk it is placed on the thread-cache, if the thread-cache reaches capacity
-'maxChunksPerThread' it will move the set to the global cache.
+// Only trim the 'malloc' heap when at least this amount has been freed since the last release.
+const size_t largeTrimMinFreed = 1024U * 1024U; // 1 MiB
 
-Note: Current implementation of the garbage collector free's only on the gc-thread and no
-allocations happen on the gc-thread. Implementation of the MemoryAllocator should NOT rely on that
-being true but it can be taken into account when tuning performance.
+static std::atomic<uint64_t> nextAllocatorId{1U};
 
-Note: All allocations are aligned to multiples of 64 bytes from the systems virtual page start.
+// Thread-cache of the current thread, only valid if 'allocatorId' matches the id of the allocator
+// (as multiple allocators can exist during the lifetime of a thread).
+struct ThreadCacheRef {
+  uint64_t allocatorId;
+  void* cache;
+};
 
-Note: Pooled memory is never returned back to the system at the moment.
-*/
+thread_local static ThreadCacheRef threadCacheRef;
 
-// On MinGW there is a bug in thread_local objects with destructors.
-// More info: https://sourceforge.net/p/mingw-w64/bugs/527/
-// as a workaround we disable our custom allocator and fall back to the systems 'malloc' / 'free'.
-// TODO(bastian): Investigate which MinGw versions are affected.
-#if defined(__MINGW32__)
-#define CUSTOM_ALLOCATOR_ENABLED false
-#else // !__MINGW32__
-#define CUSTOM_ALLOCATOR_ENABLED true
-#endif
+// Allocators that are alive, used to release the thread-cache of a thread that exits while its
+// thread-cache is still in use. Executors release their thread-cache when they finish, but forked
+// executors can be resumed on another thread (see scheduler.hpp) leaving the cache of the previous
+// thread in use.
+static std::mutex g_allocatorsMutex;
+static MemoryAllocator* g_allocatorsHead;
+
+struct ThreadExitGuard {
+  bool armed = false;
+
+  ThreadExitGuard() noexcept = default;
+  ThreadExitGuard(const ThreadExitGuard& rhs) = delete;
+  ThreadExitGuard(ThreadExitGuard&& rhs)      = delete;
+  ~ThreadExitGuard() noexcept {
+    if (!armed || threadCacheRef.allocatorId == 0U) {
+      return;
+    }
+    auto lk = std::lock_guard<std::mutex>{g_allocatorsMutex};
+    for (auto* allocator = g_allocatorsHead; allocator; allocator = allocator->m_nextAlive) {
+      if (allocator->m_id == threadCacheRef.allocatorId) {
+        allocator->releaseThreadCache();
+        break;
+      }
+    }
+  }
+
+  auto operator=(const ThreadExitGuard& rhs) -> ThreadExitGuard& = delete;
+  auto operator=(ThreadExitGuard&& rhs) -> ThreadExitGuard& = delete;
+};
 
-#if CUSTOM_ALLOCATOR_ENABLED
+// NOTE: Only accessed when acquiring a thread-cache (which registers the destructor), this way the
+// allocation fast-path only touches 'threadCacheRef'.
+thread_local static ThreadExitGuard threadExitGuard;
 
 #if defined(_WIN32)
 static auto getpagesize() -> unsigned int {
@@ -47,179 +108,617 @@ static auto getpagesize() -> unsigned int {
 }
 #endif
 
-const unsigned int pageSize                 = getpagesize(); // Systems virtual page-size.
-const unsigned int pagesPerArea             = 50U;
-const unsigned int areaSize                 = pageSize * pagesPerArea;
-const unsigned int chunkSize                = 64U;
-const unsigned int chunksPerArea            = areaSize / chunkSize;
-const unsigned int maxChunksPerThread       = chunksPerArea;
-const unsigned int preAllocateChunkSetCount = 10U;
-
-enum class MemTag : uint8_t {
-  MAlloc = 0,
-  Chunk  = 1,
-};
-
-struct Chunk {
-  Chunk* next;
-};
+const unsigned int pageSize     = getpagesize(); // Systems virtual page-size.
+const unsigned int pagesPerArea = std::max(static_cast<unsigned int>(heapAreaSize / pageSize), 1U);
 
-struct ChunkSet {
-  Chunk* head;
-  unsigned int count;
-};
+// Chunk size of a size-class.
+constexpr auto getClassSize(unsigned int sizeClass) noexcept -> unsigned int {
+  // Multiples of 8 up to 64, multiples of 16 up to 128, above that four classes per power of two.
+  if (sizeClass < 8U) {
+    return (sizeClass + 1U) * 8U;
+  }
+  if (sizeClass < 12U) {
+    return 64U + (sizeClass - 7U) * 16U;
+  }
+  const auto pow2 = 128U << ((sizeClass - 12U) / 4U);
+  return pow2 + (pow2 / 4U) * ((sizeClass - 12U) % 4U + 1U);
+}
 
-static auto getChunkSet() noexcept -> ChunkSet;
-static auto freeChunkSet(ChunkSet s) noexcept -> void;
+static_assert(getClassSize(sizeClassCount - 1) == maxChunkSize);
+static_assert(sizeClassCount + 1U <= UINT8_MAX);
 
-struct ThreadCache {
-  ChunkSet chunks;
+// Lookup table from the size (in multiples of 8 rounded up) to the size-class.
+struct SizeClassTable {
+  uint8_t classes[maxChunkSize / 8U + 1];
 
-  ~ThreadCache() noexcept {
-    if (chunks.count > 0) {
-      freeChunkSet(chunks);
+  constexpr SizeClassTable() noexcept : classes{} {
+    auto sizeClass = 0U;
+    for (auto i = 0U; i != maxChunkSize / 8U + 1; ++i) {
+      while (getClassSize(sizeClass) < i * 8U) {
+        ++sizeClass;
+      }
+      classes[i] = static_cast<uint8_t>(sizeClass);
     }
   }
 };
 
-thread_local static ThreadCache threadCache;
+constexpr SizeClassTable sizeClassTable{};
 
-static std::mutex globalChunksMutex;
-static std::vector<ChunkSet> globalChunkSets;
-static bool chunkSetsPreAllocated;
+inline auto getSizeClass(unsigned int size) noexcept -> unsigned int {
+  assert(size <= maxChunkSize);
+  return sizeClassTable.classes[(size + 7U) / 8U];
+}
+
+// MemTag of pooled allocations is the size-class offset by one ('heapLargeMemTag' is zero).
+inline auto getMemTag(unsigned int sizeClass) noexcept -> uint8_t {
+  return static_cast<uint8_t>(sizeClass + 1U);
+}
+
+// Area the thread allocates from and the free chunks in the current bitmap word of that area.
+struct ClassCursor {
+  HeapArea* area;
+  unsigned int word;
+  uint64_t freeBits;
+};
+
+struct MemoryAllocator::ThreadCache {
+  ClassCursor cursors[sizeClassCount];
+  bool inUse;
+};
+
+// Areas of a single size-class.
+struct MemoryAllocator::ClassHeap {
+  std::mutex mutex;
+  std::vector<HeapArea*> areas;     // All areas of this size-class.
+  std::vector<HeapArea*> available; // Areas with free chunks that are not owned by a thread.
+};
 
 #if defined(_WIN32)
-inline auto mapArea() noexcept -> void* {
-  return VirtualAlloc(nullptr, areaSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+// Allocation granularity of 'VirtualAlloc' is 64 KiB, so areas are aligned to their size.
+static_assert(heapAreaSize == 64U * 1024U);
+
+inline auto mapAreas(std::vector<HeapArea*>* out) noexcept -> bool {
+  auto* res = VirtualAlloc(nullptr, heapAreaSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (unlikely(res == nullptr)) {
+    return false;
+  }
+  if (unlikely((reinterpret_cast<uintptr_t>(res) & (heapAreaSize - 1)) != 0)) {
+    VirtualFree(res, 0, MEM_RELEASE);
+    return false;
+  }
+  out->push_back(static_cast<HeapArea*>(res));
+  return true;
+}
+
+inline auto unmapAreaMemory(HeapArea* area) noexcept -> void {
+  VirtualFree(area, 0, MEM_RELEASE);
+}
+
+// The pages stay reserved and committed, when they are written to again they are faulted back in.
+inline auto releasePages(void* begin, size_t size) noexcept -> void {
+  VirtualAlloc(begin, size, MEM_RESET, PAGE_READWRITE);
 }
 #else // !_WIN32
-inline auto mapArea() noexcept -> void* {
-  auto* res = mmap(nullptr, areaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  return unlikely(res == MAP_FAILED) ? nullptr : res;
+// Map a batch of areas, an extra area is mapped to be able to align the areas to their size.
+inline auto mapAreas(std::vector<HeapArea*>* out) noexcept -> bool {
+  const auto size = heapAreaSize * (heapAreaMapBatch + 1U);
+  auto* res       = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (unlikely(res == MAP_FAILED)) {
+    return false;
+  }
+  const auto begin   = reinterpret_cast<uintptr_t>(res);
+  const auto aligned = (begin + heapAreaSize - 1) & ~(heapAreaSize - 1);
+  const auto end     = aligned + heapAreaSize * heapAreaMapBatch;
+  if (aligned != begin) {
+    munmap(res, aligned - begin);
+  }
+  if (end != begin + size) {
+    munmap(reinterpret_cast<void*>(end), begin + size - end);
+  }
+  for (auto i = heapAreaMapBatch; i-- > 0;) {
+    out->push_back(reinterpret_cast<HeapArea*>(aligned + i * heapAreaSize));
+  }
+  return true;
+}
+
+inline auto unmapAreaMemory(HeapArea* area) noexcept -> void { munmap(area, heapAreaSize); }
+
+// The pages stay mapped, when they are written to again they are faulted back in.
+inline auto releasePages(void* begin, size_t size) noexcept -> void {
+#if defined(__linux__) || !defined(MADV_FREE)
+  madvise(begin, size, MADV_DONTNEED);
+#else
+  madvise(begin, size, MADV_FREE);
+#endif
 }
 #endif
 
-// Allocate an area and fill it with chunks.
-inline auto allocChunkSet() noexcept -> ChunkSet {
-  auto* area = mapArea();
-  if (unlikely(area == nullptr)) {
-    return ChunkSet{nullptr, 0};
+// Initialize the header and the bitmaps of an area for the given size-class.
+inline auto initArea(void* mem, unsigned int sizeClass) noexcept -> HeapArea* {
+  const auto chunkSize = getClassSize(sizeClass);
+  const auto maxWords  = (heapAreaSize / chunkSize + 63U) / 64U;
+  const auto header    = (sizeof(HeapArea) + maxWords * 3U * sizeof(uint64_t) + 63U) & ~63U;
+
+  auto* area         = new (mem) HeapArea{};
+  auto* bits         = reinterpret_cast<uint64_t*>(area + 1);
+  area->chunks       = static_cast<uint8_t*>(mem) + header;
+  area->chunkSize    = chunkSize;
+  area->chunkCount   = static_cast<unsigned int>((heapAreaSize - header) / chunkSize);
+  area->chunkInv     = ((uint64_t{1} << 32U) + chunkSize - 1U) / chunkSize;
+  area->wordCount    = (area->chunkCount + 63U) / 64U;
+  area->sizeClass    = static_cast<uint8_t>(sizeClass);
+  area->allocBits    = bits;
+  area->finalizeBits = bits + maxWords;
+  area->markBits     = reinterpret_cast<std::atomic<uint64_t>*>(bits + maxWords * 2U);
+  for (auto i = 0U; i != maxWords; ++i) {
+    area->allocBits[i]    = 0U;
+    area->finalizeBits[i] = 0U;
+    new (area->markBits + i) std::atomic<uint64_t>{0U};
   }
+  return area;
+}
 
-  auto* begin = static_cast<Chunk*>(area);
-  auto* cur   = begin;
-  for (auto i = 0U; i != chunksPerArea - 1; ++i) {
-    void* curMem  = static_cast<void*>(cur);
-    void* nextMem = static_cast<void*>(static_cast<uint8_t*>(curMem) + chunkSize);
+// Free chunks in the given bitmap word.
+inline auto getFreeBits(const HeapArea* area, unsigned int word) noexcept -> uint64_t {
+  const auto remaining = area->chunkCount - word * 64U;
+  const auto valid     = remaining >= 64U ? ~uint64_t{0} : (uint64_t{1} << remaining) - 1U;
+  return ~area->allocBits[word] & valid;
+}
 
-    cur->next = static_cast<Chunk*>(nextMem);
-    cur       = cur->next;
+inline auto hasFreeChunks(const HeapArea* area) noexcept -> bool {
+  for (auto w = 0U; w != area->wordCount; ++w) {
+    if (getFreeBits(area, w) != 0) {
+      return true;
+    }
   }
+  return false;
+}
 
-  cur->next = nullptr;
-  return ChunkSet{begin, chunksPerArea};
+// Check if any of the chunks in the inclusive range is allocated.
+inline auto hasAllocated(const HeapArea* area, unsigned int first, unsigned int last) noexcept
+    -> bool {
+  for (auto w = first / 64U; w <= last / 64U; ++w) {
+    auto bits = area->allocBits[w];
+    if (w == first / 64U) {
+      bits &= ~uint64_t{0} << (first % 64U);
+    }
+    if (w == last / 64U) {
+      bits &= ~uint64_t{0} >> (63U - last % 64U);
+    }
+    if (bits != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Release the pages of the area that only contain free chunks, returns the amount of released
+// bytes. The first page is never released as it contains the header.
+inline auto releaseFreePages(HeapArea* area) noexcept -> size_t {
+  const auto chunksOffset = static_cast<size_t>(area->chunks - reinterpret_cast<uint8_t*>(area));
+  const auto firstPage    = static_cast<unsigned int>((chunksOffset + pageSize - 1) / pageSize);
+
+  auto* areaMem   = reinterpret_cast<uint8_t*>(area);
+  size_t released = 0U;
+  auto runBegin   = firstPage;
+  for (auto p = firstPage; p <= pagesPerArea; ++p) {
+    bool releasable = false;
+    if (p != pagesPerArea && (area->releasedPages & (uint64_t{1} << p)) == 0) {
+      const auto pageBegin  = p * pageSize - chunksOffset;
+      const auto firstChunk = static_cast<unsigned int>(pageBegin / area->chunkSize);
+      const auto lastChunk  = std::min(
+          static_cast<unsigned int>((pageBegin + pageSize - 1) / area->chunkSize),
+          area->chunkCount - 1U);
+      releasable = firstChunk >= area->chunkCount || !hasAllocated(area, firstChunk, lastChunk);
+    }
+    if (releasable) {
+      area->releasedPages |= uint64_t{1} << p;
+      continue;
+    }
+    // Release the run of pages before this page in a single call.
+    if (p != runBegin) {
+      releasePages(areaMem + runBegin * pageSize, (p - runBegin) * pageSize);
+      released += (p - runBegin) * pageSize;
+    }
+    runBegin = p + 1;
+  }
+  return released;
+}
+
+MemoryAllocator::MemoryAllocator() noexcept :
+    m_id{nextAllocatorId.fetch_add(1U, std::memory_order_relaxed)},
+    m_nextAlive{nullptr},
+    m_heapLimit{0},
+    m_heapSize{0},
+    m_enforcedHeapLimit{0},
+    m_largeFreedSize{0},
+    m_classes{std::make_unique<ClassHeap[]>(sizeClassCount)},
+    m_largeHead{nullptr} {
+  assert(pagesPerArea <= 64U); // Released pages are tracked in a 64 bit mask.
+
+  auto lk          = std::lock_guard<std::mutex>{g_allocatorsMutex};
+  m_nextAlive      = g_allocatorsHead;
+  g_allocatorsHead = this;
 }
 
-inline auto getChunkSet() noexcept -> ChunkSet {
+MemoryAllocator::~MemoryAllocator() noexcept {
   {
-    auto lk = std::lock_guard<std::mutex>{globalChunksMutex};
-    if (!globalChunkSets.empty()) {
-      auto set = globalChunkSets.back();
-      globalChunkSets.pop_back();
-      assert(set.head != nullptr && set.count > 0);
-      return set;
+    auto lk = std::lock_guard<std::mutex>{g_allocatorsMutex};
+    for (auto** link = &g_allocatorsHead; *link; link = &(*link)->m_nextAlive) {
+      if (*link == this) {
+        *link = m_nextAlive;
+        break;
+      }
     }
   }
-  return allocChunkSet();
+  auto* large = m_largeHead;
+  while (large) {
+    auto* next = large->next;
+    std::free(large);
+    large = next;
+  }
+  for (auto sizeClass = 0U; sizeClass != sizeClassCount; ++sizeClass) {
+    for (auto* area : m_classes[sizeClass].areas) {
+      unmapAreaMemory(area);
+    }
+  }
+  for (auto* area : m_freshAreas) {
+    unmapAreaMemory(area);
+  }
 }
 
-inline auto freeChunkSet(ChunkSet chunkSet) noexcept -> void {
-  assert(chunkSet.head != nullptr && chunkSet.count > 0);
+auto MemoryAllocator::alloc(unsigned int size, bool finalize) noexcept
+    -> std::pair<void*, uint8_t> {
+  if (size > maxChunkSize) {
+    return {allocLarge(size, finalize), heapLargeMemTag};
+  }
+  const auto sizeClass = getSizeClass(size);
+  auto* cache          = getThreadCache();
+  auto& cursor         = cache->cursors[sizeClass];
+  if (unlikely(cursor.freeBits == 0) && unlikely(!advanceCursor(cache, sizeClass))) {
+    return {nullptr, heapLargeMemTag};
+  }
 
-  auto lk = std::lock_guard<std::mutex>{globalChunksMutex};
-  globalChunkSets.push_back(chunkSet);
+  // Take the first free chunk of the current bitmap word.
+  const auto bit  = countTrailingZeros(cursor.freeBits);
+  const auto mask = uint64_t{1} << bit;
+  cursor.freeBits &= cursor.freeBits - 1U;
+
+  auto* area = cursor.area;
+  area->allocBits[cursor.word] |= mask;
+  if (finalize) {
+    area->finalizeBits[cursor.word] |= mask;
+  }
+  auto* chunk = area->chunks + (cursor.word * 64U + bit) * area->chunkSize;
+  return {static_cast<void*>(chunk), getMemTag(sizeClass)};
 }
 
-inline auto preAllocateChunkSets() noexcept {
-  globalChunkSets.reserve(preAllocateChunkSetCount);
-  for (auto i = 0U; i != preAllocateChunkSetCount; ++i) {
-    auto chunkSet = allocChunkSet();
-    if (unlikely(chunkSet.head == nullptr)) {
-      return;
+auto MemoryAllocator::allocUnmanaged(unsigned int size) noexcept -> void* {
+  return std::malloc(size);
+}
+
+auto MemoryAllocator::freeUnmanaged(void* memoryPtr) noexcept -> void { std::free(memoryPtr); }
+
+auto MemoryAllocator::releaseThreadCache() noexcept -> void {
+  if (threadCacheRef.allocatorId != m_id) {
+    return; // This thread did not allocate anything.
+  }
+  auto* cache = static_cast<ThreadCache*>(threadCacheRef.cache);
+  for (auto sizeClass = 0U; sizeClass != sizeClassCount; ++sizeClass) {
+    auto& cursor = cache->cursors[sizeClass];
+    if (cursor.area) {
+      retireArea(cursor.area);
     }
-    freeChunkSet(chunkSet);
+    cursor = ClassCursor{};
   }
+  {
+    auto lk      = std::lock_guard<std::mutex>{m_threadCachesMutex};
+    cache->inUse = false;
+  }
+  threadCacheRef = ThreadCacheRef{};
 }
 
-inline auto getThreadChunk() noexcept -> Chunk* {
-  if (threadCache.chunks.count == 0) {
-    threadCache.chunks = getChunkSet();
-    if (unlikely(threadCache.chunks.head == nullptr)) {
-      return nullptr;
+auto MemoryAllocator::clearMarks() noexcept -> void {
+  for (auto sizeClass = 0U; sizeClass != sizeClassCount; ++sizeClass) {
+    for (auto* area : m_classes[sizeClass].areas) {
+      for (auto w = 0U; w != area->wordCount; ++w) {
+        area->markBits[w].store(0U, std::memory_order_relaxed);
+      }
+    }
+  }
+  auto lk = std::lock_guard<std::mutex>{m_largeMutex};
+  for (auto* large = m_largeHead; large; large = large->next) {
+    large->marked.store(false, std::memory_order_relaxed);
+  }
+}
+
+auto MemoryAllocator::sweep(FinalizeFunc finalizer) noexcept -> SweepResult {
+  auto result = SweepResult{0U, 0U};
+  for (auto sizeClass = 0U; sizeClass != sizeClassCount; ++sizeClass) {
+    auto& heap = m_classes[sizeClass];
+    auto lk    = std::lock_guard<std::mutex>{heap.mutex};
+    for (auto* area : heap.areas) {
+      // Free the allocated but unmarked chunks, only the chunks that need to be finalized are
+      // visited individually.
+      auto live = 0U;
+      for (auto w = 0U; w != area->wordCount; ++w) {
+        const auto allocated = area->allocBits[w];
+        const auto marked    = area->markBits[w].load(std::memory_order_relaxed);
+        const auto dead      = allocated & ~marked;
+        if (dead != 0) {
+          for (auto finalize = dead & area->finalizeBits[w]; finalize != 0;
+               finalize &= finalize - 1U) {
+            const auto index = w * 64U + countTrailingZeros(finalize);
+            finalizer(area->chunks + index * area->chunkSize);
+          }
+          area->allocBits[w] = allocated & marked;
+          area->finalizeBits[w] &= marked;
+        }
+        live += popCount(allocated & marked);
+      }
+      result.count += live;
+      result.bytes += static_cast<size_t>(live) * area->chunkSize;
+
+      // Make the area available to be acquired again.
+      if (!area->owned && !area->available && live < area->chunkCount) {
+        area->available = true;
+        heap.available.push_back(area);
+      }
     }
   }
+  sweepLarge(finalizer, &result);
+  return result;
+}
 
-  auto* chunk             = threadCache.chunks.head;
-  threadCache.chunks.head = chunk->next;
-  --threadCache.chunks.count;
-  return chunk;
+auto MemoryAllocator::setHeapLimit(size_t limit) noexcept -> void { m_heapLimit = limit; }
+
+auto MemoryAllocator::getHeapSize() const noexcept -> size_t {
+  return m_heapSize.load(std::memory_order_relaxed);
+}
+
+auto MemoryAllocator::isHeapLimitReached() const noexcept -> bool {
+  return m_heapLimit != 0 && getHeapSize() >= m_heapLimit;
 }
 
-inline auto freeChunk(Chunk* chunk) noexcept -> void {
-  chunk->next             = threadCache.chunks.head;
-  threadCache.chunks.head = chunk;
-  ++threadCache.chunks.count;
+auto MemoryAllocator::setHeapLimitEnforced(bool enforced) noexcept -> void {
+  m_enforcedHeapLimit.store(enforced ? m_heapLimit : 0, std::memory_order_relaxed);
+}
 
-  if (threadCache.chunks.count > maxChunksPerThread) {
-    freeChunkSet(threadCache.chunks);
-    threadCache.chunks = ChunkSet{};
+auto MemoryAllocator::isHeapLimitEnforced() const noexcept -> bool {
+  return m_enforcedHeapLimit.load(std::memory_order_relaxed) != 0;
+}
+
+auto MemoryAllocator::release(bool all) noexcept -> void {
+  for (auto sizeClass = 0U; sizeClass != sizeClassCount; ++sizeClass) {
+    releaseClass(sizeClass, all);
   }
+  if (m_largeFreedSize >= largeTrimMinFreed) {
+#if defined(__GLIBC__)
+    // Glibc keeps freed memory in its arenas, explicitly return the free pages to the system.
+    malloc_trim(0);
+#endif
+  }
+  m_largeFreedSize = 0U;
 }
 
-MemoryAllocator::MemoryAllocator() noexcept {
-  if (!chunkSetsPreAllocated) {
-    preAllocateChunkSets();
-    chunkSetsPreAllocated = true;
+inline auto MemoryAllocator::tryGrowHeap(size_t bytes) noexcept -> bool {
+  const auto limit   = m_enforcedHeapLimit.load(std::memory_order_relaxed);
+  const auto newSize = m_heapSize.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  if (unlikely(limit != 0 && newSize > limit)) {
+    m_heapSize.fetch_sub(bytes, std::memory_order_relaxed);
+    return false;
   }
+  return true;
 }
 
-auto MemoryAllocator::alloc(unsigned int size) noexcept -> std::pair<void*, uint8_t> {
-  if (size > chunkSize) {
-    return {std::malloc(size), static_cast<uint8_t>(MemTag::MAlloc)};
+inline auto MemoryAllocator::shrinkHeap(size_t bytes) noexcept -> void {
+  m_heapSize.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+inline auto MemoryAllocator::getThreadCache() noexcept -> ThreadCache* {
+  if (likely(threadCacheRef.allocatorId == m_id)) {
+    return static_cast<ThreadCache*>(threadCacheRef.cache);
   }
-  auto* chunk = getThreadChunk();
-  return {static_cast<void*>(chunk), static_cast<uint8_t>(MemTag::Chunk)};
+  return acquireThreadCache();
 }
 
-auto MemoryAllocator::free(void* memoryPtr, uint8_t memTag) noexcept -> void {
-  assert(memoryPtr != nullptr);
+auto MemoryAllocator::acquireThreadCache() noexcept -> ThreadCache* {
+  ThreadCache* result = nullptr;
+  {
+    auto lk = std::lock_guard<std::mutex>{m_threadCachesMutex};
+
+    // Reuse a thread-cache that was released by a thread that stopped, otherwise create a new one.
+    for (auto& cache : m_threadCaches) {
+      if (!cache->inUse) {
+        result = cache.get();
+        break;
+      }
+    }
+    if (!result) {
+      m_threadCaches.push_back(std::make_unique<ThreadCache>());
+      result = m_threadCaches.back().get();
+    }
+    result->inUse = true;
+  }
+  threadCacheRef        = ThreadCacheRef{m_id, result};
+  threadExitGuard.armed = true; // Release the thread-cache if the thread exits while using it.
+  return result;
+}
+
+auto MemoryAllocator::advanceCursor(ThreadCache* cache, unsigned int sizeClass) noexcept -> bool {
+  auto& cursor = cache->cursors[sizeClass];
+  auto* area   = cursor.area;
+  if (area) {
+    // Continue with the next bitmap word that has free chunks.
+    while (++cursor.word < area->wordCount) {
+      cursor.freeBits = getFreeBits(area, cursor.word);
+      if (cursor.freeBits != 0) {
+        return true;
+      }
+    }
+    retireArea(area);
+  }
 
-  switch (static_cast<MemTag>(memTag)) {
-  case MemTag::MAlloc:
-    std::free(memoryPtr);
-    break;
-  case MemTag::Chunk:
-    freeChunk(static_cast<Chunk*>(memoryPtr));
-    break;
-  default:
-    assert(false);
-    break;
+  cursor = ClassCursor{acquireArea(sizeClass), 0U, 0U};
+  if (unlikely(cursor.area == nullptr)) {
+    return false;
+  }
+  for (;; ++cursor.word) {
+    assert(cursor.word < cursor.area->wordCount); // Acquired areas always have free chunks.
+    cursor.freeBits = getFreeBits(cursor.area, cursor.word);
+    if (cursor.freeBits != 0) {
+      return true;
+    }
   }
 }
 
-#else // !CUSTOM_ALLOCATOR_ENABLED
+auto MemoryAllocator::allocLarge(unsigned int size, bool finalize) noexcept -> void* {
+  const auto totalSize = size + sizeof(HeapLargeHeader);
+  if (unlikely(!tryGrowHeap(totalSize))) {
+    return nullptr;
+  }
+  auto* mem = std::malloc(totalSize);
+  if (unlikely(mem == nullptr)) {
+    shrinkHeap(totalSize);
+    return nullptr;
+  }
+  auto* header     = new (mem) HeapLargeHeader{};
+  header->size     = totalSize;
+  header->finalize = finalize;
+  {
+    auto lk      = std::lock_guard<std::mutex>{m_largeMutex};
+    header->next = m_largeHead;
+    if (m_largeHead) {
+      m_largeHead->prev = header;
+    }
+    m_largeHead = header;
+  }
+  return header + 1;
+}
+
+auto MemoryAllocator::sweepLarge(FinalizeFunc finalizer, SweepResult* result) noexcept -> void {
+  auto lk     = std::lock_guard<std::mutex>{m_largeMutex};
+  auto* large = m_largeHead;
+  while (large) {
+    auto* next = large->next;
+    if (large->marked.load(std::memory_order_relaxed)) {
+      ++result->count;
+      result->bytes += large->size;
+    } else {
+      (large->prev ? large->prev->next : m_largeHead) = next;
+      if (next) {
+        next->prev = large->prev;
+      }
+      if (large->finalize) {
+        finalizer(large + 1);
+      }
+      m_largeFreedSize += large->size;
+      shrinkHeap(large->size);
+      std::free(large);
+    }
+    large = next;
+  }
+}
+
+auto MemoryAllocator::acquireArea(unsigned int sizeClass) noexcept -> HeapArea* {
+  auto& heap = m_classes[sizeClass];
+  {
+    auto lk = std::lock_guard<std::mutex>{heap.mutex};
+    if (!heap.available.empty()) {
+      auto* area = heap.available.back();
+      if (area->releasedPages != 0) {
+        // Released pages are faulted back in when they are written to, count them as part of the
+        // heap again.
+        if (unlikely(!tryGrowHeap(popCount(area->releasedPages) * pageSize))) {
+          return nullptr;
+        }
+        area->releasedPages = 0U;
+      }
+      heap.available.pop_back();
+      area->available        = false;
+      area->owned            = true;
+      area->usedSinceRelease = true;
+      return area;
+    }
+  }
+
+  auto* area = newArea(sizeClass);
+  if (unlikely(area == nullptr)) {
+    return nullptr;
+  }
+  area->owned            = true;
+  area->usedSinceRelease = true;
+
+  auto lk = std::lock_guard<std::mutex>{heap.mutex};
+  heap.areas.push_back(area);
+  return area;
+}
 
-MemoryAllocator::MemoryAllocator() noexcept {}
+auto MemoryAllocator::retireArea(HeapArea* area) noexcept -> void {
+  auto& heap  = m_classes[area->sizeClass];
+  auto lk     = std::lock_guard<std::mutex>{heap.mutex};
+  area->owned = false;
 
-auto MemoryAllocator::alloc(unsigned int size) noexcept -> std::pair<void*, uint8_t> {
-  return {std::malloc(size), 0};
+  // Chunks behind the cursor could have been freed by a sweep while the area was owned.
+  if (!area->available && hasFreeChunks(area)) {
+    area->available = true;
+    heap.available.push_back(area);
+  }
 }
 
-auto MemoryAllocator::free(void* memoryPtr, uint8_t /*unused*/) noexcept -> void {
-  assert(memoryPtr != nullptr);
-  std::free(memoryPtr);
+auto MemoryAllocator::newArea(unsigned int sizeClass) noexcept -> HeapArea* {
+  if (unlikely(!tryGrowHeap(heapAreaSize))) {
+    return nullptr;
+  }
+  void* mem;
+  {
+    auto lk = std::lock_guard<std::mutex>{m_freshAreasMutex};
+    if (m_freshAreas.empty() && unlikely(!mapAreas(&m_freshAreas))) {
+      shrinkHeap(heapAreaSize);
+      return nullptr;
+    }
+    mem = m_freshAreas.back();
+    m_freshAreas.pop_back();
+  }
+  return initArea(mem, sizeClass);
 }
 
-#endif
+auto MemoryAllocator::unmapArea(HeapArea* area) noexcept -> void {
+  shrinkHeap(heapAreaSize - popCount(area->releasedPages) * pageSize);
+  unmapAreaMemory(area);
+}
+
+auto MemoryAllocator::releaseClass(unsigned int sizeClass, bool all) noexcept -> void {
+  auto& heap = m_classes[sizeClass];
+  auto lk    = std::lock_guard<std::mutex>{heap.mutex};
+
+  auto keep = heap.areas.begin();
+  for (auto* area : heap.areas) {
+    // Skip areas that are owned by a thread, and on normal releases also the areas that have been
+    // allocated from since the previous release.
+    const bool release     = !area->owned && (all || !area->usedSinceRelease);
+    area->usedSinceRelease = area->owned;
+    if (release) {
+      if (!hasAllocated(area, 0U, area->chunkCount - 1U)) {
+        unmapArea(area);
+        continue;
+      }
+      shrinkHeap(releaseFreePages(area));
+    }
+    *keep++ = area;
+  }
+  if (keep == heap.areas.end()) {
+    return;
+  }
+  heap.areas.erase(keep, heap.areas.end());
+
+  // Rebuild the list of available areas without the unmapped areas.
+  heap.available.clear();
+  for (auto* area : heap.areas) {
+    if (area->available) {
+      heap.available.push_back(area);
+    }
+  }
+}
 
 } // namespace vm::internal
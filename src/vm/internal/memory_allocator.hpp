@@ -1,23 +1,198 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <utility>
+#include <vector>
 
 namespace vm::internal {
 
+// Pooled allocations are made from 'areas' of this size, areas are aligned to their size so the
+// area of an allocation can be found by masking its address.
+const size_t heapAreaSize = 64U * 1024U; // 64 KiB
+
+// Memory-tag of allocations that are too big for the pooled areas.
+const uint8_t heapLargeMemTag = 0U;
+
+// Header at the start of every area, the area is divided into chunks of a single size-class.
+// Per chunk the area keeps a bit in three bitmaps (stored right after the header):
+// * alloc:     Chunk is allocated.
+// * finalize:  Chunk is allocated and needs to be finalized before being freed.
+// * mark:      Chunk is marked as alive by the garbage collector, see 'MemoryAllocator::tryMark'.
+struct HeapArea {
+  uint8_t* chunks; // Address of the first chunk.
+  unsigned int chunkSize;
+  unsigned int chunkCount;
+  uint64_t chunkInv;      // Reciprocal of the chunk size (scaled by 2^32), see 'getChunkIndex'.
+  unsigned int wordCount; // Amount of 64 bit words per bitmap.
+  uint8_t sizeClass;
+  bool owned;             // Allocated from by a thread-cache.
+  bool available;         // Part of the list of areas with free chunks.
+  bool usedSinceRelease;  // Owned by a thread-cache since the last 'release'.
+  uint64_t releasedPages; // Bitmask of the pages that have been returned to the system.
+  uint64_t* allocBits;
+  uint64_t* finalizeBits;
+  std::atomic<uint64_t>* markBits;
+
+  [[nodiscard]] inline static auto get(void* memoryPtr) noexcept -> HeapArea* {
+    const auto addr = reinterpret_cast<uintptr_t>(memoryPtr);
+    return reinterpret_cast<HeapArea*>(addr & ~(heapAreaSize - 1));
+  }
+
+  // Division by the chunk size using a multiplication by its reciprocal, exact for offsets that
+  // are multiples of the chunk size (as the offset is always smaller then the area size).
+  [[nodiscard]] inline auto getChunkIndex(void* memoryPtr) const noexcept -> unsigned int {
+    const auto offset = static_cast<uint64_t>(static_cast<uint8_t*>(memoryPtr) - chunks);
+    return static_cast<unsigned int>((offset * chunkInv) >> 32U);
+  }
+};
+
+// Header in front of allocations that are too big for the pooled areas, these are made using the
+// systems 'malloc' and tracked in a linked list.
+struct alignas(16) HeapLargeHeader {
+  HeapLargeHeader* prev;
+  HeapLargeHeader* next;
+  size_t size; // Total size including this header.
+  std::atomic<bool> marked;
+  bool finalize;
+};
+
 // Responsible for allocating and deallocating raw memory from the system.
+//
+// The allocator does not free individual allocations, instead the garbage collector marks the
+// allocations that are still alive (see 'tryMark') and 'sweep' frees all unmarked allocations.
+//
+// The amount of memory taken from the system (the 'heap size') can be limited, reaching the limit
+// does not make allocations fail immediately, instead the garbage collector is expected to react
+// to it (see 'isHeapLimitReached') and to decide when to enforce the limit.
 class MemoryAllocator final {
 public:
+  // Called for allocations that are made with 'finalize' before they are freed.
+  using FinalizeFunc = void (*)(void* memoryPtr);
+
+  struct SweepResult {
+    size_t count; // Amount of allocations that are still alive.
+    size_t bytes; // Size in bytes of the allocations that are still alive.
+  };
+
   MemoryAllocator() noexcept;
   MemoryAllocator(const MemoryAllocator& rhs) = delete;
   MemoryAllocator(MemoryAllocator&& rhs)      = delete;
-  ~MemoryAllocator() noexcept                 = default;
+  ~MemoryAllocator() noexcept;
 
   auto operator=(const MemoryAllocator& rhs) -> MemoryAllocator& = delete;
   auto operator=(MemoryAllocator&& rhs) -> MemoryAllocator& = delete;
 
-  [[nodiscard]] auto alloc(unsigned int size) noexcept -> std::pair<void*, uint8_t>;
+  // Allocate memory, returns the memory and its memory-tag. When 'finalize' is true the finalizer
+  // is called before the allocation is freed by 'sweep'.
+  // Note: Should not be called concurrently with 'clearMarks' or 'sweep'.
+  [[nodiscard]] auto alloc(unsigned int size, bool finalize) noexcept -> std::pair<void*, uint8_t>;
+
+  // Allocate memory that is never freed by 'sweep', has to be freed using 'freeUnmanaged'.
+  [[nodiscard]] auto allocUnmanaged(unsigned int size) noexcept -> void*;
+  auto freeUnmanaged(void* memoryPtr) noexcept -> void;
+
+  // Release the thread-cache of the calling thread, the thread-cache is reused by a next thread (or
+  // by this thread when it allocates again). Threads that exit without releasing their thread-cache
+  // release it when exiting.
+  auto releaseThreadCache() noexcept -> void;
+
+  // Mark an allocation as alive, returns false if it was already marked. When 'atomic' is true
+  // multiple threads can mark at the same time.
+  [[nodiscard]] inline static auto tryMark(void* memoryPtr, uint8_t memTag, bool atomic) noexcept
+      -> bool {
+    if (memTag == heapLargeMemTag) {
+      auto* header = static_cast<HeapLargeHeader*>(memoryPtr) - 1;
+      if (header->marked.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      if (atomic) {
+        return !header->marked.exchange(true, std::memory_order_relaxed);
+      }
+      header->marked.store(true, std::memory_order_relaxed);
+      return true;
+    }
+    auto* area        = HeapArea::get(memoryPtr);
+    const auto index  = area->getChunkIndex(memoryPtr);
+    const auto mask   = uint64_t{1} << (index % 64U);
+    auto& word        = area->markBits[index / 64U];
+    const auto marked = word.load(std::memory_order_relaxed);
+    if (marked & mask) {
+      return false;
+    }
+    // NOTE: Atomic read-modify-writes are relatively expensive so they are only used when marking
+    // with multiple threads, and only after a normal load shows that the chunk is not marked yet.
+    if (atomic) {
+      return (word.fetch_or(mask, std::memory_order_relaxed) & mask) == 0;
+    }
+    word.store(marked | mask, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Unmark all allocations.
+  // Note: Should only be called while no allocations are being made.
+  auto clearMarks() noexcept -> void;
+
+  // Free all allocations that are not marked, marks are kept (see 'clearMarks').
+  // Note: Should only be called while no allocations are being made.
+  auto sweep(FinalizeFunc finalizer) noexcept -> SweepResult;
+
+  // Set the maximum heap size in bytes, 0 means unlimited.
+  // Note: Not synchronized, has to be called before the application makes any allocations.
+  auto setHeapLimit(size_t limit) noexcept -> void;
+
+  // Amount of bytes currently taken from the system, memory that has been released back to the
+  // system (see 'release') is not included.
+  [[nodiscard]] auto getHeapSize() const noexcept -> size_t;
+
+  [[nodiscard]] auto isHeapLimitReached() const noexcept -> bool;
+
+  // When enforced allocations that would grow the heap beyond its limit fail.
+  auto setHeapLimitEnforced(bool enforced) noexcept -> void;
+  [[nodiscard]] auto isHeapLimitEnforced() const noexcept -> bool;
+
+  // Return free memory back to the system. When 'all' is false only the memory of areas that have
+  // not been allocated from since the previous release is returned.
+  // Note: Should not be called concurrently with itself or with 'sweep'.
+  auto release(bool all) noexcept -> void;
+
+private:
+  friend struct ThreadExitGuard;
+
+  struct ClassHeap;
+  struct ThreadCache;
+
+  uint64_t m_id; // Unique id, used to find the thread-cache of the current thread.
+  MemoryAllocator* m_nextAlive; // Next in the list of allocators that are alive.
+  size_t m_heapLimit;
+  std::atomic<size_t> m_heapSize;
+  std::atomic<size_t> m_enforcedHeapLimit; // Heap limit when its being enforced, 0 otherwise.
+  size_t m_largeFreedSize;                 // Amount of large bytes freed since the last release.
+  std::unique_ptr<ClassHeap[]> m_classes;
+  std::mutex m_freshAreasMutex;
+  std::vector<HeapArea*> m_freshAreas; // Mapped areas that have not been used yet.
+  std::mutex m_largeMutex;
+  HeapLargeHeader* m_largeHead;
+  std::mutex m_threadCachesMutex;
+  std::vector<std::unique_ptr<ThreadCache>> m_threadCaches;
+
+  auto tryGrowHeap(size_t bytes) noexcept -> bool;
+  auto shrinkHeap(size_t bytes) noexcept -> void;
+
+  auto getThreadCache() noexcept -> ThreadCache*;
+  auto acquireThreadCache() noexcept -> ThreadCache*;
+  auto advanceCursor(ThreadCache* cache, unsigned int sizeClass) noexcept -> bool;
+
+  auto allocLarge(unsigned int size, bool finalize) noexcept -> void*;
+  auto sweepLarge(FinalizeFunc finalizer, SweepResult* result) noexcept -> void;
 
-  auto free(void* memoryPtr, uint8_t tag) noexcept -> void;
+  auto acquireArea(unsigned int sizeClass) noexcept -> HeapArea*;
+  auto retireArea(HeapArea* area) noexcept -> void;
+  auto newArea(unsigned int sizeClass) noexcept -> HeapArea*;
+  auto unmapArea(HeapArea* area) noexcept -> void;
+  auto releaseClass(unsigned int sizeClass, bool all) noexcept -> void;
 };
 
 } // namespace vm::internal
@@ -47,26 +47,30 @@ auto inline pcall(
       return;                                                                                      \
     }                                                                                              \
   }
+// NOTE: Platform-calls check the stack capacity themselves as they can push temporary values.
 #define PUSH(VAL)                                                                                  \
-  if (unlikely(!stack->push(VAL))) {                                                               \
-    execHandle->setState(ExecState::StackOverflow);                                                \
-    return;                                                                                        \
+  {                                                                                                \
+    if (unlikely(!stack->hasSpace(1)) && unlikely(!stack->grow())) {                               \
+      execHandle->setState(ExecState::StackOverflow);                                              \
+      return;                                                                                      \
+    }                                                                                              \
+    stack->push(VAL);                                                                              \
   }
 #define PUSH_INT(VAL) PUSH(intValue(VAL))
 #define PUSH_BOOL(VAL) PUSH(intValue(VAL))
-#define PUSH_ULONG(VAL)                                                                            \
+#define PUSH_LONG(VAL)                                                                             \
   {                                                                                                \
-    const uint64_t ulongVal = VAL;                                                                 \
-    if (ulongVal & (1ULL << 63)) {                                                                 \
-      PUSH_REF(refAlloc->allocPlain<ULongRef>(ulongVal));                                          \
+    const int64_t longVal = VAL;                                                                   \
+    if (likely(isSmallLong(longVal))) {                                                            \
+      PUSH(smallLongValue(longVal));                                                               \
     } else {                                                                                       \
-      PUSH(smallULongValue(ulongVal));                                                             \
+      PUSH_REF(refAlloc->allocPlain<ULongRef>(reinterpret_cast<const uint64_t&>(longVal)));        \
     }                                                                                              \
   }
-#define PUSH_LONG(VAL)                                                                             \
+#define PUSH_ULONG(VAL)                                                                            \
   {                                                                                                \
-    const int64_t longVal = VAL;                                                                   \
-    PUSH_ULONG(reinterpret_cast<const uint64_t&>(longVal));                                        \
+    const uint64_t ulongVal = VAL;                                                                 \
+    PUSH_LONG(reinterpret_cast<const int64_t&>(ulongVal));                                         \
   }
 #define PUSH_REF(VAL)                                                                              \
   {                                                                                                \
@@ -107,9 +111,15 @@ auto inline pcall(
     POP_AT(1); // Pop the stream off the stack, 1 because its behind the result string.
   } break;
   case PCallCode::StreamWriteString: {
+    // Ropes are written using their balanced representation, as the rope could be collapsed by
+    // another thread while we are writing it.
+    auto* strRef = getStringOrLinkRef(POP());
+    if (strRef->getKind() == RefKind::StringLink) {
+      strRef = balanceStringLink(refAlloc, *downcastRef<StringLinkRef>(strRef));
+      CHECK_ALLOC(strRef);
+    }
     // Note: Keep the string on the stack, reason is gc could run while we are blocked.
-    auto* strRef = getStringRef(refAlloc, PEEK());
-    CHECK_ALLOC(strRef);
+    PUSH_REF(strRef);
 
     // Note: Keep the stream on the stack, reason is gc could run while we are blocked.
     auto stream = PEEK_BEHIND(1);
@@ -382,7 +392,8 @@ auto inline pcall(
   } break;
 
   case PCallCode::GcCollect: {
-    auto flags = static_cast<GarbageCollectFlags>(PEEK_INT());
+    // Explicitly requested collections always collect all generations.
+    auto flags = static_cast<GarbageCollectFlags>(PEEK_INT() | GcCollectFull);
     execHandle->setState(ExecState::Paused);
     gc->collectNow(flags);
     execHandle->setState(ExecState::Running);
@@ -0,0 +1,466 @@
+#include "internal/program.hpp"
+#include "internal/intrinsics.hpp"
+#include "internal/ref_allocator.hpp"
+#include "internal/ref_string.hpp"
+#include "internal/verifier.hpp"
+#include <limits>
+
+namespace vm::internal {
+
+using OpCode = novasm::OpCode;
+
+// Marker for instruction offsets that do not correspond to the start of an instruction.
+const uint32_t invalidIndex = std::numeric_limits<uint32_t>::max();
+
+template <typename Type>
+NO_SANITIZE(alignment)
+inline auto readAsm(const uint8_t** ip) {
+  const Type v = *reinterpret_cast<const Type*>(*ip); // NOLINT: Reinterpret cast
+  *ip += sizeof(Type);
+  return v;
+}
+
+inline auto makeInstr(OpCode op) noexcept -> Instr {
+  auto instr    = Instr{};
+  instr.handler = nullptr;
+  instr.op      = op;
+  return instr;
+}
+
+// Decode a single instruction and advance the given instruction pointer.
+// Returns false if the instruction could not be decoded (because its unknown or truncated).
+// NOTE: Branch targets are stored as instruction offsets in 'uintArg', they are resolved once all
+// instructions have been decoded.
+static auto decodeInstr(const uint8_t** ip, const uint8_t* end, Instr* out) noexcept -> bool {
+  const auto op = readAsm<OpCode>(ip);
+
+  // Verify that enough bytes are left for the operands of this instruction.
+  auto hasOperands = [&](size_t size) { return static_cast<size_t>(end - *ip) >= size; };
+
+  switch (op) {
+  case OpCode::LoadLitInt:
+  case OpCode::MakeAtomic:
+  case OpCode::AtomicBlock:
+    if (unlikely(!hasOperands(sizeof(int32_t)))) {
+      return false;
+    }
+    *out        = makeInstr(op);
+    out->intArg = readAsm<int32_t>(ip);
+    return true;
+  case OpCode::LoadLitIntSmall:
+    if (unlikely(!hasOperands(sizeof(uint8_t)))) {
+      return false;
+    }
+    // Normalize the different int literal variants into a single instruction.
+    *out        = makeInstr(OpCode::LoadLitInt);
+    out->intArg = readAsm<uint8_t>(ip);
+    return true;
+  case OpCode::LoadLitInt0:
+  case OpCode::LoadLitInt1:
+    *out        = makeInstr(OpCode::LoadLitInt);
+    out->intArg = op == OpCode::LoadLitInt0 ? 0 : 1;
+    return true;
+  case OpCode::LoadLitLong:
+    if (unlikely(!hasOperands(sizeof(int64_t)))) {
+      return false;
+    }
+    *out         = makeInstr(op);
+    out->longArg = readAsm<int64_t>(ip);
+    return true;
+  case OpCode::LoadLitFloat:
+    if (unlikely(!hasOperands(sizeof(float)))) {
+      return false;
+    }
+    *out          = makeInstr(op);
+    out->floatArg = readAsm<float>(ip);
+    return true;
+  case OpCode::LoadLitString:
+  case OpCode::LoadLitIp:
+  case OpCode::Jump:
+  case OpCode::JumpIf:
+    if (unlikely(!hasOperands(sizeof(uint32_t)))) {
+      return false;
+    }
+    *out         = makeInstr(op);
+    out->uintArg = readAsm<uint32_t>(ip);
+    return true;
+  case OpCode::StackAlloc:
+  case OpCode::StackStore:
+  case OpCode::StackLoad:
+    if (unlikely(!hasOperands(sizeof(uint16_t)))) {
+      return false;
+    }
+    *out         = makeInstr(op);
+    out->halfArg = readAsm<uint16_t>(ip);
+    return true;
+  case OpCode::StackAllocSmall:
+  case OpCode::StackStoreSmall:
+  case OpCode::StackLoadSmall:
+    if (unlikely(!hasOperands(sizeof(uint8_t)))) {
+      return false;
+    }
+    // Normalize the small stack instructions into their regular variants.
+    *out = makeInstr(
+        op == OpCode::StackAllocSmall
+            ? OpCode::StackAlloc
+            : op == OpCode::StackStoreSmall ? OpCode::StackStore : OpCode::StackLoad);
+    out->halfArg = readAsm<uint8_t>(ip);
+    return true;
+  case OpCode::MakeStruct:
+  case OpCode::StructLoadField:
+  case OpCode::StructStoreField:
+  case OpCode::UnionWrap:
+  case OpCode::UnionCheck:
+  case OpCode::CallDyn:
+  case OpCode::CallDynTail:
+  case OpCode::CallDynForked:
+    if (unlikely(!hasOperands(sizeof(uint8_t)))) {
+      return false;
+    }
+    *out         = makeInstr(op);
+    out->byteArg = readAsm<uint8_t>(ip);
+    return true;
+  case OpCode::AtomicCompareSwap:
+    if (unlikely(!hasOperands(sizeof(int32_t) * 2))) {
+      return false;
+    }
+    *out         = makeInstr(op);
+    out->intArg  = readAsm<int32_t>(ip);
+    out->intArg2 = readAsm<int32_t>(ip);
+    return true;
+  case OpCode::Call:
+  case OpCode::CallTail:
+  case OpCode::CallForked:
+    if (unlikely(!hasOperands(sizeof(uint8_t) + sizeof(uint32_t)))) {
+      return false;
+    }
+    *out         = makeInstr(op);
+    out->byteArg = readAsm<uint8_t>(ip);
+    out->uintArg = readAsm<uint32_t>(ip);
+    return true;
+  case OpCode::PCall:
+    if (unlikely(!hasOperands(sizeof(novasm::PCallCode)))) {
+      return false;
+    }
+    *out          = makeInstr(op);
+    out->pcallArg = readAsm<novasm::PCallCode>(ip);
+    return true;
+  case OpCode::AddInt:
+  case OpCode::AddLong:
+  case OpCode::AddFloat:
+  case OpCode::AddString:
+  case OpCode::AppendChar:
+  case OpCode::SubInt:
+  case OpCode::SubLong:
+  case OpCode::SubFloat:
+  case OpCode::MulInt:
+  case OpCode::MulLong:
+  case OpCode::MulFloat:
+  case OpCode::DivInt:
+  case OpCode::DivLong:
+  case OpCode::DivFloat:
+  case OpCode::RemInt:
+  case OpCode::RemLong:
+  case OpCode::ModFloat:
+  case OpCode::PowFloat:
+  case OpCode::SqrtFloat:
+  case OpCode::SinFloat:
+  case OpCode::CosFloat:
+  case OpCode::TanFloat:
+  case OpCode::ASinFloat:
+  case OpCode::ACosFloat:
+  case OpCode::ATanFloat:
+  case OpCode::ATan2Float:
+  case OpCode::NegInt:
+  case OpCode::NegLong:
+  case OpCode::NegFloat:
+  case OpCode::ShiftLeftInt:
+  case OpCode::ShiftLeftLong:
+  case OpCode::ShiftRightInt:
+  case OpCode::ShiftRightLong:
+  case OpCode::AndInt:
+  case OpCode::AndLong:
+  case OpCode::OrInt:
+  case OpCode::OrLong:
+  case OpCode::XorInt:
+  case OpCode::XorLong:
+  case OpCode::InvInt:
+  case OpCode::InvLong:
+  case OpCode::LengthString:
+  case OpCode::IndexString:
+  case OpCode::SliceString:
+  case OpCode::HashString:
+  case OpCode::CheckEqInt:
+  case OpCode::CheckEqLong:
+  case OpCode::CheckEqFloat:
+  case OpCode::CheckEqString:
+  case OpCode::CheckEqIp:
+  case OpCode::CheckEqCallDynTgt:
+  case OpCode::CheckGtInt:
+  case OpCode::CheckGtLong:
+  case OpCode::CheckGtFloat:
+  case OpCode::CheckLeInt:
+  case OpCode::CheckLeLong:
+  case OpCode::CheckLeFloat:
+  case OpCode::CheckStructNull:
+  case OpCode::CheckIntZero:
+  case OpCode::CheckStringEmpty:
+  case OpCode::ConvIntLong:
+  case OpCode::ConvIntFloat:
+  case OpCode::ConvLongInt:
+  case OpCode::ConvLongFloat:
+  case OpCode::ConvFloatInt:
+  case OpCode::ConvIntString:
+  case OpCode::ConvLongString:
+  case OpCode::ConvFloatString:
+  case OpCode::ConvCharString:
+  case OpCode::ConvIntChar:
+  case OpCode::ConvLongChar:
+  case OpCode::ConvFloatChar:
+  case OpCode::ConvFloatLong:
+  case OpCode::AtomicLoad:
+  case OpCode::MakeNullStruct:
+  case OpCode::Ret:
+  case OpCode::Fail:
+  case OpCode::FutureWaitNano:
+  case OpCode::FutureBlock:
+  case OpCode::Dup:
+  case OpCode::Pop:
+  case OpCode::Swap:
+    *out = makeInstr(op);
+    return true;
+  case OpCode::StackLoadField:
+  case OpCode::StackLoadLoad:
+  case OpCode::StackStoreLoad:
+  case OpCode::DupStructLoadField:
+  case OpCode::AddIntLit:
+  case OpCode::SubIntLit:
+  case OpCode::CheckEqIntLit:
+  case OpCode::JumpIfZero:
+  case OpCode::JumpIfEqInt:
+  case OpCode::JumpIfGtInt:
+  case OpCode::JumpIfLeInt:
+  case OpCode::JumpIfEqIntLit:
+    // Superinstructions are only produced by the decoder, they are not valid in executables.
+    return false;
+  }
+  return false;
+}
+
+// Attempt to fuse two sequential instructions into a single superinstruction.
+// Returns true if 'next' has been merged into 'prev'.
+// NOTE: The set of fused sequences is based on the most frequent instruction pairs in compiled
+// programs, use 'novdiag-asm opstats' to gather the sequence frequencies.
+static auto fuseInstr(Instr* prev, const Instr& next) noexcept -> bool {
+  switch (prev->op) {
+  case OpCode::StackLoad:
+    if (next.op == OpCode::StructLoadField) {
+      prev->op      = OpCode::StackLoadField;
+      prev->byteArg = next.byteArg;
+      return true;
+    }
+    if (next.op == OpCode::StackLoad) {
+      prev->op     = OpCode::StackLoadLoad;
+      prev->intArg = next.halfArg;
+      return true;
+    }
+    return false;
+  case OpCode::StackStore:
+    if (next.op == OpCode::StackLoad) {
+      prev->op     = OpCode::StackStoreLoad;
+      prev->intArg = next.halfArg;
+      return true;
+    }
+    return false;
+  case OpCode::Dup:
+    if (next.op == OpCode::StructLoadField) {
+      prev->op      = OpCode::DupStructLoadField;
+      prev->byteArg = next.byteArg;
+      return true;
+    }
+    return false;
+  case OpCode::LoadLitInt:
+    switch (next.op) {
+    case OpCode::AddInt:
+      prev->op = OpCode::AddIntLit;
+      return true;
+    case OpCode::SubInt:
+      prev->op = OpCode::SubIntLit;
+      return true;
+    case OpCode::CheckEqInt:
+      prev->op = OpCode::CheckEqIntLit;
+      return true;
+    default:
+      return false;
+    }
+  case OpCode::CheckIntZero:
+  case OpCode::CheckEqInt:
+  case OpCode::CheckGtInt:
+  case OpCode::CheckLeInt:
+  case OpCode::CheckEqIntLit:
+    if (next.op != OpCode::JumpIf) {
+      return false;
+    }
+    switch (prev->op) {
+    case OpCode::CheckIntZero:
+      prev->op = OpCode::JumpIfZero;
+      break;
+    case OpCode::CheckEqInt:
+      prev->op = OpCode::JumpIfEqInt;
+      break;
+    case OpCode::CheckGtInt:
+      prev->op = OpCode::JumpIfGtInt;
+      break;
+    case OpCode::CheckLeInt:
+      prev->op = OpCode::JumpIfLeInt;
+      break;
+    default:
+      prev->op = OpCode::JumpIfEqIntLit;
+      break;
+    }
+    prev->uintArg = next.uintArg; // Target offset, resolved after decoding.
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Check if the instruction has a branch target that has to be resolved after decoding.
+inline auto hasBranchTarget(OpCode op) noexcept -> bool {
+  switch (op) {
+  case OpCode::Jump:
+  case OpCode::JumpIf:
+  case OpCode::JumpIfZero:
+  case OpCode::JumpIfEqInt:
+  case OpCode::JumpIfGtInt:
+  case OpCode::JumpIfLeInt:
+  case OpCode::JumpIfEqIntLit:
+  case OpCode::Call:
+  case OpCode::CallTail:
+  case OpCode::CallForked:
+    return true;
+  default:
+    return false;
+  }
+}
+
+Program::Program(const novasm::Executable* executable) noexcept :
+    m_executable{executable}, m_entrypoint{nullptr}, m_valid{true} {
+
+  const auto& bytes = executable->getInstructions();
+
+  // Decode all instructions and remember their offsets (in the executable).
+  auto decoded       = std::vector<Instr>{};
+  auto decodedOffset = std::vector<uint32_t>{};
+  decoded.reserve(bytes.size() / 2U + 1U);
+  decodedOffset.reserve(bytes.size() / 2U + 1U);
+
+  const auto* begin = bytes.data();
+  const auto* end   = begin + bytes.size();
+  for (const auto* ip = begin; ip != end;) {
+    const auto offset = static_cast<uint32_t>(ip - begin);
+
+    auto instr = Instr{};
+    if (unlikely(!decodeInstr(&ip, end, &instr))) {
+      // Unknown or truncated instruction: nothing after this point can be decoded reliably.
+      m_valid = false;
+      break;
+    }
+    decoded.push_back(instr);
+    decodedOffset.push_back(offset);
+  }
+
+  // Find all instructions that execution can enter from somewhere else than the previous
+  // instruction, these cannot be fused with the instruction before them.
+  auto isTarget   = std::vector<bool>(bytes.size() + 1U, false);
+  auto markTarget = [&](uint32_t offset) {
+    if (offset < isTarget.size()) {
+      isTarget[offset] = true;
+    }
+  };
+  markTarget(executable->getEntrypoint());
+  for (const auto& instr : decoded) {
+    if (instr.op == OpCode::LoadLitIp || hasBranchTarget(instr.op)) {
+      markTarget(instr.uintArg);
+    }
+  }
+
+  // Mapping from instruction offsets (in the executable) to indices in the decoded array.
+  auto offsetToIndex = std::vector<uint32_t>(bytes.size() + 1U, invalidIndex);
+
+  // Build the final instruction array, fusing common instruction sequences into superinstructions.
+  m_instrs.reserve(decoded.size() + 1U);
+  for (auto i = 0U; i != decoded.size(); ++i) {
+    const auto offset = decodedOffset[i];
+    if (!m_instrs.empty() && !isTarget[offset] && fuseInstr(&m_instrs.back(), decoded[i])) {
+      offsetToIndex[offset] = static_cast<uint32_t>(m_instrs.size() - 1U);
+      continue;
+    }
+    offsetToIndex[offset] = static_cast<uint32_t>(m_instrs.size());
+    m_instrs.push_back(decoded[i]);
+  }
+
+  // Add a 'Fail' instruction to catch execution that runs past the end, and to serve as the target
+  // for any branches to invalid offsets (which also marks the program as invalid).
+  const auto failIndex = static_cast<uint32_t>(m_instrs.size());
+  m_instrs.push_back(makeInstr(OpCode::Fail));
+
+  auto resolveIndex = [&](uint32_t offset) -> uint32_t {
+    if (unlikely(offset >= offsetToIndex.size() || offsetToIndex[offset] == invalidIndex)) {
+      m_valid = false;
+      return failIndex;
+    }
+    return offsetToIndex[offset];
+  };
+
+  // Resolve the branch targets, note: the instruction array is not resized after this point.
+  for (auto& instr : m_instrs) {
+    if (instr.op == OpCode::LoadLitIp) {
+      instr.uintArg = resolveIndex(instr.uintArg);
+    } else if (hasBranchTarget(instr.op)) {
+      instr.target = m_instrs.data() + resolveIndex(instr.uintArg);
+    }
+  }
+
+  const auto entryIndex = resolveIndex(executable->getEntrypoint());
+  m_entrypoint          = m_instrs.data() + entryIndex;
+
+  // Verify the program and compute the stack requirements of all functions.
+  const auto litStringCount =
+      static_cast<uint32_t>(executable->endLitStrings() - executable->beginLitStrings());
+  if (unlikely(!m_valid || !verifyInstrs(m_instrs, entryIndex, litStringCount, &m_frames))) {
+    m_valid = false;
+    m_frames.assign(m_instrs.size(), invalidFrame);
+    return;
+  }
+
+  // Store the stack requirements of the targets of direct calls in the call instructions, this
+  // way the executor does not have to lookup the frame info when making a call.
+  for (auto& instr : m_instrs) {
+    if (instr.op == OpCode::Call || instr.op == OpCode::CallTail) {
+      instr.intArg = static_cast<int32_t>(getFrameInfo(instr.target).maxStack);
+    }
+  }
+}
+
+auto Program::allocLitStrings(RefAllocator* refAlloc) noexcept -> bool {
+  m_litStrings.clear();
+  for (auto itr = m_executable->beginLitStrings(); itr != m_executable->endLitStrings(); ++itr) {
+    auto* strRef = refAlloc->allocStrLitImmortal(itr->data(), itr->length());
+    if (unlikely(strRef == nullptr)) {
+      return false;
+    }
+    m_litStrings.push_back(strRef);
+  }
+  return true;
+}
+
+auto Program::linkHandlers(const InstrHandler* handlers) noexcept -> void {
+  std::call_once(m_linkFlag, [this, handlers]() {
+    for (auto& instr : m_instrs) {
+      instr.handler = handlers[static_cast<uint8_t>(instr.op)];
+    }
+  });
+}
+
+} // namespace vm::internal
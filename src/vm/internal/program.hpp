@@ -0,0 +1,130 @@
+#pragma once
+#include "novasm/executable.hpp"
+#include "novasm/op_code.hpp"
+#include "novasm/pcall_code.hpp"
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vm::internal {
+
+class RefAllocator;
+class StringRef;
+
+// Address of the code that implements an instruction, only used in direct-threaded dispatch mode.
+using InstrHandler = const void*;
+
+// Pre-decoded instruction.
+// All operands are stored at fixed (aligned) positions and branch targets are resolved to absolute
+// instruction pointers, this way the executor never has to decode operand bytes or convert
+// instruction offsets while running.
+struct Instr {
+  InstrHandler handler;
+  novasm::OpCode op;
+  uint8_t byteArg;  // Argument count, field index or pcall code.
+  uint16_t halfArg; // Stack offset or stack allocation amount.
+  int32_t intArg;
+  union {
+    int32_t intArg2;
+    uint32_t uintArg;
+    int64_t longArg;
+    float floatArg;
+    novasm::PCallCode pcallArg;
+    const Instr* target;
+  };
+};
+
+// Stack requirements of a function, computed when the program is verified.
+struct FrameInfo {
+  uint32_t maxStack; // Maximum amount of values the function has on the stack (excluding args).
+  uint32_t minArgs;  // Minimum amount of arguments the function accesses.
+};
+
+// Frame info for instructions that are not the start of a function, calls to them are rejected.
+constexpr FrameInfo invalidFrame = {0U, std::numeric_limits<uint32_t>::max()};
+
+/* Runtime representation of a novus executable.
+ * The instructions of the executable are decoded once when the program is created, the executable
+ * file format itself is left unchanged.
+ *
+ * Instruction pointers that are visible to the running assembly (for example from 'LoadLitIp') are
+ * represented as indices into the decoded instruction array.
+ *
+ * After decoding the program is verified (see 'verifier.hpp'), programs that are malformed are
+ * marked as invalid and should not be executed. The verifier also computes the maximum stack
+ * usage of every function, this allows the executor to reserve the stack space for a whole
+ * stack-frame when entering a function instead of checking the capacity on every push.
+ * A 'Fail' instruction is placed after the last instruction to catch execution running past the
+ * end.
+ *
+ * String literals are materialized once (see 'allocLitStrings') as immortal string references,
+ * loading a literal then only has to push the existing reference.
+ */
+class Program final {
+public:
+  explicit Program(const novasm::Executable* executable) noexcept;
+  Program(const Program& rhs) = delete;
+  Program(Program&& rhs)      = delete;
+  ~Program() noexcept         = default;
+
+  auto operator=(const Program& rhs) -> Program& = delete;
+  auto operator=(Program&& rhs) -> Program& = delete;
+
+  [[nodiscard]] auto getExecutable() const noexcept -> const novasm::Executable* {
+    return m_executable;
+  }
+
+  [[nodiscard]] auto getEntrypoint() const noexcept -> const Instr* { return m_entrypoint; }
+
+  [[nodiscard]] auto getInstrCount() const noexcept -> size_t { return m_instrs.size(); }
+
+  // Check if the program passed verification, invalid programs should not be executed.
+  [[nodiscard]] auto isValid() const noexcept -> bool { return m_valid; }
+
+  // Lookup an instruction by index, indices are used as the instruction pointer values that are
+  // visible to the running assembly.
+  [[nodiscard]] auto getInstr(uint32_t index) const noexcept -> const Instr* {
+    assert(index < m_instrs.size());
+    return m_instrs.data() + index;
+  }
+
+  // Lookup the stack requirements of the function that starts at the given instruction.
+  // Returns 'invalidFrame' if the instruction is not the start of a function.
+  [[nodiscard]] auto getFrameInfo(uint32_t index) const noexcept -> const FrameInfo& {
+    return index < m_frames.size() ? m_frames[index] : invalidFrame;
+  }
+
+  [[nodiscard]] auto getFrameInfo(const Instr* instr) const noexcept -> const FrameInfo& {
+    assert(instr >= m_instrs.data() && instr < m_instrs.data() + m_instrs.size());
+    return m_frames[instr - m_instrs.data()];
+  }
+
+  [[nodiscard]] auto getLitString(uint32_t id) const noexcept -> StringRef* {
+    assert(id < m_litStrings.size());
+    return m_litStrings[id];
+  }
+
+  // Allocate immortal string references for all the string literals in the executable.
+  // Returns false if the allocation failed.
+  // Note: Has to be called before executing the program, the references are owned by 'refAlloc'.
+  [[nodiscard]] auto allocLitStrings(RefAllocator* refAlloc) noexcept -> bool;
+
+  // Resolve the handler addresses of all instructions.
+  // 'handlers' is indexed by opcode and has to contain an entry for all 256 possible opcode values.
+  // NOTE: Safe to be called multiple times (and concurrently), only the first call has an effect.
+  auto linkHandlers(const InstrHandler* handlers) noexcept -> void;
+
+private:
+  const novasm::Executable* m_executable;
+  std::vector<Instr> m_instrs;
+  std::vector<FrameInfo> m_frames;
+  std::vector<StringRef*> m_litStrings;
+  const Instr* m_entrypoint;
+  bool m_valid;
+  std::once_flag m_linkFlag;
+};
+
+} // namespace vm::internal
@@ -9,6 +9,7 @@
 #include "internal/ref_stream_tcp.hpp"
 #include "internal/ref_string.hpp"
 #include "internal/ref_string_link.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/ref_struct.hpp"
 #include "internal/ref_ulong.hpp"
 
@@ -36,6 +37,9 @@ auto Ref::destroy() noexcept -> void {
   case RefKind::StringLink:
     downcastRef<StringLinkRef>(this)->~StringLinkRef();
     break;
+  case RefKind::StringSlice:
+    downcastRef<StringSliceRef>(this)->~StringSliceRef();
+    break;
   case RefKind::ULong:
     downcastRef<ULongRef>(this)->~ULongRef();
     break;
@@ -1,12 +1,22 @@
 #pragma once
 #include "internal/ref_flags.hpp"
 #include "internal/ref_kind.hpp"
+#include <atomic>
 #include <cassert>
 
 namespace vm::internal {
 
+// Generation of a reference, see 'GarbageCollector'.
+enum class RefGen : uint8_t {
+  Young         = 0, // Allocated since the last collection.
+  Old           = 1, // Survived a collection.
+  OldRemembered = 2, // Old and part of the remembered-set (might point to young references).
+};
+
 // Base class for a reference.
-class Ref {
+// Note: The header is 8 bytes and 8 byte aligned, this way the payload of a reference (for example
+// the fields of a struct) is aligned. The allocator tracks the references outside of the header.
+class alignas(8) Ref {
   friend class RefAllocator;
 
 public:
@@ -23,36 +33,61 @@ public:
 
   template <RefFlags F>
   [[nodiscard]] inline auto hasFlag() const noexcept -> bool {
-    return (m_flags & F) == F;
+    return (loadFlags() & F) == F;
   }
 
+  // Note: Not an atomic read-modify-write, use 'trySetFlag' when multiple threads can update the
+  // flags of the same reference.
   template <RefFlags F>
   inline auto setFlag() noexcept -> void {
-    m_flags = m_flags | F;
+    m_flags.store(static_cast<uint8_t>(loadFlags() | F), std::memory_order_relaxed);
   }
 
   template <RefFlags F>
   inline auto unsetFlag() noexcept -> void {
-    m_flags = m_flags & ~F;
+    m_flags.store(static_cast<uint8_t>(loadFlags() & ~F), std::memory_order_relaxed);
+  }
+
+  // Atomically set the flag, returns false if the flag was already set.
+  template <RefFlags F>
+  [[nodiscard]] inline auto trySetFlag() noexcept -> bool {
+    const auto prev = m_flags.fetch_or(static_cast<uint8_t>(F), std::memory_order_relaxed);
+    return (static_cast<RefFlags>(prev) & F) != F;
   }
 
+  // Note: The generation is stored separately from the flags as its read by the executors (in the
+  // write-barrier) while the garbage collector can be updating the flags.
+  [[nodiscard]] inline auto getGen() const noexcept -> RefGen {
+    return m_gen.load(std::memory_order_relaxed);
+  }
+
+  // Note: Should only be called by the garbage collector while all executors are paused.
+  inline auto setGen(RefGen gen) noexcept -> void { m_gen.store(gen, std::memory_order_relaxed); }
+
 protected:
-  inline explicit Ref(RefKind kind) noexcept : m_next{nullptr}, m_kind{kind}, m_flags{} {}
+  inline explicit Ref(RefKind kind) noexcept :
+      m_memTag{0U}, m_kind{kind}, m_flags{0U}, m_gen{RefGen::Young} {}
 
   // Get a raw pointer to the begining of the Ref struct. Can be used by ref implementations to
   // calculate their end-pointer.
   // For obvious reasons this is a dangernous api and care must be taken.
   [[nodiscard]] inline auto getPtr() noexcept -> uint8_t* {
-    return static_cast<uint8_t*>(static_cast<void*>(&m_next));
+    return static_cast<uint8_t*>(static_cast<void*>(this));
   }
 
 private:
-  Ref* m_next; // Used by the RefAllocator to track all references.
-  uint8_t m_memTag;
+  uint8_t m_memTag; // Used by the RefAllocator to mark the reference.
   RefKind m_kind;
-  RefFlags m_flags;
+  std::atomic<uint8_t> m_flags; // Atomic as the garbage collector reads them while marking.
+  std::atomic<RefGen> m_gen;
+
+  [[nodiscard]] inline auto loadFlags() const noexcept -> RefFlags {
+    return static_cast<RefFlags>(m_flags.load(std::memory_order_relaxed));
+  }
 };
 
+static_assert(sizeof(Ref) == 8U);
+
 // Downcast a reference to a child-type, be sure that the types match before calling this.
 template <typename RefType>
 inline auto downcastRef(Ref* ref) noexcept -> RefType* {
@@ -9,24 +9,29 @@
 
 namespace vm::internal {
 
-RefAllocator::RefAllocator(MemoryAllocator* memAlloc) noexcept :
-    m_memAlloc(memAlloc), m_head{nullptr} {}
+// Destroy a reference before its memory is freed, calls the destructor of the implementation.
+// Note: Reason why its not using a virtual destructor is that this way we can avoid the vtable.
+static auto finalizeRef(void* ref) noexcept -> void { static_cast<Ref*>(ref)->destroy(); }
+
+RefAllocator::RefAllocator(MemoryAllocator* memAlloc) noexcept : m_memAlloc(memAlloc) {}
 
 RefAllocator::~RefAllocator() noexcept {
   /* Delete all allocations. Note this assumes no new allocations are being made while we are
   running the destructor. */
 
-  auto* ref = m_head.load(std::memory_order_acquire);
-  while (ref) {
-    auto next = ref->m_next;
-    RefAllocator::freeUnsafe(ref);
-    ref = next;
+  m_memAlloc->clearMarks();
+  m_memAlloc->sweep(finalizeRef);
+
+  // Delete all immortal allocations.
+  for (auto* ref : m_immortals) {
+    ref->destroy();
+    m_memAlloc->freeUnmanaged(ref);
   }
 }
 
 auto RefAllocator::subscribe(RefAllocObserver* observer) -> void {
   // Only allowed to be called before allocating any references.
-  assert(m_head.load(std::memory_order_acquire) == nullptr);
+  assert(m_memAlloc->getHeapSize() == 0U);
 
   m_observers.push_back(observer);
 }
@@ -65,13 +70,34 @@ auto RefAllocator::allocStrLit(const char* literal, size_t literalLength) noexce
   return refPtr;
 }
 
-auto RefAllocator::allocStrLink(Ref* prev, Value val) noexcept -> StringLinkRef* {
+auto RefAllocator::allocStrLitImmortal(const char* literal, size_t literalLength) noexcept
+    -> StringRef* {
+  // Note: Does not notify the observers, immortal allocations are never garbage collected.
+  auto* mem = m_memAlloc->allocUnmanaged(sizeof(StringRef));
+  if (unlikely(mem == nullptr)) {
+    return nullptr;
+  }
+
+  // Note: Same as 'allocStrLit' the resulting string ref points to the memory held by the literal.
+  auto litSize   = static_cast<unsigned int>(literalLength);
+  auto* charData = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(literal));
+  auto* refPtr   = static_cast<StringRef*>(new (mem) StringRef{charData, litSize});
+  refPtr->setFlag<RefFlags::Immortal>();
+
+  // Keep track of the immortal references so we can free them when the allocator is destroyed.
+  m_immortals.push_back(refPtr);
+  return refPtr;
+}
+
+auto RefAllocator::allocStrLink(Ref* left, Value right, bool balanced) noexcept
+    -> StringLinkRef* {
   auto mem = alloc<StringLinkRef>(0);
   if (unlikely(mem.refPtr == nullptr)) {
     return nullptr;
   }
 
-  auto* refPtr = static_cast<StringLinkRef*>(new (mem.refPtr) StringLinkRef{prev, val});
+  auto* refPtr =
+      static_cast<StringLinkRef*>(new (mem.refPtr) StringLinkRef{left, right, balanced});
   initRef(refPtr, mem.memTag);
   return refPtr;
 }
@@ -87,15 +113,36 @@ auto RefAllocator::allocStruct(uint8_t fieldCount) noexcept -> StructRef* {
   return refPtr;
 }
 
-auto RefAllocator::initRef(Ref* ref, uint8_t memTag) noexcept -> void {
+auto RefAllocator::allocFuture(uint8_t argCount) noexcept -> FutureRef* {
+  auto mem = alloc<FutureRef>(sizeof(Value) * argCount);
+  if (unlikely(mem.refPtr == nullptr)) {
+    return nullptr;
+  }
 
-  // Store the memory-tag as we need it when free-ing the memory.
-  ref->m_memTag = memTag;
+  auto* refPtr = static_cast<FutureRef*>(new (mem.refPtr) FutureRef{argCount});
+  initRef(refPtr, mem.memTag);
+  return refPtr;
+}
+
+auto RefAllocator::sweep() noexcept -> MemoryAllocator::SweepResult {
+  return m_memAlloc->sweep(finalizeRef);
+}
+
+auto RefAllocator::clearRemembered() noexcept -> void {
+  auto lk = std::lock_guard<std::mutex>{m_rememberedMutex};
+  for (auto* ref : m_remembered) {
+    ref->setGen(RefGen::Old);
+  }
+  m_remembered.clear();
+}
 
-  // Keep track of all allocated references by linking them as a singly linked list.
-  ref->m_next = m_head.load(std::memory_order_relaxed);
-  while (!m_head.compare_exchange_weak(
-      ref->m_next, ref, std::memory_order_release, std::memory_order_relaxed)) {
+auto RefAllocator::remember(Ref* ref) noexcept -> void {
+  // Only add the reference once, multiple executors can be storing into the same reference.
+  auto expected = RefGen::Old;
+  if (ref->m_gen.compare_exchange_strong(
+          expected, RefGen::OldRemembered, std::memory_order_relaxed)) {
+    auto lk = std::lock_guard<std::mutex>{m_rememberedMutex};
+    m_remembered.push_back(ref);
   }
 }
 
@@ -5,18 +5,28 @@
 #include "internal/intrinsics.hpp"
 #include "internal/memory_allocator.hpp"
 #include "internal/ref_alloc_observer.hpp"
+#include "internal/value.hpp"
 #include <atomic>
+#include <mutex>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace vm::internal {
 
+class FutureRef;
 class StringRef;
 class StringLinkRef;
 class StructRef;
 
 // Reference Allocator is responsible for acquiring raw memory from the MemoryAllocator and then
 // initialing references in it.
-// Also responsible for keeping track of all live references.
+// The references themselves are tracked by the MemoryAllocator, the garbage collector marks the
+// live references (see 'tryMark') and afterwards sweeps the unmarked ones (see 'sweep').
+//
+// References are divided into generations (see 'GarbageCollector'), the marks are kept between
+// collections so marked references are old. Old references that had a reference stored into them
+// since the last collection are tracked in the 'remembered-set' (see 'writeBarrier').
 class RefAllocator final {
 public:
   RefAllocator(MemoryAllocator* memAlloc) noexcept;
@@ -27,6 +37,8 @@ public:
   auto operator=(const RefAllocator& rhs) -> RefAllocator& = delete;
   auto operator=(RefAllocator&& rhs) -> RefAllocator& = delete;
 
+  [[nodiscard]] inline auto getMemAlloc() noexcept -> MemoryAllocator* { return m_memAlloc; }
+
   // Observe allocations being made.
   // Note: NOT synchronized has to be called before the application makes any allocations.
   auto subscribe(RefAllocObserver* observer) -> void;
@@ -40,12 +52,25 @@ public:
   // Allocate a string from a literal, upon failure returns nullptr.
   [[nodiscard]] auto allocStrLit(const char* literal, size_t literalLength) noexcept -> StringRef*;
 
-  // Allocate a string-link, upon failure returns nullptr.
-  [[nodiscard]] auto allocStrLink(Ref* prev, Value val) noexcept -> StringLinkRef*;
+  // Allocate an immortal string from a literal, upon failure returns nullptr.
+  // Immortal references are not tracked in the list of live allocations (so never visited by the
+  // garbage collector), they stay alive until the allocator is destroyed.
+  // Note: Not thread-safe, meant to be called before the application starts running.
+  [[nodiscard]] auto allocStrLitImmortal(const char* literal, size_t literalLength) noexcept
+      -> StringRef*;
+
+  // Allocate a string-link (a rope node), upon failure returns nullptr.
+  // 'balanced' should only be set for nodes that are part of a balanced representation, see
+  // 'balanceStringLink'.
+  [[nodiscard]] auto allocStrLink(Ref* left, Value right, bool balanced = false) noexcept
+      -> StringLinkRef*;
 
   // Allocate a struct, upon failure returns nullptr.
   [[nodiscard]] auto allocStruct(uint8_t fieldCount) noexcept -> StructRef*;
 
+  // Allocate a future with room for the arguments of the forked call, upon failure returns nullptr.
+  [[nodiscard]] auto allocFuture(uint8_t argCount) noexcept -> FutureRef*;
+
   // Allocate a plain ref type, upon failure returns nullptr.
   template <typename RefType, class... ArgTypes>
   [[nodiscard]] auto allocPlain(ArgTypes&&... args) noexcept -> RefType* {
@@ -61,30 +86,43 @@ public:
     return refPtr;
   }
 
-  // The 'head' allocation is the newest created reference. In combination with the 'getNextAlloc'
-  // allows walking all live references.
-  [[nodiscard]] inline auto getHeadAlloc() noexcept -> Ref* {
-    return m_head.load(std::memory_order_acquire);
+  // Has to be called after storing a value into an existing reference (for example a struct field).
+  // Old references that might now point to a young reference are added to the remembered-set.
+  inline auto writeBarrier(Ref* target, const Value& val) noexcept -> void {
+    if (val.isRef() && unlikely(target->getGen() == RefGen::Old)) {
+      remember(target);
+    }
   }
 
-  // Retrieve the 'next' references for a given reference, allows walking all live references.
-  [[nodiscard]] inline auto getNextAlloc(Ref* ref) noexcept -> Ref* { return ref->m_next; }
-
-  // Free the reference after the given one.
-  // Note: Not thread-safe, should not be called concurrently.
-  // Frees the next one instead of the given one because then we can more efficiently keep our
-  // linked list of references up to date.
-  inline auto freeNext(Ref* ref) noexcept -> Ref* {
-    auto* toFree = ref->m_next;
-    if (toFree) {
-      auto* next  = toFree->m_next;
-      ref->m_next = next;
-      freeUnsafe(toFree);
-      return next;
-    }
-    return nullptr;
+  // Release the thread-cache of the calling thread, after this the thread should not allocate
+  // anymore.
+  inline auto releaseThreadCache() noexcept -> void { m_memAlloc->releaseThreadCache(); }
+
+  // Mark the reference as alive, returns false if it was already marked.
+  // Note: Should only be called while all executors are paused.
+  [[nodiscard]] inline auto tryMark(Ref* ref, bool parallel) noexcept -> bool {
+    return MemoryAllocator::tryMark(ref, ref->m_memTag, parallel);
   }
 
+  // Unmark all references, see 'sweep'.
+  // Note: Should only be called while all executors are paused.
+  inline auto clearMarks() noexcept -> void { m_memAlloc->clearMarks(); }
+
+  // Destroy and free all references that are not marked. Returns the amount and the size of the
+  // remaining references.
+  // Note: Should only be called while all executors are paused.
+  auto sweep() noexcept -> MemoryAllocator::SweepResult;
+
+  // Old references that could point to young references.
+  // Note: Should only be accessed while all executors are paused.
+  [[nodiscard]] inline auto getRemembered() noexcept -> const std::vector<Ref*>& {
+    return m_remembered;
+  }
+
+  // Clear the remembered-set.
+  // Note: Should only be called while all executors are paused.
+  auto clearRemembered() noexcept -> void;
+
 private:
   struct Allocation {
     void* refPtr;
@@ -93,10 +131,17 @@ private:
   };
 
   MemoryAllocator* m_memAlloc;
-  std::atomic<Ref*> m_head;
+  std::vector<Ref*> m_immortals;
   std::vector<RefAllocObserver*> m_observers;
+  std::mutex m_rememberedMutex;
+  std::vector<Ref*> m_remembered;
 
-  auto initRef(Ref* ref, uint8_t memTag) noexcept -> void;
+  inline auto initRef(Ref* ref, uint8_t memTag) noexcept -> void {
+    // Store the memory-tag as we need it when marking the reference.
+    ref->m_memTag = memTag;
+  }
+
+  auto remember(Ref* ref) noexcept -> void;
 
   // Allocate raw memory for a structure + a payload for that structure. When 'payloadsize' is 0
   // only enough memory to hold the structure is allocated. When 'payloadsize' is 10 then 10
@@ -106,10 +151,12 @@ private:
   // Note: When memory allocation fails returns {nullptr, nullptr},
   template <typename ConcreteRef>
   inline auto alloc(const unsigned int payloadsize) noexcept -> Allocation {
-    // Make a single allocation of the header and the payload.
+    // Make a single allocation of the header and the payload. References with a non-trivial
+    // destructor are finalized (see 'Ref::destroy') before their memory is freed.
     const auto refSize   = sizeof(ConcreteRef);
     const auto allocSize = refSize + payloadsize;
-    auto alloc           = m_memAlloc->alloc(allocSize);
+    const auto finalize  = !std::is_trivially_destructible<ConcreteRef>::value;
+    auto alloc           = m_memAlloc->alloc(allocSize, finalize);
     void* payloadPtr     = static_cast<char*>(alloc.first) + refSize;
 
     // Notify any observers about this allocation.
@@ -119,15 +166,6 @@ private:
 
     return Allocation{alloc.first, payloadPtr, alloc.second};
   }
-
-  // Destruct and free the given ref, unsafe because it doesn't update any of the bookkeeping.
-  inline auto freeUnsafe(Ref* ref) noexcept -> void {
-    // 'Destroy' the reference, which will call the destructor of the implementation.
-    // Note: Reason why its not using a virtual destructor is that this way we can avoid the vtable.
-    ref->destroy();
-    // Free the backing memory.
-    m_memAlloc->free(ref, ref->m_memTag);
-  }
 };
 
 } // namespace vm::internal
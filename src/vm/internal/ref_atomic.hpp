@@ -1,4 +1,5 @@
 #pragma once
+#include "internal/futex.hpp"
 #include "internal/ref.hpp"
 #include "internal/value.hpp"
 #include <atomic>
@@ -6,6 +7,11 @@
 
 namespace vm::internal {
 
+// Atomic 32 bit integer, used for synchronizing executors (for example 'lazy' values).
+//
+// Executors that wait for the atomic to reach a value park their thread on a futex of the value
+// instead of spinning. To avoid a syscall on every successful compare-and-swap the amount of parked
+// waiters is tracked, only when there are waiters is the futex woken.
 class AtomicRef final : public Ref {
   friend class RefAllocator;
 
@@ -20,18 +26,42 @@ public:
   [[nodiscard]] constexpr static auto getKind() { return RefKind::Atomic; }
 
   [[nodiscard]] inline auto compareAndSwap(int32_t expected, int32_t desired) noexcept -> int32_t {
-    m_atomic.compare_exchange_strong(expected, desired, std::memory_order_seq_cst);
-    return expected;
+    auto val = static_cast<uint32_t>(expected);
+    if (m_atomic.compare_exchange_strong(
+            val, static_cast<uint32_t>(desired), std::memory_order_seq_cst) &&
+        expected != desired && m_waiters.load(std::memory_order_seq_cst) != 0U) {
+      futexWakeAll(&m_atomic);
+    }
+    return static_cast<int32_t>(val);
   }
 
   [[nodiscard]] inline auto load() const -> int32_t {
-    return m_atomic.load(std::memory_order_seq_cst);
+    return static_cast<int32_t>(m_atomic.load(std::memory_order_seq_cst));
   }
 
+  // Register the caller as a waiter and return the current value, the caller can then 'wait' for
+  // the value to change. Has to be followed by a call to 'endWait'.
+  // NOTE: Registering before loading guarantees that either the waiter observes a new value or the
+  // thread that changed the value observes the waiter (and wakes it).
+  [[nodiscard]] inline auto beginWait() noexcept -> int32_t {
+    m_waiters.fetch_add(1U, std::memory_order_seq_cst);
+    return load();
+  }
+
+  // Block the calling thread while the value is equal to 'current'.
+  // NOTE: Can return spuriously, callers have to re-check the value in a loop.
+  inline auto wait(int32_t current) noexcept -> void {
+    futexWait(&m_atomic, static_cast<uint32_t>(current));
+  }
+
+  inline auto endWait() noexcept -> void { m_waiters.fetch_sub(1U, std::memory_order_seq_cst); }
+
 private:
-  std::atomic<int32_t> m_atomic;
+  std::atomic<uint32_t> m_atomic;
+  std::atomic<uint32_t> m_waiters; // Fits in the padding after 'm_atomic'.
 
-  inline explicit AtomicRef(int32_t val) noexcept : Ref(getKind()), m_atomic{val} {}
+  inline explicit AtomicRef(int32_t val) noexcept :
+      Ref(getKind()), m_atomic{static_cast<uint32_t>(val)}, m_waiters{0U} {}
 };
 
 inline auto getAtomic(const Value& val) noexcept { return val.getDowncastRef<AtomicRef>(); }
@@ -5,7 +5,7 @@ namespace vm::internal {
 
 enum class RefFlags : uint8_t {
   None     = 0U,
-  GcMarked = 1U,
+  Immortal = 1U, // Never collected, not tracked by the allocator.
 };
 
 constexpr auto operator|(RefFlags lhs, RefFlags rhs) noexcept {
@@ -1,11 +1,10 @@
 #pragma once
+#include "internal/futex.hpp"
 #include "internal/thread.hpp"
 #include "internal/value.hpp"
 #include "vm/exec_state.hpp"
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
-#include <mutex>
 
 namespace vm::internal {
 
@@ -13,24 +12,35 @@ class Value;
 
 // A future is a handle to a forked executor that is asynchronously computing (or has computed) a
 // value.
+//
+// The arguments of the forked call are copied into the future (allocated right after this class),
+// this way the parent executor can continue immediately after forking. Until the forked executor
+// has taken the arguments the future is kept alive as a 'pending fork' in the executor registry.
+//
+// The state of the future is a single atomic word: the lowest byte holds the 'ExecState' of the
+// forked executor and the remaining bits count the threads that are waiting on the future. Polling
+// is a single load, waiters block on the word (see 'futexWait') and are only woken when there are
+// any.
 class FutureRef final : public Ref {
   friend class RefAllocator;
+  friend class ExecutorRegistry;
 
 public:
   FutureRef(const FutureRef& rhs) = delete;
   FutureRef(FutureRef&& rhs)      = delete;
   ~FutureRef() noexcept {
-    {
-      auto lk = std::lock_guard<std::mutex>{m_mutex};
-      if (m_state == ExecState::Running) {
-        m_state = ExecState::Aborted;
-      }
-      m_condVar.notify_all();
+    auto cur = m_state.load(std::memory_order_acquire);
+    while (getState(cur) == ExecState::Running &&
+           !m_state.compare_exchange_weak(
+               cur, withState(cur, ExecState::Aborted), std::memory_order_acq_rel)) {
     }
+    if (getWaiterCount(cur) != 0) {
+      futexWakeAll(&m_state);
 
-    // Wait until all waiters have received the abort message.
-    while (m_waitersCount.load(std::memory_order_acquire)) {
-      threadPause();
+      // Wait until all waiters have received the abort message.
+      while (getWaiterCount(m_state.load(std::memory_order_acquire)) != 0) {
+        threadPause();
+      }
     }
   }
 
@@ -41,69 +51,106 @@ public:
 
   // Block until the value has been computed (or the executor failed).
   [[nodiscard]] inline auto block() noexcept -> ExecState {
-    m_waitersCount.fetch_add(1, std::memory_order_release);
-
-    {
-      auto lk = std::unique_lock<std::mutex>{m_mutex};
-      m_condVar.wait(lk, [this] { return m_state != ExecState::Running; });
+    auto cur = m_state.load(std::memory_order_acquire);
+    if (getState(cur) != ExecState::Running) {
+      return getState(cur);
     }
-
-    m_waitersCount.fetch_sub(1, std::memory_order_release);
-    return m_state;
+    cur = m_state.fetch_add(waiterInc, std::memory_order_acq_rel) + waiterInc;
+    while (getState(cur) == ExecState::Running) {
+      futexWait(&m_state, cur);
+      cur = m_state.load(std::memory_order_acquire);
+    }
+    m_state.fetch_sub(waiterInc, std::memory_order_release);
+    return getState(cur);
   }
 
   // Block until the value has been computed or a timeout occurs.
   [[nodiscard]] inline auto waitNano(int64_t timeout) noexcept -> bool {
-    m_waitersCount.fetch_add(1, std::memory_order_release);
-
-    bool res;
-    {
-      auto lk = std::unique_lock<std::mutex>{m_mutex};
-      res     = m_condVar.wait_for(
-          lk, std::chrono::nanoseconds(timeout), [this] { return m_state != ExecState::Running; });
+    auto cur = m_state.load(std::memory_order_acquire);
+    if (getState(cur) != ExecState::Running) {
+      return true;
     }
-
-    m_waitersCount.fetch_sub(1, std::memory_order_release);
-    return res;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout);
+    cur = m_state.fetch_add(waiterInc, std::memory_order_acq_rel) + waiterInc;
+    while (getState(cur) == ExecState::Running) {
+      const auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 deadline - std::chrono::steady_clock::now())
+                                 .count();
+      if (remaining <= 0) {
+        break;
+      }
+      futexWait(&m_state, cur, remaining);
+      cur = m_state.load(std::memory_order_acquire);
+    }
+    m_state.fetch_sub(waiterInc, std::memory_order_release);
+    return getState(cur) != ExecState::Running;
   }
 
   // Check the state of the executor that is computing the value.
   [[nodiscard]] inline auto poll() noexcept -> ExecState {
-    auto lk = std::lock_guard<std::mutex>{m_mutex};
-    return m_state;
+    return getState(m_state.load(std::memory_order_acquire));
+  }
+
+  // Get a pointer to the first argument (In memory right after this class).
+  [[nodiscard]] inline auto getArgsBegin() noexcept -> Value* {
+    return static_cast<Value*>(static_cast<void*>(getPtr() + sizeof(FutureRef)));
   }
 
-  // Check if the executor has started computing the value.
-  [[nodiscard]] inline auto getStarted() noexcept -> std::atomic_bool& { return m_started; }
+  // Amount of arguments that the forked executor has not taken yet.
+  [[nodiscard]] inline auto getArgCount() const noexcept { return m_argCount; }
+
+  // Called by the forked executor after it has taken the arguments, from then on the future does
+  // not keep them alive anymore.
+  inline auto clearArgs() noexcept { m_argCount = 0; }
 
   [[nodiscard]] inline auto getResult() noexcept -> Value { return m_result; }
 
   inline auto setResult(Value result) noexcept { m_result = result; }
 
+  // Publish the final state of the executor (and thereby its result), wakes all waiters.
   inline auto setState(ExecState state) noexcept {
-    auto lk = std::lock_guard<std::mutex>{m_mutex};
-    m_state = state;
-    m_condVar.notify_all();
+    auto cur = m_state.load(std::memory_order_relaxed);
+    while (!m_state.compare_exchange_weak(cur, withState(cur, state), std::memory_order_acq_rel)) {
+    }
+    if (getWaiterCount(cur) != 0) {
+      futexWakeAll(&m_state);
+    }
   }
 
 private:
-  std::atomic_bool m_started;
-  ExecState m_state;
-  std::mutex m_mutex;
-  std::condition_variable m_condVar;
-  std::atomic<uint32_t> m_waitersCount;
+  // The waiter count is stored above the state byte.
+  static const uint32_t waiterInc = 1U << 8U;
+
+  uint8_t m_argCount;
+  std::atomic<uint32_t> m_state;
   Value m_result;
+  FutureRef* m_pendingPrev;
+  FutureRef* m_pendingNext;
 
-  inline explicit FutureRef() noexcept :
+  inline explicit FutureRef(uint8_t argCount) noexcept :
       Ref(getKind()),
-      m_started{false},
-      m_state{ExecState::Running},
-      m_mutex{},
-      m_condVar{},
-      m_waitersCount{0},
-      m_result{} {}
+      m_argCount{argCount},
+      m_state{withState(0U, ExecState::Running)},
+      m_result{},
+      m_pendingPrev{nullptr},
+      m_pendingNext{nullptr} {}
+
+  [[nodiscard]] inline static auto getState(uint32_t word) noexcept -> ExecState {
+    return static_cast<ExecState>(static_cast<int8_t>(word & 0xFFU));
+  }
+
+  [[nodiscard]] inline static auto getWaiterCount(uint32_t word) noexcept -> uint32_t {
+    return word >> 8U;
+  }
+
+  [[nodiscard]] inline static auto withState(uint32_t word, ExecState state) noexcept -> uint32_t {
+    return (word & ~0xFFU) | static_cast<uint8_t>(state);
+  }
 };
 
+// Keep futures small, with up to three arguments they fit in a 64 byte chunk of the allocator.
+static_assert(sizeof(FutureRef) == 40U);
+
 inline auto getFutureRef(const Value& val) noexcept { return val.getDowncastRef<FutureRef>(); }
 
 } // namespace vm::internal
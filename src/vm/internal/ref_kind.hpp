@@ -16,6 +16,7 @@ enum class RefKind : uint8_t {
   StreamProcess = 9U,
   Process       = 10U,
   IOWatcher     = 11U,
+  StringSlice   = 12U,
 };
 
 } // namespace vm::internal
@@ -5,6 +5,7 @@
 #include "internal/ref.hpp"
 #include "internal/ref_allocator.hpp"
 #include "internal/ref_string.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/stream_opts.hpp"
 #include "internal/thread.hpp"
 #include "intrinsics.hpp"
@@ -95,27 +96,27 @@ public:
     return bytesRead > 0;
   }
 
-  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringRef* str) noexcept
+  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringSpan str) noexcept
       -> bool {
     if (unlikely(m_kind == ConsoleStreamKind::StdIn)) {
       *pErr = PlatformError::StreamWriteNotSupported;
       return false;
     }
 
-    if (unlikely(str->getSize() == 0)) {
+    if (unlikely(str.getSize() == 0)) {
       return true;
     }
 
     execHandle->setState(ExecState::Paused);
 
-    const int bytesWritten = fileWrite(m_consoleHandle, str->getCharDataPtr(), str->getSize());
+    const int bytesWritten = fileWrite(m_consoleHandle, str.getCharDataPtr(), str.getSize());
 
     execHandle->setState(ExecState::Running);
     if (execHandle->trap()) {
       return false; // Aborted.
     }
 
-    if (bytesWritten != static_cast<int>(str->getSize())) {
+    if (bytesWritten != static_cast<int>(str.getSize())) {
       *pErr = getConsolePlatformError();
       return false;
     }
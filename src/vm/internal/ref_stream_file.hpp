@@ -5,6 +5,7 @@
 #include "internal/ref.hpp"
 #include "internal/ref_allocator.hpp"
 #include "internal/ref_string.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/stream_opts.hpp"
 #include "intrinsics.hpp"
 #include "vm/file.hpp"
@@ -105,27 +106,27 @@ public:
     return bytesRead > 0;
   }
 
-  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringRef* str) noexcept
+  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringSpan str) noexcept
       -> bool {
 
     if (unlikely(m_mode == FileStreamMode::OpenReadOnly)) {
       *pErr = PlatformError::StreamWriteNotSupported;
       return false;
     }
-    if (unlikely(str->getSize() == 0)) {
+    if (unlikely(str.getSize() == 0)) {
       return true;
     }
 
     execHandle->setState(ExecState::Paused);
 
-    const int bytesWritten = fileWrite(m_fileHandle, str->getCharDataPtr(), str->getSize());
+    const int bytesWritten = fileWrite(m_fileHandle, str.getCharDataPtr(), str.getSize());
 
     execHandle->setState(ExecState::Running);
     if (execHandle->trap()) {
       return false;
     }
 
-    if (bytesWritten != static_cast<int>(str->getSize())) {
+    if (bytesWritten != static_cast<int>(str.getSize())) {
       *pErr = getFilePlatformError();
       return false;
     }
@@ -1,6 +1,7 @@
 #pragma once
 #include "internal/platform_utilities.hpp"
 #include "internal/ref_process.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/stream_opts.hpp"
 
 namespace vm::internal {
@@ -68,7 +69,7 @@ public:
     return bytesRead > 0;
   }
 
-  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringRef* str) noexcept
+  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringSpan str) noexcept
       -> bool {
     if (unlikely(m_streamKind != ProcessStreamKind::StdIn)) {
       *pErr = PlatformError::StreamWriteNotSupported;
@@ -77,14 +78,14 @@ public:
 
     execHandle->setState(ExecState::Paused);
 
-    const int bytesWritten = fileWrite(getFile(), str->getCharDataPtr(), str->getSize());
+    const int bytesWritten = fileWrite(getFile(), str.getCharDataPtr(), str.getSize());
 
     execHandle->setState(ExecState::Running);
     if (execHandle->trap()) {
       return false; // Aborted.
     }
 
-    if (bytesWritten != static_cast<int>(str->getSize())) {
+    if (bytesWritten != static_cast<int>(str.getSize())) {
       *pErr = getProcessStreamPlatformError();
       return false;
     }
@@ -4,6 +4,7 @@
 #include "internal/ref.hpp"
 #include "internal/ref_allocator.hpp"
 #include "internal/ref_string.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/settings.hpp"
 #include "internal/stream_opts.hpp"
 #include "internal/thread.hpp"
@@ -190,13 +191,13 @@ public:
     return true;
   }
 
-  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringRef* str) noexcept
+  auto writeString(ExecutorHandle* execHandle, PlatformError* pErr, StringSpan str) noexcept
       -> bool {
     if (unlikely(m_type != TcpStreamType::Connection)) {
       *pErr = PlatformError::StreamWriteNotSupported;
       return false;
     }
-    if (str->getSize() == 0) {
+    if (str.getSize() == 0) {
       return true;
     }
 
@@ -204,7 +205,7 @@ public:
 
     int bytesWritten = -1;
     while (m_state.load(std::memory_order_acquire) == TcpStreamState::Valid) {
-      bytesWritten = ::send(m_socket, str->getCharDataPtr(), str->getSize(), 0);
+      bytesWritten = ::send(m_socket, str.getCharDataPtr(), str.getSize(), 0);
       if (bytesWritten >= 0) {
         break; // No error while writing.
       }
@@ -231,7 +232,7 @@ public:
       m_state.store(TcpStreamState::Failed, std::memory_order_release);
       return false;
     }
-    if (bytesWritten != static_cast<int>(str->getSize())) {
+    if (bytesWritten != static_cast<int>(str.getSize())) {
       *pErr = PlatformError::TcpUnknownError;
       return false;
     }
@@ -1,6 +1,7 @@
 #pragma once
 #include "internal/ref.hpp"
 #include "internal/value.hpp"
+#include <atomic>
 #include <cassert>
 
 namespace vm::internal {
@@ -36,14 +37,27 @@ public:
 
     // Null-terminate.
     m_data[size] = '\0';
+
+    // Characters have changed so a previously computed hash is no longer valid.
+    m_hash.store(0U, std::memory_order_relaxed);
+  }
+
+  // Hash of the characters if it has been computed, otherwise 0, see 'getStringHash'.
+  [[nodiscard]] inline auto getHash() const noexcept -> uint32_t {
+    return m_hash.load(std::memory_order_relaxed);
   }
 
+  // Note: Multiple threads can compute the hash of the same string at the same time, this is
+  // harmless as they compute the same value.
+  inline auto setHash(uint32_t hash) noexcept { m_hash.store(hash, std::memory_order_relaxed); }
+
 private:
   unsigned int m_size;
   uint8_t* m_data;
+  std::atomic<uint32_t> m_hash;
 
   inline explicit StringRef(uint8_t* data, unsigned int size) noexcept :
-      Ref(getKind()), m_size{size}, m_data{data} {}
+      Ref(getKind()), m_size{size}, m_data{data}, m_hash{0U} {}
 };
 
 } // namespace vm::internal
@@ -1,17 +1,29 @@
 #pragma once
 #include "internal/ref.hpp"
 #include "internal/ref_string.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/value.hpp"
+#include <algorithm>
+#include <atomic>
 
 namespace vm::internal {
 
 class RefAllocator;
 
-// A 'StringLink' can be used to create a linked list of StringRef's. Used as an optimization when
-// concatenation strings, only when the 'result' is needed is the actual concatenation performed.
-// Note: Only forward links are supported as the common case is building up a string forwards, but
-// if building a string backwards turns out to be common also we could support a configurable
-// direction.
+// Ropes that are deeper then this are balanced before they are walked, see 'balanceStringLink'.
+const unsigned int ropeMaxDepth = 48U;
+
+// A 'StringLink' is a node of a rope, a string that is represented as the concatenation of its
+// 'left' and 'right' side. Used as an optimization when concatenating strings (both appending and
+// prepending), only when the actual characters are needed is the rope walked.
+//
+// The left side is a StringRef, StringSliceRef or another StringLinkRef, the right side can also
+// be a single character (stored as an int). Every node caches its size and its depth (the longest
+// path to a leaf) so the size of a rope is known without walking it.
+//
+// Concatenating never balances the rope, instead ropes that become too deep to walk are balanced
+// when they are observed. The balanced representation is stored on the node and is used in place
+// of the node by future operations (including concatenations), see 'balanceStringLink'.
 class StringLinkRef final : public Ref {
   friend class RefAllocator;
 
@@ -25,60 +37,125 @@ public:
 
   [[nodiscard]] constexpr static auto getKind() { return RefKind::StringLink; }
 
-  // Prev can either be a StringRef or another StringLinkRef.
-  [[nodiscard]] inline auto getPrev() const noexcept { return m_prev; }
+  // Left side of the rope, either a StringRef, a StringSliceRef or another StringLinkRef.
+  [[nodiscard]] inline auto getLeft() const noexcept { return m_left; }
 
-  // The 'value' of the link is either a StringRef or a single character as an int.
-  [[nodiscard]] inline auto getVal() const noexcept { return m_val; }
+  // Right side of the rope, either a string (same as the left side) or a single character as an
+  // int.
+  [[nodiscard]] inline auto getRight() const noexcept { return m_right; }
 
-  // Size of the 'value' of the link, either the size of the StringRef or 1 incase of a character.
-  [[nodiscard]] inline auto getValSize() const noexcept {
-    if (m_val.isRef()) {
-      return m_val.getDowncastRef<StringRef>()->getSize();
-    }
-    // If its not a string it has to be a single character.
-    return 1U;
-  }
+  // Total amount of characters in the rope.
+  [[nodiscard]] inline auto getSize() const noexcept { return m_size; }
+
+  // Length of the longest path to a leaf (strings and characters have a depth of 0).
+  [[nodiscard]] inline auto getDepth() const noexcept { return m_depth; }
+
+  // Is this node part of a balanced representation, balanced nodes never get a balanced
+  // representation of their own.
+  [[nodiscard]] inline auto isBalanced() const noexcept { return m_balanced; }
+
+  // A balanced representation of the rope if it has been computed, otherwise null. Either a
+  // StringRef (a 'collapsed' representation) or a balanced StringLinkRef.
+  [[nodiscard]] inline auto getBalanced() const noexcept { return m_balancedRepr; }
 
-  // Has a collapsed version been computed.
-  [[nodiscard]] inline auto isCollapsed() const noexcept { return m_collapsed != nullptr; }
+  // Hash of the characters if it has been computed, otherwise 0, see 'getStringHash'.
+  [[nodiscard]] inline auto getHash() const noexcept -> uint32_t {
+    return m_hash.load(std::memory_order_relaxed);
+  }
 
-  // A collapsed version of the chain if it has been computed, otherwise null.
-  [[nodiscard]] inline auto getCollapsed() const noexcept { return m_collapsed; }
+  inline auto setHash(uint32_t hash) noexcept { m_hash.store(hash, std::memory_order_relaxed); }
 
-  // Set a collapsed version of the chain.
-  // Note: We cannot yet clear the 'prev' and 'val' references as multiple threads might be
-  // accessing this same link. Instead we wait until the next gc cycle before we clear those.
-  inline auto setCollapsed(StringRef* stringRef) noexcept { m_collapsed = stringRef; }
+  // Set a balanced representation of the rope.
+  // Note: We cannot yet clear the 'left' and 'right' references as multiple threads might be
+  // accessing this same rope. Instead we wait until the next gc cycle before we clear those.
+  inline auto setBalanced(Ref* repr) noexcept {
+    assert(!m_balanced);
+    assert(repr->getKind() == RefKind::String || repr->getKind() == RefKind::StringLink);
+    m_balancedRepr = repr;
+  }
 
-  // Clear the 'prev' and 'val references.
-  // Note: Should ONLY be called after a 'collapsed' version has been computed and its guaranteed no
-  // other thread is still accessing 'prev' and 'val'.
-  [[nodiscard]] inline auto clearLink() noexcept {
-    assert(m_collapsed != nullptr);
-    m_prev = nullptr;
-    m_val  = Value();
+  // Clear the 'left' and 'right' references.
+  // Note: Should ONLY be called after a balanced representation has been computed and its
+  // guaranteed no other thread is still accessing 'left' and 'right'.
+  inline auto clearLink() noexcept {
+    assert(m_balancedRepr != nullptr);
+    m_left  = nullptr;
+    m_right = Value();
   }
 
 private:
-  Ref* m_prev;
-  Value m_val;
-  StringRef* m_collapsed;
+  unsigned int m_size;
+  uint8_t m_depth;
+  bool m_balanced;
+  std::atomic<uint32_t> m_hash; // Fits in the padding before 'm_left'.
+  Ref* m_left;
+  Value m_right;
+  Ref* m_balancedRepr;
+
+  inline explicit StringLinkRef(Ref* left, Value right, bool balanced) noexcept;
+};
+
+// Get the representation of a string to use, for ropes this is the balanced representation if it
+// has been computed.
+inline auto getStringRepr(Ref* ref) noexcept -> Ref* {
+  if (ref->getKind() == RefKind::StringLink) {
+    auto* repr = downcastRef<StringLinkRef>(ref)->getBalanced();
+    if (repr != nullptr) {
+      return repr;
+    }
+  }
+  return ref;
+}
 
-  inline explicit StringLinkRef(Ref* prev, Value val) noexcept :
-      Ref(getKind()), m_prev{prev}, m_val{val}, m_collapsed{nullptr} {
+// Amount of characters in a StringRef, StringSliceRef or StringLinkRef.
+inline auto getStringSize(Ref* ref) noexcept -> unsigned int {
+  if (ref->getKind() == RefKind::StringLink) {
+    return downcastRef<StringLinkRef>(ref)->getSize();
+  }
+  return getStringSpan(ref).getSize();
+}
 
-    // Check the invariant that StringLink's are never empty.
-    assert(!val.isRef() || downcastRef<StringRef>(val.getRef())->getSize() != 0);
+// Amount of characters in a side of a rope, either a string or a single character.
+inline auto getStringSize(const Value& val) noexcept -> unsigned int {
+  return val.isRef() ? getStringSize(val.getRef()) : 1U;
+}
 
-    assert(m_prev != nullptr);
-    assert(m_prev->getKind() == RefKind::String || m_prev->getKind() == RefKind::StringLink);
+// Depth of a string, 0 for StringRefs and StringSliceRefs.
+inline auto getStringDepth(Ref* ref) noexcept -> unsigned int {
+  ref = getStringRepr(ref);
+  if (ref->getKind() == RefKind::StringLink) {
+    return downcastRef<StringLinkRef>(ref)->getDepth();
   }
-};
+  return 0U;
+}
+
+inline StringLinkRef::StringLinkRef(Ref* left, Value right, bool balanced) noexcept :
+    Ref(getKind()),
+    m_size{0U},
+    m_depth{0U},
+    m_balanced{balanced},
+    m_hash{0U},
+    m_left{getStringRepr(left)},
+    m_right{right.isRef() ? refValue(getStringRepr(right.getRef())) : right},
+    m_balancedRepr{nullptr} {
+
+  // Check the invariant that StringLink's are never empty.
+  assert(getStringSize(m_left) + getStringSize(m_right) != 0);
+
+  m_size = getStringSize(m_left) + getStringSize(m_right);
+
+  // Depth is saturated at the maximum value that fits in a byte, deeper ropes are balanced before
+  // they are walked anyway.
+  const auto childDepth = std::max(
+      getStringDepth(m_left), m_right.isRef() ? getStringDepth(m_right.getRef()) : 0U);
+  m_depth = static_cast<uint8_t>(std::min(childDepth + 1U, 255U));
+}
 
 inline auto getStringOrLinkRef(const Value& val) noexcept {
   auto* ref = val.getRef();
-  assert(ref->getKind() == RefKind::String || ref->getKind() == RefKind::StringLink);
+  assert(
+      ref->getKind() == RefKind::String || ref->getKind() == RefKind::StringSlice ||
+      ref->getKind() == RefKind::StringLink);
   return ref;
 }
 
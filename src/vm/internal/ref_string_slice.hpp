@@ -0,0 +1,77 @@
+#pragma once
+#include "internal/ref.hpp"
+#include "internal/ref_string.hpp"
+#include <cassert>
+#include <cstdint>
+
+namespace vm::internal {
+
+class RefAllocator;
+
+// A 'StringSlice' is a substring that references the characters of its parent string instead of
+// copying them, the parent is kept alive by the slice. Slices of slices reference the original
+// parent so the chain is never more then one deep.
+// Note: Unlike StringRef's the characters of a slice are not null-terminated.
+class StringSliceRef final : public Ref {
+  friend class RefAllocator;
+
+public:
+  StringSliceRef(const StringSliceRef& rhs) = delete;
+  StringSliceRef(StringSliceRef&& rhs)      = delete;
+  ~StringSliceRef() noexcept                = default;
+
+  auto operator=(const StringSliceRef& rhs) -> StringSliceRef& = delete;
+  auto operator=(StringSliceRef&& rhs) -> StringSliceRef& = delete;
+
+  [[nodiscard]] constexpr static auto getKind() { return RefKind::StringSlice; }
+
+  [[nodiscard]] inline auto getParent() const noexcept { return m_parent; }
+
+  [[nodiscard]] inline auto getDataPtr() const noexcept { return m_data; }
+
+  [[nodiscard]] inline auto getSize() const noexcept { return m_size; }
+
+private:
+  unsigned int m_size;
+  const uint8_t* m_data;
+  StringRef* m_parent;
+
+  inline explicit StringSliceRef(
+      StringRef* parent, const uint8_t* data, unsigned int size) noexcept :
+      Ref(getKind()), m_size{size}, m_data{data}, m_parent{parent} {
+
+    assert(data >= parent->getDataPtr());
+    assert(data + size <= parent->getDataPtr() + parent->getSize());
+  }
+};
+
+// Read-only view over the characters of a StringRef or a StringSliceRef.
+// Note: The characters are not guaranteed to be null-terminated.
+class StringSpan final {
+public:
+  inline StringSpan(const uint8_t* data, unsigned int size) noexcept : m_data{data}, m_size{size} {}
+
+  [[nodiscard]] inline auto getDataPtr() const noexcept { return m_data; }
+
+  [[nodiscard]] inline auto getCharDataPtr() const noexcept {
+    return reinterpret_cast<const char*>(m_data);
+  }
+
+  [[nodiscard]] inline auto getSize() const noexcept { return m_size; }
+
+private:
+  const uint8_t* m_data;
+  unsigned int m_size;
+};
+
+// Get the characters of a StringRef or a StringSliceRef.
+inline auto getStringSpan(Ref* ref) noexcept -> StringSpan {
+  if (ref->getKind() == RefKind::String) {
+    auto* strRef = downcastRef<StringRef>(ref);
+    return StringSpan{strRef->getDataPtr(), strRef->getSize()};
+  }
+  auto* sliceRef = downcastRef<StringSliceRef>(ref);
+  return StringSpan{sliceRef->getDataPtr(), sliceRef->getSize()};
+}
+
+} // namespace vm::internal
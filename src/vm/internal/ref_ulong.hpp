@@ -1,4 +1,5 @@
 #pragma once
+#include "internal/intrinsics.hpp"
 #include "internal/ref.hpp"
 #include "internal/value.hpp"
 #include <cstdint>
@@ -7,8 +8,8 @@ namespace vm::internal {
 
 // Reference to a 64 bit integer value.
 // We cannot store the full 64 bits in a 'Value' because only 63 bits are available for storage.
-// As an optimization longs with the most significant bit set to 0 are stored directly in a 'Value'
-// others are stored in a ULongRef.
+// As an optimization longs in the signed 63 bit range are stored directly in a 'Value', only longs
+// outside of that range are stored in a ULongRef.
 class ULongRef final : public Ref {
   friend class RefAllocator;
 
@@ -30,18 +31,19 @@ private:
   inline explicit ULongRef(uint64_t val) noexcept : Ref(getKind()), m_val{val} {}
 };
 
-inline auto getULong(const Value& val) noexcept -> uint64_t {
-  // Small long's (most significant bit set to 0) are stored in the value directly, while others
-  // are stored as references.
-  if (val.isRef()) {
-    return val.getDowncastRef<ULongRef>()->getVal();
+inline auto getLong(const Value& val) noexcept -> int64_t {
+  // Small long's (signed 63 bit range) are stored in the value directly, while others are stored
+  // as references.
+  if (likely(!val.isRef())) {
+    return val.getSmallLong();
   }
-  return val.getSmallULong();
+  const uint64_t raw = val.getDowncastRef<ULongRef>()->getVal();
+  return reinterpret_cast<const int64_t&>(raw);
 }
 
-inline auto getLong(const Value& val) noexcept -> int64_t {
-  const uint64_t raw = getULong(val);
-  return reinterpret_cast<const int64_t&>(raw);
+inline auto getULong(const Value& val) noexcept -> uint64_t {
+  const int64_t longVal = getLong(val);
+  return reinterpret_cast<const uint64_t&>(longVal);
 }
 
 } // namespace vm::internal
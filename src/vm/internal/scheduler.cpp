@@ -0,0 +1,823 @@
+#include "internal/scheduler.hpp"
+#include "internal/fiber.hpp"
+#include "internal/intrinsics.hpp"
+#include "internal/os_include.hpp"
+#include "internal/thread.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vm::internal {
+
+// Amount of fibers of finished tasks that are kept for reuse per worker and shared between the
+// workers, creating a fiber maps a new stack.
+const auto workerFiberCacheSize = 32U;
+const auto sharedFiberCacheSize = 256U;
+
+// Parked tasks are spread over a fixed amount of buckets based on the address they are parked on.
+const auto parkBucketCount = 256U;
+
+const auto taskDequeInitialCapacity = int64_t{256};
+
+struct Task {
+  SchedulerState* state;
+  Fiber* fiber; // Assigned when the task first runs, nullptr for tasks that run on their thread.
+  Scheduler::Routine routine;
+  void* arg;
+  Task* next; // Link in the global queue or a park bucket.
+  const std::atomic<uint32_t>* parkAddr;
+};
+
+// Work-stealing deque (Chase-Lev), the worker that owns the deque pushes and pops tasks at the
+// bottom while other workers steal from the top.
+//
+// Implementation of 'Correct and Efficient Work-Stealing for Weak Memory Models' (Lê et al.).
+// When full the deque grows into a new array, the old arrays are kept until the deque is destroyed
+// as thieves could still be reading from them.
+class TaskDeque final {
+public:
+  TaskDeque() noexcept : m_top{0}, m_bottom{0}, m_array{new Array(taskDequeInitialCapacity)} {}
+  TaskDeque(const TaskDeque& rhs) = delete;
+  TaskDeque(TaskDeque&& rhs)      = delete;
+  ~TaskDeque() noexcept {
+    auto* array = m_array.load(std::memory_order_relaxed);
+    while (array) {
+      auto* retired = array->retired;
+      delete array;
+      array = retired;
+    }
+  }
+
+  auto operator=(const TaskDeque& rhs) -> TaskDeque& = delete;
+  auto operator=(TaskDeque&& rhs) -> TaskDeque& = delete;
+
+  [[nodiscard]] auto isEmpty() const noexcept -> bool {
+    return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+  }
+
+  // NOTE: Only called by the owner.
+  auto push(Task* task) noexcept -> void {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed);
+    const auto top    = m_top.load(std::memory_order_acquire);
+    auto* array       = m_array.load(std::memory_order_relaxed);
+    if (unlikely(bottom - top > array->mask)) {
+      array = grow(array, top, bottom);
+    }
+    array->slots[bottom & array->mask].store(task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // NOTE: Only called by the owner.
+  [[nodiscard]] auto pop() noexcept -> Task* {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    auto* array       = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = m_top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      m_bottom.store(bottom + 1, std::memory_order_relaxed); // Empty.
+      return nullptr;
+    }
+    auto* task = array->slots[bottom & array->mask].load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // Last task: race against thieves for it.
+      if (!m_top.compare_exchange_strong(
+              top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        task = nullptr;
+      }
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Returns nullptr if the deque is empty or if another worker took the task first.
+  [[nodiscard]] auto steal() noexcept -> Task* {
+    auto top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return nullptr;
+    }
+    auto* array = m_array.load(std::memory_order_acquire);
+    auto* task  = array->slots[top & array->mask].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(
+            top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return task;
+  }
+
+private:
+  struct Array {
+    int64_t mask;
+    std::unique_ptr<std::atomic<Task*>[]> slots;
+    Array* retired; // Previous (smaller) array.
+
+    explicit Array(int64_t capacity) noexcept :
+        mask{capacity - 1}, slots{new std::atomic<Task*>[capacity]}, retired{nullptr} {}
+  };
+
+  alignas(64) std::atomic<int64_t> m_top;
+  alignas(64) std::atomic<int64_t> m_bottom;
+  std::atomic<Array*> m_array;
+
+  auto grow(Array* array, int64_t top, int64_t bottom) noexcept -> Array* {
+    auto* newArray = new Array((array->mask + 1) * 2);
+    for (auto i = top; i != bottom; ++i) {
+      newArray->slots[i & newArray->mask].store(
+          array->slots[i & array->mask].load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    }
+    newArray->retired = array;
+    m_array.store(newArray, std::memory_order_release);
+    return newArray;
+  }
+};
+
+struct alignas(64) Worker {
+  TaskDeque deque;
+  unsigned int index;
+  unsigned int tick; // Amount of tasks taken, used to periodically check the global queue.
+  std::vector<Fiber*> fiberCache;
+
+  explicit Worker(unsigned int index) noexcept : deque{}, index{index}, tick{0U}, fiberCache{} {
+    fiberCache.reserve(workerFiberCacheSize);
+  }
+};
+
+// Thread that is waiting for a worker after a blocking call, lives on the stack of the thread.
+struct LeaveWaiter {
+  Worker* worker = nullptr;
+  std::condition_variable condVar;
+  LeaveWaiter* next = nullptr;
+};
+
+struct SchedulerState {
+  std::atomic<unsigned int> refCount; // The scheduler, every thread and every unfinished task.
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<bool> shutdown;
+
+  // Global queue and the fiber cache that is shared between the workers.
+  std::mutex globalMutex;
+  Task* globalHead;
+  Task* globalTail;
+  std::atomic<unsigned int> globalCount;
+  std::vector<Fiber*> fiberCache;
+  std::atomic<unsigned int> fiberCacheCount; // Size of 'fiberCache', can be read without the lock.
+
+  // Idle workers and threads.
+  std::mutex mutex;
+  std::vector<Worker*> idleWorkers;
+  std::atomic<unsigned int> idleWorkerCount; // Size of 'idleWorkers', can be read without the lock.
+  LeaveWaiter* leaveHead;
+  LeaveWaiter* leaveTail;
+  std::condition_variable threadCondVar;
+  unsigned int threadCount;
+  unsigned int idleThreadCount;
+  unsigned int wakeTokens;   // Wakes for idle threads that have not been taken yet.
+  unsigned int pendingWakes; // Woken or started threads that have not tried to take a worker yet.
+
+  explicit SchedulerState(unsigned int workerCount) noexcept :
+      refCount{1U},
+      shutdown{false},
+      globalHead{nullptr},
+      globalTail{nullptr},
+      globalCount{0U},
+      fiberCache{},
+      fiberCacheCount{0U},
+      idleWorkerCount{workerCount},
+      leaveHead{nullptr},
+      leaveTail{nullptr},
+      threadCount{0U},
+      idleThreadCount{0U},
+      wakeTokens{0U},
+      pendingWakes{0U} {
+    for (auto i = 0U; i != workerCount; ++i) {
+      workers.push_back(std::make_unique<Worker>(i));
+    }
+    for (auto i = workerCount; i-- != 0U;) {
+      idleWorkers.push_back(workers[i].get());
+    }
+    fiberCache.reserve(sharedFiberCacheSize);
+  }
+
+  SchedulerState(const SchedulerState& rhs) = delete;
+  SchedulerState(SchedulerState&& rhs)      = delete;
+
+  ~SchedulerState() noexcept {
+    std::for_each(fiberCache.begin(), fiberCache.end(), &fiberDestroy);
+    for (auto& worker : workers) {
+      std::for_each(worker->fiberCache.begin(), worker->fiberCache.end(), &fiberDestroy);
+    }
+  }
+
+  auto operator=(const SchedulerState& rhs) -> SchedulerState& = delete;
+  auto operator=(SchedulerState&& rhs) -> SchedulerState& = delete;
+};
+
+// What the thread has to do after a task switched back to it, some things can only be done once
+// the task has stopped running on its own stack.
+enum class AfterSwitch {
+  Park,   // Unlock the park bucket.
+  Yield,  // Push the task onto the global queue.
+  Finish, // Cache the fiber of the task.
+};
+
+// Per thread context of the scheduler threads.
+struct ThreadCtx {
+  SchedulerState* state;
+  Fiber* threadFiber;
+  Worker* worker; // Worker that the thread owns, nullptr when not owning one.
+  Task* current;  // Task that is currently running on the thread.
+  AfterSwitch action;
+  std::mutex* parkLock;
+};
+
+thread_local static ThreadCtx* threadCtx;
+
+// Tasks can be resumed on a different thread, the context is read through a function that the
+// compiler cannot assume to return the same value on every call (it could otherwise keep the
+// address of the thread-local from before a switch).
+NO_INLINE static auto getThreadCtx() noexcept -> ThreadCtx* {
+  auto* ctx = threadCtx;
+#if defined(__clang__) || defined(__GNUG__)
+  asm volatile("" : "+r"(ctx) : : "memory");
+#endif
+  return ctx;
+}
+
+struct ParkBucket {
+  std::mutex mutex;
+  std::atomic<unsigned int> parkedCount; // Tasks parked (or being parked) in this bucket.
+  Task* head;                            // Intrusive list of the parked tasks.
+};
+
+static ParkBucket g_parkBuckets[parkBucketCount];
+
+static auto getParkBucket(const std::atomic<uint32_t>* addr) noexcept -> ParkBucket& {
+  const auto hash = std::hash<const std::atomic<uint32_t>*>{}(addr);
+  return g_parkBuckets[(hash >> 2U) % parkBucketCount];
+}
+
+// Thread-local error codes are saved when a task is suspended and restored when it is resumed
+// (possibly on a different thread).
+struct SavedErrors {
+  int err;
+#if defined(_WIN32)
+  unsigned long lastErr;
+#endif
+
+  SavedErrors() noexcept :
+      err{errno}
+#if defined(_WIN32)
+      ,
+      lastErr{GetLastError()}
+#endif
+  {
+  }
+
+  auto restore() const noexcept -> void {
+    errno = err;
+#if defined(_WIN32)
+    SetLastError(lastErr);
+#endif
+  }
+};
+
+static auto release(SchedulerState* state) noexcept -> void {
+  if (state->refCount.fetch_sub(1U, std::memory_order_acq_rel) == 1U) {
+    delete state;
+  }
+}
+
+static auto anyWork(SchedulerState* state) noexcept -> bool {
+  if (state->globalCount.load(std::memory_order_relaxed) != 0U) {
+    return true;
+  }
+  return std::any_of(state->workers.begin(), state->workers.end(), [](const auto& worker) {
+    return !worker->deque.isEmpty();
+  });
+}
+
+static auto pushGlobal(SchedulerState* state, Task* task) noexcept -> void {
+  auto lk    = std::lock_guard<std::mutex>{state->globalMutex};
+  task->next = nullptr;
+  if (state->globalTail) {
+    state->globalTail->next = task;
+  } else {
+    state->globalHead = task;
+  }
+  state->globalTail = task;
+  state->globalCount.fetch_add(1U, std::memory_order_relaxed);
+}
+
+static auto popGlobal(SchedulerState* state) noexcept -> Task* {
+  if (state->globalCount.load(std::memory_order_relaxed) == 0U) {
+    return nullptr;
+  }
+  auto lk    = std::lock_guard<std::mutex>{state->globalMutex};
+  auto* task = state->globalHead;
+  if (task) {
+    state->globalHead = task->next;
+    if (!state->globalHead) {
+      state->globalTail = nullptr;
+    }
+    state->globalCount.fetch_sub(1U, std::memory_order_relaxed);
+  }
+  return task;
+}
+
+// Remove a task from the global queue, returns false if it was not queued (anymore).
+static auto removeGlobal(SchedulerState* state, Task* task) noexcept -> bool {
+  auto lk    = std::lock_guard<std::mutex>{state->globalMutex};
+  Task* prev = nullptr;
+  for (auto* itr = state->globalHead; itr; prev = itr, itr = itr->next) {
+    if (itr != task) {
+      continue;
+    }
+    (prev ? prev->next : state->globalHead) = task->next;
+    if (state->globalTail == task) {
+      state->globalTail = prev;
+    }
+    state->globalCount.fetch_sub(1U, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+// Fibers are reused, every time a thread switches to a fiber that is not running a task yet it
+// starts running the current task of the thread.
+static auto fiberMain(void* /*unused*/) noexcept -> void {
+  while (true) {
+    auto* task = getThreadCtx()->current;
+    task->routine(task->arg);
+
+    // Switch back to the thread, which caches the fiber until it is used for a next task.
+    auto* ctx   = getThreadCtx();
+    ctx->action = AfterSwitch::Finish;
+    fiberSwitch(task->fiber, ctx->threadFiber);
+  }
+}
+
+// Returns nullptr if no fiber could be created.
+static auto acquireFiber(SchedulerState* state, Worker* worker) noexcept -> Fiber* {
+  if (!worker->fiberCache.empty()) {
+    auto* fiber = worker->fiberCache.back();
+    worker->fiberCache.pop_back();
+    return fiber;
+  }
+  if (state->fiberCacheCount.load(std::memory_order_relaxed) != 0U) {
+    auto lk = std::lock_guard<std::mutex>{state->globalMutex};
+    if (!state->fiberCache.empty()) {
+      auto* fiber = state->fiberCache.back();
+      state->fiberCache.pop_back();
+      state->fiberCacheCount.store(
+          static_cast<unsigned int>(state->fiberCache.size()), std::memory_order_relaxed);
+      return fiber;
+    }
+  }
+  return fiberCreate(&fiberMain, nullptr);
+}
+
+static auto recycleFiber(SchedulerState* state, Worker* worker, Fiber* fiber) noexcept -> void {
+  if (worker && worker->fiberCache.size() != workerFiberCacheSize) {
+    worker->fiberCache.push_back(fiber);
+    return;
+  }
+  {
+    auto lk = std::lock_guard<std::mutex>{state->globalMutex};
+    if (state->fiberCache.size() != sharedFiberCacheSize) {
+      state->fiberCache.push_back(fiber);
+      state->fiberCacheCount.store(
+          static_cast<unsigned int>(state->fiberCache.size()), std::memory_order_relaxed);
+      return;
+    }
+  }
+  fiberDestroy(fiber);
+}
+
+// Give an idle worker to a thread that is waiting to leave a blocking call, or add it to the idle
+// workers. NOTE: Has to be called while holding the lock.
+static auto putIdleWorker(SchedulerState* state, Worker* worker) noexcept -> void {
+  if (auto* waiter = state->leaveHead) {
+    state->leaveHead = waiter->next;
+    if (!state->leaveHead) {
+      state->leaveTail = nullptr;
+    }
+    waiter->worker = worker;
+    waiter->condVar.notify_one();
+    return;
+  }
+  state->idleWorkers.push_back(worker);
+  state->idleWorkerCount.store(
+      static_cast<unsigned int>(state->idleWorkers.size()), std::memory_order_seq_cst);
+}
+
+// NOTE: Has to be called while holding the lock.
+static auto popIdleWorker(SchedulerState* state) noexcept -> Worker* {
+  assert(!state->idleWorkers.empty());
+  auto* worker = state->idleWorkers.back();
+  state->idleWorkers.pop_back();
+  state->idleWorkerCount.store(
+      static_cast<unsigned int>(state->idleWorkers.size()), std::memory_order_relaxed);
+  return worker;
+}
+
+static auto threadMain(void* rawState) noexcept -> void;
+
+// Start a thread that takes an idle worker, returns false if no thread could be started.
+static auto startThread(SchedulerState* state, std::unique_lock<std::mutex>* lk) noexcept -> bool {
+  assert(lk->owns_lock());
+
+  ++state->threadCount;
+  state->refCount.fetch_add(1U, std::memory_order_relaxed);
+
+  // Start the thread without holding the lock.
+  lk->unlock();
+  const auto started = threadStart(&threadMain, static_cast<void*>(state));
+  lk->lock();
+
+  if (unlikely(started != ThreadStartResult::Success)) {
+    --state->threadCount;
+    --state->pendingWakes;
+    state->refCount.fetch_sub(1U, std::memory_order_relaxed); // Caller holds a reference.
+    return false;
+  }
+  return true;
+}
+
+// Make sure there is a thread for every idle worker while there is work, wakes an idle thread or
+// starts a new one. Returns false if a thread was needed but could not be started.
+// NOTE: Has to be called while holding the lock.
+static auto wakeLocked(SchedulerState* state, std::unique_lock<std::mutex>* lk) noexcept -> bool {
+  if (state->idleWorkers.size() <= state->pendingWakes) {
+    return true; // Already enough threads on their way to take the idle workers.
+  }
+  ++state->pendingWakes;
+  if (state->idleThreadCount > state->wakeTokens) {
+    ++state->wakeTokens;
+    state->threadCondVar.notify_one();
+    return true;
+  }
+  return startThread(state, lk);
+}
+
+static auto wake(SchedulerState* state) noexcept -> bool {
+  auto lk = std::unique_lock<std::mutex>{state->mutex};
+  return wakeLocked(state, &lk);
+}
+
+// Called after making a task runnable.
+// NOTE: Ordered after the push, pairs with the fence after releasing a worker. Either the pusher
+// observes the idle worker (and wakes a thread for it) or the releasing thread observes the task.
+static auto notifyWork(SchedulerState* state) noexcept -> bool {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (state->idleWorkerCount.load(std::memory_order_relaxed) == 0U) {
+    return true;
+  }
+  return wake(state);
+}
+
+static auto makeRunnable(Task* task) noexcept -> void {
+  auto* state = task->state;
+  auto* ctx   = getThreadCtx();
+  if (ctx && ctx->worker && ctx->state == state) {
+    ctx->worker->deque.push(task);
+  } else {
+    pushGlobal(state, task);
+  }
+  notifyWork(state);
+}
+
+static auto findTask(SchedulerState* state, Worker* worker) noexcept -> Task* {
+  Task* task;
+  if (++worker->tick % globalQueueCheckInterval == 0U && (task = popGlobal(state))) {
+    return task;
+  }
+  if ((task = worker->deque.pop()) || (task = popGlobal(state))) {
+    return task;
+  }
+
+  // Steal from the other workers.
+  const auto workerCount = static_cast<unsigned int>(state->workers.size());
+  for (auto i = 1U; i < workerCount; ++i) {
+    auto& victim = state->workers[(worker->index + i) % workerCount]->deque;
+    while (!victim.isEmpty()) {
+      if ((task = victim.steal())) {
+        return task;
+      }
+    }
+  }
+  return nullptr;
+}
+
+static auto runTask(ThreadCtx* ctx, Task* task) noexcept -> void {
+  ctx->current = task;
+  if (!task->fiber && unlikely(!(task->fiber = acquireFiber(ctx->state, ctx->worker)))) {
+    // No fiber could be created, run the task on the thread instead. It cannot park or yield so it
+    // blocks the thread (and its worker) while waiting.
+    task->routine(task->arg);
+    ctx->action = AfterSwitch::Finish;
+  } else {
+    fiberSwitch(ctx->threadFiber, task->fiber);
+  }
+  ctx->current = nullptr;
+
+  switch (ctx->action) {
+  case AfterSwitch::Park:
+    ctx->parkLock->unlock();
+    break;
+  case AfterSwitch::Yield:
+    pushGlobal(ctx->state, task);
+    break;
+  case AfterSwitch::Finish:
+    if (task->fiber) {
+      recycleFiber(ctx->state, ctx->worker, task->fiber);
+    }
+    delete task;
+    release(ctx->state); // Cannot reach zero, the thread holds a reference.
+    break;
+  }
+}
+
+// Run tasks until there is no more work, returns after releasing the worker.
+static auto runWorker(ThreadCtx* ctx) noexcept -> void {
+  auto* state = ctx->state;
+  while (true) {
+    auto* worker = ctx->worker;
+    if (!worker) {
+      return; // Handed off by a task that did not leave its blocking call.
+    }
+    auto* task = findTask(state, worker);
+    if (task) {
+      runTask(ctx, task);
+      continue;
+    }
+
+    // Out of work: release the worker, then check again as pushers only wake threads when they
+    // observe an idle worker.
+    auto lk = std::unique_lock<std::mutex>{state->mutex};
+    putIdleWorker(state, worker);
+    ctx->worker = nullptr;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!anyWork(state) || state->idleWorkers.empty()) {
+      return;
+    }
+    ctx->worker = popIdleWorker(state);
+  }
+}
+
+static auto threadMain(void* rawState) noexcept -> void {
+  auto* state = static_cast<SchedulerState*>(rawState);
+  auto ctx =
+      ThreadCtx{state, fiberThreadEnter(), nullptr, nullptr, AfterSwitch::Finish, nullptr};
+  threadCtx = &ctx;
+
+  auto lk = std::unique_lock<std::mutex>{state->mutex};
+  --state->pendingWakes; // Threads are started by a wake.
+
+  while (likely(ctx.threadFiber)) {
+    if (!state->idleWorkers.empty()) {
+      ctx.worker = popIdleWorker(state);
+      lk.unlock();
+      runWorker(&ctx);
+      lk.lock();
+    }
+    if (state->shutdown.load(std::memory_order_relaxed)) {
+      break;
+    }
+
+    // Wait for a wake.
+    ++state->idleThreadCount;
+    state->threadCondVar.wait_for(
+        lk, std::chrono::milliseconds(schedulerThreadIdleTimeoutMilliseconds), [state]() {
+          return state->wakeTokens != 0U || state->shutdown.load(std::memory_order_relaxed);
+        });
+    --state->idleThreadCount;
+
+    if (state->wakeTokens == 0U) {
+      break; // Timed out or shutting down.
+    }
+    --state->wakeTokens;
+    --state->pendingWakes;
+  }
+
+  --state->threadCount;
+  lk.unlock();
+
+  threadCtx = nullptr;
+  if (ctx.threadFiber) {
+    fiberThreadLeave(ctx.threadFiber);
+  }
+  release(state);
+}
+
+Scheduler::Scheduler(unsigned int workerCount) noexcept :
+    m_state{new SchedulerState(std::max(workerCount, 1U))} {}
+
+Scheduler::~Scheduler() noexcept {
+  shutdown();
+  release(m_state);
+}
+
+auto Scheduler::run(Routine routine, void* arg) noexcept -> bool {
+  assert(routine);
+
+  auto* state = m_state;
+  if (unlikely(state->shutdown.load(std::memory_order_relaxed))) {
+    return false;
+  }
+
+  // Tasks started from a task go to the deque of its worker.
+  auto* ctx    = getThreadCtx();
+  auto* worker = ctx && ctx->state == state ? ctx->worker : nullptr;
+
+  auto* task = new Task{state, nullptr, routine, arg, nullptr, nullptr};
+  state->refCount.fetch_add(1U, std::memory_order_relaxed);
+
+  if (worker) {
+    worker->deque.push(task);
+    notifyWork(state);
+    return true;
+  }
+  pushGlobal(state, task);
+  if (likely(notifyWork(state))) {
+    return true;
+  }
+
+  // Failed to start a thread, fail the task if no other thread has taken it in the meantime.
+  if (!removeGlobal(state, task)) {
+    return true;
+  }
+  delete task;
+  release(state);
+  return false;
+}
+
+auto Scheduler::shutdown() noexcept -> void {
+  auto* state = m_state;
+  {
+    auto lk = std::lock_guard<std::mutex>{state->mutex};
+    if (state->shutdown.load(std::memory_order_relaxed)) {
+      return;
+    }
+    state->shutdown.store(true, std::memory_order_relaxed);
+    state->threadCondVar.notify_all();
+  }
+
+  // Wake the parked tasks, they re-park if their value has not changed.
+  for (auto& bucket : g_parkBuckets) {
+    Task* woken = nullptr;
+    {
+      auto lk = std::lock_guard<std::mutex>{bucket.mutex};
+      for (auto** link = &bucket.head; *link;) {
+        auto* task = *link;
+        if (task->state != state) {
+          link = &task->next;
+          continue;
+        }
+        *link      = task->next;
+        task->next = woken;
+        woken      = task;
+        bucket.parkedCount.fetch_sub(1U, std::memory_order_relaxed);
+      }
+    }
+    while (woken) {
+      auto* next = woken->next;
+      makeRunnable(woken);
+      woken = next;
+    }
+  }
+}
+
+auto Scheduler::getWorkerCount() const noexcept -> unsigned int {
+  return static_cast<unsigned int>(m_state->workers.size());
+}
+
+auto Scheduler::getThreadCount() noexcept -> unsigned int {
+  auto lk = std::lock_guard<std::mutex>{m_state->mutex};
+  return m_state->threadCount;
+}
+
+auto schedulerPark(const std::atomic<uint32_t>* addr, uint32_t expected) noexcept -> bool {
+  auto* ctx = getThreadCtx();
+  if (!ctx || !ctx->current || !ctx->current->fiber || !ctx->worker) {
+    return false;
+  }
+  auto& bucket = getParkBucket(addr);
+  bucket.mutex.lock();
+
+  // Count the task before checking the value, pairs with the fence in 'schedulerUnparkAll'. Either
+  // we observe the new value or the waker observes the parked task (and waits for the lock).
+  bucket.parkedCount.fetch_add(1U, std::memory_order_seq_cst);
+  if (addr->load(std::memory_order_seq_cst) != expected) {
+    bucket.parkedCount.fetch_sub(1U, std::memory_order_relaxed);
+    bucket.mutex.unlock();
+    return true;
+  }
+  auto* task     = ctx->current;
+  task->parkAddr = addr;
+  task->next     = bucket.head;
+  bucket.head    = task;
+
+  // Suspend the task, the bucket is unlocked by the thread once the task has stopped running.
+  // NOTE: The context cannot be used after resuming as the task can be resumed on another thread.
+  const auto savedErrors = SavedErrors{};
+  ctx->action            = AfterSwitch::Park;
+  ctx->parkLock          = &bucket.mutex;
+  fiberSwitch(task->fiber, ctx->threadFiber);
+  savedErrors.restore();
+  return true;
+}
+
+auto schedulerUnparkAll(const std::atomic<uint32_t>* addr) noexcept -> void {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto& bucket = getParkBucket(addr);
+  if (bucket.parkedCount.load(std::memory_order_relaxed) == 0U) {
+    return;
+  }
+  Task* woken = nullptr;
+  {
+    auto lk = std::lock_guard<std::mutex>{bucket.mutex};
+    for (auto** link = &bucket.head; *link;) {
+      auto* task = *link;
+      if (task->parkAddr != addr) {
+        link = &task->next;
+        continue;
+      }
+      *link      = task->next;
+      task->next = woken;
+      woken      = task;
+      bucket.parkedCount.fetch_sub(1U, std::memory_order_relaxed);
+    }
+  }
+  while (woken) {
+    auto* next = woken->next;
+    makeRunnable(woken);
+    woken = next;
+  }
+}
+
+auto schedulerYield() noexcept -> void {
+  auto* ctx = getThreadCtx();
+  if (!ctx || !ctx->current || !ctx->current->fiber || !ctx->worker || !anyWork(ctx->state)) {
+    return;
+  }
+  auto* task             = ctx->current;
+  const auto savedErrors = SavedErrors{};
+  ctx->action            = AfterSwitch::Yield;
+  fiberSwitch(task->fiber, ctx->threadFiber);
+  savedErrors.restore();
+}
+
+auto schedulerEnterBlocking() noexcept -> void {
+  auto* ctx = getThreadCtx();
+  if (!ctx || !ctx->current || !ctx->worker) {
+    return;
+  }
+  auto* state = ctx->state;
+  auto lk     = std::unique_lock<std::mutex>{state->mutex};
+  putIdleWorker(state, ctx->worker);
+  ctx->worker = nullptr;
+
+  // Let another thread run the queued work while we are blocked.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (anyWork(state)) {
+    wakeLocked(state, &lk);
+  }
+}
+
+auto schedulerLeaveBlocking() noexcept -> void {
+  auto* ctx = getThreadCtx();
+  if (!ctx || !ctx->current || ctx->worker) {
+    return;
+  }
+  const auto savedErrors = SavedErrors{};
+  auto* state            = ctx->state;
+  auto lk                = std::unique_lock<std::mutex>{state->mutex};
+  if (!state->idleWorkers.empty()) {
+    ctx->worker = popIdleWorker(state);
+  } else {
+    // Wait until a worker is released, released workers are given to waiting threads first.
+    auto waiter = LeaveWaiter{};
+    if (state->leaveTail) {
+      state->leaveTail->next = &waiter;
+    } else {
+      state->leaveHead = &waiter;
+    }
+    state->leaveTail = &waiter;
+    waiter.condVar.wait(lk, [&waiter]() { return waiter.worker != nullptr; });
+    ctx->worker = waiter.worker;
+  }
+  lk.unlock();
+  savedErrors.restore();
+}
+
+} // namespace vm::internal
@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace vm::internal {
+
+// Threads that have no worker (and no wake) for this long exit.
+const auto schedulerThreadIdleTimeoutMilliseconds = 1000U;
+
+// Workers take a task from the global queue before their local deque once every this many tasks.
+const auto globalQueueCheckInterval = 61U;
+
+struct SchedulerState;
+
+// M:N scheduler that runs routines (forked executors) as tasks on a fixed amount of workers.
+//
+// Every task runs on its own fiber (see fiber.hpp) so it can be suspended at any point, fibers are
+// only assigned once a task starts running and are reused after it finishes. A thread has to own a
+// worker to run tasks. Each worker has a local work-stealing deque: tasks started from a task are
+// pushed onto the deque of its worker and are popped in LIFO order, workers that run out of work
+// steal from the other end of the deques of other workers. Tasks that are started from outside the
+// scheduler (for example by the main executor) go to a global FIFO queue, which workers also check
+// periodically (see 'globalQueueCheckInterval') to avoid starving it.
+//
+// Tasks give up their worker at two kinds of blocking points:
+// - Parking: a task that waits on a futex (see futex.hpp) without a timeout is suspended and its
+//   worker continues with other tasks, waking the futex makes the task runnable again. Executors
+//   park when waiting on a future, an atomic or a pause of the registry.
+// - Blocking calls: a task that enters a blocking call (sleeping, io, process waits, timed waits)
+//   keeps its thread but hands off its worker so another thread can run the other tasks. After the
+//   call it waits until a worker is available again. Executors mark blocking calls by pausing
+//   themselves, see 'ExecutorHandle::setState'.
+//
+// This way the amount of threads is bounded by the amount of workers plus the amount of tasks that
+// are inside a blocking call (instead of the amount of executors).
+//
+// NOTE: Tasks are not preempted, a task runs until it blocks, yields or finishes. Executors that
+// poll a future yield (see 'schedulerYield') so a busy-wait cannot starve the task it waits for.
+//
+class Scheduler final {
+public:
+  using Routine = void (*)(void* arg) noexcept;
+
+  explicit Scheduler(unsigned int workerCount) noexcept;
+  Scheduler(const Scheduler& rhs) = delete;
+  Scheduler(Scheduler&& rhs)      = delete;
+  ~Scheduler() noexcept;
+
+  auto operator=(const Scheduler& rhs) -> Scheduler& = delete;
+  auto operator=(Scheduler&& rhs) -> Scheduler& = delete;
+
+  // Run the routine as a new task, returns false if no thread could be started to run it.
+  // NOTE: Does not wait for the task to start.
+  [[nodiscard]] auto run(Routine routine, void* arg) noexcept -> bool;
+
+  // Stop the idle threads and wake all parked tasks once (so aborted executors can observe the
+  // abort), tasks that are still running finish on the remaining threads.
+  // NOTE: The scheduler cannot be used to run new tasks anymore after this.
+  auto shutdown() noexcept -> void;
+
+  [[nodiscard]] auto getWorkerCount() const noexcept -> unsigned int;
+
+  // Amount of threads that are currently started.
+  [[nodiscard]] auto getThreadCount() noexcept -> unsigned int;
+
+private:
+  // State is shared with the threads and the tasks and freed by whoever releases it last, this way
+  // threads and tasks that are still running (aborted) executors can outlive the scheduler.
+  SchedulerState* m_state;
+};
+
+// Park the current task while the value at 'addr' is equal to 'expected', the worker runs other
+// tasks in the meantime. Returns false (without waiting) if not called from a task that owns a
+// worker, the caller has to block its thread instead.
+// NOTE: Can return spuriously, callers have to re-check the value in a loop.
+auto schedulerPark(const std::atomic<uint32_t>* addr, uint32_t expected) noexcept -> bool;
+
+// Make all tasks that are parked on the given address runnable again.
+// NOTE: Has to be called after changing the value at 'addr', otherwise tasks can miss the wake.
+auto schedulerUnparkAll(const std::atomic<uint32_t>* addr) noexcept -> void;
+
+// Let the worker of the current task run other runnable tasks first, no-op when there are none or
+// when not called from a task.
+auto schedulerYield() noexcept -> void;
+
+// Hand off the worker of the current task before a blocking call, no-op when not called from a
+// task.
+auto schedulerEnterBlocking() noexcept -> void;
+
+// Wait until the current task owns a worker again after a blocking call, no-op when it still owns
+// one or when not called from a task.
+// NOTE: The task stays on its thread, so thread-local state (like 'errno') set by the blocking call
+// is preserved.
+auto schedulerLeaveBlocking() noexcept -> void;
+
+} // namespace vm::internal
@@ -1,38 +1,57 @@
 #pragma once
+#include "internal/intrinsics.hpp"
 #include "internal/value.hpp"
 #include <array>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 
 namespace vm::internal {
 
-// Virtual memory stack used by executors.
-// Note: stored on the hardware stack so capacity x 64 bit needs to fit in the platform's
-// stack-size.
-template <unsigned int Capacity>
+// Growable virtual memory stack used by executors.
+//
+// The first 'InitialCapacity' values are stored inline (so on the hardware stack of the executor),
+// when more space is needed the values are moved to a heap allocation that doubles in size every
+// time it runs out of space, up to 'MaxCapacity' values.
+//
+// Note: Growing the stack moves all values, pointers into the stack are invalidated by 'grow'.
+// Note: 'push' and 'alloc' do not check the capacity, the caller has to make sure there is enough
+// space (using 'hasSpace' and 'grow') before pushing. This allows reserving the space for a whole
+// stack-frame at once instead of checking on every push.
+template <unsigned int InitialCapacity, unsigned int MaxCapacity>
 class Stack final {
+  static_assert(InitialCapacity > 0 && InitialCapacity <= MaxCapacity);
+
 public:
   Stack() noexcept :
-      m_stack{}, m_stackNext{m_stack.data()}, m_stackMax{m_stack.data() + Capacity} {}
+      m_bottom{m_initial.data()},
+      m_stackNext{m_initial.data()},
+      m_stackMax{m_initial.data() + InitialCapacity} {}
   Stack(const Stack& rhs) = delete;
   Stack(Stack&& rhs)      = delete;
-  ~Stack() noexcept       = default;
+  ~Stack() noexcept {
+    if (m_bottom != m_initial.data()) {
+      std::free(m_bottom); // NOLINT: Manual memory management.
+    }
+  }
 
   auto operator=(const Stack& rhs) -> Stack& = delete;
   auto operator=(Stack&& rhs) -> Stack& = delete;
 
-  [[nodiscard]] inline auto getBottom() noexcept -> Value* { return m_stack.data(); }
+  [[nodiscard]] inline auto getBottom() const noexcept -> Value* { return m_bottom; }
 
   [[nodiscard]] inline auto getTop() const noexcept -> Value* { return m_stackNext - 1; }
 
   [[nodiscard]] inline auto getNext() const noexcept -> Value* { return m_stackNext; }
 
-  [[nodiscard]] inline auto isEmpty() const noexcept -> bool {
-    return m_stackNext == m_stack.data();
-  }
+  [[nodiscard]] inline auto isEmpty() const noexcept -> bool { return m_stackNext == m_bottom; }
 
   [[nodiscard]] inline auto getSize() const noexcept -> unsigned int {
-    return m_stackNext - m_stack.data();
+    return m_stackNext - m_bottom;
+  }
+
+  [[nodiscard]] inline auto getCapacity() const noexcept -> unsigned int {
+    return m_stackMax - m_bottom;
   }
 
   inline auto rewindToNext(Value* next) noexcept -> void {
@@ -40,20 +59,31 @@ public:
     m_stackNext = next;
   }
 
+  // Set the next free stack slot, used when continuing after generated code (see jit.hpp) has
+  // modified the stack.
+  inline auto setNext(Value* next) noexcept -> void {
+    assert(next >= m_bottom && next <= m_stackMax);
+    m_stackNext = next;
+  }
+
   inline auto rewindToTop(Value* top) noexcept -> void {
     assert(top <= getTop()); // Not allowed to go forwards.
     m_stackNext = top + 1;
   }
 
-  [[nodiscard]] inline auto alloc(unsigned int amount) noexcept -> bool {
+  [[nodiscard]] inline auto hasSpace(unsigned int amount) const noexcept -> bool {
+    return static_cast<unsigned int>(m_stackMax - m_stackNext) >= amount;
+  }
+
+  inline auto alloc(unsigned int amount) noexcept -> void {
     assert(amount != 0);
+    assert(hasSpace(amount));
     m_stackNext += amount;
-    return m_stackNext < m_stackMax;
   }
 
-  inline auto push(Value value) noexcept -> bool {
+  inline auto push(Value value) noexcept -> void {
+    assert(hasSpace(1));
     *m_stackNext++ = value;
-    return m_stackNext < m_stackMax;
   }
 
   inline auto peek() noexcept -> Value { return *getTop(); }
@@ -64,7 +94,7 @@ public:
   }
 
   inline auto pop() noexcept -> Value {
-    assert(m_stackNext - m_stack.data() != 0);
+    assert(m_stackNext - m_bottom != 0);
     return *--m_stackNext;
   }
 
@@ -79,12 +109,47 @@ public:
     return result;
   }
 
+  // Grow the stack so there is space for at least 'amount' more values.
+  // Returns false if the maximum capacity would be exceeded or the allocation failed.
+  // Note: Invalidates all pointers into the stack, use 'getBottom' to rebase them.
+  [[nodiscard]] auto grow(unsigned int amount = 1U) noexcept -> bool {
+    const auto size = getSize();
+    if (unlikely(amount > MaxCapacity - size)) {
+      return false;
+    }
+    auto newCapacity = getCapacity();
+    while (newCapacity < size + amount) {
+      newCapacity *= 2U;
+    }
+    if (newCapacity > MaxCapacity) {
+      newCapacity = MaxCapacity;
+    }
+
+    // NOLINTNEXTLINE: Manual memory management.
+    auto* newBottom = static_cast<Value*>(std::malloc(sizeof(Value) * newCapacity));
+    if (unlikely(newBottom == nullptr)) {
+      return false;
+    }
+
+    std::memcpy(newBottom, m_bottom, sizeof(Value) * size);
+    if (m_bottom != m_initial.data()) {
+      std::free(m_bottom); // NOLINT: Manual memory management.
+    }
+
+    m_bottom    = newBottom;
+    m_stackNext = newBottom + size;
+    m_stackMax  = newBottom + newCapacity;
+    return true;
+  }
+
 private:
-  std::array<Value, Capacity + 1> m_stack; // + 1 to be able to delay the bounds check.
+  std::array<Value, InitialCapacity> m_initial;
+  Value* m_bottom;
   Value* m_stackNext;
   Value* m_stackMax;
 };
 
-using BasicStack = Stack<10240>;
+// Executors start with 256 values (2 KiB) and can grow up to 8 million values (64 MiB).
+using BasicStack = Stack<256, 8U * 1024U * 1024U>;
 
 } // namespace vm::internal
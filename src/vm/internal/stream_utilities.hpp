@@ -6,11 +6,17 @@
 #include "internal/ref_stream_process.hpp"
 #include "internal/ref_stream_tcp.hpp"
 #include "internal/ref_string.hpp"
+#include "internal/ref_string_slice.hpp"
+#include "internal/string_link_utilities.hpp"
 #include "internal/stream_opts.hpp"
 #include "internal/value.hpp"
+#include <cstring>
 
 namespace vm::internal {
 
+// Size of the buffer that is used to combine the characters of ropes when writing them to streams.
+const unsigned int streamWriteBufferSize = 4U * 1024U; // 4 KiB
+
 // Instead of making a virtual class we dispatch manually based on refKind. This avoids the size
 // overhead of a vtable pointer.
 #define STREAM_DISPATCH(STREAM, EXPR)                                                              \
@@ -47,15 +53,50 @@ inline auto streamReadString(
   STREAM_DISPATCH(stream, readString(execHandle, pErr, tgt))
 }
 
+inline auto streamWriteSpan(
+    ExecutorHandle* execHandle, PlatformError* pErr, const Value& stream, StringSpan str) noexcept
+    -> bool {
+  STREAM_DISPATCH(stream, writeString(execHandle, pErr, str))
+}
+
+// Write a StringRef, StringSliceRef or a balanced StringLinkRef (see 'balanceStringLink').
+// Note: Balanced ropes are never modified so they can safely be walked while being blocked.
 inline auto streamWriteString(
-    ExecutorHandle* execHandle, PlatformError* pErr, const Value& stream, StringRef* str) noexcept
+    ExecutorHandle* execHandle, PlatformError* pErr, const Value& stream, Ref* str) noexcept
     -> bool {
 
   if (!streamCheckValid(stream)) {
     *pErr = PlatformError::StreamInvalid;
     return false;
   }
-  STREAM_DISPATCH(stream, writeString(execHandle, pErr, str))
+  if (str->getKind() != RefKind::StringLink) {
+    return streamWriteSpan(execHandle, pErr, stream, getStringSpan(str));
+  }
+  assert(downcastRef<StringLinkRef>(str)->isBalanced());
+
+  // Write the spans of the rope, short spans are combined into a buffer to avoid many small writes.
+  uint8_t buffer[streamWriteBufferSize];
+  auto bufferSize = 0U;
+  auto itr        = StringLinkIterator{str};
+  auto span       = StringSpan{nullptr, 0U};
+  while (itr.next(&span)) {
+    if (bufferSize != 0U && bufferSize + span.getSize() > streamWriteBufferSize) {
+      if (!streamWriteSpan(execHandle, pErr, stream, StringSpan{buffer, bufferSize})) {
+        return false;
+      }
+      bufferSize = 0U;
+    }
+    if (span.getSize() >= streamWriteBufferSize) {
+      if (!streamWriteSpan(execHandle, pErr, stream, span)) {
+        return false;
+      }
+      continue;
+    }
+    std::memcpy(buffer + bufferSize, span.getDataPtr(), span.getSize());
+    bufferSize += span.getSize();
+  }
+  return bufferSize == 0U ||
+      streamWriteSpan(execHandle, pErr, stream, StringSpan{buffer, bufferSize});
 }
 
 inline auto streamSetOpts(PlatformError* pErr, const Value& stream, StreamOpts opts) noexcept
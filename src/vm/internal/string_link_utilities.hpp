@@ -3,97 +3,295 @@
 #include "internal/ref_allocator.hpp"
 #include "internal/ref_string.hpp"
 #include "internal/ref_string_link.hpp"
+#include "internal/ref_string_slice.hpp"
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 namespace vm::internal {
 
-// Compute the total size of a string-link.
-inline auto getStringLinkSize(StringLinkRef& l) noexcept -> unsigned int {
-  // If we've precomputed this chain then we can return that size.
-  if (l.isCollapsed()) {
-    return l.getCollapsed()->getSize();
+// Balanced ropes are made out of 'chunks' of characters, short strings are copied into chunks of
+// at most this size while longer strings are referenced directly. Chunks (including the StringRef
+// and the null-terminator) fit in a 1 KiB size-class of the allocator.
+const unsigned int ropeChunkSize = 1024U - sizeof(StringRef) - 1U;
+
+// Balanced sub-ropes up to this depth are reused when rebalancing a rope, deeper ones are split up.
+const unsigned int ropeReuseMaxDepth = ropeMaxDepth / 2U;
+
+// Iterator over the characters of a rope, provides the characters as a sequence of spans.
+// Note: Only supports ropes up to 'ropeMaxDepth' deep, see 'getWalkableStringLink'.
+class StringLinkIterator final {
+public:
+  inline explicit StringLinkIterator(Ref* str) noexcept : m_stackSize{1U}, m_char{0U} {
+    m_stack[0] = refValue(str);
+  }
+
+  // Get the next (non-empty) span of characters, returns false if the end has been reached.
+  // Note: Spans of single characters are only valid until the next call.
+  [[nodiscard]] inline auto next(StringSpan* span) noexcept -> bool {
+    while (m_stackSize != 0U) {
+      const auto val = m_stack[--m_stackSize];
+      if (!val.isRef()) {
+        m_char = static_cast<uint8_t>(val.getInt());
+        *span  = StringSpan{&m_char, 1U};
+        return true;
+      }
+      auto* ref = getStringRepr(val.getRef());
+      if (ref->getKind() == RefKind::StringLink) {
+        auto* link = downcastRef<StringLinkRef>(ref);
+        assert(m_stackSize + 2U <= stackCapacity);
+        m_stack[m_stackSize++] = link->getRight();
+        m_stack[m_stackSize++] = refValue(link->getLeft());
+        continue;
+      }
+      *span = getStringSpan(ref);
+      if (span->getSize() != 0U) {
+        return true;
+      }
+    }
+    return false;
   }
 
-  // Otherwise walk the chain to compute the full size.
-  auto result = l.getValSize();
-  auto* cur   = l.getPrev();
+private:
+  // Sides of ropes can have a balanced representation that is deeper then the side itself, but
+  // those are never deeper then 'ropeMaxDepth'.
+  static const unsigned int stackCapacity = ropeMaxDepth * 2U + 2U;
+
+  Value m_stack[stackCapacity];
+  unsigned int m_stackSize;
+  uint8_t m_char;
+};
+
+// Visit the parts of a rope together with their offset, in no particular order.
+// The visitor is invoked with the part, its offset and its size. For StringLinkRefs it returns if
+// the sides of the link should be visited. Visits the shallow sides first so the amount of pending
+// sides stays small for unbalanced ropes.
+template <typename Visitor>
+inline auto visitStringLink(Ref* str, Visitor visitor) noexcept -> void {
+  auto pending = std::vector<std::pair<Value, unsigned int>>{};
+  auto cur     = std::make_pair(refValue(str), 0U);
   while (true) {
-    if (cur->getKind() == RefKind::String) {
-      result += downcastRef<StringRef>(cur)->getSize();
-      break;
+    auto descended = false;
+    if (cur.first.isRef()) {
+      auto* ref = getStringRepr(cur.first.getRef());
+      if (ref->getKind() == RefKind::StringLink) {
+        auto* link = downcastRef<StringLinkRef>(ref);
+        if (visitor(refValue(ref), cur.second, link->getSize())) {
+          const auto rightOffset = cur.second + getStringSize(link->getLeft());
+          auto left              = std::make_pair(refValue(link->getLeft()), cur.second);
+          auto right             = std::make_pair(link->getRight(), rightOffset);
+          const auto depthL = getStringDepth(link->getLeft());
+          const auto depthR = right.first.isRef() ? getStringDepth(right.first.getRef()) : 0U;
+          if (depthL > depthR) {
+            std::swap(left, right);
+          }
+          pending.push_back(right);
+          cur       = left;
+          descended = true;
+        }
+      } else {
+        visitor(refValue(ref), cur.second, getStringSpan(ref).getSize());
+      }
+    } else {
+      visitor(cur.first, cur.second, 1U);
     }
-    auto* curLink = downcastRef<StringLinkRef>(cur);
-    if (curLink->isCollapsed()) {
-      result += curLink->getCollapsed()->getSize();
-      break;
+    if (!descended) {
+      if (pending.empty()) {
+        break;
+      }
+      cur = pending.back();
+      pending.pop_back();
     }
-
-    result += curLink->getValSize();
-    cur = curLink->getPrev();
-    assert(cur != nullptr);
   }
+}
 
-  return result;
+// Copy the characters of a rope into the given buffer.
+inline auto copyStringLink(Ref* str, uint8_t* buffer) noexcept -> void {
+  visitStringLink(str, [buffer](const Value& part, unsigned int offset, unsigned int /*unused*/) {
+    if (!part.isRef()) {
+      buffer[offset] = static_cast<uint8_t>(part.getInt());
+      return false;
+    }
+    if (part.getRef()->getKind() == RefKind::StringLink) {
+      return true;
+    }
+    const auto span = getStringSpan(part.getRef());
+    std::memcpy(buffer + offset, span.getDataPtr(), span.getSize());
+    return false;
+  });
 }
 
-// Collapse a string-link into a normal string.
-inline auto collapseStringLink(RefAllocator* refAlloc, StringLinkRef& l) noexcept -> StringRef* {
-  // If we've collapsed this link before return the previous result.
-  if (l.isCollapsed()) {
-    return l.getCollapsed();
+// Compute a balanced representation of a rope, either a single StringRef or a tree of balanced
+// StringLinkRefs at most 'ropeMaxDepth' deep. The result is stored on the rope so it is only
+// computed once.
+//
+// Long strings and balanced sub-ropes (for example the balanced representation of a rope that was
+// appended to) are reused, the remaining short strings and characters are copied into chunks. This
+// way building up a string while observing it only copies the new characters.
+inline auto balanceStringLink(RefAllocator* refAlloc, StringLinkRef& l) noexcept -> Ref* {
+  if (l.getBalanced() != nullptr) {
+    return l.getBalanced();
   }
-
-  // Allocate a new string big enough to the hold the entire chain.
-  auto size = getStringLinkSize(l);
-  auto str  = refAlloc->allocStr(size);
-  if (unlikely(str == nullptr)) {
-    return nullptr;
+  if (l.isBalanced()) {
+    return &l;
   }
 
-  auto* charDataStartPtr = str->getDataPtr();
-  auto* charDataPtr      = charDataStartPtr + size;
+  struct Part {
+    unsigned int offset;
+    unsigned int size;
+    Ref* ref;
+    bool isChunk;
+  };
 
-  // Utility macro for copying to the end to our string.
-#define CPY_STR(STR_SRC)                                                                           \
-  {                                                                                                \
-    charDataPtr -= (STR_SRC)->getSize();                                                           \
-    std::memcpy(charDataPtr, (STR_SRC)->getDataPtr(), (STR_SRC)->getSize());                       \
-  }
+  // Gather the parts that are reused.
+  auto parts = std::vector<Part>{};
+  visitStringLink(&l, [&parts](const Value& part, unsigned int offset, unsigned int size) {
+    if (!part.isRef()) {
+      return false;
+    }
+    auto* ref = part.getRef();
+    if (ref->getKind() == RefKind::StringLink) {
+      auto* link = downcastRef<StringLinkRef>(ref);
+      if (link->isBalanced() && link->getDepth() <= ropeReuseMaxDepth) {
+        parts.push_back(Part{offset, size, ref, false});
+        return false;
+      }
+      return true;
+    }
+    if (size >= ropeChunkSize / 2U) {
+      parts.push_back(Part{offset, size, ref, false});
+    }
+    return false;
+  });
+  std::sort(parts.begin(), parts.end(), [](const Part& a, const Part& b) {
+    return a.offset < b.offset;
+  });
 
-  // Copy our own value into the string.
-  if (l.getVal().isRef()) {
-    CPY_STR(l.getVal().getDowncastRef<StringRef>());
-  } else {
-    *--charDataPtr = static_cast<uint8_t>(l.getVal().getInt());
+  // Allocate chunks for the characters in between the reused parts.
+  auto allParts  = std::vector<Part>{};
+  auto cursor    = 0U;
+  auto addChunks = [&](unsigned int end) {
+    const auto size       = end - cursor;
+    const auto chunkCount = (size + ropeChunkSize - 1U) / ropeChunkSize;
+    for (auto i = 0U; i != chunkCount; ++i) {
+      const auto chunkEnd = cursor + (end - cursor) / (chunkCount - i);
+      auto* chunk         = refAlloc->allocStr(chunkEnd - cursor);
+      if (unlikely(chunk == nullptr)) {
+        return false;
+      }
+      allParts.push_back(Part{cursor, chunkEnd - cursor, chunk, true});
+      cursor = chunkEnd;
+    }
+    return true;
+  };
+  for (const auto& part : parts) {
+    if (unlikely(!addChunks(part.offset))) {
+      return nullptr;
+    }
+    allParts.push_back(part);
+    cursor += part.size;
+  }
+  if (unlikely(!addChunks(l.getSize()))) {
+    return nullptr;
   }
 
-  // Copy the rest of the chain into the string.
-  auto* cur = l.getPrev();
-  while (true) {
-    if (cur->getKind() == RefKind::String) {
-      CPY_STR(downcastRef<StringRef>(cur));
-      break;
+  // Copy the characters into the chunks.
+  visitStringLink(&l, [&allParts](const Value& part, unsigned int offset, unsigned int size) {
+    auto itr = std::upper_bound(
+        allParts.begin(), allParts.end(), offset, [](unsigned int val, const Part& p) {
+          return val < p.offset;
+        });
+    --itr;
+    if (!itr->isChunk && offset + size <= itr->offset + itr->size) {
+      return false; // Part of a reused part.
     }
-    auto* curLink = downcastRef<StringLinkRef>(cur);
-    if (curLink->isCollapsed()) {
-      CPY_STR(curLink->getCollapsed());
-      break;
+    if (part.isRef() && part.getRef()->getKind() == RefKind::StringLink) {
+      return true;
     }
+    for (; itr != allParts.end() && itr->offset < offset + size; ++itr) {
+      if (!itr->isChunk) {
+        continue;
+      }
+      const auto copyBegin = std::max(offset, itr->offset);
+      const auto copyEnd   = std::min(offset + size, itr->offset + itr->size);
+      auto* chunk          = downcastRef<StringRef>(itr->ref);
+      auto* chunkData      = chunk->getDataPtr() + (copyBegin - itr->offset);
+      if (part.isRef()) {
+        const auto span = getStringSpan(part.getRef());
+        std::memcpy(chunkData, span.getDataPtr() + (copyBegin - offset), copyEnd - copyBegin);
+      } else {
+        *chunkData = static_cast<uint8_t>(part.getInt());
+      }
+    }
+    return false;
+  });
 
-    if (curLink->getVal().isRef()) {
-      CPY_STR(curLink->getVal().getDowncastRef<StringRef>());
-    } else {
-      *--charDataPtr = static_cast<uint8_t>(curLink->getVal().getInt());
+  // Build a balanced tree out of the parts.
+  auto build = [&](auto& self, size_t begin, size_t end) -> Ref* {
+    if (end - begin == 1U) {
+      return allParts[begin].ref;
+    }
+    const auto mid = begin + (end - begin) / 2U;
+    auto* left     = self(self, begin, mid);
+    auto* right    = left == nullptr ? nullptr : self(self, mid, end);
+    if (unlikely(right == nullptr)) {
+      return nullptr;
     }
-    cur = curLink->getPrev();
-    assert(cur != nullptr);
+    return refAlloc->allocStrLink(left, refValue(right), true);
+  };
+  auto* result = build(build, 0U, allParts.size());
+  if (unlikely(result == nullptr)) {
+    return nullptr;
+  }
+
+  // Pathological ropes (huge amounts of small reused parts) are collapsed into a single string.
+  if (getStringDepth(result) > ropeMaxDepth) {
+    auto* str = refAlloc->allocStr(l.getSize());
+    if (unlikely(str == nullptr)) {
+      return nullptr;
+    }
+    copyStringLink(result, str->getDataPtr());
+    result = str;
   }
 
-#undef CPY_LINK
+  // Store the balanced representation on the rope, this caches the value for future requests on
+  // the same rope.
+  l.setBalanced(result);
+  refAlloc->writeBarrier(&l, refValue(result));
+
+  return result;
+}
+
+// Get a version of the rope that can be walked, see 'StringLinkIterator'.
+inline auto getWalkableStringLink(RefAllocator* refAlloc, StringLinkRef& l) noexcept -> Ref* {
+  auto* repr = getStringRepr(&l);
+  if (getStringDepth(repr) <= ropeMaxDepth) {
+    return repr;
+  }
+  return balanceStringLink(refAlloc, l);
+}
+
+// Collapse a rope into a normal string.
+inline auto collapseStringLink(RefAllocator* refAlloc, StringLinkRef& l) noexcept -> StringRef* {
+  // If we've collapsed this rope before return the previous result.
+  auto* repr = l.getBalanced();
+  if (repr != nullptr && repr->getKind() == RefKind::String) {
+    return downcastRef<StringRef>(repr);
+  }
+
+  // Allocate a new string big enough to the hold the entire rope.
+  auto str = refAlloc->allocStr(l.getSize());
+  if (unlikely(str == nullptr)) {
+    return nullptr;
+  }
+  copyStringLink(&l, str->getDataPtr());
 
-  // Set the new string as the 'collapsed' representation for that link, this caches the value for
-  // future requests on the same link.
-  l.setCollapsed(str);
+  // Set the new string as the 'collapsed' representation for the rope, this caches the value for
+  // future requests on the same rope.
+  // Note: Replaces a previous (balanced) representation, operations that block while walking the
+  // previous representation keep it alive themselves.
+  l.setBalanced(str);
+  refAlloc->writeBarrier(&l, refValue(str));
 
   return str;
 }
@@ -3,27 +3,75 @@
 #include "internal/intrinsics.hpp"
 #include "internal/ref_allocator.hpp"
 #include "internal/ref_string.hpp"
+#include "internal/ref_string_slice.hpp"
 #include "internal/string_link_utilities.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
 
 namespace vm::internal {
 
+// Slices of at least this many characters reference the characters of the target string instead
+// of copying them, see 'StringSliceRef'.
+const unsigned int stringSliceMinSize = 32U;
+
+// Slices are only made if they cover at least 1 / 'stringSliceMaxWaste' of their parent string,
+// this prevents small slices of big strings from keeping the big string alive. Once repeated
+// slicing goes below this threshold a compact copy is made which becomes the new parent.
+const unsigned int stringSliceMaxWaste = 4U;
+
 inline auto isStringEmpty(const Value& val) noexcept {
   auto* ref = getStringOrLinkRef(val);
   if (ref->getKind() == RefKind::String) {
     return downcastRef<StringRef>(ref)->getSize() == 0;
   }
 
-  // String-links are never empty.
+  // String-links and string-slices are never empty.
   return false;
 }
 
-// Get a StringRef* from a value. Supports direct StringRef's or StringLinkRefs.
+// Get a StringRef* or StringSliceRef* from a value, string-link are collapsed into a StringRef.
 // Requires a allocator as in-case of a StringLinkRef we might need to allocate a new string.
-inline auto getStringRef(RefAllocator* refAlloc, const Value& val) noexcept {
+inline auto getStringOrSliceRef(RefAllocator* refAlloc, const Value& val) noexcept -> Ref* {
   auto* ref = val.getRef();
+  if (ref->getKind() != RefKind::StringLink) {
+    assert(ref->getKind() == RefKind::String || ref->getKind() == RefKind::StringSlice);
+    return ref;
+  }
+
+  // Collapse the string-link chain into a normal string.
+  auto* strLinkRef = val.getDowncastRef<StringLinkRef>();
+  return collapseStringLink(refAlloc, *strLinkRef);
+}
+
+// Get a StringRef*, StringSliceRef* or a StringLinkRef* that can be walked (see
+// 'getWalkableStringLink') from a value.
+// Requires a allocator as in-case of a deep StringLinkRef we might need to balance it.
+// Note: Short ropes are collapsed instead, operations on flat strings are cheaper then walking the
+// rope and the collapsed string is reused by future operations on the same rope.
+inline auto getWalkableStringRef(RefAllocator* refAlloc, const Value& val) noexcept -> Ref* {
+  auto* ref = getStringOrLinkRef(val);
+  if (ref->getKind() != RefKind::StringLink) {
+    return ref;
+  }
+  auto* link = downcastRef<StringLinkRef>(ref);
+  if (link->getBalanced() == nullptr && link->getSize() <= ropeChunkSize) {
+    return collapseStringLink(refAlloc, *link);
+  }
+  return getWalkableStringLink(refAlloc, *link);
+}
+
+// Get a StringRef* from a value. Supports direct StringRef's, StringLinkRefs or StringSliceRefs.
+// Requires a allocator as in-case of a StringLinkRef or a StringSliceRef we might need to allocate
+// a new string.
+// Note: Meant for consumers that need a null-terminated string (for example to pass it to the os),
+// others should prefer 'getStringOrSliceRef' as that avoids copying string-slices.
+inline auto getStringRef(RefAllocator* refAlloc, const Value& val) noexcept -> StringRef* {
+  auto* ref = getStringOrSliceRef(refAlloc, val);
+  if (unlikely(ref == nullptr)) {
+    return nullptr;
+  }
   if (ref->getKind() == RefKind::String) {
     auto strRef = downcastRef<StringRef>(ref);
     // Assert that the string is null-terminated.
@@ -31,12 +79,14 @@ inline auto getStringRef(RefAllocator* refAlloc, const Value& val) noexcept {
     return strRef;
   }
 
-  // If its not a string we assume its a string-link.
-  assert(ref->getKind() == RefKind::StringLink);
-
-  // Collapse the string-link chain into a normal string.
-  auto* strLinkRef = val.getDowncastRef<StringLinkRef>();
-  return collapseStringLink(refAlloc, *strLinkRef);
+  // Copy the characters of the slice into a new (null-terminated) string.
+  auto* sliceRef = downcastRef<StringSliceRef>(ref);
+  auto* str      = refAlloc->allocStr(sliceRef->getSize());
+  if (unlikely(str == nullptr)) {
+    return nullptr;
+  }
+  std::memcpy(str->getDataPtr(), sliceRef->getDataPtr(), sliceRef->getSize());
+  return str;
 }
 
 template <typename IntType>
@@ -147,21 +197,219 @@ enum FloatToStringFlags : uint8_t {
   return toStringRef(refAlloc, cstr, std::strlen(cstr));
 }
 
-[[nodiscard]] auto inline checkStringEq(StringRef* a, StringRef* b) noexcept -> bool {
-  return (a->getSize() == b->getSize()) &&
-      std::memcmp(a->getDataPtr(), b->getDataPtr(), a->getSize()) == 0;
+// Strings of at least this many characters get their hash computed when compared, this way repeated
+// comparisons between different strings (for example when searching a list) only have to compare
+// the cached hashes.
+const unsigned int stringHashEqMinSize = 64U;
+
+// Incremental hash of a sequence of characters.
+// Characters are processed 8 at a time as 64 bit words, the result only depends on the characters
+// and not on how they are split into spans (which allows hashing ropes without collapsing them).
+// Note: Words are always read in little-endian order (the order partial words are assembled in),
+// otherwise the hash would depend on how the characters are split into spans on big-endian hosts.
+class StringHasher final {
+public:
+  inline StringHasher() noexcept : m_state{seed}, m_word{0U}, m_wordSize{0U}, m_size{0U} {}
+
+  inline auto add(const StringSpan& span) noexcept -> void {
+    const auto* data = span.getDataPtr();
+    const auto* end  = data + span.getSize();
+    m_size += span.getSize();
+
+    // Complete a partial word from the previous span.
+    for (; m_wordSize != 0U && data != end; ++data) {
+      addChar(*data);
+    }
+    for (; end - data >= 8; data += 8) {
+      mix(loadWord(data));
+    }
+    for (; data != end; ++data) {
+      addChar(*data);
+    }
+  }
+
+  // Finish the hash, never returns 0 as that is used to indicate that a hash is not computed yet.
+  [[nodiscard]] inline auto finish() noexcept -> uint32_t {
+    if (m_wordSize != 0U) {
+      mix(m_word);
+    }
+    // Final avalanche from MurmurHash3 ('fmix64').
+    auto hash = m_state ^ m_size;
+    hash ^= hash >> 33U;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33U;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33U;
+    const auto result = static_cast<uint32_t>(hash ^ (hash >> 32U));
+    return result == 0U ? 1U : result;
+  }
+
+private:
+  static const uint64_t seed  = 0x9E3779B97F4A7C15ULL;
+  static const uint64_t prime = 0x87C37B91114253D5ULL;
+
+  uint64_t m_state;
+  uint64_t m_word;
+  unsigned int m_wordSize;
+  uint64_t m_size;
+
+  [[nodiscard]] inline static auto loadWord(const uint8_t* data) noexcept -> uint64_t {
+    uint64_t word;
+    std::memcpy(&word, data, 8U);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+  }
+
+  inline auto addChar(uint8_t c) noexcept -> void {
+    m_word |= static_cast<uint64_t>(c) << (m_wordSize * 8U);
+    if (++m_wordSize == 8U) {
+      mix(m_word);
+      m_word     = 0U;
+      m_wordSize = 0U;
+    }
+  }
+
+  inline auto mix(uint64_t word) noexcept -> void {
+    m_state ^= word * prime;
+    m_state = ((m_state << 31U) | (m_state >> 33U)) * seed;
+  }
+};
+
+// Hash of a string if it has been computed before, otherwise 0.
+[[nodiscard]] auto inline getCachedStringHash(Ref* str) noexcept -> uint32_t {
+  switch (str->getKind()) {
+  case RefKind::String:
+    return downcastRef<StringRef>(str)->getHash();
+  case RefKind::StringLink:
+    return downcastRef<StringLinkRef>(str)->getHash();
+  default:
+    return 0U;
+  }
+}
+
+// Compute the hash of a string, the hash of StringRefs and StringLinkRefs is cached.
+// Note: Ropes have to be walkable, see 'getWalkableStringRef'.
+[[nodiscard]] auto inline getStringHash(Ref* str) noexcept -> uint32_t {
+  const auto cached = getCachedStringHash(str);
+  if (cached != 0U) {
+    return cached;
+  }
+  auto hasher = StringHasher{};
+  switch (str->getKind()) {
+  case RefKind::String: {
+    hasher.add(getStringSpan(str));
+    const auto hash = hasher.finish();
+    downcastRef<StringRef>(str)->setHash(hash);
+    return hash;
+  }
+  case RefKind::StringLink: {
+    auto itr  = StringLinkIterator{str};
+    auto span = StringSpan{nullptr, 0U};
+    while (itr.next(&span)) {
+      hasher.add(span);
+    }
+    const auto hash = hasher.finish();
+    downcastRef<StringLinkRef>(str)->setHash(hash);
+    return hash;
+  }
+  default:
+    hasher.add(getStringSpan(str));
+    return hasher.finish();
+  }
+}
+
+// Note: Ropes have to be walkable, see 'getWalkableStringRef'.
+[[nodiscard]] auto inline checkStringEq(Ref* a, Ref* b) noexcept -> bool {
+  const auto size = getStringSize(a);
+  if (size != getStringSize(b)) {
+    return false;
+  }
+  a = getStringRepr(a);
+  b = getStringRepr(b);
+
+  // Strings with different hashes are never equal. Slices do not cache their hash so for those only
+  // previously computed hashes are used.
+  auto aHash = getCachedStringHash(a);
+  auto bHash = getCachedStringHash(b);
+  if (size >= stringHashEqMinSize) {
+    if (aHash == 0U && a->getKind() != RefKind::StringSlice) {
+      aHash = getStringHash(a);
+    }
+    if (bHash == 0U && b->getKind() != RefKind::StringSlice) {
+      bHash = getStringHash(b);
+    }
+  }
+  if (aHash != 0U && bHash != 0U && aHash != bHash) {
+    return false;
+  }
+  if (a->getKind() != RefKind::StringLink && b->getKind() != RefKind::StringLink) {
+    const auto aSpan = getStringSpan(a);
+    return std::memcmp(aSpan.getDataPtr(), getStringSpan(b).getDataPtr(), aSpan.getSize()) == 0;
+  }
+
+  // Compare the spans of characters of both strings, as the sizes are equal both end together.
+  auto aItr  = StringLinkIterator{a};
+  auto bItr  = StringLinkIterator{b};
+  auto aSpan = StringSpan{nullptr, 0U};
+  auto bSpan = StringSpan{nullptr, 0U};
+  auto aPos  = 0U;
+  auto bPos  = 0U;
+  while (true) {
+    if (aPos == aSpan.getSize()) {
+      if (!aItr.next(&aSpan)) {
+        return true;
+      }
+      aPos = 0U;
+    }
+    if (bPos == bSpan.getSize()) {
+      if (!bItr.next(&bSpan)) {
+        return true;
+      }
+      bPos = 0U;
+    }
+    const auto size = std::min(aSpan.getSize() - aPos, bSpan.getSize() - bPos);
+    if (std::memcmp(aSpan.getDataPtr() + aPos, bSpan.getDataPtr() + bPos, size) != 0) {
+      return false;
+    }
+    aPos += size;
+    bPos += size;
+  }
 }
 
-[[nodiscard]] auto inline indexString(StringRef* target, int32_t idx) noexcept -> uint8_t {
-  if (idx < 0 || static_cast<unsigned>(idx) >= target->getSize()) {
+// Note: Ropes have to be walkable, see 'getWalkableStringRef'.
+[[nodiscard]] auto inline indexString(Ref* target, int32_t idx) noexcept -> uint8_t {
+  if (idx < 0 || static_cast<unsigned>(idx) >= getStringSize(target)) {
     return 0;
   }
-  return *(target->getDataPtr() + idx);
+
+  // Walk down the rope to the side that contains the index.
+  auto index = static_cast<unsigned int>(idx);
+  while (true) {
+    target = getStringRepr(target);
+    if (target->getKind() != RefKind::StringLink) {
+      return *(getStringSpan(target).getDataPtr() + index);
+    }
+    auto* link          = downcastRef<StringLinkRef>(target);
+    const auto leftSize = getStringSize(link->getLeft());
+    if (index < leftSize) {
+      target = link->getLeft();
+      continue;
+    }
+    index -= leftSize;
+    if (!link->getRight().isRef()) {
+      return static_cast<uint8_t>(link->getRight().getInt());
+    }
+    target = link->getRight().getRef();
+  }
 }
 
+// Slice a StringRef or a StringSliceRef, returns either a StringRef or a StringSliceRef.
 [[nodiscard]] auto inline sliceString(
-    RefAllocator* refAlloc, StringRef* target, int32_t start, int32_t end) noexcept -> StringRef* {
-  const auto tgtSize = target->getSize();
+    RefAllocator* refAlloc, Ref* target, int32_t start, int32_t end) noexcept -> Ref* {
+  const auto tgtSpan = getStringSpan(target);
+  const auto tgtSize = tgtSpan.getSize();
 
   // Check for negative indicies.
   if (start < 0) {
@@ -189,14 +437,26 @@ enum FloatToStringFlags : uint8_t {
     return refAlloc->allocStr(0);
   }
 
+  const auto sliceSize  = static_cast<unsigned int>(end - start);
+  const auto* sliceData = tgtSpan.getDataPtr() + start;
+
+  // Reference the characters of the parent string if the slice is big enough to be worth it.
+  if (sliceSize >= stringSliceMinSize) {
+    auto* parent = target->getKind() == RefKind::String
+        ? downcastRef<StringRef>(target)
+        : downcastRef<StringSliceRef>(target)->getParent();
+    if (static_cast<uint64_t>(sliceSize) * stringSliceMaxWaste >= parent->getSize()) {
+      return refAlloc->allocPlain<StringSliceRef>(parent, sliceData, sliceSize);
+    }
+  }
+
   // Copy the slice into a new string.
-  const auto sliceSize = end - start;
-  const auto str       = refAlloc->allocStr(sliceSize);
+  const auto str = refAlloc->allocStr(sliceSize);
   if (str == nullptr) {
     return nullptr;
   }
 
-  std::memcpy(str->getDataPtr(), target->getDataPtr() + start, sliceSize);
+  std::memcpy(str->getDataPtr(), sliceData, sliceSize);
   return str;
 }
 
@@ -44,6 +44,10 @@ enum class ThreadStartResult {
   Failure = 1,
 };
 
+// Start a new thread that calls routine with the given arg.
+// NOTE: the return type of the routine is not used at this time.
+[[nodiscard]] auto threadStart(ThreadRoutineRaw routine, void* arg) noexcept -> ThreadStartResult;
+
 // Start a new thread that calls routine with the given args.
 // NOTE: the return type of the routine is not used at this time.
 template <typename RetT, typename... TArgs>
@@ -66,10 +70,6 @@ template <typename RetT, typename... TArgs>
   return threadStart(routineWrapper, dataPtr);
 }
 
-// Start a new thread that calls routine with the given arg.
-// NOTE: the return type of the routine is not used at this time.
-[[nodiscard]] auto threadStart(ThreadRoutineRaw routine, void* arg) noexcept -> ThreadStartResult;
-
 // Place this thread at the bottom of the run queue.
 auto threadYield() noexcept -> void;
 
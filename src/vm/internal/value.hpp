@@ -12,10 +12,11 @@ static const uint64_t valMask = ~static_cast<uint64_t>(1U);
 class Value final {
   friend auto uintValue(uint32_t val) noexcept -> Value;
   friend auto intValue(int32_t val) noexcept -> Value;
-  friend auto smallULongValue(uint64_t val) noexcept -> Value;
+  friend auto smallLongValue(int64_t val) noexcept -> Value;
   friend auto floatValue(float val) noexcept -> Value;
   friend auto refValue(Ref* ref) noexcept -> Value;
   friend auto nullRefValue() noexcept -> Value;
+  friend auto unionValue(const Value& val, uint8_t discriminant) noexcept -> Value;
   template <typename Type>
   friend auto rawPtrValue(Type* ptr) noexcept -> Value;
 
@@ -32,6 +33,9 @@ public:
 
   [[nodiscard]] inline auto isRef() const noexcept -> bool { return (m_raw & refTag) != 0U; }
 
+  // Raw representation of the value, used to embed values in generated code (see jit.hpp).
+  [[nodiscard]] inline auto getRaw() const noexcept -> uint64_t { return m_raw; }
+
   [[nodiscard]] inline auto getUInt() const noexcept -> uint32_t {
     assert(!isRef());
     return static_cast<uint32_t>(m_raw >> 32U);
@@ -43,9 +47,10 @@ public:
     return reinterpret_cast<int32_t&>(upperRaw); // NOLINT: Reinterpret cast
   }
 
-  [[nodiscard]] inline auto getSmallULong() const noexcept -> uint64_t {
+  [[nodiscard]] inline auto getSmallLong() const noexcept -> int64_t {
     assert(!isRef());
-    return m_raw >> 1U;
+    // Arithmetic shift to sign-extend the 63 bit value back to 64 bits.
+    return static_cast<int64_t>(m_raw) >> 1U;
   }
 
   [[nodiscard]] inline auto getFloat() const noexcept -> float {
@@ -54,6 +59,12 @@ public:
     return reinterpret_cast<float&>(upperRaw); // NOLINT: Reinterpret cast
   }
 
+  // Discriminant of an unboxed union, see 'unionValue'.
+  [[nodiscard]] inline auto getUnionDiscriminant() const noexcept -> uint8_t {
+    assert(!isRef());
+    return static_cast<uint8_t>(m_raw >> 1U);
+  }
+
   [[nodiscard]] inline auto getRef() const noexcept -> Ref* {
     assert(isRef());
     // Mask of the tag and interpret it as a pointer (works because due to alignment lowest bit is
@@ -94,11 +105,17 @@ private:
   return Value{static_cast<uint64_t>(upperRaw) << 32U};
 }
 
-[[nodiscard]] inline auto smallULongValue(uint64_t val) noexcept -> Value {
-  assert((val & (1ULL << 63)) == 0);
+// Check if a long fits in the signed 63 bit range that can be stored directly in a value.
+[[nodiscard]] inline auto isSmallLong(int64_t val) noexcept -> bool {
+  return static_cast<uint64_t>(val) + (1ULL << 62U) < (1ULL << 63U);
+}
+
+[[nodiscard]] inline auto smallLongValue(int64_t val) noexcept -> Value {
+  assert(isSmallLong(val));
 
-  // ULongs with the most significant bit set to zero, can be stored in the upper 63 bits.
-  return Value{val << 1U};
+  // Longs in the signed 63 bit range are stored in the upper 63 bits, the sign is restored by an
+  // arithmetic shift when reading it back.
+  return Value{static_cast<uint64_t>(val) << 1U};
 }
 
 [[nodiscard]] inline auto floatValue(float val) noexcept -> Value {
@@ -119,6 +136,14 @@ private:
 
 [[nodiscard]] inline auto nullRefValue() noexcept -> Value { return Value{refTag}; }
 
+[[nodiscard]] inline auto unionValue(const Value& val, uint8_t discriminant) noexcept -> Value {
+  // Unboxed unions store the payload in the upper 32 bit (same as ints and floats) and the
+  // discriminant in the bits above the ref tag. Payloads that are null-refs (tag types) are stored
+  // as 0 as there are no operations that can be done on them.
+  const auto payload = val.m_raw & 0xFFFFFFFF00000000ULL;
+  return Value{payload | (static_cast<uint64_t>(discriminant) << 1U)};
+}
+
 template <typename Type>
 [[nodiscard]] inline auto rawPtrValue(Type* ptr) noexcept -> Value {
   assert(ptr != nullptr);
@@ -0,0 +1,441 @@
+#include "internal/verifier.hpp"
+#include "internal/intrinsics.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace vm::internal {
+
+using OpCode    = novasm::OpCode;
+using PCallCode = novasm::PCallCode;
+
+namespace {
+
+struct StackEffect {
+  uint32_t pops;
+  uint32_t pushes;
+};
+
+// Amount of values that a platform-call takes from the stack, see 'pcall_code.hpp'.
+// Note: All platform-calls push a single value, returns false for unknown platform-calls.
+auto getPCallArgCount(PCallCode code, uint32_t* argCount) noexcept -> bool {
+  switch (code) {
+  case PCallCode::EndiannessNative:
+  case PCallCode::PlatformErrorCode:
+  case PCallCode::EnvGetArgCount:
+  case PCallCode::InteruptIsReq:
+  case PCallCode::InteruptResetReq:
+  case PCallCode::ClockMicroSinceEpoch:
+  case PCallCode::ClockNanoSteady:
+  case PCallCode::ClockTimezoneOffset:
+  case PCallCode::VersionRt:
+  case PCallCode::VersionCompiler:
+  case PCallCode::PlatformCode:
+  case PCallCode::WorkingDirPath:
+  case PCallCode::RtPath:
+  case PCallCode::ProgramPath:
+    *argCount = 0U;
+    return true;
+  case PCallCode::StreamCheckValid:
+  case PCallCode::ProcessBlock:
+  case PCallCode::ProcessGetId:
+  case PCallCode::FileType:
+  case PCallCode::FileModTimeMicroSinceEpoch:
+  case PCallCode::FileSize:
+  case PCallCode::FileCreateDir:
+  case PCallCode::FileRemove:
+  case PCallCode::FileRemoveDir:
+  case PCallCode::TcpAcceptCon:
+  case PCallCode::TcpShutdown:
+  case PCallCode::ConsoleOpenStream:
+  case PCallCode::IsTerm:
+  case PCallCode::TermGetWidth:
+  case PCallCode::TermGetHeight:
+  case PCallCode::EnvGetArg:
+  case PCallCode::EnvHasVar:
+  case PCallCode::EnvGetVar:
+  case PCallCode::IOWatcherGet:
+  case PCallCode::GcCollect:
+  case PCallCode::SleepNano:
+    *argCount = 1U;
+    return true;
+  case PCallCode::StreamReadString:
+  case PCallCode::StreamWriteString:
+  case PCallCode::StreamSetOptions:
+  case PCallCode::StreamUnsetOptions:
+  case PCallCode::ProcessStart:
+  case PCallCode::ProcessOpenStream:
+  case PCallCode::ProcessSendSignal:
+  case PCallCode::FileOpenStream:
+  case PCallCode::FileRename:
+  case PCallCode::FileDirList:
+  case PCallCode::FileDirCount:
+  case PCallCode::IpLookupAddress:
+  case PCallCode::TermSetOptions:
+  case PCallCode::TermUnsetOptions:
+  case PCallCode::IOWatcherCreate:
+    *argCount = 2U;
+    return true;
+  case PCallCode::TcpOpenCon:
+  case PCallCode::TcpStartServer:
+    *argCount = 3U;
+    return true;
+  }
+  return false;
+}
+
+// Lookup the stack effect of an instruction, returns false if the instruction is invalid.
+auto getStackEffect(const Instr& instr, uint32_t litStringCount, StackEffect* effect) noexcept
+    -> bool {
+  switch (instr.op) {
+  case OpCode::LoadLitString:
+    if (unlikely(instr.uintArg >= litStringCount)) {
+      return false;
+    }
+    *effect = {0U, 1U};
+    return true;
+  case OpCode::LoadLitInt:
+  case OpCode::LoadLitLong:
+  case OpCode::LoadLitFloat:
+  case OpCode::LoadLitIp:
+  case OpCode::StackLoad:
+  case OpCode::StackLoadField:
+  case OpCode::MakeAtomic:
+  case OpCode::MakeNullStruct:
+    *effect = {0U, 1U};
+    return true;
+  case OpCode::StackLoadLoad:
+    *effect = {0U, 2U};
+    return true;
+  case OpCode::StackAlloc:
+    *effect = {0U, instr.halfArg};
+    return true;
+  case OpCode::StackStore:
+  case OpCode::JumpIf:
+  case OpCode::JumpIfZero:
+  case OpCode::JumpIfEqIntLit:
+  case OpCode::AtomicBlock:
+  case OpCode::Pop:
+    *effect = {1U, 0U};
+    return true;
+  case OpCode::StructStoreField:
+  case OpCode::JumpIfEqInt:
+  case OpCode::JumpIfGtInt:
+  case OpCode::JumpIfLeInt:
+    *effect = {2U, 0U};
+    return true;
+  case OpCode::StackStoreLoad:
+  case OpCode::AddIntLit:
+  case OpCode::SubIntLit:
+  case OpCode::CheckEqIntLit:
+  case OpCode::SqrtFloat:
+  case OpCode::SinFloat:
+  case OpCode::CosFloat:
+  case OpCode::TanFloat:
+  case OpCode::ASinFloat:
+  case OpCode::ACosFloat:
+  case OpCode::ATanFloat:
+  case OpCode::NegInt:
+  case OpCode::NegLong:
+  case OpCode::NegFloat:
+  case OpCode::InvInt:
+  case OpCode::InvLong:
+  case OpCode::LengthString:
+  case OpCode::HashString:
+  case OpCode::CheckStructNull:
+  case OpCode::CheckIntZero:
+  case OpCode::CheckStringEmpty:
+  case OpCode::ConvIntLong:
+  case OpCode::ConvIntFloat:
+  case OpCode::ConvLongInt:
+  case OpCode::ConvLongFloat:
+  case OpCode::ConvFloatInt:
+  case OpCode::ConvIntString:
+  case OpCode::ConvLongString:
+  case OpCode::ConvCharString:
+  case OpCode::ConvIntChar:
+  case OpCode::ConvLongChar:
+  case OpCode::ConvFloatChar:
+  case OpCode::ConvFloatLong:
+  case OpCode::AtomicLoad:
+  case OpCode::AtomicCompareSwap:
+  case OpCode::StructLoadField:
+  case OpCode::UnionWrap:
+  case OpCode::UnionCheck:
+  case OpCode::FutureBlock:
+    *effect = {1U, 1U};
+    return true;
+  case OpCode::DupStructLoadField:
+  case OpCode::Dup:
+    *effect = {1U, 2U};
+    return true;
+  case OpCode::AddInt:
+  case OpCode::AddLong:
+  case OpCode::AddFloat:
+  case OpCode::AddString:
+  case OpCode::AppendChar:
+  case OpCode::SubInt:
+  case OpCode::SubLong:
+  case OpCode::SubFloat:
+  case OpCode::MulInt:
+  case OpCode::MulLong:
+  case OpCode::MulFloat:
+  case OpCode::DivInt:
+  case OpCode::DivLong:
+  case OpCode::DivFloat:
+  case OpCode::RemInt:
+  case OpCode::RemLong:
+  case OpCode::ModFloat:
+  case OpCode::PowFloat:
+  case OpCode::ATan2Float:
+  case OpCode::ShiftLeftInt:
+  case OpCode::ShiftLeftLong:
+  case OpCode::ShiftRightInt:
+  case OpCode::ShiftRightLong:
+  case OpCode::AndInt:
+  case OpCode::AndLong:
+  case OpCode::OrInt:
+  case OpCode::OrLong:
+  case OpCode::XorInt:
+  case OpCode::XorLong:
+  case OpCode::IndexString:
+  case OpCode::CheckEqInt:
+  case OpCode::CheckEqLong:
+  case OpCode::CheckEqFloat:
+  case OpCode::CheckEqString:
+  case OpCode::CheckEqIp:
+  case OpCode::CheckEqCallDynTgt:
+  case OpCode::CheckGtInt:
+  case OpCode::CheckGtLong:
+  case OpCode::CheckGtFloat:
+  case OpCode::CheckLeInt:
+  case OpCode::CheckLeLong:
+  case OpCode::CheckLeFloat:
+  case OpCode::ConvFloatString:
+  case OpCode::FutureWaitNano:
+    *effect = {2U, 1U};
+    return true;
+  case OpCode::Swap:
+    *effect = {2U, 2U};
+    return true;
+  case OpCode::SliceString:
+    *effect = {3U, 1U};
+    return true;
+  case OpCode::MakeStruct:
+    if (unlikely(instr.byteArg == 0U)) {
+      return false;
+    }
+    *effect = {instr.byteArg, 1U};
+    return true;
+  case OpCode::Call:
+  case OpCode::CallForked:
+    *effect = {instr.byteArg, 1U};
+    return true;
+  case OpCode::CallDyn:
+  case OpCode::CallDynForked:
+    *effect = {instr.byteArg + 1U, 1U}; // + 1 for the target ip / closure.
+    return true;
+  case OpCode::CallTail:
+    *effect = {instr.byteArg, 0U};
+    return true;
+  case OpCode::CallDynTail:
+    *effect = {instr.byteArg + 1U, 0U}; // + 1 for the target ip / closure.
+    return true;
+  case OpCode::PCall: {
+    uint32_t argCount;
+    if (unlikely(!getPCallArgCount(instr.pcallArg, &argCount))) {
+      return false;
+    }
+    *effect = {argCount, 1U};
+    return true;
+  }
+  case OpCode::Ret:
+    *effect = {1U, 0U};
+    return true;
+  case OpCode::Jump:
+  case OpCode::Fail:
+    *effect = {0U, 0U};
+    return true;
+  default:
+    // Variants that are normalized during decoding (for example 'LoadLitIntSmall') should never
+    // be encountered here.
+    return false;
+  }
+}
+
+inline auto isTerminator(OpCode op) noexcept -> bool {
+  switch (op) {
+  case OpCode::Jump:
+  case OpCode::CallTail:
+  case OpCode::CallDynTail:
+  case OpCode::Ret:
+  case OpCode::Fail:
+    return true;
+  default:
+    return false;
+  }
+}
+
+inline auto isConditionalJump(OpCode op) noexcept -> bool {
+  switch (op) {
+  case OpCode::JumpIf:
+  case OpCode::JumpIfZero:
+  case OpCode::JumpIfEqInt:
+  case OpCode::JumpIfGtInt:
+  case OpCode::JumpIfLeInt:
+  case OpCode::JumpIfEqIntLit:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+auto verifyInstrs(
+    const std::vector<Instr>& instrs,
+    uint32_t entrypoint,
+    uint32_t litStringCount,
+    std::vector<FrameInfo>* frames) noexcept -> bool {
+
+  const auto instrCount = static_cast<uint32_t>(instrs.size());
+  const auto indexOf    = [&](const Instr* instr) {
+    return static_cast<uint32_t>(instr - instrs.data());
+  };
+
+  frames->assign(instrCount, invalidFrame);
+
+  // Function entry points that still have to be verified.
+  auto isFunction  = std::vector<bool>(instrCount, false);
+  auto functions   = std::vector<uint32_t>{};
+  auto addFunction = [&](uint32_t index) {
+    if (!isFunction[index]) {
+      isFunction[index] = true;
+      functions.push_back(index);
+    }
+  };
+
+  // Direct calls, verified once the argument requirements of all functions are known.
+  struct DirectCall {
+    uint32_t target;
+    uint32_t argCount;
+  };
+  auto directCalls = std::vector<DirectCall>{};
+
+  /* Stack depth per instruction, relative to the end of the arguments. Functions are allowed to
+   * consume their arguments from the stack so the depth can be negative.
+   * To avoid clearing the array for every function we track which function last visited an
+   * instruction. */
+  auto depths    = std::vector<int64_t>(instrCount, 0);
+  auto visitedBy = std::vector<uint32_t>(instrCount, instrCount);
+  auto pending   = std::vector<std::pair<uint32_t, int64_t>>{};
+
+  addFunction(entrypoint);
+  for (auto funcItr = 0U; funcItr != functions.size(); ++funcItr) {
+    const auto func = functions[funcItr];
+
+    int64_t maxDepth = 0;
+    int64_t minArgs  = 0;
+
+    // Values below the start of the stack-frame are arguments, so the function needs at least
+    // enough arguments to cover all the values it accesses.
+    auto accessValue = [&minArgs](int64_t offset, int64_t depth) {
+      minArgs = std::max(minArgs, offset - depth + 1);
+    };
+
+    pending.clear();
+    pending.emplace_back(func, 0);
+    while (!pending.empty()) {
+      const auto [index, depth] = pending.back();
+      pending.pop_back();
+
+      if (visitedBy[index] == func) {
+        if (unlikely(depths[index] != depth)) {
+          return false; // Inconsistent stack depth.
+        }
+        continue;
+      }
+      visitedBy[index] = func;
+      depths[index]    = depth;
+
+      const auto& instr = instrs[index];
+      StackEffect effect;
+      if (unlikely(!getStackEffect(instr, litStringCount, &effect))) {
+        return false;
+      }
+
+      // Returning from the root stack-frame does not require a value, so allow the entrypoint to
+      // return without pushing anything.
+      if (instr.op == OpCode::Ret && func == entrypoint && depth <= 0) {
+        effect.pops = 0U;
+      }
+
+      // Values that are popped below the start of the stack-frame have to be arguments.
+      if (effect.pops != 0U) {
+        accessValue(-1, depth - effect.pops);
+      }
+      const auto newDepth = depth - effect.pops + effect.pushes;
+      maxDepth            = std::max(maxDepth, newDepth);
+
+      switch (instr.op) {
+      case OpCode::StackLoad:
+      case OpCode::StackLoadField:
+        accessValue(instr.halfArg, depth);
+        break;
+      case OpCode::StackLoadLoad:
+        accessValue(instr.halfArg, depth);
+        accessValue(instr.intArg, depth + 1);
+        break;
+      case OpCode::StackStore:
+        accessValue(instr.halfArg, depth - 1);
+        break;
+      case OpCode::StackStoreLoad:
+        accessValue(instr.halfArg, depth - 1);
+        accessValue(instr.intArg, depth - 1);
+        break;
+      case OpCode::LoadLitIp:
+        if (unlikely(instr.uintArg >= instrCount)) {
+          return false;
+        }
+        addFunction(instr.uintArg);
+        break;
+      case OpCode::Call:
+      case OpCode::CallTail:
+      case OpCode::CallForked:
+        addFunction(indexOf(instr.target));
+        directCalls.push_back({indexOf(instr.target), instr.byteArg});
+        break;
+      default:
+        break;
+      }
+
+      if (instr.op == OpCode::Jump || isConditionalJump(instr.op)) {
+        pending.emplace_back(indexOf(instr.target), newDepth);
+      }
+      if (!isTerminator(instr.op)) {
+        // NOTE: There is always a next instruction as the program ends with a 'Fail' instruction.
+        assert(index + 1U < instrCount);
+        pending.emplace_back(index + 1U, newDepth);
+      }
+    }
+
+    if (unlikely(minArgs > std::numeric_limits<uint8_t>::max())) {
+      return false; // More arguments then can be passed to a function.
+    }
+    (*frames)[func] = FrameInfo{
+        static_cast<uint32_t>(std::min<int64_t>(maxDepth, std::numeric_limits<uint32_t>::max())),
+        static_cast<uint32_t>(minArgs)};
+  }
+
+  // Verify that the program is entered and called with enough arguments.
+  if (unlikely((*frames)[entrypoint].minArgs != 0U)) {
+    return false;
+  }
+  for (const auto& call : directCalls) {
+    if (unlikely(call.argCount < (*frames)[call.target].minArgs)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace vm::internal
@@ -0,0 +1,26 @@
+#pragma once
+#include "internal/program.hpp"
+#include <vector>
+
+namespace vm::internal {
+
+/* Verify the (decoded) instructions of a program.
+ * Every function (code that is reachable from the entrypoint, a call target or an instruction
+ * pointer literal) is walked and the following is validated:
+ * - The stack depth is the same for all paths that reach an instruction.
+ * - Stack loads, stores and pops only access the arguments and values of the current stack-frame.
+ * - Direct calls pass enough arguments for the function they call (the amount of arguments a
+ *   function needs is derived from the stack values that it accesses).
+ * - Operands are valid (string literal ids, struct field counts and platform-call codes).
+ *
+ * As a result the stack requirements of every function are written to 'frames' (indexed by
+ * instruction index, instructions that are not function entry points get 'invalidFrame').
+ * Returns false if the instructions are malformed.
+ */
+[[nodiscard]] auto verifyInstrs(
+    const std::vector<Instr>& instrs,
+    uint32_t entrypoint,
+    uint32_t litStringCount,
+    std::vector<FrameInfo>* frames) noexcept -> bool;
+
+} // namespace vm::internal
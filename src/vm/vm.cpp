@@ -2,11 +2,16 @@
 #include "internal/executor.hpp"
 #include "internal/executor_registry.hpp"
 #include "internal/interupt.hpp"
+#include "internal/jit.hpp"
 #include "internal/os_include.hpp"
 #include "internal/platform_utilities.hpp"
 #include "internal/ref_allocator.hpp"
+#include "internal/scheduler.hpp"
 #include "vm/platform_interface.hpp"
+#include <algorithm>
 #include <csignal>
+#include <optional>
+#include <thread>
 
 namespace vm {
 
@@ -108,12 +113,39 @@ static auto teardown(const internal::Settings* /*unused*/, PlatformInterface* /*
 
 #endif // !_WIN32
 
-auto run(const novasm::Executable* executable, PlatformInterface* iface) noexcept -> ExecState {
+auto run(
+    const novasm::Executable* executable,
+    PlatformInterface* iface,
+    const Options& options) noexcept -> ExecState {
+
+  // Decode and verify the executable.
+  auto program = internal::Program{executable};
+  if (unlikely(!program.isValid())) {
+    return ExecState::InvalidAssembly;
+  }
 
   auto execRegistry = internal::ExecutorRegistry{};
   auto memAlloc     = internal::MemoryAllocator{};
+  memAlloc.setHeapLimit(static_cast<size_t>(options.heapLimit));
   auto refAlloc     = internal::RefAllocator{&memAlloc};
-  auto gc           = internal::GarbageCollector{&refAlloc, &execRegistry};
+  auto gc           = internal::GarbageCollector{&refAlloc, &execRegistry, options};
+
+  auto workerThreads = options.workerThreads;
+  if (workerThreads == 0) {
+    workerThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  auto scheduler = internal::Scheduler{workerThreads};
+
+  // Optionally compile hot functions to native code.
+  auto jit = std::optional<internal::Jit>{};
+  if (options.jitEnabled && internal::Jit::isSupported()) {
+    jit.emplace(&program, options.jitThreshold);
+  }
+
+  // Materialize all string literals up front, they are never collected.
+  if (unlikely(!program.allocLitStrings(&refAlloc))) {
+    return ExecState::VmInitFailed;
+  }
 
   if (unlikely(gc.startCollector() == internal::GarbageCollector::CollectorStartResult::Failure)) {
     return ExecState::VmInitFailed;
@@ -127,14 +159,14 @@ auto run(const novasm::Executable* executable, PlatformInterface* iface) noexcep
 
   auto resultState = execute(
       &settings,
-      executable,
+      &program,
       iface,
       &execRegistry,
+      &scheduler,
       &refAlloc,
       &gc,
-      executable->getEntrypoint(),
-      0,
-      nullptr,
+      jit ? &*jit : nullptr,
+      program.getEntrypoint(),
       nullptr);
 
   // Terminate the garbage-collector (finishes any ongoing collections).
@@ -147,6 +179,10 @@ auto run(const novasm::Executable* executable, PlatformInterface* iface) noexcep
 
   assert(execRegistry.isAborted());
 
+  // Stop the idle scheduler threads and wake the parked executors so they observe the abort, the
+  // threads exit once the aborted executors have returned.
+  scheduler.shutdown();
+
   teardown(&settings, iface);
 
   return resultState;
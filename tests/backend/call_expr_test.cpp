@@ -309,6 +309,10 @@ TEST_CASE("[backend] Generate assembly for call expressions", "backend") {
           asmb->addLoadLitInt(6);
           asmb->addSliceString();
         });
+    CHECK_EXPR_INT("intrinsic{string_hash}(\"hello\")", [](novasm::Assembler* asmb) -> void {
+      asmb->addLoadLitString("hello");
+      asmb->addHashString();
+    });
   }
 
   SECTION("String checks") {
@@ -0,0 +1,161 @@
+#include "catch2/catch.hpp"
+#include "helpers.hpp"
+
+namespace backend {
+
+TEST_CASE("[backend] Generate assembly for unions", "backend") {
+
+  SECTION("Create unboxed union") {
+    CHECK_PROG(
+        "union U = int, float "
+        "fun test(U u) u "
+        "test(U(42))",
+        [](novasm::Assembler* asmb) -> void {
+          // --- test function start.
+          asmb->label("func-test");
+          asmb->addStackLoad(0);
+          asmb->addRet();
+          // --- test function end.
+
+          // --- exec statement start.
+          asmb->label("prog");
+          asmb->addLoadLitInt(42);
+          asmb->addUnionWrap(0);
+
+          asmb->addCall("func-test", 1, novasm::CallMode::Normal);
+          asmb->addRet();
+          // --- exec statement end.
+
+          asmb->setEntrypoint("prog");
+        });
+  }
+
+  SECTION("Create unboxed union with tag type") {
+    CHECK_PROG(
+        "struct None "
+        "union Opt = int, None "
+        "fun test(Opt o) o "
+        "test(Opt(None()))",
+        [](novasm::Assembler* asmb) -> void {
+          // --- test function start.
+          asmb->label("func-test");
+          asmb->addStackLoad(0);
+          asmb->addRet();
+          // --- test function end.
+
+          // --- exec statement start.
+          asmb->label("prog");
+          asmb->addMakeNullStruct();
+          asmb->addUnionWrap(1);
+
+          asmb->addCall("func-test", 1, novasm::CallMode::Normal);
+          asmb->addRet();
+          // --- exec statement end.
+
+          asmb->setEntrypoint("prog");
+        });
+  }
+
+  SECTION("Create boxed union") {
+    CHECK_PROG(
+        "union U = int, string "
+        "fun test(U u) u "
+        "test(U(\"hello world\"))",
+        [](novasm::Assembler* asmb) -> void {
+          // --- test function start.
+          asmb->label("func-test");
+          asmb->addStackLoad(0);
+          asmb->addRet();
+          // --- test function end.
+
+          // --- exec statement start.
+          asmb->label("prog");
+          asmb->addLoadLitInt(1);
+          asmb->addLoadLitString("hello world");
+          asmb->addMakeStruct(2);
+
+          asmb->addCall("func-test", 1, novasm::CallMode::Normal);
+          asmb->addRet();
+          // --- exec statement end.
+
+          asmb->setEntrypoint("prog");
+        });
+  }
+
+  SECTION("Check unboxed union") {
+    CHECK_PROG(
+        "union U = int, float "
+        "fun test(U u) -> bool u is float "
+        "test(U(42))",
+        [](novasm::Assembler* asmb) -> void {
+          // --- test function start.
+          asmb->label("func-test");
+          asmb->addStackLoad(0);
+          asmb->addUnionCheck(1);
+          asmb->addRet();
+          // --- test function end.
+
+          // --- exec statement start.
+          asmb->label("prog");
+          asmb->addLoadLitInt(42);
+          asmb->addUnionWrap(0);
+
+          asmb->addCall("func-test", 1, novasm::CallMode::Normal);
+          asmb->addRet();
+          // --- exec statement end.
+
+          asmb->setEntrypoint("prog");
+        });
+  }
+
+  SECTION("Get unboxed union value") {
+    CHECK_PROG(
+        "union U = int, float "
+        "fun test(U u) -> int u as int i ? i : 0 "
+        "test(U(42))",
+        [](novasm::Assembler* asmb) -> void {
+          // --- test function start.
+          asmb->label("func-test");
+          asmb->addStackAlloc(1);
+
+          asmb->addStackLoad(0);
+          asmb->addDup();
+          asmb->addUnionCheck(0);
+          asmb->addJumpIf("type-equal");
+
+          asmb->addPop();
+          asmb->addLoadLitInt(0);
+          asmb->addJump("get-end");
+
+          asmb->label("type-equal");
+          asmb->addStackStore(1);
+          asmb->addLoadLitInt(1);
+
+          asmb->label("get-end");
+          asmb->addJumpIf("true");
+
+          asmb->addLoadLitInt(0);
+          asmb->addJump("end");
+
+          asmb->label("true");
+          asmb->addStackLoad(1);
+
+          asmb->label("end");
+          asmb->addRet();
+          // --- test function end.
+
+          // --- exec statement start.
+          asmb->label("prog");
+          asmb->addLoadLitInt(42);
+          asmb->addUnionWrap(0);
+
+          asmb->addCall("func-test", 1, novasm::CallMode::Normal);
+          asmb->addRet();
+          // --- exec statement end.
+
+          asmb->setEntrypoint("prog");
+        });
+  }
+}
+
+} // namespace backend
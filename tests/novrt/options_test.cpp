@@ -0,0 +1,119 @@
+#include "catch2/catch.hpp"
+#include "novrt/options.hpp"
+#include <cstdlib>
+
+namespace novrt {
+
+static auto setEnv(const char* name, const char* value) -> void {
+#if defined(_WIN32)
+  _putenv_s(name, value ? value : "");
+#else
+  if (value) {
+    setenv(name, value, 1);
+  } else {
+    unsetenv(name);
+  }
+#endif
+}
+
+TEST_CASE("[novrt] Parse runtime options", "novrt") {
+
+  SECTION("Unsigned integers") {
+    auto val = 0U;
+    CHECK(parseUIntOpt("0", &val));
+    CHECK(val == 0U);
+    CHECK(parseUIntOpt("42", &val));
+    CHECK(val == 42U);
+    CHECK(parseUIntOpt("4294967295", &val));
+    CHECK(val == UINT32_MAX);
+
+    val = 1337U;
+    CHECK(!parseUIntOpt("", &val));
+    CHECK(!parseUIntOpt("abc", &val));
+    CHECK(!parseUIntOpt("42abc", &val));
+    CHECK(!parseUIntOpt("-1", &val));
+    CHECK(!parseUIntOpt("4294967296", &val));
+    CHECK(!parseUIntOpt("4294967396", &val));
+    CHECK(!parseUIntOpt("99999999999999999999999", &val));
+    CHECK(val == 1337U);
+  }
+
+  SECTION("Sizes") {
+    auto val = uint64_t{0};
+    CHECK(parseSizeOpt("512", &val));
+    CHECK(val == 512U);
+    CHECK(parseSizeOpt("4K", &val));
+    CHECK(val == 4U * 1024U);
+    CHECK(parseSizeOpt("512m", &val));
+    CHECK(val == 512U * 1024U * 1024U);
+    CHECK(parseSizeOpt("2G", &val));
+    CHECK(val == uint64_t{2} * 1024U * 1024U * 1024U);
+    CHECK(parseSizeOpt("17179869183G", &val));
+    CHECK(val == (UINT64_MAX >> 30U) << 30U);
+
+    val = 1337U;
+    CHECK(!parseSizeOpt("", &val));
+    CHECK(!parseSizeOpt("G", &val));
+    CHECK(!parseSizeOpt("-1", &val));
+    CHECK(!parseSizeOpt("12T", &val));
+    CHECK(!parseSizeOpt("12MB", &val));
+    CHECK(!parseSizeOpt("17179869184G", &val));
+    CHECK(!parseSizeOpt("99999999999G", &val));
+    CHECK(!parseSizeOpt("99999999999999999999999", &val));
+    CHECK(val == 1337U);
+  }
+
+  SECTION("Apply pacing options") {
+    auto options = vm::Options{};
+    CHECK(applyRuntimeOption("--gc-growth=25", &options) == RuntimeOptResult::Applied);
+    CHECK(applyRuntimeOption("--gc-interval=0", &options) == RuntimeOptResult::Applied);
+    CHECK(applyRuntimeOption("--gc-soft-target=64M", &options) == RuntimeOptResult::Applied);
+    CHECK(applyRuntimeOption("--heap-limit=1G", &options) == RuntimeOptResult::Applied);
+    CHECK(options.gcGrowthPercent == 25U);
+    CHECK(options.gcMinIntervalMilliseconds == 0U);
+    CHECK(options.gcSoftHeapTarget == 64U * 1024U * 1024U);
+    CHECK(options.heapLimit == 1024U * 1024U * 1024U);
+  }
+
+  SECTION("Invalid option values are reported") {
+    auto options                 = vm::Options{};
+    const RuntimeOpt* invalidOpt = nullptr;
+    CHECK(
+        applyRuntimeOption("--gc-growth=abc", &options, &invalidOpt) ==
+        RuntimeOptResult::InvalidValue);
+    REQUIRE(invalidOpt != nullptr);
+    CHECK_THAT(invalidOpt->input, Catch::Equals("--gc-growth="));
+    CHECK(
+        applyRuntimeOption("--heap-limit=99999999999G", &options) ==
+        RuntimeOptResult::InvalidValue);
+    CHECK(options.gcGrowthPercent == 100U);
+    CHECK(options.heapLimit == 0U);
+  }
+
+  SECTION("Arguments that are not options are left alone") {
+    auto options = vm::Options{};
+    CHECK(applyRuntimeOption("prog.nx", &options) == RuntimeOptResult::NotAnOption);
+    CHECK(applyRuntimeOption("--install", &options) == RuntimeOptResult::NotAnOption);
+    CHECK(applyRuntimeOption("--gc-growth", &options) == RuntimeOptResult::NotAnOption);
+  }
+
+  SECTION("Options from the environment") {
+    setEnv("NOVUS_GC_GROWTH", "50");
+    setEnv("NOVUS_GC_INTERVAL", "100");
+    setEnv("NOVUS_GC_SOFT_TARGET", "16M");
+    auto options = vm::Options{};
+    CHECK(applyRuntimeEnvOptions(&options) == nullptr);
+    CHECK(options.gcGrowthPercent == 50U);
+    CHECK(options.gcMinIntervalMilliseconds == 100U);
+    CHECK(options.gcSoftHeapTarget == 16U * 1024U * 1024U);
+
+    setEnv("NOVUS_GC_GROWTH", "4294967396");
+    CHECK_THAT(applyRuntimeEnvOptions(&options), Catch::Equals("NOVUS_GC_GROWTH"));
+
+    setEnv("NOVUS_GC_GROWTH", nullptr);
+    setEnv("NOVUS_GC_INTERVAL", nullptr);
+    setEnv("NOVUS_GC_SOFT_TARGET", nullptr);
+  }
+}
+
+} // namespace novrt
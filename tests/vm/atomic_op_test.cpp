@@ -210,6 +210,63 @@ TEST_CASE("[vm] Execute atomic operations", "vm") {
         "input",
         "1337");
   }
+
+  SECTION("Block wakes all executors that wait on the atomic") {
+    CHECK_PROG(
+        [&](novasm::Assembler* asmb) -> void {
+          constexpr uint8_t numForks = 15u;
+
+          asmb->setEntrypoint("entry");
+          // --- Main function start.
+          asmb->label("entry");
+          asmb->addStackAlloc(1 + numForks); // Reserve stack space:
+          // Stack var 0:                     atomic.
+          // Stack var 1 - ( numForks + 1 ):  future handles to the forked workers.
+
+          // Create an atomic and save it in a variable.
+          asmb->addMakeAtomic(0); // Start with value 0.
+          asmb->addStackStore(0);
+
+          // Start multiple workers that block until the atomic has the value 1.
+          for (auto i = 0u; i != numForks; ++i) {
+            asmb->addStackLoad(0); // Pass the atomic to the worker.
+            asmb->addCall("worker", 1, novasm::CallMode::Forked);
+            asmb->addStackStore(1u + i); // Store the future to the fork on the stack.
+          }
+
+          // Sleep for a milli-second to make sure the workers have to wait for us.
+          asmb->addLoadLitLong(1'000'000);
+          asmb->addPCall(novasm::PCallCode::SleepNano);
+          asmb->addPop(); // Ignore the sleep result.
+
+          // Change the atomic to 1.
+          asmb->addStackLoad(0);
+          asmb->addAtomicCompareSwap(0, 1);
+          asmb->addPop(); // Ignore the cas result.
+
+          // Wait for all workers to complete and sum their results.
+          asmb->addLoadLitInt(0);
+          for (auto i = 0u; i != numForks; ++i) {
+            asmb->addStackLoad(1u + i); // Load the future from the stack.
+            asmb->addFutureBlock();
+            asmb->addAddInt();
+          }
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+          // --- Main function end.
+
+          // --- Worker function start (takes one atomic, blocks until it is 1 and returns 1).
+          asmb->label("worker");
+          asmb->addStackLoad(0); // Load the atomic from arg 0.
+          asmb->addAtomicBlock(1);
+          asmb->addLoadLitInt(1); // Return 1.
+          asmb->addRet();
+          // --- Worker function end.
+        },
+        "input",
+        "15");
+  }
 }
 
 } // namespace vm
@@ -158,6 +158,45 @@ TEST_CASE("[vm] Execute calls", "vm") {
       },
       "input",
       "1379");
+
+  // Deep (non-tail) recursion that grows the stack far beyond its initial capacity, every frame
+  // keeps a heap string on the stack and a garbage collection is performed at the deepest point.
+  CHECK_PROG(
+      [](novasm::Assembler* asmb) -> void {
+        asmb->label("entry");
+        asmb->addLoadLitInt(100'000);
+        asmb->addCall("count", 1, novasm::CallMode::Normal);
+        asmb->addConvIntString();
+        ADD_PRINT(asmb);
+        asmb->addRet();
+
+        asmb->label("count");
+        asmb->addLoadLitInt(1);
+        asmb->addConvIntString();
+        asmb->addStackLoad(0);
+        asmb->addCheckIntZero();
+        asmb->addJumpIf("count-end");
+
+        asmb->addStackLoad(0);
+        asmb->addLoadLitInt(1);
+        asmb->addSubInt();
+        asmb->addCall("count", 1, novasm::CallMode::Normal);
+        asmb->addSwap();
+        asmb->addLengthString();
+        asmb->addAddInt();
+        asmb->addRet();
+
+        asmb->label("count-end");
+        asmb->addLoadLitInt(1); // Blocking sweep.
+        asmb->addPCall(novasm::PCallCode::GcCollect);
+        asmb->addPop();
+        asmb->addLengthString();
+        asmb->addRet();
+
+        asmb->setEntrypoint("entry");
+      },
+      "input",
+      "100001");
 }
 
 } // namespace vm
@@ -23,7 +23,8 @@ TEST_CASE("[vm] Runtime errors", "vm") {
         ExecState::StackOverflow);
   }
 
-  SECTION("Stack overflow") {
+  SECTION("Unbounded stack growth is rejected at load time") {
+    // Stack depth differs between the paths that reach 'push1'.
     CHECK_EXPR_RESULTCODE(
         [](novasm::Assembler* asmb) -> void {
           asmb->label("push1");
@@ -31,7 +32,7 @@ TEST_CASE("[vm] Runtime errors", "vm") {
           asmb->addJump("push1");
         },
         "input",
-        ExecState::StackOverflow);
+        ExecState::InvalidAssembly);
   }
 
   SECTION("Stack overflow") {
@@ -46,6 +47,74 @@ TEST_CASE("[vm] Runtime errors", "vm") {
         "input",
         ExecState::StackOverflow);
   }
+
+  SECTION("Invalid instructions") {
+    const auto version = std::string{"0.42.1337"};
+    const auto op      = [](novasm::OpCode code) { return static_cast<uint8_t>(code); };
+
+    // Unknown opcode.
+    CHECK_ASM_RESULTCODE(
+        novasm::Executable(version, 0, {}, {254}), "input", ExecState::InvalidAssembly);
+
+    // Truncated instruction.
+    CHECK_ASM_RESULTCODE(
+        novasm::Executable(version, 0, {}, {op(novasm::OpCode::LoadLitInt), 42}),
+        "input",
+        ExecState::InvalidAssembly);
+
+    // Running past the end of the program.
+    CHECK_ASM_RESULTCODE(
+        novasm::Executable(version, 0, {}, {op(novasm::OpCode::LoadLitInt0)}),
+        "input",
+        ExecState::Failed);
+
+    // Jump into the middle of an instruction.
+    CHECK_ASM_RESULTCODE(
+        novasm::Executable(
+            version, 0, {}, {op(novasm::OpCode::Jump), 2, 0, 0, 0, op(novasm::OpCode::Ret)}),
+        "input",
+        ExecState::InvalidAssembly);
+  }
+
+  SECTION("Malformed stack usage") {
+    const auto version = std::string{"0.42.1337"};
+    const auto op      = [](novasm::OpCode code) { return static_cast<uint8_t>(code); };
+
+    // Popping a value in a function that is called without arguments.
+    CHECK_ASM_RESULTCODE(
+        novasm::Executable(
+            version,
+            0,
+            {},
+            {op(novasm::OpCode::Call),
+             0,
+             6,
+             0,
+             0,
+             0,
+             op(novasm::OpCode::Pop),
+             op(novasm::OpCode::LoadLitInt0),
+             op(novasm::OpCode::Ret)}),
+        "input",
+        ExecState::InvalidAssembly);
+
+    // Loading a stack value that does not exist in the entrypoint.
+    CHECK_ASM_RESULTCODE(
+        novasm::Executable(
+            version, 0, {}, {op(novasm::OpCode::StackLoadSmall), 2, op(novasm::OpCode::Ret)}),
+        "input",
+        ExecState::InvalidAssembly);
+
+    // Loading a string literal that does not exist.
+    CHECK_ASM_RESULTCODE(
+        novasm::Executable(
+            version,
+            0,
+            {},
+            {op(novasm::OpCode::LoadLitString), 1, 0, 0, 0, op(novasm::OpCode::Ret)}),
+        "input",
+        ExecState::InvalidAssembly);
+  }
 }
 
 } // namespace vm
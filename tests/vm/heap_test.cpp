@@ -0,0 +1,416 @@
+#include "catch2/catch.hpp"
+#include "helpers.hpp"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace vm {
+
+const uint64_t testHeapLimit = 32U * 1024U * 1024U; // 32 MiB
+
+// Add functions to the program for allocating large string buffers:
+// * 'buffer' () -> string: Allocate a 1 MiB string.
+// * 'drop' (int n) -> int: Allocate 'n' buffers and drop them immediately.
+// * 'chain' (int n, struct acc) -> struct: Allocate 'n' buffers and keep them alive in a chain.
+static auto addBufferFuncs(novasm::Assembler* asmb) -> void {
+  asmb->label("buffer");
+  asmb->addLoadLitString(std::string(256U * 1024U, 'a'));
+  asmb->addDup();
+  asmb->addAddString();
+  asmb->addDup();
+  asmb->addAddString();
+  asmb->addDup();
+  asmb->addLoadLitInt(0);
+  asmb->addLoadLitInt(1);
+  asmb->addSliceString(); // Slice the string to allocate the concatenated buffer.
+  asmb->addPop();
+  asmb->addRet();
+
+  asmb->label("drop");
+  asmb->addStackLoad(0);
+  asmb->addCheckIntZero();
+  asmb->addJumpIf("drop-end");
+  asmb->addCall("buffer", 0, novasm::CallMode::Normal);
+  asmb->addPop();
+  asmb->addStackLoad(0);
+  asmb->addLoadLitInt(1);
+  asmb->addSubInt();
+  asmb->addCall("drop", 1, novasm::CallMode::Tail);
+  asmb->label("drop-end");
+  asmb->addLoadLitInt(0);
+  asmb->addRet();
+
+  asmb->label("chain");
+  asmb->addStackLoad(0);
+  asmb->addCheckIntZero();
+  asmb->addJumpIf("chain-end");
+  asmb->addStackLoad(0);
+  asmb->addLoadLitInt(1);
+  asmb->addSubInt();
+  asmb->addCall("buffer", 0, novasm::CallMode::Normal);
+  asmb->addStackLoad(1);
+  asmb->addMakeStruct(2);
+  asmb->addCall("chain", 2, novasm::CallMode::Tail);
+  asmb->label("chain-end");
+  asmb->addStackLoad(1);
+  asmb->addRet();
+}
+
+static auto runWithOptions(
+    const novasm::Executable& assembly, const std::function<void(Options*)>& configure)
+    -> std::vector<std::pair<ExecState, std::string>> {
+  auto results = std::vector<std::pair<ExecState, std::string>>{};
+  for (auto options : getTestOptions()) {
+    configure(&options);
+
+    const FileHandle stdInFile  = prepareStdIn(std::string{});
+    const FileHandle stdOutFile = getTempFile();
+
+    auto iface = PlatformInterface{std::string{}, 0, nullptr, stdInFile, stdOutFile, stdOutFile};
+    const auto res = run(&assembly, &iface, options);
+    results.emplace_back(res, getString(stdOutFile));
+
+    fileClose(stdInFile);
+    fileClose(stdOutFile);
+  }
+  return results;
+}
+
+static auto runWithHeapLimit(const novasm::Executable& assembly, uint64_t heapLimit)
+    -> std::vector<std::pair<ExecState, std::string>> {
+  return runWithOptions(
+      assembly, [heapLimit](Options* options) { options->heapLimit = heapLimit; });
+}
+
+// Keeps a chain of 'n' buffers alive while dropping 'drop' buffers, then prints the size of the
+// first buffer and the second buffer in the chain.
+static auto buildLiveChainProgram(int n, int drop) -> novasm::Executable {
+  return buildExecutable([n, drop](novasm::Assembler* asmb) -> void {
+    asmb->label("entry");
+    asmb->addStackAlloc(1);
+    asmb->addLoadLitInt(n);
+    asmb->addMakeNullStruct();
+    asmb->addCall("chain", 2, novasm::CallMode::Normal);
+    asmb->addStackStore(0);
+
+    asmb->addLoadLitInt(drop);
+    asmb->addCall("drop", 1, novasm::CallMode::Normal);
+    asmb->addPop();
+
+    asmb->addStackLoad(0);
+    asmb->addStructLoadField(0);
+    asmb->addLengthString();
+    asmb->addConvIntString();
+    asmb->addLoadLitString(" ");
+    asmb->addAddString();
+    asmb->addStackLoad(0);
+    asmb->addStructLoadField(1);
+    asmb->addStructLoadField(0);
+    asmb->addLengthString();
+    asmb->addConvIntString();
+    asmb->addAddString();
+    ADD_PRINT(asmb);
+    asmb->addRet();
+
+    addBufferFuncs(asmb);
+    asmb->setEntrypoint("entry");
+  });
+}
+
+#if defined(__linux__)
+static auto getRssBytes() -> uint64_t {
+  auto statm    = std::ifstream{"/proc/self/statm"};
+  uint64_t size = 0;
+  uint64_t rss  = 0;
+  statm >> size >> rss;
+  return rss * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+#endif
+
+TEST_CASE("[vm] Execute with a heap limit", "vm") {
+
+  SECTION("Dropped buffers are collected without reaching the heap limit") {
+    auto assembly = buildExecutable([](novasm::Assembler* asmb) -> void {
+      asmb->label("entry");
+      asmb->addLoadLitInt(256); // NOLINT: Magic numbers
+      asmb->addCall("drop", 1, novasm::CallMode::Normal);
+      asmb->addConvIntString();
+      ADD_PRINT(asmb);
+      asmb->addRet();
+
+      addBufferFuncs(asmb);
+      asmb->setEntrypoint("entry");
+    });
+    for (const auto& res : runWithHeapLimit(assembly, testHeapLimit)) {
+      CHECK(res.first == ExecState::Success);
+      CHECK_THAT(res.second, Catch::Equals("0"));
+    }
+  }
+
+  SECTION("Live buffers over the heap limit fail to allocate") {
+    auto assembly = buildExecutable([](novasm::Assembler* asmb) -> void {
+      asmb->label("entry");
+      asmb->addLoadLitInt(256); // NOLINT: Magic numbers
+      asmb->addMakeNullStruct();
+      asmb->addCall("chain", 2, novasm::CallMode::Normal);
+      asmb->addPop();
+      asmb->addLoadLitString("unreachable");
+      ADD_PRINT(asmb);
+      asmb->addRet();
+
+      addBufferFuncs(asmb);
+      asmb->setEntrypoint("entry");
+    });
+    for (const auto& res : runWithHeapLimit(assembly, testHeapLimit)) {
+      CHECK(res.first == ExecState::AllocFailed);
+      CHECK(res.second.empty());
+    }
+  }
+
+#if defined(__linux__)
+  SECTION("Memory of dropped buffers is returned to the system") {
+    // Repeatedly builds up 64 MiB of live buffers and drops them again, after the last round a full
+    // collection is requested which should return the free memory to the system.
+    auto assembly = buildExecutable([](novasm::Assembler* asmb) -> void {
+      asmb->label("entry");
+      asmb->addLoadLitInt(4); // NOLINT: Magic numbers
+      asmb->addCall("round", 1, novasm::CallMode::Normal);
+      asmb->addPop();
+      asmb->addLoadLitInt(0);
+      asmb->addPCall(novasm::PCallCode::GcCollect);
+      asmb->addPop();
+      asmb->addLoadLitString("done");
+      ADD_PRINT(asmb);
+      asmb->addRet();
+
+      asmb->label("round");
+      asmb->addStackLoad(0);
+      asmb->addCheckIntZero();
+      asmb->addJumpIf("round-end");
+      asmb->addLoadLitInt(64); // NOLINT: Magic numbers
+      asmb->addMakeNullStruct();
+      asmb->addCall("chain", 2, novasm::CallMode::Normal);
+      asmb->addPop();
+      asmb->addStackLoad(0);
+      asmb->addLoadLitInt(1);
+      asmb->addSubInt();
+      asmb->addCall("round", 1, novasm::CallMode::Tail);
+      asmb->label("round-end");
+      asmb->addLoadLitInt(0);
+      asmb->addRet();
+
+      addBufferFuncs(asmb);
+      asmb->setEntrypoint("entry");
+    });
+
+    auto options          = Options{};
+    options.gcMarkThreads = 1U;
+
+    const FileHandle stdInFile  = prepareStdIn(std::string{});
+    const FileHandle stdOutFile = getTempFile();
+    auto iface = PlatformInterface{std::string{}, 0, nullptr, stdInFile, stdOutFile, stdOutFile};
+
+    // Sample the resident set size while the program is running.
+    const auto baseRss = getRssBytes();
+    auto samples       = std::vector<uint64_t>{};
+    auto running       = std::atomic<bool>{true};
+    auto sampler       = std::thread{[&]() {
+      while (running.load()) {
+        samples.push_back(getRssBytes());
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      }
+    }};
+    CHECK(run(&assembly, &iface, options) == ExecState::Success);
+    running.store(false);
+    sampler.join();
+    const auto endRss  = getRssBytes();
+    const auto peakRss = *std::max_element(samples.begin(), samples.end());
+
+    auto report = std::ostringstream{};
+    report << "rss over time (MiB):";
+    for (auto i = 0U; i < samples.size(); i += std::max(samples.size() / 32U, size_t{1})) {
+      report << ' ' << samples[i] / (1024U * 1024U);
+    }
+    report << ", base: " << baseRss / (1024U * 1024U) << ", peak: " << peakRss / (1024U * 1024U)
+           << ", end: " << endRss / (1024U * 1024U);
+    INFO(report.str());
+
+    CHECK_THAT(getString(stdOutFile), Catch::Equals("done"));
+    CHECK(peakRss > baseRss + 32U * 1024U * 1024U);
+    CHECK(endRss < baseRss + 16U * 1024U * 1024U);
+
+    fileClose(stdInFile);
+    fileClose(stdOutFile);
+  }
+#endif
+}
+
+TEST_CASE("[vm] Collect while many executors are blocked", "vm") {
+  // Forks 'count' workers that block (half on an atomic and half on a future that waits for the
+  // same atomic), then runs a blocking collection and measures how long it pauses the program.
+  // Afterwards the atomic is set and the results of all workers are summed.
+  constexpr auto count = 10'000;
+  auto assembly        = buildExecutable([](novasm::Assembler* asmb) -> void {
+    asmb->label("entry");
+    asmb->addStackAlloc(4); // Atomic, gate future, list of worker futures and the pause time.
+    asmb->addMakeAtomic(0);
+    asmb->addStackStore(0);
+    asmb->addStackLoad(0);
+    asmb->addCall("gate", 1, novasm::CallMode::Forked);
+    asmb->addStackStore(1);
+
+    asmb->addLoadLitInt(count);
+    asmb->addStackLoad(0);
+    asmb->addStackLoad(1);
+    asmb->addMakeNullStruct();
+    asmb->addCall("spawn", 4, novasm::CallMode::Normal);
+    asmb->addStackStore(2);
+
+    // Give the workers time to block.
+    asmb->addLoadLitLong(100'000'000);
+    asmb->addPCall(novasm::PCallCode::SleepNano);
+    asmb->addPop();
+
+    asmb->addPCall(novasm::PCallCode::ClockNanoSteady);
+    asmb->addLoadLitInt(1); // GcCollectBlockingSweep.
+    asmb->addPCall(novasm::PCallCode::GcCollect);
+    asmb->addPop();
+    asmb->addPCall(novasm::PCallCode::ClockNanoSteady);
+    asmb->addSwap();
+    asmb->addSubLong();
+    asmb->addStackStore(3);
+
+    // Release the workers and sum their results.
+    asmb->addStackLoad(0);
+    asmb->addAtomicCompareSwap(0, 1);
+    asmb->addPop();
+    asmb->addStackLoad(2);
+    asmb->addLoadLitInt(0);
+    asmb->addCall("sum", 2, novasm::CallMode::Normal);
+    asmb->addConvIntString();
+    asmb->addLoadLitString(" ");
+    asmb->addAddString();
+    asmb->addStackLoad(3);
+    asmb->addConvLongString();
+    asmb->addAddString();
+    ADD_PRINT(asmb);
+    asmb->addRet();
+
+    // (int n, atomic, future gate, struct list) -> struct list.
+    asmb->label("spawn");
+    asmb->addStackLoad(0);
+    asmb->addCheckIntZero();
+    asmb->addJumpIf("spawn-end");
+    asmb->addStackLoad(0);
+    asmb->addLoadLitInt(1);
+    asmb->addSubInt();
+    asmb->addStackLoad(1);
+    asmb->addStackLoad(2);
+    asmb->addStackLoad(0);
+    asmb->addStackLoad(1);
+    asmb->addStackLoad(2);
+    asmb->addCall("worker", 3, novasm::CallMode::Forked);
+    asmb->addStackLoad(3);
+    asmb->addMakeStruct(2);
+    asmb->addCall("spawn", 4, novasm::CallMode::Tail);
+    asmb->label("spawn-end");
+    asmb->addStackLoad(3);
+    asmb->addRet();
+
+    // (int n, atomic, future gate) -> int n.
+    asmb->label("worker");
+    asmb->addStackLoad(0);
+    asmb->addLoadLitInt(1);
+    asmb->addAndInt();
+    asmb->addCheckIntZero();
+    asmb->addJumpIf("worker-atomic");
+    asmb->addStackLoad(2);
+    asmb->addFutureBlock();
+    asmb->addPop();
+    asmb->addStackLoad(0);
+    asmb->addRet();
+    asmb->label("worker-atomic");
+    asmb->addStackLoad(1);
+    asmb->addAtomicBlock(1);
+    asmb->addStackLoad(0);
+    asmb->addRet();
+
+    // (atomic) -> int.
+    asmb->label("gate");
+    asmb->addStackLoad(0);
+    asmb->addAtomicBlock(1);
+    asmb->addLoadLitInt(0);
+    asmb->addRet();
+
+    // (struct list, int acc) -> int.
+    asmb->label("sum");
+    asmb->addStackLoad(0);
+    asmb->addCheckStructNull();
+    asmb->addJumpIf("sum-end");
+    asmb->addStackLoad(0);
+    asmb->addStructLoadField(1);
+    asmb->addStackLoad(0);
+    asmb->addStructLoadField(0);
+    asmb->addFutureBlock();
+    asmb->addStackLoad(1);
+    asmb->addAddInt();
+    asmb->addCall("sum", 2, novasm::CallMode::Tail);
+    asmb->label("sum-end");
+    asmb->addStackLoad(1);
+    asmb->addRet();
+
+    asmb->setEntrypoint("entry");
+  });
+
+  for (const auto& res : runWithOptions(assembly, [](Options* /*unused*/) {})) {
+    REQUIRE(res.first == ExecState::Success);
+
+    const auto expectedSum = std::to_string(count * (count + 1) / 2) + " ";
+    REQUIRE_THAT(res.second, Catch::StartsWith(expectedSum));
+    const auto pauseNs = std::stoll(res.second.substr(expectedSum.size()));
+    INFO("gc pause with " << count << " blocked executors: " << pauseNs / 1000 << " us");
+    CHECK(pauseNs > 0);
+  }
+}
+
+TEST_CASE("[vm] Execute with gc pacing options", "vm") {
+  const auto assembly = buildLiveChainProgram(8, 64); // NOLINT: Magic numbers
+
+  SECTION("Small growth percentage") {
+    for (const auto& res : runWithOptions(assembly, [](Options* options) {
+           options->gcGrowthPercent = 1U;
+         })) {
+      CHECK(res.first == ExecState::Success);
+      CHECK_THAT(res.second, Catch::Equals("1048576 1048576"));
+    }
+  }
+
+  SECTION("Small soft heap target") {
+    for (const auto& res : runWithOptions(assembly, [](Options* options) {
+           options->gcSoftHeapTarget = 1U * 1024U * 1024U;
+         })) {
+      CHECK(res.first == ExecState::Success);
+      CHECK_THAT(res.second, Catch::Equals("1048576 1048576"));
+    }
+  }
+
+  SECTION("Short collection interval") {
+    for (const auto& res : runWithOptions(assembly, [](Options* options) {
+           options->gcGrowthPercent           = 1000U;
+           options->gcMinIntervalMilliseconds = 1U;
+         })) {
+      CHECK(res.first == ExecState::Success);
+      CHECK_THAT(res.second, Catch::Equals("1048576 1048576"));
+    }
+  }
+}
+
+} // namespace vm
@@ -62,38 +62,58 @@ inline auto prepareStdIn(std::string input) -> FileHandle {
   return stdInFile;
 }
 
+// Every program is executed both by the interpreter and with the jit compiling all functions on
+// their first call, both modes have to produce the same results.
+// NOTE: The interpreter runs mark garbage on a single thread and the jit runs use multiple mark
+// threads, this way both garbage collector paths are covered regardless of the hardware.
+inline auto getTestOptions() -> std::array<Options, 2> {
+  auto interpreter          = Options{};
+  interpreter.gcMarkThreads = 1U;
+  auto jit                  = Options{};
+  jit.jitEnabled            = true;
+  jit.jitThreshold          = 0U;
+  jit.gcMarkThreads         = 4U;
+  return {interpreter, jit};
+}
+
 #define CHECK_ASM(ASM, INPUT, EXPECTED)                                                            \
   {                                                                                                \
     auto assembly = ASM;                                                                           \
+    for (const auto& options : getTestOptions()) {                                                 \
+      INFO("jit: " << options.jitEnabled);                                                         \
                                                                                                    \
-    const FileHandle stdInFile  = prepareStdIn(std::string{INPUT});                                \
-    const FileHandle stdOutFile = getTempFile();                                                   \
+      const FileHandle stdInFile  = prepareStdIn(std::string{INPUT});                              \
+      const FileHandle stdOutFile = getTempFile();                                                 \
                                                                                                    \
-    std::array<const char*, 2> envArgs = {"Test argument 1", "Test argument 2"};                   \
-    auto iface =                                                                                   \
-        PlatformInterface{std::string{}, 2, envArgs.data(), stdInFile, stdOutFile, stdOutFile};    \
+      std::array<const char*, 2> envArgs = {"Test argument 1", "Test argument 2"};                 \
+      auto iface =                                                                                 \
+          PlatformInterface{std::string{}, 2, envArgs.data(), stdInFile, stdOutFile, stdOutFile};  \
                                                                                                    \
-    CHECK(run(&assembly, &iface) == ExecState::Success);                                           \
+      CHECK(run(&assembly, &iface, options) == ExecState::Success);                                \
                                                                                                    \
-    CHECK_THAT(getString(stdOutFile), Catch::Equals(EXPECTED));                                    \
+      CHECK_THAT(getString(stdOutFile), Catch::Equals(EXPECTED));                                  \
                                                                                                    \
-    fileClose(stdInFile);                                                                          \
-    fileClose(stdOutFile);                                                                         \
+      fileClose(stdInFile);                                                                        \
+      fileClose(stdOutFile);                                                                       \
+    }                                                                                              \
   }
 
 #define CHECK_ASM_RESULTCODE(ASM, INPUT, EXPECTED)                                                 \
   {                                                                                                \
     auto assembly = ASM;                                                                           \
+    for (const auto& options : getTestOptions()) {                                                 \
+      INFO("jit: " << options.jitEnabled);                                                         \
                                                                                                    \
-    const FileHandle stdInFile  = prepareStdIn(std::string{INPUT});                                \
-    const FileHandle stdOutFile = fileInvalid();                                                   \
+      const FileHandle stdInFile  = prepareStdIn(std::string{INPUT});                              \
+      const FileHandle stdOutFile = fileInvalid();                                                 \
                                                                                                    \
-    std::array<const char*, 2> envArgs = {"Test argument 1", "Test argument 2"};                   \
-    auto iface =                                                                                   \
-        PlatformInterface{std::string{}, 2, envArgs.data(), stdInFile, stdOutFile, stdOutFile};    \
-    CHECK(run(&assembly, &iface) == (EXPECTED));                                                   \
+      std::array<const char*, 2> envArgs = {"Test argument 1", "Test argument 2"};                 \
+      auto iface =                                                                                 \
+          PlatformInterface{std::string{}, 2, envArgs.data(), stdInFile, stdOutFile, stdOutFile};  \
+      CHECK(run(&assembly, &iface, options) == (EXPECTED));                                        \
                                                                                                    \
-    fileClose(stdInFile);                                                                          \
+      fileClose(stdInFile);                                                                        \
+    }                                                                                              \
   }
 
 #define CHECK_EXPR(BUILD, INPUT, EXPECTED) CHECK_ASM(buildExecutableExpr(BUILD), INPUT, EXPECTED)
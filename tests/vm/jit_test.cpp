@@ -0,0 +1,201 @@
+#include "catch2/catch.hpp"
+#include "helpers.hpp"
+
+namespace vm {
+
+// NOTE: All vm tests are executed both in the interpreter and with the jit enabled (see
+// 'getTestOptions'), these tests focus on switching between native code and the interpreter.
+
+TEST_CASE("[vm] Execute jit", "vm") {
+
+  SECTION("Backward jump loop") {
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addStackAlloc(1);
+          asmb->addLoadLitInt(0);
+          asmb->addStackStore(0);
+
+          asmb->label("loop");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(100'000); // NOLINT: Magic numbers
+          asmb->addCheckEqInt();
+          asmb->addJumpIf("end");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1);
+          asmb->addAddInt();
+          asmb->addStackStore(0);
+          asmb->addJump("loop");
+
+          asmb->label("end");
+          asmb->addStackLoad(0);
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "100000");
+  }
+
+  SECTION("Recursive calls") {
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addLoadLitInt(20); // NOLINT: Magic numbers
+          asmb->addCall("fib", 1, novasm::CallMode::Normal);
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          asmb->label("fib");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(2);
+          asmb->addCheckLeInt();
+          asmb->addJumpIf("fib-small");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1);
+          asmb->addSubInt();
+          asmb->addCall("fib", 1, novasm::CallMode::Normal);
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(2);
+          asmb->addSubInt();
+          asmb->addCall("fib", 1, novasm::CallMode::Normal);
+          asmb->addAddInt();
+          asmb->addRet();
+
+          asmb->label("fib-small");
+          asmb->addStackLoad(0);
+          asmb->addRet();
+
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "6765");
+  }
+
+  SECTION("Struct field loads") {
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addLoadLitInt(40); // NOLINT: Magic numbers
+          asmb->addLoadLitInt(2);
+          asmb->addMakeStruct(2);
+          asmb->addCall("sum", 1, novasm::CallMode::Normal);
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          asmb->label("sum");
+          asmb->addStackLoad(0);
+          asmb->addCheckStructNull();
+          asmb->addJumpIf("sum-null");
+          asmb->addStackLoad(0);
+          asmb->addStructLoadField(0);
+          asmb->addStackLoad(0);
+          asmb->addStructLoadField(1);
+          asmb->addAddInt();
+          asmb->addRet();
+
+          asmb->label("sum-null");
+          asmb->addLoadLitInt(-1);
+          asmb->addRet();
+
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "42");
+  }
+
+  SECTION("Float compare with NaN") {
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addLoadLitFloat(0.0F);
+          asmb->addLoadLitFloat(0.0F);
+          asmb->addDivFloat(); // NaN.
+          asmb->addCall("cmp", 1, novasm::CallMode::Normal);
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          asmb->label("cmp");
+          asmb->addStackLoad(0);
+          asmb->addStackLoad(0);
+          asmb->addCheckEqFloat();
+          asmb->addJumpIf("cmp-true");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitFloat(1.0F);
+          asmb->addCheckGtFloat();
+          asmb->addJumpIf("cmp-true");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitFloat(1.0F);
+          asmb->addCheckLeFloat();
+          asmb->addJumpIf("cmp-true");
+          asmb->addLoadLitString("false");
+          asmb->addRet();
+
+          asmb->label("cmp-true");
+          asmb->addLoadLitString("true");
+          asmb->addRet();
+
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "false");
+  }
+
+  SECTION("Native loop reaches safe-points while other executors allocate") {
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addLoadLitInt(5'000'000); // NOLINT: Magic numbers
+          asmb->addCall("count", 1, novasm::CallMode::Forked);
+
+          // Allocate enough strings to trigger garbage collections while the fork is running.
+          asmb->addLoadLitInt(200'000); // NOLINT: Magic numbers
+          asmb->addCall("alloc", 1, novasm::CallMode::Normal);
+          asmb->addPop();
+
+          asmb->addFutureBlock();
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          asmb->label("count");
+          asmb->addStackLoad(0);
+          asmb->addCheckIntZero();
+          asmb->addJumpIf("count-end");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1);
+          asmb->addSubInt();
+          asmb->addStackStore(0);
+          asmb->addJump("count");
+          asmb->label("count-end");
+          asmb->addLoadLitInt(1337); // NOLINT: Magic numbers
+          asmb->addRet();
+
+          asmb->label("alloc");
+          asmb->addStackLoad(0);
+          asmb->addCheckIntZero();
+          asmb->addJumpIf("alloc-end");
+          asmb->addStackLoad(0);
+          asmb->addConvIntString();
+          asmb->addPop();
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1);
+          asmb->addSubInt();
+          asmb->addStackStore(0);
+          asmb->addJump("alloc");
+          asmb->label("alloc-end");
+          asmb->addLoadLitInt(0);
+          asmb->addRet();
+
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "1337");
+  }
+}
+
+} // namespace vm
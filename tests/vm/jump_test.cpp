@@ -77,6 +77,80 @@ TEST_CASE("[vm] Execute jump", "vm") {
         "input",
         "42");
   }
+
+  SECTION("Compare and jump") {
+    using CheckFunc = void (novasm::Assembler::*)();
+    const auto checkJump =
+        [](CheckFunc check, int32_t a, int32_t b, const std::string& expected) {
+          CHECK_EXPR(
+              [&](novasm::Assembler* asmb) -> void {
+                asmb->addLoadLitInt(a);
+                asmb->addLoadLitInt(b);
+                (asmb->*check)();
+                asmb->addJumpIf("jumped");
+
+                asmb->addLoadLitString("not-jumped");
+                asmb->addJump("end");
+
+                asmb->label("jumped");
+                asmb->addLoadLitString("jumped");
+
+                asmb->label("end");
+                ADD_PRINT(asmb);
+              },
+              "input",
+              expected);
+        };
+    checkJump(&novasm::Assembler::addCheckEqInt, 42, 42, "jumped");
+    checkJump(&novasm::Assembler::addCheckEqInt, 42, 1337, "not-jumped");
+    checkJump(&novasm::Assembler::addCheckGtInt, 1337, 42, "jumped");
+    checkJump(&novasm::Assembler::addCheckGtInt, 42, 42, "not-jumped");
+    checkJump(&novasm::Assembler::addCheckLeInt, 42, 1337, "jumped");
+    checkJump(&novasm::Assembler::addCheckLeInt, 42, 42, "not-jumped");
+
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitInt(0);
+          asmb->addCheckIntZero();
+          asmb->addJumpIf("jumped");
+
+          asmb->addLoadLitString("not-jumped");
+          asmb->addJump("end");
+
+          asmb->label("jumped");
+          asmb->addLoadLitString("jumped");
+
+          asmb->label("end");
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "jumped");
+  }
+
+  SECTION("Jump into the middle of a fusable sequence") {
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitInt(42);
+          asmb->addLoadLitInt(1);
+          asmb->addJump("check");
+
+          asmb->addLoadLitInt(1337); // Not executed, but can be fused with the next instruction.
+          asmb->label("check");
+          asmb->addCheckEqInt();
+          asmb->addJumpIf("jumped");
+
+          asmb->addLoadLitString("not-jumped");
+          asmb->addJump("end");
+
+          asmb->label("jumped");
+          asmb->addLoadLitString("jumped");
+
+          asmb->label("end");
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "not-jumped");
+  }
 }
 
 } // namespace vm
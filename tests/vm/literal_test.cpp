@@ -87,6 +87,27 @@ TEST_CASE("[vm] Execute literals", "vm") {
         "input",
         "hello world !");
   }
+
+  SECTION("String literals survive garbage collection") {
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString("hello");
+          asmb->addLoadLitString(" world");
+          asmb->addAddString();
+
+          for (auto i = 0; i != 2; ++i) {
+            asmb->addLoadLitInt(1); // Blocking sweep.
+            asmb->addPCall(novasm::PCallCode::GcCollect);
+            asmb->addPop();
+          }
+
+          asmb->addLoadLitString("!");
+          asmb->addAddString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "hello world!");
+  }
 }
 
 } // namespace vm
@@ -446,6 +446,52 @@ TEST_CASE("[vm] Execute long operations", "vm") {
         "input",
         "-65536");
   }
+
+  SECTION("Inline storage boundary") {
+    // Longs in the signed 63 bit range are stored inline, others are boxed.
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitLong(4611686018427387903L);
+          asmb->addLoadLitLong(1);
+          asmb->addAddLong();
+          asmb->addConvLongString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "4611686018427387904");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitLong(-4611686018427387904L);
+          asmb->addLoadLitLong(1);
+          asmb->addSubLong();
+          asmb->addConvLongString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "-4611686018427387905");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitLong(-4611686018427387905L);
+          asmb->addLoadLitLong(1);
+          asmb->addAddLong();
+          asmb->addLoadLitLong(-4611686018427387904L);
+          asmb->addCheckEqLong();
+          ADD_BOOL_TO_STRING(asmb);
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "true");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitLong(-1);
+          asmb->addLoadLitLong(-4611686018427387904L);
+          asmb->addMulLong();
+          asmb->addConvLongString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "4611686018427387904");
+  }
 }
 
 } // namespace vm
@@ -0,0 +1,163 @@
+#include "catch2/catch.hpp"
+#include "internal/futex.hpp"
+#include "internal/scheduler.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+namespace vm {
+
+using internal::Scheduler;
+
+// Wait until the predicate returns true, returns false if it did not within 5 seconds.
+static auto waitFor(const std::function<bool()>& pred) -> bool {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+struct TestState {
+  std::atomic<uint32_t> value{0U};
+  std::atomic<bool> flag{false};
+  std::atomic<unsigned int> arrived{0U};
+  std::atomic<unsigned int> finished{0U};
+  Scheduler* scheduler{nullptr};
+};
+
+// Routine that counts itself as finished.
+static auto countRoutine(void* arg) noexcept -> void {
+  ++static_cast<TestState*>(arg)->finished;
+}
+
+// Routine that sets the flag.
+static auto flagRoutine(void* arg) noexcept -> void {
+  auto* state = static_cast<TestState*>(arg);
+  state->flag.store(true);
+  ++state->finished;
+}
+
+// Routine that waits on the futex until the value is not zero anymore.
+static auto parkRoutine(void* arg) noexcept -> void {
+  auto* state = static_cast<TestState*>(arg);
+  ++state->arrived;
+  while (state->value.load() == 0U) {
+    internal::futexWait(&state->value, 0U);
+  }
+  ++state->finished;
+}
+
+// Routine that blocks its thread until the flag is set, handing off its worker in the meantime.
+static auto blockingRoutine(void* arg) noexcept -> void {
+  auto* state = static_cast<TestState*>(arg);
+  internal::schedulerEnterBlocking();
+  while (!state->flag.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  internal::schedulerLeaveBlocking();
+  ++state->finished;
+}
+
+// Routine that yields until the flag is set.
+static auto yieldRoutine(void* arg) noexcept -> void {
+  auto* state = static_cast<TestState*>(arg);
+  while (!state->flag.load()) {
+    internal::schedulerYield();
+  }
+  ++state->finished;
+}
+
+// Routine that blocks its thread (without handing off its worker) until two of them have arrived.
+static auto rendezvousRoutine(void* arg) noexcept -> void {
+  auto* state = static_cast<TestState*>(arg);
+  ++state->arrived;
+  while (state->arrived.load() < 2U) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ++state->finished;
+}
+
+// Routine that runs two rendezvous routines, which end up on the deque of its own worker.
+static auto spawnRoutine(void* arg) noexcept -> void {
+  auto* state = static_cast<TestState*>(arg);
+  CHECK(state->scheduler->run(&rendezvousRoutine, state));
+  CHECK(state->scheduler->run(&rendezvousRoutine, state));
+}
+
+TEST_CASE("[vm] Scheduler", "vm") {
+
+  SECTION("Runs all routines") {
+    auto state     = TestState{};
+    auto scheduler = Scheduler{2U};
+    for (auto i = 0U; i != 1000U; ++i) {
+      CHECK(scheduler.run(&countRoutine, &state));
+    }
+    CHECK(waitFor([&]() { return state.finished.load() == 1000U; }));
+    CHECK(scheduler.getThreadCount() <= 2U);
+  }
+
+  SECTION("Parked tasks do not occupy a thread") {
+    auto state     = TestState{};
+    auto scheduler = Scheduler{2U};
+    for (auto i = 0U; i != 100U; ++i) {
+      CHECK(scheduler.run(&parkRoutine, &state));
+    }
+    CHECK(waitFor([&]() { return state.arrived.load() == 100U; }));
+    CHECK(scheduler.getThreadCount() <= 2U);
+    CHECK(state.finished.load() == 0U);
+
+    state.value.store(1U);
+    internal::futexWakeAll(&state.value);
+    CHECK(waitFor([&]() { return state.finished.load() == 100U; }));
+  }
+
+  SECTION("Blocking call hands off the worker") {
+    auto state     = TestState{};
+    auto scheduler = Scheduler{1U};
+    CHECK(scheduler.run(&blockingRoutine, &state));
+    CHECK(scheduler.run(&flagRoutine, &state));
+    CHECK(waitFor([&]() { return state.finished.load() == 2U; }));
+  }
+
+  SECTION("Yielding runs other tasks") {
+    auto state     = TestState{};
+    auto scheduler = Scheduler{1U};
+    CHECK(scheduler.run(&yieldRoutine, &state));
+    CHECK(scheduler.run(&flagRoutine, &state));
+    CHECK(waitFor([&]() { return state.finished.load() == 2U; }));
+  }
+
+  SECTION("Idle workers steal tasks") {
+    auto state      = TestState{};
+    auto scheduler  = Scheduler{4U};
+    state.scheduler = &scheduler;
+    CHECK(scheduler.run(&spawnRoutine, &state));
+    CHECK(waitFor([&]() { return state.finished.load() == 2U; }));
+  }
+
+  SECTION("Shutdown wakes parked tasks") {
+    auto state     = TestState{};
+    auto scheduler = Scheduler{1U};
+    CHECK(scheduler.run(&parkRoutine, &state));
+    CHECK(waitFor([&]() { return state.arrived.load() == 1U; }));
+
+    // Change the value without waking, only the shutdown wakes the task.
+    state.value.store(1U);
+    scheduler.shutdown();
+    CHECK(waitFor([&]() { return state.finished.load() == 1U; }));
+  }
+
+  SECTION("Run fails after shutdown") {
+    auto state     = TestState{};
+    auto scheduler = Scheduler{1U};
+    scheduler.shutdown();
+    CHECK(!scheduler.run(&countRoutine, &state));
+  }
+}
+
+} // namespace vm
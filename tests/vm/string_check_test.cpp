@@ -38,6 +38,35 @@ TEST_CASE("[vm] Execute string checks", "vm") {
         },
         "input",
         "true");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString("hello ");
+          asmb->addLoadLitString("wor");
+          asmb->addLoadLitString("ld");
+          asmb->addAddString();
+          asmb->addAddString();
+          asmb->addLoadLitString("hel");
+          asmb->addLoadLitString("lo world");
+          asmb->addAddString();
+          asmb->addCheckEqString();
+          ADD_BOOL_TO_STRING(asmb);
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "true");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString("0123456789abcdefghijklmnopqrstuvwxyz");
+          asmb->addLoadLitString("--0123456789abcdefghijklmnopqrstuvwxyz--");
+          asmb->addLoadLitInt(2);
+          asmb->addLoadLitInt(38);
+          asmb->addSliceString();
+          asmb->addCheckEqString();
+          ADD_BOOL_TO_STRING(asmb);
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "true");
     CHECK_EXPR(
         [](novasm::Assembler* asmb) -> void {
           asmb->addLoadLitString("");
@@ -3,6 +3,30 @@
 
 namespace vm {
 
+// String that is long enough for slices to reference it instead of copying, see 'StringSliceRef'.
+static const auto* longStr = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-+";
+
+// Add a 'wrap' (int n, string str) -> string function to the program that surrounds the string 'n'
+// times with '<' and '>', this builds up a deep rope by both prepending and appending.
+static auto addWrapFunc(novasm::Assembler* asmb) -> void {
+  asmb->label("wrap");
+  asmb->addStackLoad(0);
+  asmb->addCheckIntZero();
+  asmb->addJumpIf("wrap-end");
+  asmb->addStackLoad(0);
+  asmb->addLoadLitInt(1);
+  asmb->addSubInt();
+  asmb->addLoadLitString("<");
+  asmb->addStackLoad(1);
+  asmb->addAddString();
+  asmb->addLoadLitInt('>');
+  asmb->addAppendChar();
+  asmb->addCall("wrap", 2, novasm::CallMode::Tail);
+  asmb->label("wrap-end");
+  asmb->addStackLoad(1);
+  asmb->addRet();
+}
+
 TEST_CASE("[vm] Execute string operations", "vm") {
 
   SECTION("Add") {
@@ -261,6 +285,276 @@ TEST_CASE("[vm] Execute string operations", "vm") {
         "input",
         "");
   }
+
+  SECTION("Slicing long strings") {
+    // Slices of long strings reference the characters of the original string.
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(10);
+          asmb->addLoadLitInt(62);
+          asmb->addSliceString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(10);
+          asmb->addLoadLitInt(62);
+          asmb->addSliceString();
+          asmb->addLoadLitInt(26);
+          asmb->addLoadLitInt(99);
+          asmb->addSliceString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(10);
+          asmb->addLoadLitInt(62);
+          asmb->addSliceString();
+          asmb->addLoadLitInt(1);
+          asmb->addLoadLitInt(50);
+          asmb->addSliceString();
+          asmb->addLoadLitInt(5);
+          asmb->addLoadLitInt(10);
+          asmb->addSliceString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "ghijk");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(0);
+          asmb->addLoadLitInt(40);
+          asmb->addSliceString();
+          asmb->addLengthString();
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "40");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(10);
+          asmb->addLoadLitInt(62);
+          asmb->addSliceString();
+          asmb->addLoadLitInt(26);
+          asmb->addIndexString();
+          asmb->addConvCharString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "A");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(10);
+          asmb->addLoadLitInt(62);
+          asmb->addSliceString();
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(0);
+          asmb->addLoadLitInt(40);
+          asmb->addSliceString();
+          asmb->addAddString();
+          asmb->addLoadLitString("!");
+          asmb->addAddString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyz"
+        "ABCD!");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          // Slice of a heap string that is only kept alive by the slice during a collection.
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitString(longStr);
+          asmb->addAddString();
+          asmb->addLoadLitInt(36);
+          asmb->addLoadLitInt(100);
+          asmb->addSliceString();
+          asmb->addLoadLitInt(0);
+          asmb->addPCall(novasm::PCallCode::GcCollect);
+          asmb->addPop();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ-+0123456789abcdefghijklmnopqrstuvwxyz");
+  }
+
+  SECTION("Hashing") {
+    // Hash of a flat string, a rope and a slice with the same characters.
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString(std::string(longStr, 40U));
+          asmb->addHashString();
+          asmb->addLoadLitString(std::string(longStr, 13U));
+          asmb->addLoadLitString(std::string(longStr + 13U, 27U));
+          asmb->addAddString();
+          asmb->addHashString();
+          asmb->addCheckEqInt();
+          asmb->addLoadLitString(longStr);
+          asmb->addLoadLitInt(0);
+          asmb->addLoadLitInt(40);
+          asmb->addSliceString();
+          asmb->addHashString();
+          asmb->addLoadLitString(std::string(longStr, 40U));
+          asmb->addHashString();
+          asmb->addCheckEqInt();
+          asmb->addAndInt();
+          ADD_BOOL_TO_STRING(asmb);
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "true");
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString("hello");
+          asmb->addHashString();
+          asmb->addLoadLitString("hellp");
+          asmb->addHashString();
+          asmb->addCheckEqInt();
+          ADD_BOOL_TO_STRING(asmb);
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "false");
+  }
+
+  SECTION("Ropes") {
+    const auto wrapped = std::string(500U, '<') + std::string(500U, '>');
+
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitString("hello");
+          asmb->addLoadLitString(" ");
+          asmb->addLoadLitString("world");
+          asmb->addAddString();
+          asmb->addAddString();
+          asmb->addLoadLitString("!");
+          asmb->addSwap();
+          asmb->addAddString();
+          ADD_PRINT(asmb);
+        },
+        "input",
+        "!hello world");
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addLoadLitInt(500);
+          asmb->addLoadLitString("");
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          addWrapFunc(asmb);
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        wrapped);
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addLoadLitInt(500);
+          asmb->addLoadLitString("");
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          asmb->addDup();
+          asmb->addLengthString();
+          asmb->addConvIntString();
+          asmb->addSwap();
+          asmb->addDup();
+          asmb->addLoadLitInt(499);
+          asmb->addIndexString();
+          asmb->addConvCharString();
+          asmb->addSwap();
+          asmb->addLoadLitInt(500);
+          asmb->addIndexString();
+          asmb->addConvCharString();
+          asmb->addAddString();
+          asmb->addAddString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          addWrapFunc(asmb);
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "1000<>");
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          // Deep ropes with a different structure but the same characters.
+          asmb->label("entry");
+          asmb->addLoadLitInt(500);
+          asmb->addLoadLitString("");
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          asmb->addLoadLitInt(250);
+          asmb->addLoadLitInt(249);
+          asmb->addLoadLitString("<>");
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          asmb->addCheckEqString();
+          ADD_BOOL_TO_STRING(asmb);
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          addWrapFunc(asmb);
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "true");
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addLoadLitInt(500);
+          asmb->addLoadLitString("");
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          asmb->addLoadLitInt(499);
+          asmb->addLoadLitString("><");
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          asmb->addCheckEqString();
+          ADD_BOOL_TO_STRING(asmb);
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          addWrapFunc(asmb);
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "false");
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          // Balanced rope that is extended after a collection cleared the original links.
+          asmb->label("entry");
+          asmb->addLoadLitInt(500);
+          asmb->addLoadLitString("");
+          asmb->addCall("wrap", 2, novasm::CallMode::Normal);
+          asmb->addDup();
+          asmb->addLoadLitInt(0);
+          asmb->addIndexString();
+          asmb->addPop();
+          asmb->addLoadLitInt(0);
+          asmb->addPCall(novasm::PCallCode::GcCollect);
+          asmb->addPop();
+          asmb->addLoadLitString("[");
+          asmb->addSwap();
+          asmb->addAddString();
+          asmb->addLoadLitInt(']');
+          asmb->addAppendChar();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          addWrapFunc(asmb);
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "[" + wrapped + "]");
+  }
 }
 
 } // namespace vm
@@ -88,6 +88,168 @@ TEST_CASE("[vm] Execute struct operations", "vm") {
         "input",
         "hello moto");
   }
+
+  SECTION("Check unboxed union discriminant") {
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitInt(-42);
+          asmb->addUnionWrap(3);
+          asmb->addUnionCheck(3);
+          ADD_ASSERT(asmb);
+
+          asmb->addLoadLitInt(-42);
+          asmb->addUnionWrap(3);
+          asmb->addUnionCheck(2);
+          asmb->addCheckIntZero(); // Invert.
+          ADD_ASSERT(asmb);
+
+          asmb->addMakeNullStruct();
+          asmb->addUnionWrap(255);
+          asmb->addUnionCheck(255);
+          ADD_ASSERT(asmb);
+        },
+        "input",
+        "");
+  }
+
+  SECTION("Unboxed union keeps its value") {
+    CHECK_EXPR(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->addLoadLitInt(-1337);
+          asmb->addUnionWrap(1);
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+          asmb->addPop();
+
+          asmb->addLoadLitFloat(0.5F); // NOLINT: Magic numbers
+          asmb->addUnionWrap(7);
+          asmb->addLoadLitFloat(0.5F); // NOLINT: Magic numbers
+          asmb->addCheckEqFloat();
+          ADD_ASSERT(asmb);
+        },
+        "input",
+        "-1337");
+  }
+
+  SECTION("Store young reference in old struct survives garbage collections") {
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addStackAlloc(1);
+
+          asmb->addLoadLitString("hello ");
+          asmb->addLoadLitString("world");
+          asmb->addMakeStruct(2);
+          asmb->addStackStore(0);
+
+          // Promote the struct to the old generation.
+          asmb->addLoadLitInt(1); // Blocking sweep.
+          asmb->addPCall(novasm::PCallCode::GcCollect);
+          asmb->addPop();
+
+          // Store a newly allocated string in the old struct.
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1337); // NOLINT: Magic numbers
+          asmb->addConvIntString();
+          asmb->addStructStoreField(1);
+
+          // Allocate enough strings to trigger (minor) garbage collections.
+          asmb->addLoadLitInt(1'000'000); // NOLINT: Magic numbers
+          asmb->addCall("alloc", 1, novasm::CallMode::Normal);
+          asmb->addPop();
+
+          asmb->addStackLoad(0);
+          asmb->addStructLoadField(0);
+          asmb->addStackLoad(0);
+          asmb->addStructLoadField(1);
+          asmb->addAddString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          asmb->label("alloc");
+          asmb->addStackLoad(0);
+          asmb->addCheckIntZero();
+          asmb->addJumpIf("alloc-end");
+          asmb->addStackLoad(0);
+          asmb->addConvIntString();
+          asmb->addPop();
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1);
+          asmb->addSubInt();
+          asmb->addCall("alloc", 1, novasm::CallMode::Tail);
+          asmb->addRet();
+          asmb->label("alloc-end");
+          asmb->addLoadLitInt(0);
+          asmb->addRet();
+
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "hello 1337");
+  }
+
+  SECTION("Tree of structs survives garbage collections") {
+    CHECK_PROG(
+        [](novasm::Assembler* asmb) -> void {
+          asmb->label("entry");
+          asmb->addStackAlloc(1);
+          asmb->addLoadLitInt(14); // NOLINT: Magic numbers
+          asmb->addCall("build", 1, novasm::CallMode::Normal);
+          asmb->addStackStore(0);
+
+          asmb->addLoadLitInt(1); // Blocking sweep.
+          asmb->addPCall(novasm::PCallCode::GcCollect);
+          asmb->addPop();
+
+          asmb->addStackLoad(0);
+          asmb->addCall("count", 1, novasm::CallMode::Normal);
+          asmb->addConvIntString();
+          ADD_PRINT(asmb);
+          asmb->addRet();
+
+          // Build a binary tree of the given depth.
+          asmb->label("build");
+          asmb->addStackLoad(0);
+          asmb->addCheckIntZero();
+          asmb->addJumpIf("build-leaf");
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1);
+          asmb->addSubInt();
+          asmb->addCall("build", 1, novasm::CallMode::Normal);
+          asmb->addStackLoad(0);
+          asmb->addLoadLitInt(1);
+          asmb->addSubInt();
+          asmb->addCall("build", 1, novasm::CallMode::Normal);
+          asmb->addMakeStruct(2);
+          asmb->addRet();
+          asmb->label("build-leaf");
+          asmb->addMakeNullStruct();
+          asmb->addRet();
+
+          // Count the nodes in the tree.
+          asmb->label("count");
+          asmb->addStackLoad(0);
+          asmb->addCheckStructNull();
+          asmb->addJumpIf("count-leaf");
+          asmb->addStackLoad(0);
+          asmb->addStructLoadField(0);
+          asmb->addCall("count", 1, novasm::CallMode::Normal);
+          asmb->addStackLoad(0);
+          asmb->addStructLoadField(1);
+          asmb->addCall("count", 1, novasm::CallMode::Normal);
+          asmb->addAddInt();
+          asmb->addLoadLitInt(1);
+          asmb->addAddInt();
+          asmb->addRet();
+          asmb->label("count-leaf");
+          asmb->addLoadLitInt(0);
+          asmb->addRet();
+
+          asmb->setEntrypoint("entry");
+        },
+        "input",
+        "16383");
+  }
 }
 
 } // namespace vm